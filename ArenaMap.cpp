@@ -0,0 +1,307 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Floor zones binding the people in them to robots        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "ArenaMap.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+// Side of a grid cell. In millimeters.
+const float g_arenaCellSize = 100;
+
+ArenaHysteresis MakeArenaHysteresis()
+{
+	ArenaHysteresis hysteresis = {150, 500000};
+	return hysteresis;
+}
+
+ArenaMap::ArenaMap(const ArenaHysteresis& hysteresis) :
+	m_zoneCount(0), m_hysteresis(hysteresis), m_pCells(NULL), m_columns(0), m_rows(0),
+	m_originX(0), m_originZ(0), m_hasFloor(false), m_now(0)
+{
+	memset(m_drivers, 0, sizeof(m_drivers));
+	memset(m_users, 0, sizeof(m_users));
+}
+
+ArenaMap::~ArenaMap()
+{
+	delete[] m_pCells;
+}
+
+int ArenaMap::AddZone(const ArenaZone& zone)
+{
+	if (m_zoneCount >= ARENA_MAX_ZONES || zone.maxX <= zone.minX || zone.maxZ <= zone.minZ)
+	{
+		return -1;
+	}
+	m_zones[m_zoneCount] = zone;
+	m_drivers[m_zoneCount] = 0;
+	BuildGrid();
+	return m_zoneCount++;
+}
+
+void ArenaMap::AddStrips(int count, float width, float nearZ, float farZ)
+{
+	float left = -width * count / 2;
+	for (int i = 0; i < count; ++i)
+	{
+		ArenaZone zone = {left + i * width, left + (i + 1) * width, nearZ, farZ, i};
+		AddZone(zone);
+	}
+}
+
+// Called before m_zoneCount counts the zone just added
+void ArenaMap::BuildGrid()
+{
+	int zones = m_zoneCount + 1;
+	float minX = m_zones[0].minX, maxX = m_zones[0].maxX, minZ = m_zones[0].minZ, maxZ = m_zones[0].maxZ;
+	for (int i = 1; i < zones; ++i)
+	{
+		minX = m_zones[i].minX < minX ? m_zones[i].minX : minX;
+		maxX = m_zones[i].maxX > maxX ? m_zones[i].maxX : maxX;
+		minZ = m_zones[i].minZ < minZ ? m_zones[i].minZ : minZ;
+		maxZ = m_zones[i].maxZ > maxZ ? m_zones[i].maxZ : maxZ;
+	}
+	m_originX = minX;
+	m_originZ = minZ;
+	m_columns = (int)ceil((maxX - minX) / g_arenaCellSize);
+	m_rows = (int)ceil((maxZ - minZ) / g_arenaCellSize);
+	delete[] m_pCells;
+	m_pCells = new signed char[m_columns * m_rows];
+
+	for (int row = 0; row < m_rows; ++row)
+	{
+		float z0 = m_originZ + row * g_arenaCellSize, z1 = z0 + g_arenaCellSize;
+		for (int column = 0; column < m_columns; ++column)
+		{
+			float x0 = m_originX + column * g_arenaCellSize, x1 = x0 + g_arenaCellSize;
+			signed char cell = -1;
+			for (int i = 0; i < zones; ++i)
+			{
+				const ArenaZone& zone = m_zones[i];
+				bool overlaps = x1 > zone.minX && x0 < zone.maxX && z1 > zone.minZ && z0 < zone.maxZ;
+				bool covers = x0 >= zone.minX && x1 <= zone.maxX && z0 >= zone.minZ && z1 <= zone.maxZ;
+				if (covers)
+				{
+					cell = (signed char)i;
+					break;
+				}
+				if (overlaps)
+				{
+					cell = -2;
+				}
+			}
+			m_pCells[row * m_columns + column] = cell;
+		}
+	}
+}
+
+void ArenaMap::SetFloor(const float* pNormal)
+{
+	float length = sqrtf(pNormal[0] * pNormal[0] + pNormal[1] * pNormal[1] + pNormal[2] * pNormal[2]);
+	if (length <= 0)
+	{
+		m_hasFloor = false;
+		return;
+	}
+	float n[3] = {pNormal[0] / length, pNormal[1] / length, pNormal[2] / length};
+
+	// Camera x and z laid flat on the floor
+	float x[3] = {1 - n[0] * n[0], -n[0] * n[1], -n[0] * n[2]};
+	float xLength = sqrtf(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+	float z[3] = {-n[2] * n[0], -n[2] * n[1], 1 - n[2] * n[2]};
+	float zLength = sqrtf(z[0] * z[0] + z[1] * z[1] + z[2] * z[2]);
+	if (xLength <= 0 || zLength <= 0)
+	{
+		m_hasFloor = false;
+		return;
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		m_floorX[i] = x[i] / xLength;
+		m_floorZ[i] = z[i] / zLength;
+	}
+	m_hasFloor = true;
+}
+
+// Distances along the floor from the point below the camera. Both floor
+// axes lie in the plane, so the height of the point drops out.
+void ArenaMap::ToFloor(float x, float y, float z, float* pFloorX, float* pFloorZ) const
+{
+	if (!m_hasFloor)
+	{
+		*pFloorX = x;
+		*pFloorZ = z;
+		return;
+	}
+	*pFloorX = x * m_floorX[0] + y * m_floorX[1] + z * m_floorX[2];
+	*pFloorZ = x * m_floorZ[0] + y * m_floorZ[1] + z * m_floorZ[2];
+}
+
+bool ArenaMap::Inside(int zone, float x, float z, float margin) const
+{
+	const ArenaZone& area = m_zones[zone];
+	return x >= area.minX + margin && x <= area.maxX - margin && z >= area.minZ + margin && z <= area.maxZ - margin;
+}
+
+int ArenaMap::FindZone(float floorX, float floorZ) const
+{
+	if (m_pCells == NULL || floorX < m_originX || floorZ < m_originZ)
+	{
+		return -1;
+	}
+	int column = (int)((floorX - m_originX) / g_arenaCellSize);
+	int row = (int)((floorZ - m_originZ) / g_arenaCellSize);
+	if (column >= m_columns || row >= m_rows)
+	{
+		return -1;
+	}
+	int cell = m_pCells[row * m_columns + column];
+	if (cell != -2)
+	{
+		return cell;
+	}
+	for (int i = 0; i < m_zoneCount; ++i)
+	{
+		if (Inside(i, floorX, floorZ, 0))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+ArenaMap::User* ArenaMap::FindUser(int userId, bool create)
+{
+	for (int i = 0; i < ARENA_USER_SLOTS; ++i)
+	{
+		User& user = m_users[(userId + i) & (ARENA_USER_SLOTS - 1)];
+		if (user.userId == userId)
+		{
+			return &user;
+		}
+		if (user.userId == 0)
+		{
+			if (!create)
+			{
+				return NULL;
+			}
+			user.userId = userId;
+			user.zone = -1;
+			user.pending = -1;
+			user.since = 0;
+			user.placed = false;
+			return &user;
+		}
+	}
+	return NULL;
+}
+
+const ArenaMap::User* ArenaMap::FindUser(int userId) const
+{
+	return const_cast<ArenaMap*>(this)->FindUser(userId, false);
+}
+
+int ArenaMap::GetUserZone(int userId) const
+{
+	const User* pUser = FindUser(userId);
+	return pUser != NULL ? pUser->zone : -1;
+}
+
+void ArenaMap::BeginFrame(uint64_t timestamp)
+{
+	m_now = timestamp;
+	for (int i = 0; i < ARENA_USER_SLOTS; ++i)
+	{
+		m_users[i].placed = false;
+	}
+}
+
+int ArenaMap::Place(int userId, float x, float y, float z)
+{
+	User* pUser = FindUser(userId, true);
+	if (pUser == NULL || userId == 0)
+	{
+		return -1;
+	}
+	pUser->placed = true;
+	float floorX, floorZ;
+	ToFloor(x, y, z, &floorX, &floorZ);
+
+	// Leaving needs the margin outside the zone, entering the margin inside
+	if (pUser->zone >= 0 && !Inside(pUser->zone, floorX, floorZ, -m_hysteresis.margin))
+	{
+		if (m_drivers[pUser->zone] == userId)
+		{
+			m_drivers[pUser->zone] = 0;
+		}
+		pUser->zone = -1;
+	}
+	int found = FindZone(floorX, floorZ);
+	if (found < 0 || found == pUser->zone || !Inside(found, floorX, floorZ, m_hysteresis.margin))
+	{
+		pUser->pending = -1;
+	}
+	else if (found != pUser->pending)
+	{
+		pUser->pending = found;
+		pUser->since = m_now;
+	}
+	else if (m_now - pUser->since >= m_hysteresis.dwell)
+	{
+		if (pUser->zone >= 0 && m_drivers[pUser->zone] == userId)
+		{
+			m_drivers[pUser->zone] = 0;
+		}
+		pUser->zone = found;
+		pUser->pending = -1;
+	}
+
+	if (pUser->zone >= 0 && m_drivers[pUser->zone] == 0)
+	{
+		m_drivers[pUser->zone] = userId;
+	}
+	return pUser->zone;
+}
+
+// Slots are freed by moving later colliding users back, so lookups that
+// stop at a free slot still find them. A user moved into the freed slot is
+// looked at again.
+void ArenaMap::EndFrame()
+{
+	for (int i = 0; i < ARENA_USER_SLOTS; )
+	{
+		User& user = m_users[i];
+		if (user.userId == 0 || user.placed)
+		{
+			++i;
+			continue;
+		}
+		if (user.zone >= 0 && m_drivers[user.zone] == user.userId)
+		{
+			m_drivers[user.zone] = 0;
+		}
+		user.userId = 0;
+		for (int j = (i + 1) & (ARENA_USER_SLOTS - 1); m_users[j].userId != 0; j = (j + 1) & (ARENA_USER_SLOTS - 1))
+		{
+			User moved = m_users[j];
+			m_users[j].userId = 0;
+			User* pSlot = FindUser(moved.userId, true);
+			*pSlot = moved;
+		}
+	}
+
+	// A zone freed by its driver goes to whoever else stands in it
+	for (int i = 0; i < ARENA_USER_SLOTS; ++i)
+	{
+		const User& user = m_users[i];
+		if (user.userId != 0 && user.zone >= 0 && m_drivers[user.zone] == 0)
+		{
+			m_drivers[user.zone] = user.userId;
+		}
+	}
+}
@@ -0,0 +1,117 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Floor zones binding the people in them to robots        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_ARENA_MAP_H_
+#define _MINDSTORM_ARENA_MAP_H_
+
+#include <stdint.h>
+
+#define ARENA_MAX_ZONES		8
+// Users remembered at once, a power of two. NiTE tracks far fewer.
+#define ARENA_USER_SLOTS	64
+
+// Rectangle on the floor, bound to one robot. Floor coordinates are in
+// millimeters: x to the right as the camera sees it, z away from it.
+struct ArenaZone
+{
+	float minX;
+	float maxX;
+	float minZ;
+	float maxZ;
+	int robot;
+};
+
+// Handoffs: a user has to be this far inside a zone to enter it and this far
+// outside to leave, and stay in a new zone this long. In mm and microseconds.
+struct ArenaHysteresis
+{
+	float margin;
+	uint64_t dwell;
+};
+
+ArenaHysteresis MakeArenaHysteresis();
+
+// Floor split into zones, one driver per zone. Every frame each user's
+// center of mass is put on the floor plane and looked up in a grid over the
+// arena, whose cells name the zone they lie in; only cells on a zone edge
+// need the zones themselves. A user keeps a zone through the hysteresis,
+// and the first user in a zone drives its robot until leaving it.
+class ArenaMap
+{
+	public:
+		ArenaMap(const ArenaHysteresis& hysteresis);
+		~ArenaMap();
+
+		// Zones must not overlap. Returns the index, -1 when full.
+		int AddZone(const ArenaZone& zone);
+		// count zones side by side, each width wide and from near to far
+		// from the camera, bound to robots 0..count-1
+		void AddStrips(int count, float width, float nearZ, float farZ);
+		int GetZoneCount() const { return m_zoneCount; }
+		const ArenaZone& GetZone(int zone) const { return m_zones[zone]; }
+
+		// Normal of NiTE's floor plane, in camera space. Until it is set, or
+		// when the tracker is not sure of the floor, camera x and z are used
+		// as they are, as for a camera held level.
+		void SetFloor(const float* pNormal);
+		void ClearFloor() { m_hasFloor = false; }
+		void ToFloor(float x, float y, float z, float* pFloorX, float* pFloorZ) const;
+
+		// Called once per frame, before Place()
+		void BeginFrame(uint64_t timestamp);
+		// Where one visible user stands, camera space center of mass.
+		// Returns the zone the user is in, -1 for none.
+		int Place(int userId, float x, float y, float z);
+		// Called after every user of the frame is placed: users not placed
+		// are forgotten and their zones freed
+		void EndFrame();
+
+		int GetUserZone(int userId) const;	// -1 for none
+		// User driving the zone's robot, 0 for none
+		int GetDriver(int zone) const { return m_drivers[zone]; }
+		// The grid lookup alone, floor coordinates, -1 outside every zone
+		int FindZone(float floorX, float floorZ) const;
+
+	private:
+		ArenaMap(const ArenaMap&);
+		ArenaMap& operator=(const ArenaMap&);
+
+		struct User
+		{
+			int userId;			// 0 for a free slot
+			int zone;			// -1 for none
+			int pending;		// Zone being entered, -1 for none
+			uint64_t since;		// When the user got into the pending zone
+			bool placed;		// This frame
+		};
+
+		void BuildGrid();
+		bool Inside(int zone, float x, float z, float margin) const;
+		User* FindUser(int userId, bool create);
+		const User* FindUser(int userId) const;
+
+		ArenaZone				m_zones[ARENA_MAX_ZONES];
+		int						m_zoneCount;
+		int						m_drivers[ARENA_MAX_ZONES];
+		ArenaHysteresis			m_hysteresis;
+
+		// Grid over the zones' bounding box, cells of g_arenaCellSize
+		signed char*			m_pCells;	// Zone, -1 for none, -2 for a zone edge
+		int						m_columns;
+		int						m_rows;
+		float					m_originX;
+		float					m_originZ;
+
+		bool					m_hasFloor;
+		float					m_floorX[3];	// Unit vectors along the floor
+		float					m_floorZ[3];
+
+		User					m_users[ARENA_USER_SLOTS];
+		uint64_t				m_now;
+};
+
+#endif // _MINDSTORM_ARENA_MAP_H_
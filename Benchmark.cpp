@@ -0,0 +1,2410 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Benchmarks run without camera or robot                  *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "Benchmark.h"
+#include "Platform.h"
+#include "RobotLink.h"
+#include "Drivetrain.h"
+#include "ClosedLoopDrivetrain.h"
+#include "IntentDrivetrain.h"
+#include "IntentMessage.h"
+#include "BrickScheduler.h"
+#include "Steering.h"
+#include "SkeletonGenerator.h"
+#include "JointHistory.h"
+#include "GestureRecognizer.h"
+#include "UserMerger.h"
+#include "SensorCalibration.h"
+#include "SkeletonPublisher.h"
+#include "SkeletonReader.h"
+#include "MockTransport.h"
+#include "SerialTransport.h"
+#include "FakeBrick.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Frames encoded and decoded for the codec throughput figures
+const int g_codecBenchFrames = 5000000;
+// Random frames pushed through every encoder and decoder
+const int g_codecFuzzRounds = 200000;
+// Ramp the intent drivetrain asks the mock brick for. In milliseconds.
+const int g_intentBenchRampMs = 200;
+// How long the link is kept busy for the throughput figure. In milliseconds.
+const unsigned int g_linkBenchDuration = 3000;
+const int g_stopBenchSamples = 40;
+// Length of each congested link run. In milliseconds.
+const unsigned int g_rateBenchDuration = 10000;
+// Length of each telemetry run. In milliseconds.
+const unsigned int g_telemetryBenchDuration = 5000;
+// Speed regulation: time to settle, then to measure the speed. In milliseconds.
+const unsigned int g_speedBenchSettle = 2000;
+const unsigned int g_speedBenchDuration = 3000;
+// Wheel travel per tachometer degree of the robot's 56 mm wheels. In millimeters.
+const double g_benchMillimetersPerDegree = 56 * 3.14159265358979 / 360;
+// Length of each run with several bricks on one adapter. In milliseconds.
+const unsigned int g_brickBenchDuration = 4000;
+// User frames generated for every skeleton generator figure
+const int g_skeletonBenchFrames = 2000000;
+// Frames pushed through the joint histories of MAX_USERS users
+const int g_historyBenchFrames = 200000;
+// Frames looked back over for the velocity, acceleration and range figures
+const int g_historyBenchSpan = 2;
+const int g_historyBenchWindow = 30;
+// Generated frames of every user matched against the gesture templates
+const int g_gestureBenchFrames = 30000;
+// Templates matched in total, the defaults and made up ones to tell apart
+const int g_gestureBenchTemplates = 48;
+// Depth frame rates the sensors offer, and generated time at each. In seconds.
+const int g_modeBenchRates[] = {25, 30, 60};
+const int g_modeBenchSeconds = 600;
+// Users walking between two sensors, and generated time. In seconds.
+const int g_mergeBenchUsers = 4;
+const int g_mergeBenchSeconds = 600;
+// How far users walk to either side of where they stand, and how long one
+// way takes. In millimeters and seconds.
+const float g_mergeBenchWalk = 1500;
+const double g_mergeBenchWalkSeconds = 10;
+// Sensors 2 m apart, both turned 15 degrees inwards, with half an Xtion's
+// field of view. The second one's pose is off by a small calibration error.
+const float g_mergeBenchSensorX = 1000;
+const float g_mergeBenchSensorYaw = 15;
+const float g_mergeBenchHalfView = 29;
+const float g_mergeBenchPoseError = 30;
+// People closer than this to someone else are one blob to the sensors, and
+// who is who is anyone's guess. In millimeters.
+const float g_mergeBenchCrowd = 500;
+// Three sensors around the users: the first at the origin, the second off
+// to the side, turned inwards and tilted down, the third behind the users
+// looking back, so it sees them from behind with left and right swapped. In
+// mm and degrees: x, y, z, yaw, pitch, roll.
+const float g_fusionBenchSensors[3][6] =
+{
+	{ 0, 0, 0, 0, 0, 0 },
+	{ 1800, 300, 200, -35, -8, 3 },
+	{ -300, 200, 4500, 180, -5, 0 }
+};
+const int g_fusionBenchMirrored = 2;
+// One user walks around for the calibration, then users stand side by side
+// for the fusion. In seconds.
+const int g_fusionBenchCalibrationSeconds = 60;
+const int g_fusionBenchSeconds = 120;
+const int g_fusionBenchUsers = 4;
+// Calibration walk to either side and back and forth. In millimeters.
+const float g_fusionBenchWalkX = 1200;
+const float g_fusionBenchWalkZ = 700;
+// Every sensor's joints, independently: mostly sure within the first
+// jitter, unsure within the second, or lost and off by the third. In mm
+// and percent of joints.
+const float g_fusionBenchNoise = 20;
+const float g_fusionBenchUnsureNoise = 60;
+const float g_fusionBenchLostOffset = 250;
+const int g_fusionBenchUnsurePercent = 20;
+const int g_fusionBenchLostPercent = 4;
+// Frames published, and readers spinning on them. Not the viewer's name, so
+// a running viewer is left alone.
+const int g_publishBenchFrames = 200000;
+const int g_publishBenchReaders = 4;
+const char* g_publishBenchName = "MindstormSkeletonsBench";
+// Length of each users times robots run. In milliseconds.
+const unsigned int g_loadBenchDuration = 3000;
+
+// Small deterministic generator, so fuzz failures can be reproduced
+class FuzzRandom
+{
+	public:
+		FuzzRandom(unsigned long seed) : m_state(seed) {}
+		unsigned int Next()
+		{
+			m_state = m_state * 1103515245UL + 12345UL;
+			return (unsigned int)((m_state >> 16) & 0x7FFF);
+		}
+		int Range(int low, int high) { return low + (int)(Next() % (unsigned int)(high - low + 1)); }
+		unsigned long Next32() { return ((unsigned long)Next() << 17) ^ ((unsigned long)Next() << 2) ^ Next(); }
+
+	private:
+		unsigned long			m_state;
+};
+
+struct LinkBenchResult
+{
+	double commandsPerSecond;
+	double medianLatencyMs;		// SetForward() until the brick runs it or a later one
+	double p95LatencyMs;
+	int commands;
+	int roundTrips;
+};
+
+static double Percentile(std::vector<double>& values, double fraction)
+{
+	if (values.empty())
+	{
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	size_t index = (size_t)(fraction * (values.size() - 1) + 0.5);
+	return values[index];
+}
+
+static bool WaitConnected(const RobotLink& link)
+{
+	for (int i = 0; i < 1000 && !link.IsConnected(); ++i)
+	{
+		SleepMillis(1);
+	}
+	return link.IsConnected();
+}
+
+// First iteration from after on that sets the port to power. Powers repeat
+// every 100 iterations, and the brick is checked every iteration, so it is
+// never 100 further than it was.
+static int RunIteration(int power, int port, int after)
+{
+	return after + ((power - 1 - after - port * 10) % 100 + 200) % 100;
+}
+
+// All three motors change as fast as the tracker can ask, the link sends as
+// much as it can. Latency of every SetForward() runs until the simulated
+// brick runs the motor at that power or a later one, so changes the link
+// overtook count until the one that replaced them arrived.
+static LinkBenchResult MeasureLink(RobotTransport* pTransport, MockTransport& mock, RobotLinkMode mode)
+{
+	LinkBenchResult result = {0, 0, 0, 0, 0};
+	RobotLink link(pTransport, "program1", mode);
+	link.Start();
+	if (!WaitConnected(link))
+	{
+		return result;
+	}
+
+	std::vector<uint64_t> issued[MOTOR_PORT_COUNT];
+	int waiting[MOTOR_PORT_COUNT] = {0};		// First iteration the brick has not run yet
+	std::vector<double> latencies;
+	int startCommands = mock.GetCommandCount();
+	int startReplies = mock.GetReplyCount();
+	uint64_t start = GetTimeMicros(), stop = start + g_linkBenchDuration * 1000;
+	bool caughtUp = false;
+	for (int i = 0; !caughtUp && GetTimeMicros() < stop + 1000000; ++i)
+	{
+		bool sending = GetTimeMicros() < stop;
+		if (!sending && result.commands == 0)
+		{
+			result.commands = mock.GetCommandCount() - startCommands;
+			result.roundTrips = mock.GetReplyCount() - startReplies;
+			result.commandsPerSecond = result.commands / ((GetTimeMicros() - start) / 1e6);
+		}
+		for (int port = 0; sending && port < MOTOR_PORT_COUNT; ++port)
+		{
+			issued[port].push_back(GetTimeMicros());
+			link.SetForward(port, 1 + ((int)issued[port].size() - 1 + port * 10) % 100);
+		}
+		SleepMillis(1);
+
+		// Once the tracker stops, until the brick has run the last powers
+		caughtUp = !sending;
+		uint64_t now = GetTimeMicros();
+		for (int port = 0; port < MOTOR_PORT_COUNT; ++port)
+		{
+			int power = mock.GetMotorPower(port);
+			int last = (int)issued[port].size() - 1;
+			int ran = power >= 1 && power <= 100 ? RunIteration(power, port, waiting[port] - 1) : -1;
+			for (; waiting[port] <= ran && waiting[port] <= last; ++waiting[port])
+			{
+				latencies.push_back((now - issued[port][waiting[port]]) / 1000.0);
+			}
+			caughtUp = caughtUp && waiting[port] > last;
+		}
+	}
+	result.medianLatencyMs = Percentile(latencies, 0.5);
+	result.p95LatencyMs = Percentile(latencies, 0.95);
+
+	link.Shutdown();
+	return result;
+}
+
+static bool PrintLinkResult(const char* name, const LinkBenchResult& result)
+{
+	if (result.commands == 0)
+	{
+		printf("%-14s could not connect\n", name);
+		return false;
+	}
+	printf("%-14s %14.1f %12.2f %12.2f %12d %12d\n", name, result.commandsPerSecond,
+		result.medianLatencyMs, result.p95LatencyMs, result.commands, result.roundTrips);
+	return true;
+}
+
+static void PrintLatencyModel(const char* transport)
+{
+	MockLatency latency = MakeBluetoothLatency();
+	printf("Robot link over %s: %u us per frame, %u us per byte, %u us reply turnaround\n",
+		transport, latency.frameUs, latency.byteUs, latency.turnaroundUs);
+}
+
+static void PrintLinkHeader(const char* transport)
+{
+	PrintLatencyModel(transport);
+	printf("%-14s %14s %12s %12s %12s %12s\n", "mode", "commands/s", "median ms", "p95 ms", "commands", "round trips");
+}
+
+static int RunLinkBenchmark()
+{
+	PrintLinkHeader("a simulated brick");
+	const char* names[] = {"acknowledged", "pipelined"};
+	RobotLinkMode modes[] = {LINK_ACKNOWLEDGED, LINK_PIPELINED};
+	for (int i = 0; i < 2; ++i)
+	{
+		MockTransport mock;
+		mock.SetLatency(MakeBluetoothLatency());
+		if (!PrintLinkResult(names[i], MeasureLink(&mock, mock, modes[i])))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Drive motors and gripper are kept changing every millisecond, then the
+// tracker loses the driver and asks for a stop. Time-to-stop runs until the
+// simulated brick has all three motors at 0.
+static void MeasureStop(RobotLinkMode mode, std::vector<double>* pTimes)
+{
+	MockTransport mock;
+	mock.SetLatency(MakeBluetoothLatency());
+	RobotLink link(&mock, "program1", mode);
+	link.Start();
+	if (!WaitConnected(link))
+	{
+		return;
+	}
+
+	FuzzRandom random(33);
+	for (int sample = 0; sample < g_stopBenchSamples; ++sample)
+	{
+		uint64_t saturateUntil = GetTimeMicros() + random.Range(60, 160) * 1000;
+		for (int i = 0; GetTimeMicros() < saturateUntil; ++i)
+		{
+			link.SetSynchronized(1, 2, 20 + i % 80, i % 40 - 20);
+			link.SetForward(0, 10 + i % 30);
+			SleepMillis(1);
+		}
+
+		uint64_t stopped = GetTimeMicros();
+		link.SetSynchronized(1, 2, 0, 0);
+		link.Stop(0, true);
+		while ((mock.GetMotorPower(0) != 0 || mock.GetMotorPower(1) != 0 || mock.GetMotorPower(2) != 0) &&
+			GetTimeMicros() - stopped < 2000000)
+		{
+			SleepMicros(100);
+		}
+		pTimes->push_back((GetTimeMicros() - stopped) / 1000.0);
+	}
+	link.Shutdown();
+}
+
+static int RunStopBenchmark()
+{
+	PrintLatencyModel("a simulated brick, saturated");
+	printf("%-14s %12s %12s %12s\n", "mode", "median ms", "p95 ms", "max ms");
+	const char* names[] = {"acknowledged", "pipelined"};
+	RobotLinkMode modes[] = {LINK_ACKNOWLEDGED, LINK_PIPELINED};
+	for (int i = 0; i < 2; ++i)
+	{
+		std::vector<double> times;
+		MeasureStop(modes[i], &times);
+		if (times.empty())
+		{
+			printf("%-14s could not connect\n", names[i]);
+			return 1;
+		}
+		printf("%-14s %12.2f %12.2f %12.2f\n", names[i], Percentile(times, 0.5), Percentile(times, 0.95), Percentile(times, 1.0));
+	}
+	return 0;
+}
+
+struct RateBenchResult
+{
+	double medianLatencyMs;		// SetForward() until the brick runs it
+	double maxLatencyMs;
+	double commandsPerSecond;
+	int maxQueueDepth;			// Commands waiting in the send buffer
+	RobotLinkMetrics last;
+};
+
+// Tracker at 30 frames per second turning the robot on every frame, over a
+// radio that carries fewer frames than that. The gripper port is set to a
+// new value every half second to see how stale commands get.
+static RateBenchResult MeasureRate(bool rateControl)
+{
+	RateBenchResult result = {0, 0, 0, 0};
+	MockTransport mock;
+	mock.SetLatency(MakeCongestedLatency());
+	RobotLink link(&mock, "program1", LINK_PIPELINED);
+	link.SetRateControl(rateControl);
+	link.Start();
+	if (!WaitConnected(link))
+	{
+		return result;
+	}
+	// The stop of all motors on connect is never held back, so it is not
+	// counted as queued by the rate control
+	for (int i = 0; i < 1000 && mock.GetQueuedBytes() > 0; ++i)
+	{
+		SleepMillis(1);
+	}
+
+	std::vector<double> latencies;
+	uint64_t start = GetTimeMicros(), nextFrame = start, nextProbe = start, probeSent = 0;
+	int frame = 0, probe = 0, startCommands = link.GetCommandCount();
+	while (GetTimeMicros() - start < g_rateBenchDuration * 1000)
+	{
+		uint64_t now = GetTimeMicros();
+		if (now >= nextFrame)
+		{
+			link.SetSynchronized(1, 2, 30 + frame % 40, frame % 60 - 30);
+			frame++;
+			nextFrame += 33333;
+		}
+		if (probeSent != 0 && mock.GetMotorPower(0) == 10 + probe % 50)
+		{
+			latencies.push_back((now - probeSent) / 1000.0);
+			probeSent = 0;
+		}
+		if (now >= nextProbe && probeSent == 0)
+		{
+			probe++;
+			link.SetForward(0, 10 + probe % 50);
+			probeSent = now;
+			nextProbe = now + 500000;
+		}
+		int queued = (mock.GetQueuedBytes() + NXT_BT_LENGTH_SIZE + NXT_SETOUTPUTSTATE_SIZE - 1) / (NXT_BT_LENGTH_SIZE + NXT_SETOUTPUTSTATE_SIZE);
+		if (queued > result.maxQueueDepth)
+		{
+			result.maxQueueDepth = queued;
+		}
+		SleepMillis(1);
+	}
+	if (probeSent != 0)
+	{
+		// Still not applied when the run ended
+		latencies.push_back((GetTimeMicros() - probeSent) / 1000.0);
+	}
+	result.commandsPerSecond = (link.GetCommandCount() - startCommands) * 1000.0 / g_rateBenchDuration;
+	result.last = link.GetMetrics();
+	result.medianLatencyMs = Percentile(latencies, 0.5);
+	result.maxLatencyMs = Percentile(latencies, 1.0);
+	link.Shutdown();
+	return result;
+}
+
+static int RunRateBenchmark()
+{
+	MockLatency latency = MakeCongestedLatency();
+	printf("Robot link over a congested radio: %u us per frame, %u us per byte, %u byte send buffer\n",
+		latency.frameUs, latency.byteUs, latency.bufferBytes);
+	printf("%-14s %12s %12s %12s %12s %12s %12s\n", "rate control", "commands/s", "median ms", "max ms", "max queue", "limit/s", "rtt ms");
+	for (int i = 0; i < 2; ++i)
+	{
+		RateBenchResult result = MeasureRate(i == 1);
+		printf("%-14s %12.1f %12.1f %12.1f %12d %12.1f %12.1f\n", i == 1 ? "adaptive" : "off", result.commandsPerSecond,
+			result.medianLatencyMs, result.maxLatencyMs, result.maxQueueDepth, result.last.rateLimit, result.last.rttMs);
+	}
+	return 0;
+}
+
+struct TelemetryBenchResult
+{
+	double medianLatencyMs;		// SetForward() until the brick runs it
+	double p95LatencyMs;
+	double maxLatencyMs;
+	double readingsPerSecond;
+	int batteryMillivolts;
+	long tachoError;			// Telemetry behind the brick at the end, in degrees
+};
+
+// Tracker steering at 30 frames per second, with a gripper command every
+// 100 ms whose latency is measured, polled or not polled, over a transport
+// with asynchronous replies or one that only answers round trips like NXT++
+static TelemetryBenchResult MeasureTelemetry(RobotLinkMode mode, bool asyncReplies, bool telemetry)
+{
+	TelemetryBenchResult result = {0, 0, 0, 0, 0, 0};
+	MockTransport mock;
+	mock.SetLatency(MakeBluetoothLatency());
+	mock.SetAsyncReplies(asyncReplies);
+	RobotLink link(&mock, "program1", mode);
+	link.SetTelemetry(telemetry);
+	link.Start();
+	if (!WaitConnected(link))
+	{
+		return result;
+	}
+
+	std::vector<double> latencies;
+	FuzzRandom random(35);
+	int startReadings = link.GetTelemetry().replyCount;
+	uint64_t start = GetTimeMicros(), nextFrame = start, nextProbe = start + 50000, probeSent = 0;
+	int frame = 0, probe = 0;
+	while (GetTimeMicros() - start < g_telemetryBenchDuration * 1000)
+	{
+		uint64_t now = GetTimeMicros();
+		if (now >= nextFrame)
+		{
+			link.SetSynchronized(1, 2, 30 + frame % 40, frame % 60 - 30);
+			frame++;
+			nextFrame += 33333;
+		}
+		if (probeSent != 0 && mock.GetMotorPower(0) == 10 + probe % 50)
+		{
+			latencies.push_back((now - probeSent) / 1000.0);
+			probeSent = 0;
+		}
+		if (now >= nextProbe && probeSent == 0)
+		{
+			probe++;
+			link.SetForward(0, 10 + probe % 50);
+			probeSent = now;
+			nextProbe = now + random.Range(80, 120) * 1000;
+		}
+		SleepMicros(200);
+	}
+	RobotTelemetry last = link.GetTelemetry();
+	result.readingsPerSecond = (last.replyCount - startReadings) * 1000.0 / g_telemetryBenchDuration;
+	result.batteryMillivolts = last.batteryMillivolts;
+	result.tachoError = telemetry ? mock.GetTachoCount(1) - last.motors[1].tachoCount : 0;
+	result.medianLatencyMs = Percentile(latencies, 0.5);
+	result.p95LatencyMs = Percentile(latencies, 0.95);
+	result.maxLatencyMs = Percentile(latencies, 1.0);
+	link.Shutdown();
+	return result;
+}
+
+static int RunTelemetryBenchmark()
+{
+	PrintLatencyModel("a simulated brick");
+	printf("%-14s %-8s %-10s %10s %10s %10s %12s %10s %10s\n", "mode", "replies", "telemetry", "median ms", "p95 ms",
+		"max ms", "readings/s", "battery V", "tacho lag");
+	const char* names[] = {"acknowledged", "pipelined"};
+	RobotLinkMode modes[] = {LINK_ACKNOWLEDGED, LINK_PIPELINED};
+	for (int i = 0; i < 8; ++i)
+	{
+		bool asyncReplies = (i / 2) % 2 == 0;
+		bool telemetry = (i % 2) == 1;
+		TelemetryBenchResult result = MeasureTelemetry(modes[i / 4], asyncReplies, telemetry);
+		printf("%-14s %-8s %-10s %10.2f %10.2f %10.2f %12.1f %10.2f %10ld\n", names[i / 4], asyncReplies ? "async" : "sync",
+			telemetry ? "on" : "off", result.medianLatencyMs, result.p95LatencyMs, result.maxLatencyMs,
+			result.readingsPerSecond, result.batteryMillivolts / 1000.0, result.tachoError);
+	}
+	return 0;
+}
+
+struct SpeedBenchResult
+{
+	double leftSpeed;		// Measured on the simulated brick, in mm/s
+	double rightSpeed;
+	double odometryError;	// Distance by odometry against the brick, in mm
+};
+
+// The robot drives straight at speed 40 (160 mm/s) over a floor that lets
+// the motors reach only part of their nominal speed, read back with
+// asynchronous replies or, like NXT++, round trips only
+static SpeedBenchResult MeasureSpeed(bool closedLoop, bool asyncReplies, double load)
+{
+	SpeedBenchResult result = {0, 0, 0};
+	MockTransport mock;
+	mock.SetLatency(MakeBluetoothLatency());
+	mock.SetAsyncReplies(asyncReplies);
+	mock.SetLoad(load);
+	RobotLink link(&mock, "program1", LINK_PIPELINED);
+	link.Start();
+	if (!WaitConnected(link))
+	{
+		return result;
+	}
+
+	Drivetrain* pDrive = closedLoop ? new ClosedLoopDrivetrain(&link, 1, 2, 0) : new Drivetrain(&link, 1, 2, 0);
+	pDrive->Drive(40, 0);
+	SleepMillis(g_speedBenchSettle);
+	long left = mock.GetTachoCount(1), right = mock.GetTachoCount(2);
+	RobotPose startPose = closedLoop ? ((ClosedLoopDrivetrain*)pDrive)->GetPose() : RobotPose();
+	uint64_t start = GetTimeMicros();
+	SleepMillis(g_speedBenchDuration);
+	double seconds = (GetTimeMicros() - start) / 1e6;
+	left = mock.GetTachoCount(1) - left;
+	right = mock.GetTachoCount(2) - right;
+	result.leftSpeed = left * g_benchMillimetersPerDegree / seconds;
+	result.rightSpeed = right * g_benchMillimetersPerDegree / seconds;
+	if (closedLoop)
+	{
+		// The pose lags the brick by one telemetry round at both ends
+		RobotPose pose = ((ClosedLoopDrivetrain*)pDrive)->GetPose();
+		result.odometryError = (pose.x - startPose.x) - (left + right) / 2.0 * g_benchMillimetersPerDegree;
+	}
+	pDrive->Stop();
+	delete pDrive;
+	link.Shutdown();
+	return result;
+}
+
+static int RunSpeedBenchmark()
+{
+	PrintLatencyModel("a simulated brick");
+	printf("%-12s %-8s %-8s %12s %12s %12s %14s\n", "regulation", "replies", "load", "left mm/s", "right mm/s", "error %",
+		"odometry mm");
+	double loads[] = {1.0, 0.85, 0.7};
+	for (int i = 0; i < 9; ++i)
+	{
+		bool closedLoop = i >= 3;
+		bool asyncReplies = i < 6;
+		double load = loads[i % 3];
+		SpeedBenchResult result = MeasureSpeed(closedLoop, asyncReplies, load);
+		double error = ((result.leftSpeed + result.rightSpeed) / 2 - 160) / 160 * 100;
+		printf("%-12s %-8s %-8.2f %12.1f %12.1f %+12.1f %14.1f\n", closedLoop ? "closed loop" : "open loop",
+			asyncReplies ? "async" : "sync", load, result.leftSpeed, result.rightSpeed, error, result.odometryError);
+	}
+	return 0;
+}
+
+// Command latency of every brick, from SetForward() until it runs the motor
+struct BrickBenchResult
+{
+	int bricks;
+	double p50Ms[SCHEDULER_MAX_BRICKS];
+	double p95Ms[SCHEDULER_MAX_BRICKS];
+	double p99Ms[SCHEDULER_MAX_BRICKS];
+	double commandsPerSecond[SCHEDULER_MAX_BRICKS];
+};
+
+// Bricks paired with one adapter. Brick 0 is steered as fast as the tracker
+// can ask, every millisecond; the others at 30 frames per second. Every
+// brick also gets a gripper command every 80-120 ms whose latency is measured.
+// Without a scheduler the links write whenever they like and simply wait
+// for each other on the air, as separate NXT++ connections do.
+static BrickBenchResult MeasureBricks(int bricks, bool scheduled, SchedulePolicy policy)
+{
+	BrickBenchResult result;
+	memset(&result, 0, sizeof(result));
+	result.bricks = bricks;
+	Mutex air;
+	MockTransport* mocks[SCHEDULER_MAX_BRICKS];
+	RobotLink* links[SCHEDULER_MAX_BRICKS];
+	BrickScheduler scheduler(policy);
+	for (int i = 0; i < bricks; ++i)
+	{
+		mocks[i] = new MockTransport;
+		mocks[i]->SetLatency(MakeBluetoothLatency());
+		mocks[i]->ShareAir(&air);
+		links[i] = scheduled ? scheduler.AddBrick(mocks[i], "program1") : new RobotLink(mocks[i], "program1");
+		links[i]->Start();
+	}
+	for (int i = 0; i < bricks; ++i)
+	{
+		WaitConnected(*links[i]);
+	}
+
+	std::vector<double> latencies[SCHEDULER_MAX_BRICKS];
+	uint64_t nextProbe[SCHEDULER_MAX_BRICKS], probeSent[SCHEDULER_MAX_BRICKS];
+	int probe[SCHEDULER_MAX_BRICKS], startCommands[SCHEDULER_MAX_BRICKS];
+	FuzzRandom random(37);
+	uint64_t start = GetTimeMicros(), nextFrame = start, lastGreedy = 0;
+	for (int i = 0; i < bricks; ++i)
+	{
+		nextProbe[i] = start + random.Range(50, 150) * 1000;
+		probeSent[i] = 0;
+		probe[i] = 0;
+		startCommands[i] = links[i]->GetCommandCount();
+	}
+	int frame = 0;
+	while (GetTimeMicros() - start < g_brickBenchDuration * 1000)
+	{
+		uint64_t now = GetTimeMicros();
+		if (now - lastGreedy >= 1000)
+		{
+			links[0]->SetSynchronized(1, 2, 20 + (int)(now / 1000) % 80, (int)(now / 1000) % 40 - 20);
+			lastGreedy = now;
+		}
+		if (now >= nextFrame)
+		{
+			for (int i = 1; i < bricks; ++i)
+			{
+				links[i]->SetSynchronized(1, 2, 30 + (frame + i) % 40, (frame + i) % 60 - 30);
+			}
+			frame++;
+			nextFrame += 33333;
+		}
+		for (int i = 0; i < bricks; ++i)
+		{
+			if (probeSent[i] != 0 && mocks[i]->GetMotorPower(0) == 10 + probe[i] % 50)
+			{
+				latencies[i].push_back((now - probeSent[i]) / 1000.0);
+				probeSent[i] = 0;
+			}
+			if (now >= nextProbe[i] && probeSent[i] == 0)
+			{
+				probe[i]++;
+				links[i]->SetForward(0, 10 + probe[i] % 50);
+				probeSent[i] = now;
+				nextProbe[i] = now + random.Range(80, 120) * 1000;
+			}
+		}
+		SleepMicros(200);
+	}
+
+	double seconds = (GetTimeMicros() - start) / 1e6;
+	for (int i = 0; i < bricks; ++i)
+	{
+		if (probeSent[i] != 0)
+		{
+			// Still not applied when the run ended
+			latencies[i].push_back((GetTimeMicros() - probeSent[i]) / 1000.0);
+		}
+		result.p50Ms[i] = Percentile(latencies[i], 0.5);
+		result.p95Ms[i] = Percentile(latencies[i], 0.95);
+		result.p99Ms[i] = Percentile(latencies[i], 0.99);
+		result.commandsPerSecond[i] = (links[i]->GetCommandCount() - startCommands[i]) / seconds;
+	}
+	// Links that are shut down no longer touch their transport
+	for (int i = 0; i < bricks; ++i)
+	{
+		links[i]->Shutdown();
+	}
+	for (int i = 0; i < bricks; ++i)
+	{
+		if (!scheduled)
+		{
+			delete links[i];
+		}
+		delete mocks[i];
+	}
+	return result;
+	return result;
+}
+
+static int RunBrickBenchmark()
+{
+	PrintLatencyModel("simulated bricks sharing one adapter");
+	printf("Brick 0 steered every millisecond, the others at 30 frames per second\n");
+	printf("%-7s %-12s %6s %10s %10s %10s %12s\n", "bricks", "scheduling", "brick", "p50 ms", "p95 ms", "p99 ms", "commands/s");
+	int counts[] = {1, 3, 5, 6, 8};
+	const char* names[] = {"none", "round robin", "fair"};
+	for (int c = 0; c < 5; ++c)
+	{
+		for (int mode = 0; mode < 3; ++mode)
+		{
+			BrickBenchResult result = MeasureBricks(counts[c], mode > 0, mode == 1 ? SCHEDULE_ROUND_ROBIN : SCHEDULE_FAIR);
+			for (int i = 0; i < result.bricks; ++i)
+			{
+				printf("%-7d %-12s %6d %10.1f %10.1f %10.1f %12.1f\n", result.bricks, names[mode], i,
+					result.p50Ms[i], result.p95Ms[i], result.p99Ms[i], result.commandsPerSecond[i]);
+			}
+		}
+	}
+	return 0;
+}
+
+// What the users' steering asks of one robot. Users sharing a robot
+// overrule each other within a frame; what is left at the end of the frame
+// is the robot's command, remembered until the brick is seen running it.
+// A command replaced in a later frame before that was dropped by the link.
+class RecordingDrivetrain : public Drivetrain
+{
+	public:
+		RecordingDrivetrain(RobotLink* pLink) :
+			Drivetrain(pLink, 1, 2, 0), m_speed(0), m_turnRatio(0), m_changed(0), m_commandSpeed(0), m_commandTurnRatio(0),
+			m_issued(0), m_commands(0), m_overruled(0), m_dropped(0) {}
+
+		virtual void Drive(int speed, int turnRatio)
+		{
+			if (speed != m_speed || turnRatio != m_turnRatio)
+			{
+				if (m_changed != 0)
+				{
+					m_overruled++;
+				}
+				m_speed = speed;
+				m_turnRatio = turnRatio;
+				m_changed = GetTimeMicros();
+			}
+			Drivetrain::Drive(speed, turnRatio);
+		}
+
+		void EndFrame()
+		{
+			if (m_changed != 0 && (m_speed != m_commandSpeed || m_turnRatio != m_commandTurnRatio))
+			{
+				if (m_issued != 0)
+				{
+					m_dropped++;
+				}
+				m_commandSpeed = m_speed;
+				m_commandTurnRatio = m_turnRatio;
+				m_issued = m_changed;
+				m_commands++;
+			}
+			m_changed = 0;
+		}
+
+		// Adds a latency sample once the brick runs the latest command
+		void Check(const MockTransport& mock, uint64_t now, std::vector<double>* pLatencies)
+		{
+			if (m_issued != 0 && mock.GetMotorPower(1) == m_commandSpeed && mock.GetTurnRatio(1) == m_commandTurnRatio)
+			{
+				pLatencies->push_back((now - m_issued) / 1000.0);
+				m_issued = 0;
+			}
+		}
+
+		int GetCommands() const { return m_commands; }
+		int GetOverruled() const { return m_overruled; }
+		int GetDropped() const { return m_dropped; }
+
+	private:
+		int						m_speed;			// Latest Drive()
+		int						m_turnRatio;
+		uint64_t				m_changed;			// When it changed this frame, 0 if not
+		int						m_commandSpeed;		// Left at the end of the latest frame
+		int						m_commandTurnRatio;
+		uint64_t				m_issued;			// 0 once the brick runs it
+		int						m_commands;
+		int						m_overruled;
+		int						m_dropped;
+};
+
+struct LoadBenchResult
+{
+	double skeletonCpu;		// Share of one core, in percent
+	double steeringCpu;
+	double linkCpu;			// Every other thread: links, scheduler, simulated radios
+	double frameMicros;		// Tracker thread work per frame, all users
+	double p50Ms;			// Drive() until the brick runs it
+	double p95Ms;
+	double p99Ms;
+	int commands;
+	int overruled;			// By another user of the same robot, same frame
+	int dropped;			// Never delivered although the link had a frame for it
+};
+
+// Generated users steer robots at 30 frames per second through RunSteering()
+// with method 0, the robots share one adapter. User n drives robot n % robots.
+static LoadBenchResult MeasureLoad(int users, int robots)
+{
+	LoadBenchResult result;
+	memset(&result, 0, sizeof(result));
+	Mutex air;
+	MockTransport* mocks[SCHEDULER_MAX_BRICKS];
+	RecordingDrivetrain* drives[SCHEDULER_MAX_BRICKS];
+	BrickScheduler scheduler;
+	for (int i = 0; i < robots; ++i)
+	{
+		mocks[i] = new MockTransport;
+		mocks[i]->SetLatency(MakeBluetoothLatency());
+		mocks[i]->ShareAir(&air);
+		drives[i] = new RecordingDrivetrain(scheduler.AddBrick(mocks[i], "program1"));
+	}
+	scheduler.Start();
+	for (int i = 0; i < robots; ++i)
+	{
+		WaitConnected(*scheduler.GetLink(i));
+	}
+
+	std::vector<double> latencies;
+	// Quick motions, so every robot gets a few commands a second
+	SkeletonGeneratorSettings settings = MakeSkeletonSettings(users, 38);
+	settings.minMotionSeconds = 0.2;
+	settings.maxMotionSeconds = 0.6;
+	SkeletonGenerator generator(settings);
+	std::vector<SkeletonFrame> skeletons(users);
+	uint64_t skeletonCpu = 0, steeringCpu = 0;
+	uint64_t startCpu = GetProcessCpuMicros(), startThreadCpu = GetThreadCpuMicros();
+	uint64_t start = GetTimeMicros(), nextFrame = start;
+	int frame = 0;
+	while (GetTimeMicros() - start < g_loadBenchDuration * 1000)
+	{
+		uint64_t now = GetTimeMicros();
+		if (now >= nextFrame)
+		{
+			uint64_t cpu = GetThreadCpuMicros();
+			generator.Next(&skeletons[0]);
+			uint64_t steering = GetThreadCpuMicros();
+			for (int user = 0; user < users; ++user)
+			{
+				RunSteering(0, skeletons[user], drives[user % robots]);
+			}
+			uint64_t done = GetThreadCpuMicros();
+			skeletonCpu += steering - cpu;
+			steeringCpu += done - steering;
+			for (int i = 0; i < robots; ++i)
+			{
+				drives[i]->EndFrame();
+			}
+			frame++;
+			nextFrame += 33333;
+		}
+		now = GetTimeMicros();
+		for (int i = 0; i < robots; ++i)
+		{
+			drives[i]->Check(*mocks[i], now, &latencies);
+		}
+		SleepMicros(500);
+	}
+
+	double seconds = (GetTimeMicros() - start) / 1e6;
+	uint64_t threadCpu = GetThreadCpuMicros() - startThreadCpu;
+	uint64_t processCpu = GetProcessCpuMicros() - startCpu;
+	result.skeletonCpu = skeletonCpu / seconds / 1e4;
+	result.steeringCpu = steeringCpu / seconds / 1e4;
+	result.linkCpu = (processCpu > threadCpu ? processCpu - threadCpu : 0) / seconds / 1e4;
+	result.frameMicros = frame > 0 ? (double)(skeletonCpu + steeringCpu) / frame : 0;
+	result.p50Ms = Percentile(latencies, 0.5);
+	result.p95Ms = Percentile(latencies, 0.95);
+	result.p99Ms = Percentile(latencies, 0.99);
+	for (int i = 0; i < robots; ++i)
+	{
+		result.commands += drives[i]->GetCommands();
+		result.overruled += drives[i]->GetOverruled();
+		result.dropped += drives[i]->GetDropped();
+	}
+
+	scheduler.Shutdown();
+	for (int i = 0; i < robots; ++i)
+	{
+		delete drives[i];
+		delete mocks[i];
+	}
+	return result;
+}
+
+static int RunLoadBenchmark()
+{
+	PrintLatencyModel("simulated bricks sharing one adapter");
+	printf("Users steer at 30 frames per second, MAX_USERS is %d\n", MAX_USERS);
+	printf("%6s %6s %10s %10s %10s %9s %8s %8s %8s %9s %9s %8s\n", "users", "robots", "skel cpu%", "steer cpu%",
+		"link cpu%", "frame us", "p50 ms", "p95 ms", "p99 ms", "commands", "overruled", "dropped");
+	int userCounts[] = {1, MAX_USERS, 4 * MAX_USERS, 20 * MAX_USERS};
+	int robotCounts[] = {1, 4, SCHEDULER_MAX_BRICKS};
+	for (int u = 0; u < 4; ++u)
+	{
+		for (int r = 0; r < 3; ++r)
+		{
+			if (robotCounts[r] > userCounts[u])
+			{
+				continue;
+			}
+			LoadBenchResult result = MeasureLoad(userCounts[u], robotCounts[r]);
+			printf("%6d %6d %10.2f %10.2f %10.2f %9.1f %8.1f %8.1f %8.1f %9d %9d %8d\n", userCounts[u], robotCounts[r],
+				result.skeletonCpu, result.steeringCpu, result.linkCpu, result.frameMicros,
+				result.p50Ms, result.p95Ms, result.p99Ms, result.commands, result.overruled, result.dropped);
+		}
+	}
+	return 0;
+}
+
+// Counts what the steering asks for instead of sending it
+class CountingDrivetrain : public Drivetrain
+{
+	public:
+		CountingDrivetrain() : Drivetrain(NULL, 1, 2, 0), m_calls(0) {}
+		virtual void Drive(int /*speed*/, int /*turnRatio*/) { m_calls++; }
+		virtual void Gripper(int /*power*/) { m_calls++; }
+		virtual void EmergencyStop() { m_calls++; }
+
+	private:
+		int						m_calls;
+};
+
+// Generated frames per second, alone and through RunSteering() of every
+// method, and a check that a seed always gives the same frames
+static int RunSkeletonBenchmark()
+{
+	printf("%-8s %-22s %16s %12s\n", "users", "stage", "user frames/s", "ns/frame");
+	int userCounts[] = {1, MAX_USERS, 100};
+	for (int u = 0; u < 3; ++u)
+	{
+		int users = userCounts[u];
+		int frames = g_skeletonBenchFrames / users;
+		std::vector<SkeletonFrame> skeletons(users);
+		for (int method = -1; method < STEERING_METHOD_COUNT; ++method)
+		{
+			SkeletonGenerator generator(MakeSkeletonSettings(users, 39));
+			CountingDrivetrain drive;
+			uint64_t start = GetTimeMicros();
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				generator.Next(&skeletons[0]);
+				for (int user = 0; method >= 0 && user < users; ++user)
+				{
+					RunSteering(method, skeletons[user], &drive);
+				}
+			}
+			double seconds = (GetTimeMicros() - start) / 1e6;
+			char stage[32];
+			sprintf(stage, method < 0 ? "generator" : "generator + method %d", method);
+			printf("%-8d %-22s %16.0f %12.1f\n", users, stage, (double)frames * users / seconds,
+				seconds * 1e9 / ((double)frames * users));
+		}
+	}
+
+	// Same seed, same frames, however they are read; another seed differs
+	SkeletonGenerator first(MakeSkeletonSettings(MAX_USERS, 39)), second(MakeSkeletonSettings(MAX_USERS, 39));
+	SkeletonGenerator other(MakeSkeletonSettings(MAX_USERS, 40));
+	SkeletonFrame a[MAX_USERS], b[MAX_USERS], c[MAX_USERS];
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	memset(c, 0, sizeof(c));
+	int mismatches = 0, differences = 0;
+	unsigned long checksum = 0;
+	for (int frame = 0; frame < 10000; ++frame)
+	{
+		first.Next(a);
+		second.Next(b);
+		other.Next(c);
+		mismatches += memcmp(a, b, sizeof(a)) != 0;
+		differences += memcmp(a, c, sizeof(a)) != 0;
+		for (int i = 0; i < MAX_USERS; ++i)
+		{
+			checksum = checksum * 31 + (unsigned long)(a[i].joints[SKELETON_RIGHT_HAND].y * 10) + first.GetMotion(i);
+		}
+	}
+	printf("Seed 39 twice: %d of 10000 frames differ, seed 40: %d differ (checksum %lu)\n", mismatches, differences,
+		checksum & 0xFFFFFFFFUL);
+	return mismatches == 0 && differences > 0 ? 0 : 1;
+}
+
+// Velocity, acceleration and range of every joint looked up the plain way,
+// from the SkeletonFrame copies of the last frames. Same formulas as
+// JointHistory, to check it and to compare with.
+class FrameHistory
+{
+	public:
+		FrameHistory() : m_head(JOINT_HISTORY_FRAMES - 1), m_count(0) {}
+
+		void Push(const SkeletonFrame& frame)
+		{
+			m_head = (m_head + 1) % JOINT_HISTORY_FRAMES;
+			m_frames[m_head] = frame;
+			m_count = m_count < JOINT_HISTORY_FRAMES ? m_count + 1 : m_count;
+		}
+
+		const SkeletonFrame& Get(int age) const { return m_frames[(m_head - age + JOINT_HISTORY_FRAMES) % JOINT_HISTORY_FRAMES]; }
+		int GetCount() const { return m_count; }
+
+		void GetVelocity(int span, JointVectors* pVelocity) const
+		{
+			const SkeletonFrame& now = Get(0);
+			const SkeletonFrame& then = Get(span);
+			float scale = (float)(1e6 / (now.timestamp - then.timestamp));
+			for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+			{
+				pVelocity->x[i] = (now.joints[i].x - then.joints[i].x) * scale;
+				pVelocity->y[i] = (now.joints[i].y - then.joints[i].y) * scale;
+				pVelocity->z[i] = (now.joints[i].z - then.joints[i].z) * scale;
+			}
+		}
+
+		void GetAcceleration(int span, JointVectors* pAcceleration) const
+		{
+			JointVectors late, early;
+			const SkeletonFrame& now = Get(0);
+			const SkeletonFrame& middle = Get(span);
+			const SkeletonFrame& then = Get(2 * span);
+			double lateSeconds = (double)(now.timestamp - middle.timestamp) / 1e6;
+			double earlySeconds = (double)(middle.timestamp - then.timestamp) / 1e6;
+			float lateScale = (float)(1 / lateSeconds), earlyScale = (float)(1 / earlySeconds);
+			float scale = (float)(2 / (lateSeconds + earlySeconds));
+			for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+			{
+				late.x[i] = (now.joints[i].x - middle.joints[i].x) * lateScale;
+				late.y[i] = (now.joints[i].y - middle.joints[i].y) * lateScale;
+				late.z[i] = (now.joints[i].z - middle.joints[i].z) * lateScale;
+				early.x[i] = (middle.joints[i].x - then.joints[i].x) * earlyScale;
+				early.y[i] = (middle.joints[i].y - then.joints[i].y) * earlyScale;
+				early.z[i] = (middle.joints[i].z - then.joints[i].z) * earlyScale;
+				pAcceleration->x[i] = (late.x[i] - early.x[i]) * scale;
+				pAcceleration->y[i] = (late.y[i] - early.y[i]) * scale;
+				pAcceleration->z[i] = (late.z[i] - early.z[i]) * scale;
+			}
+		}
+
+		void GetRange(int frames, JointVectors* pMin, JointVectors* pMax) const
+		{
+			for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+			{
+				const SkeletonJoint& joint = Get(0).joints[i];
+				pMin->x[i] = pMax->x[i] = joint.x;
+				pMin->y[i] = pMax->y[i] = joint.y;
+				pMin->z[i] = pMax->z[i] = joint.z;
+				for (int age = 1; age < frames; ++age)
+				{
+					const SkeletonJoint& older = Get(age).joints[i];
+					pMin->x[i] = std::min(pMin->x[i], older.x);
+					pMin->y[i] = std::min(pMin->y[i], older.y);
+					pMin->z[i] = std::min(pMin->z[i], older.z);
+					pMax->x[i] = std::max(pMax->x[i], older.x);
+					pMax->y[i] = std::max(pMax->y[i], older.y);
+					pMax->z[i] = std::max(pMax->z[i], older.z);
+				}
+			}
+		}
+
+	private:
+		SkeletonFrame			m_frames[JOINT_HISTORY_FRAMES];
+		int						m_head;
+		int						m_count;
+};
+
+static float LargestDifference(const JointVectors& a, const JointVectors& b)
+{
+	float largest = 0;
+	for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+	{
+		largest = std::max(largest, (float)fabs(a.x[i] - b.x[i]));
+		largest = std::max(largest, (float)fabs(a.y[i] - b.y[i]));
+		largest = std::max(largest, (float)fabs(a.z[i] - b.z[i]));
+	}
+	return largest;
+}
+
+// Push, velocity, acceleration and a range of every user every frame, from
+// JointHistory and from copies of the frames, and how far the two disagree
+static int RunHistoryBenchmark()
+{
+	SkeletonGenerator generator(MakeSkeletonSettings(MAX_USERS, 40));
+	std::vector<SkeletonFrame> skeletons(MAX_USERS);
+	JointHistory* histories = new JointHistory[MAX_USERS];
+	std::vector<FrameHistory> copies(MAX_USERS);
+	JointVectors velocity, acceleration, low, high, expected, expectedHigh;
+	uint64_t historyMicros = 0, copyMicros = 0;
+	float velocityError = 0, accelerationError = 0, rangeError = 0;
+	bool aligned = ((size_t)histories & 63) == 0;
+	for (int frame = 0; frame < g_historyBenchFrames; ++frame)
+	{
+		generator.Next(&skeletons[0]);
+		bool ready = frame >= g_historyBenchWindow;
+		uint64_t start = GetTimeMicros();
+		for (int user = 0; user < MAX_USERS; ++user)
+		{
+			histories[user].Push(skeletons[user]);
+			if (ready)
+			{
+				histories[user].GetVelocity(g_historyBenchSpan, &velocity);
+				histories[user].GetAcceleration(g_historyBenchSpan, &acceleration);
+				histories[user].GetRange(g_historyBenchWindow, &low, &high);
+			}
+		}
+		uint64_t middle = GetTimeMicros();
+		for (int user = 0; user < MAX_USERS; ++user)
+		{
+			copies[user].Push(skeletons[user]);
+			if (ready)
+			{
+				copies[user].GetVelocity(g_historyBenchSpan, &expected);
+				copies[user].GetAcceleration(g_historyBenchSpan, &expected);
+				copies[user].GetRange(g_historyBenchWindow, &expected, &expectedHigh);
+			}
+		}
+		historyMicros += middle - start;
+		copyMicros += GetTimeMicros() - middle;
+
+		// Checked on the last user only, outside the timed part
+		if (ready)
+		{
+			const FrameHistory& copy = copies[MAX_USERS - 1];
+			copy.GetVelocity(g_historyBenchSpan, &expected);
+			velocityError = std::max(velocityError, LargestDifference(velocity, expected));
+			copy.GetAcceleration(g_historyBenchSpan, &expected);
+			accelerationError = std::max(accelerationError, LargestDifference(acceleration, expected));
+			copy.GetRange(g_historyBenchWindow, &expected, &expectedHigh);
+			rangeError = std::max(rangeError, LargestDifference(low, expected));
+			rangeError = std::max(rangeError, LargestDifference(high, expectedHigh));
+		}
+	}
+	delete[] histories;
+
+	double userFrames = (double)g_historyBenchFrames * MAX_USERS;
+	printf("%d users, velocity and acceleration over %d frames, range over %d, %d bytes per user\n",
+		MAX_USERS, g_historyBenchSpan, g_historyBenchWindow, (int)sizeof(JointHistory));
+	printf("%-22s %12s\n", "history", "ns/frame");
+	printf("%-22s %12.1f\n", "JointHistory", historyMicros * 1e3 / userFrames);
+	printf("%-22s %12.1f\n", "SkeletonFrame copies", copyMicros * 1e3 / userFrames);
+	printf("Histories 64 byte aligned: %s\n", aligned ? "yes" : "no");
+	printf("Largest difference: velocity %g mm/s, acceleration %g mm/s^2, range %g mm\n",
+		velocityError, accelerationError, rangeError);
+	return aligned && velocityError < 1e-2f && accelerationError < 1 && rangeError == 0 ? 0 : 1;
+}
+
+// Generated users walking to and fro in front of two sensors whose views
+// overlap in the middle. Every sensor gives its own ids to the users it
+// sees, and the merge has to count everyone once and keep their ids through
+// handoffs from one sensor to the other.
+static int RunMergeBenchmark()
+{
+	SkeletonGeneratorSettings settings = MakeSkeletonSettings(g_mergeBenchUsers, 48);
+	SkeletonGenerator generator(settings);
+	std::vector<SkeletonFrame> skeletons(g_mergeBenchUsers);
+	const int sensorCount = 2;
+	SensorPose poses[sensorCount] = {MakeSensorPose(), MakeSensorPose()};
+	poses[0].x = -g_mergeBenchSensorX;
+	poses[0].yaw = g_mergeBenchSensorYaw;
+	poses[1].x = g_mergeBenchSensorX;
+	poses[1].yaw = -g_mergeBenchSensorYaw;
+
+	// The generating side knows where the sensors really are
+	UserMerger actual;
+	UserMerger merger;
+	for (int s = 0; s < sensorCount; ++s)
+	{
+		actual.SetPose(s, poses[s]);
+		merger.SetPose(s, poses[s]);
+	}
+	poses[1].x += g_mergeBenchPoseError;
+	poses[1].z -= g_mergeBenchPoseError;
+	actual.SetPose(1, poses[1]);
+
+	SensorFrame* frames = new SensorFrame[sensorCount];
+	MergedUser* merged = new MergedUser[MERGE_MAX_USERS];
+	std::vector<std::vector<int> > localIds(sensorCount, std::vector<int>(g_mergeBenchUsers, 0));
+	std::vector<int> nextLocalId(sensorCount, 1);
+	std::vector<int> lastId(g_mergeBenchUsers, 0), lastAlone(g_mergeBenchUsers, -1), aloneId(g_mergeBenchUsers, 0);
+	std::vector<float> walkX(g_mergeBenchUsers), walkZ(g_mergeBenchUsers);
+	std::vector<bool> crowded(g_mergeBenchUsers, false);
+	int frameCount = (int)(g_mergeBenchSeconds * settings.frameRate);
+	int wrongCount = 0, splits = 0, idChanges = 0, crowdChanges = 0, handoffs = 0, handoffsKept = 0, crowdHandoffs = 0;
+	int shared = 0;
+	uint64_t mergeMicros = 0;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		generator.Next(&skeletons[0]);
+		uint64_t timestamp = skeletons[0].timestamp;
+		int inView = 0;
+		for (int s = 0; s < sensorCount; ++s)
+		{
+			frames[s].frameIndex = frame;
+			frames[s].timestamp = timestamp;
+			frames[s].captured = timestamp;
+			frames[s].userCount = 0;
+		}
+		for (int user = 0; user < g_mergeBenchUsers; ++user)
+		{
+			float walk = g_mergeBenchWalk * (float)sin(2 * 3.14159265358979 * frame / (2 * g_mergeBenchWalkSeconds * settings.frameRate) + user);
+			walkX[user] = skeletons[user].joints[SKELETON_TORSO].x + walk;
+			walkZ[user] = skeletons[user].joints[SKELETON_TORSO].z;
+			bool seen = false;
+			for (int s = 0; s < sensorCount; ++s)
+			{
+				SkeletonFrame local = skeletons[user];
+				for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+				{
+					float camera[3];
+					actual.ToSensor(s, local.joints[j].x + walk, local.joints[j].y, local.joints[j].z, camera);
+					local.joints[j].x = camera[0];
+					local.joints[j].y = camera[1];
+					local.joints[j].z = camera[2];
+				}
+				const SkeletonJoint& torso = local.joints[SKELETON_TORSO];
+				if (torso.z <= 0 || fabs(atan2(torso.x, torso.z)) * 180 / 3.14159265358979 > g_mergeBenchHalfView)
+				{
+					localIds[s][user] = 0;
+					continue;
+				}
+				// A sensor gives a new id to everyone coming into its view
+				if (localIds[s][user] == 0)
+				{
+					localIds[s][user] = nextLocalId[s]++;
+				}
+				SensorUser& sensorUser = frames[s].users[frames[s].userCount++];
+				local.userId = localIds[s][user];
+				sensorUser.userId = local.userId;
+				sensorUser.visible = true;
+				sensorUser.x = torso.x;
+				sensorUser.y = torso.y;
+				sensorUser.z = torso.z;
+				sensorUser.skeleton = local;
+				seen = true;
+			}
+			inView += seen ? 1 : 0;
+		}
+
+		uint64_t start = GetTimeMicros();
+		int count = merger.Merge(frames, sensorCount, merged);
+		mergeMicros += GetTimeMicros() - start;
+		wrongCount += count != inView ? 1 : 0;
+
+		for (int user = 0; user < g_mergeBenchUsers; ++user)
+		{
+			bool crowd = false;
+			for (int other = 0; other < g_mergeBenchUsers && !crowd; ++other)
+			{
+				crowd = other != user && (float)hypot(walkX[user] - walkX[other], walkZ[user] - walkZ[other]) < g_mergeBenchCrowd;
+			}
+			crowded[user] = crowded[user] || crowd;
+
+			int id = 0, seenBy = 0, alone = -1;
+			bool split = false;
+			for (int s = 0; s < sensorCount; ++s)
+			{
+				if (localIds[s][user] == 0)
+				{
+					continue;
+				}
+				int sensorId = merger.GetMergedId(s, localIds[s][user]);
+				split = split || (id != 0 && sensorId != id);
+				id = sensorId;
+				seenBy++;
+				alone = s;
+			}
+			splits += split ? 1 : 0;
+			shared += seenBy > 1 ? 1 : 0;
+			if (lastId[user] != 0 && id != 0 && id != lastId[user])
+			{
+				(crowd ? crowdChanges : idChanges)++;
+			}
+			lastId[user] = id;
+			if (seenBy == 0)
+			{
+				lastAlone[user] = -1;
+			}
+			else if (seenBy == 1)
+			{
+				// Only handoffs nobody came close during are counted as kept or not
+				if (lastAlone[user] >= 0 && lastAlone[user] != alone && crowded[user])
+				{
+					crowdHandoffs++;
+				}
+				else if (lastAlone[user] >= 0 && lastAlone[user] != alone)
+				{
+					handoffs++;
+					handoffsKept += aloneId[user] == id ? 1 : 0;
+				}
+				lastAlone[user] = alone;
+				aloneId[user] = id;
+				crowded[user] = false;
+			}
+		}
+	}
+	delete[] frames;
+	delete[] merged;
+
+	printf("%d users walking across %d sensors, %d s at %.0f fps, pose off by %.0f mm\n", g_mergeBenchUsers,
+		sensorCount, g_mergeBenchSeconds, settings.frameRate, g_mergeBenchPoseError);
+	printf("%.2f us per merge, %.2f people per frame seen by both sensors\n", (double)mergeMicros / frameCount,
+		(double)shared / frameCount);
+	printf("%d of %d frames with the wrong number of people, %d times someone split in two\n", wrongCount,
+		frameCount, splits);
+	printf("%d id changes of people in view, %d more with someone closer than %.0f mm\n", idChanges, crowdChanges,
+		g_mergeBenchCrowd);
+	printf("%d of %d handoffs between sensors kept the id, %d more passed someone on the way\n", handoffsKept,
+		handoffs, crowdHandoffs);
+	return splits == 0 && idChanges == 0 && handoffsKept == handoffs ? 0 : 1;
+}
+
+// Sensor placed and turned by yaw, then pitch, then roll, in degrees
+static SensorTransform MakeBenchTransform(const float* pPose)
+{
+	double yaw = pPose[3] * 3.14159265358979 / 180, pitch = pPose[4] * 3.14159265358979 / 180,
+		roll = pPose[5] * 3.14159265358979 / 180;
+	double y[9] = { cos(yaw), 0, sin(yaw), 0, 1, 0, -sin(yaw), 0, cos(yaw) };
+	double p[9] = { 1, 0, 0, 0, cos(pitch), -sin(pitch), 0, sin(pitch), cos(pitch) };
+	double r[9] = { cos(roll), -sin(roll), 0, sin(roll), cos(roll), 0, 0, 0, 1 };
+	double yp[9];
+	SensorTransform transform;
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			yp[i * 3 + j] = y[i * 3] * p[j] + y[i * 3 + 1] * p[3 + j] + y[i * 3 + 2] * p[6 + j];
+		}
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			transform.rotation[i * 3 + j] = (float)(yp[i * 3] * r[j] + yp[i * 3 + 1] * r[3 + j] + yp[i * 3 + 2] * r[6 + j]);
+		}
+		transform.translation[i] = pPose[i];
+	}
+	return transform;
+}
+
+// Angle between two rotations in degrees, and distance between the
+// translations in millimeters
+static void CompareTransforms(const SensorTransform& a, const SensorTransform& b, double* pDegrees, double* pDistance)
+{
+	double trace = 0;
+	for (int i = 0; i < 9; ++i)
+	{
+		trace += a.rotation[i] * b.rotation[i];
+	}
+	double c = (trace - 1) / 2;
+	*pDegrees = acos(c > 1 ? 1 : (c < -1 ? -1 : c)) * 180 / 3.14159265358979;
+	double dx = a.translation[0] - b.translation[0];
+	double dy = a.translation[1] - b.translation[1];
+	double dz = a.translation[2] - b.translation[2];
+	*pDistance = sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Left and right joints trade places, as for a sensor seeing someone from
+// behind
+static void SwapSides(SkeletonFrame* pSkeleton)
+{
+	static const int pairs[6][2] =
+	{
+		{ SKELETON_LEFT_SHOULDER, SKELETON_RIGHT_SHOULDER }, { SKELETON_LEFT_ELBOW, SKELETON_RIGHT_ELBOW },
+		{ SKELETON_LEFT_HAND, SKELETON_RIGHT_HAND }, { SKELETON_LEFT_HIP, SKELETON_RIGHT_HIP },
+		{ SKELETON_LEFT_KNEE, SKELETON_RIGHT_KNEE }, { SKELETON_LEFT_FOOT, SKELETON_RIGHT_FOOT }
+	};
+	for (int i = 0; i < 6; ++i)
+	{
+		std::swap(pSkeleton->joints[pairs[i][0]], pSkeleton->joints[pairs[i][1]]);
+	}
+}
+
+// What sensor s reports of a world space skeleton: camera space, its own
+// jitter and dropouts, and sides swapped when it sees people from behind
+static void SenseSkeleton(const UserMerger& actual, int s, const SkeletonFrame& world, FuzzRandom* pRandom,
+	SkeletonFrame* pSeen)
+{
+	*pSeen = world;
+	for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+	{
+		SkeletonJoint& joint = pSeen->joints[j];
+		float camera[3];
+		actual.ToSensor(s, joint.x, joint.y, joint.z, camera);
+		int roll = pRandom->Range(0, 99);
+		float noise = g_fusionBenchNoise;
+		joint.confidence = 1;
+		if (roll < g_fusionBenchLostPercent)
+		{
+			joint.confidence = 0;
+			camera[pRandom->Range(0, 2)] += pRandom->Range(0, 1) == 0 ? -g_fusionBenchLostOffset : g_fusionBenchLostOffset;
+		}
+		else if (roll < g_fusionBenchLostPercent + g_fusionBenchUnsurePercent)
+		{
+			joint.confidence = 0.5f;
+			noise = g_fusionBenchUnsureNoise;
+		}
+		joint.x = camera[0] + pRandom->Range((int)-noise, (int)noise);
+		joint.y = camera[1] + pRandom->Range((int)-noise, (int)noise);
+		joint.z = camera[2] + pRandom->Range((int)-noise, (int)noise);
+	}
+	if (s == g_fusionBenchMirrored)
+	{
+		SwapSides(pSeen);
+	}
+}
+
+// Mean distance of a world space skeleton's joints from the real ones
+static double JointError(const SkeletonFrame& skeleton, const SkeletonFrame& world, std::vector<double>* pErrors)
+{
+	double sum = 0;
+	for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+	{
+		double dx = skeleton.joints[j].x - world.joints[j].x;
+		double dy = skeleton.joints[j].y - world.joints[j].y;
+		double dz = skeleton.joints[j].z - world.joints[j].z;
+		double error = sqrt(dx * dx + dy * dy + dz * dz);
+		pErrors->push_back(error);
+		sum += error;
+	}
+	return sum / SKELETON_JOINT_COUNT;
+}
+
+// Three sensors around the users, one tilted and one behind them. First one
+// user walks around while the second and third sensor are calibrated
+// against the first, then the calibrated transforms merge four users, and
+// the fused skeletons are compared with the most confident sensor's and the
+// first sensor's alone.
+static int RunFusionBenchmark()
+{
+	const int sensorCount = 3;
+	UserMerger actual;
+	for (int s = 0; s < sensorCount; ++s)
+	{
+		actual.SetTransform(s, MakeBenchTransform(g_fusionBenchSensors[s]));
+	}
+	FuzzRandom random(49);
+
+	SkeletonGeneratorSettings settings = MakeSkeletonSettings(1, 49);
+	settings.noise = 0;
+	settings.dropoutsPerSecond = 0;
+	SkeletonGenerator walker(settings);
+	SensorCalibration* calibrations = new SensorCalibration[sensorCount];
+	int frameCount = (int)(g_fusionBenchCalibrationSeconds * settings.frameRate);
+	uint64_t addMicros = 0;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		SkeletonFrame world;
+		walker.Next(&world);
+		double t = frame / settings.frameRate;
+		float walkX = g_fusionBenchWalkX * (float)sin(2 * 3.14159265358979 * t / 20);
+		float walkZ = g_fusionBenchWalkZ * (float)sin(2 * 3.14159265358979 * t / 13);
+		for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+		{
+			world.joints[j].x += walkX;
+			world.joints[j].z += walkZ;
+		}
+		SkeletonFrame seen[sensorCount];
+		for (int s = 0; s < sensorCount; ++s)
+		{
+			SenseSkeleton(actual, s, world, &random, &seen[s]);
+		}
+		// The first sensor defines world space
+		uint64_t start = GetTimeMicros();
+		for (int s = 1; s < sensorCount; ++s)
+		{
+			calibrations[s].AddFrame(seen[0], seen[s]);
+		}
+		addMicros += GetTimeMicros() - start;
+	}
+
+	UserMerger merger;
+	printf("%d s of one user walking, %d sensors calibrated against the first\n", g_fusionBenchCalibrationSeconds,
+		sensorCount - 1);
+	printf("%-10s %8s %10s %10s %12s %10s\n", "sensor", "points", "rms mm", "degrees", "mm", "solve us");
+	bool calibrated = true;
+	for (int s = 1; s < sensorCount; ++s)
+	{
+		SensorTransform transform;
+		float rms = 0;
+		uint64_t start = GetTimeMicros();
+		bool solved = calibrations[s].Solve(&transform, &rms);
+		uint64_t solveMicros = GetTimeMicros() - start;
+		double degrees = 180, distance = 1e9;
+		if (solved)
+		{
+			merger.SetTransform(s, transform);
+			CompareTransforms(transform, actual.GetTransform(s), &degrees, &distance);
+		}
+		printf("%-10d %8d %10.1f %10.2f %12.1f %10d\n", s, calibrations[s].GetPairCount(), rms, degrees, distance,
+			(int)solveMicros);
+		calibrated = calibrated && solved && degrees < 1 && distance < 25;
+	}
+	printf("%.2f us per frame pairing joints\n", (double)addMicros / frameCount / (sensorCount - 1));
+	delete[] calibrations;
+
+	settings = MakeSkeletonSettings(g_fusionBenchUsers, 50);
+	settings.noise = 0;
+	settings.dropoutsPerSecond = 0;
+	SkeletonGenerator generator(settings);
+	std::vector<SkeletonFrame> worlds(g_fusionBenchUsers);
+	SensorFrame* frames = new SensorFrame[sensorCount];
+	MergedUser* merged = new MergedUser[MERGE_MAX_USERS];
+	std::vector<double> fusedErrors, confidentErrors, firstErrors, mergeTimes;
+	double fusedSum = 0, confidentSum = 0, firstSum = 0;
+	int samples = 0, wrongCount = 0;
+	frameCount = (int)(g_fusionBenchSeconds * settings.frameRate);
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		generator.Next(&worlds[0]);
+		for (int s = 0; s < sensorCount; ++s)
+		{
+			frames[s].frameIndex = frame;
+			frames[s].timestamp = worlds[0].timestamp;
+			frames[s].captured = worlds[0].timestamp;
+			frames[s].userCount = g_fusionBenchUsers;
+			for (int user = 0; user < g_fusionBenchUsers; ++user)
+			{
+				SensorUser& sensorUser = frames[s].users[user];
+				SenseSkeleton(actual, s, worlds[user], &random, &sensorUser.skeleton);
+				sensorUser.userId = user + 1;
+				sensorUser.skeleton.userId = user + 1;
+				sensorUser.visible = true;
+				float camera[3];
+				const SkeletonJoint& torso = worlds[user].joints[SKELETON_TORSO];
+				actual.ToSensor(s, torso.x, torso.y, torso.z, camera);
+				sensorUser.x = camera[0];
+				sensorUser.y = camera[1];
+				sensorUser.z = camera[2];
+			}
+		}
+
+		uint64_t start = GetTimeMicros();
+		int count = merger.Merge(frames, sensorCount, merged);
+		mergeTimes.push_back((double)(GetTimeMicros() - start));
+		wrongCount += count != g_fusionBenchUsers ? 1 : 0;
+
+		for (int i = 0; i < count; ++i)
+		{
+			const MergedUser& user = merged[i];
+			if (user.sensors != (1 << sensorCount) - 1 || !user.skeleton.tracked)
+			{
+				continue;
+			}
+			// Whoever the sensors agree on, found by the first sensor's id
+			int truth = -1;
+			for (int u = 0; u < g_fusionBenchUsers; ++u)
+			{
+				truth = merger.GetMergedId(0, u + 1) == user.userId ? u : truth;
+			}
+			if (truth < 0)
+			{
+				continue;
+			}
+			fusedSum += JointError(user.skeleton, worlds[truth], &fusedErrors);
+
+			// The most confident sensor's skeleton as it is, sides put back
+			SkeletonFrame confident = frames[user.skeletonSensor].users[truth].skeleton;
+			if (user.skeletonSensor == g_fusionBenchMirrored)
+			{
+				SwapSides(&confident);
+			}
+			SkeletonFrame first = frames[0].users[truth].skeleton;
+			for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+			{
+				float point[3];
+				merger.ToWorld(user.skeletonSensor, confident.joints[j].x, confident.joints[j].y, confident.joints[j].z, point);
+				confident.joints[j].x = point[0];
+				confident.joints[j].y = point[1];
+				confident.joints[j].z = point[2];
+				merger.ToWorld(0, first.joints[j].x, first.joints[j].y, first.joints[j].z, point);
+				first.joints[j].x = point[0];
+				first.joints[j].y = point[1];
+				first.joints[j].z = point[2];
+			}
+			confidentSum += JointError(confident, worlds[truth], &confidentErrors);
+			firstSum += JointError(first, worlds[truth], &firstErrors);
+			samples++;
+		}
+	}
+	delete[] frames;
+	delete[] merged;
+
+	printf("%d users seen by all %d sensors, %d s at %.0f fps\n", g_fusionBenchUsers, sensorCount,
+		g_fusionBenchSeconds, settings.frameRate);
+	printf("%-22s %12s %12s\n", "skeleton", "mean mm", "p95 mm");
+	printf("%-22s %12.1f %12.1f\n", "fused", samples > 0 ? fusedSum / samples : 0, Percentile(fusedErrors, 0.95));
+	printf("%-22s %12.1f %12.1f\n", "most confident sensor", samples > 0 ? confidentSum / samples : 0,
+		Percentile(confidentErrors, 0.95));
+	printf("%-22s %12.1f %12.1f\n", "first sensor", samples > 0 ? firstSum / samples : 0,
+		Percentile(firstErrors, 0.95));
+	printf("%d of %d frames with the wrong number of people\n", wrongCount, frameCount);
+	printf("Merge and fusion: %.2f us median, %.2f us p99, %.0f us at most\n", Percentile(mergeTimes, 0.5),
+		Percentile(mergeTimes, 0.99), Percentile(mergeTimes, 1.0));
+	return calibrated && wrongCount == 0 && samples > 0 && fusedSum < confidentSum ? 0 : 1;
+}
+
+// Reader thread of the publish benchmark, reading the newest frame again
+// and again, as fast as it can
+struct PublishBenchReader
+{
+	AtomicInt* pRunning;
+	int reads;
+	int dropped;			// Written over while read, or not there
+	int inconsistent;		// Taken for whole although it was not
+};
+
+static void PublishBenchReaderThread(void* pArg)
+{
+	PublishBenchReader* pReader = (PublishBenchReader*)pArg;
+	SkeletonReader reader;
+	if (!reader.Open(g_publishBenchName))
+	{
+		return;
+	}
+	while (pReader->pRunning->Get() != 0)
+	{
+		int sequence;
+		const SharedFrame* pFrame = reader.BeginRead(reader.GetLatest(), &sequence);
+		if (pFrame == NULL)
+		{
+			pReader->dropped++;
+			continue;
+		}
+		// Every value of a frame follows from its frame index
+		int frameIndex = pFrame->frameIndex;
+		bool consistent = pFrame->userCount == SHARED_SKELETONS_USERS;
+		for (int i = 0; i < SHARED_SKELETONS_USERS; ++i)
+		{
+			const SharedUser& user = pFrame->users[i];
+			consistent = consistent && user.userId == frameIndex;
+			for (int j = 0; j < SHARED_SKELETONS_JOINTS; ++j)
+			{
+				consistent = consistent && user.joints[j].x == (float)(frameIndex % 1000 + j);
+			}
+		}
+		consistent = consistent && pFrame->robots[0].speed == frameIndex % 100;
+		if (!reader.EndRead(pFrame, sequence))
+		{
+			pReader->dropped++;
+			continue;
+		}
+		pReader->reads++;
+		pReader->inconsistent += consistent ? 0 : 1;
+	}
+}
+
+// Frames published as fast as they can be written, first with nobody
+// reading, then with readers spinning on the newest frame. The viewer's
+// processor time per frame only grows by the cache lines readers share,
+// its wall time also by their time slices where cores are fewer than
+// threads, and no reader may take a frame for whole that was written over
+// while it read.
+static int RunPublishBenchmark()
+{
+	// A run that was killed leaves the name behind
+	SkeletonPublisher publisher;
+	if (!publisher.Open(g_publishBenchName, true))
+	{
+		printf("Could not create shared memory %s\n", g_publishBenchName);
+		return 1;
+	}
+	SkeletonFrame skeleton;
+	memset(&skeleton, 0, sizeof(skeleton));
+	skeleton.tracked = true;
+
+	printf("%d users per frame, %d frames in a ring of %d, %d bytes shared\n", SHARED_SKELETONS_USERS,
+		g_publishBenchFrames, SHARED_SKELETONS_SLOTS, (int)sizeof(SharedSkeletons));
+	printf("%-10s %12s %12s %12s %12s %12s %12s\n", "readers", "ns/frame", "cpu ns/frame", "max us", "reads", "dropped",
+		"torn taken");
+	int readerCounts[] = {0, g_publishBenchReaders};
+	bool ok = true;
+	for (int run = 0; run < 2; ++run)
+	{
+		int readers = readerCounts[run];
+		AtomicInt running(1);
+		std::vector<PublishBenchReader> state(g_publishBenchReaders);
+		std::vector<Thread*> threads;
+		for (int i = 0; i < readers; ++i)
+		{
+			PublishBenchReader none = {&running, 0, 0, 0};
+			state[i] = none;
+			threads.push_back(new Thread());
+			threads[i]->Start(PublishBenchReaderThread, &state[i]);
+		}
+
+		uint64_t start = GetTimeMicros(), startCpu = GetThreadCpuMicros(), longest = 0;
+		for (int frame = 0; frame < g_publishBenchFrames; ++frame)
+		{
+			uint64_t frameStart = GetTimeMicros();
+			publisher.BeginFrame(frame, frameStart, 0);
+			skeleton.userId = frame;
+			for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+			{
+				skeleton.joints[j].x = (float)(frame % 1000 + j);
+			}
+			for (int i = 0; i < SHARED_SKELETONS_USERS; ++i)
+			{
+				publisher.AddUser(skeleton, true, 0, 0, 2000, 1);
+			}
+			publisher.SetRobot(0, frame, true, frame % 100, 0, 0);
+			publisher.EndFrame();
+			uint64_t took = GetTimeMicros() - frameStart;
+			longest = took > longest ? took : longest;
+		}
+		uint64_t micros = GetTimeMicros() - start, cpuMicros = GetThreadCpuMicros() - startCpu;
+
+		running.Set(0);
+		int reads = 0, dropped = 0, inconsistent = 0;
+		for (int i = 0; i < readers; ++i)
+		{
+			threads[i]->Join();
+			delete threads[i];
+			reads += state[i].reads;
+			dropped += state[i].dropped;
+			inconsistent += state[i].inconsistent;
+		}
+		printf("%-10d %12.1f %12.1f %12d %12d %12d %12d\n", readers, micros * 1000.0 / g_publishBenchFrames,
+			cpuMicros * 1000.0 / g_publishBenchFrames, (int)longest, reads, dropped, inconsistent);
+		ok = ok && inconsistent == 0 && (readers == 0 || reads > 0);
+	}
+	publisher.Close();
+	return ok ? 0 : 1;
+}
+
+// Smooth made up hand paths, for templates no generated motion should match
+static void AddDistractorTemplates(GestureRecognizer* pRecognizer, int count)
+{
+	FuzzRandom random(41);
+	float points[GESTURE_MAX_FRAMES][3];
+	for (int t = 0; t < count; ++t)
+	{
+		int frames = random.Range(20, 40);
+		float from[3], to[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			from[k] = random.Range(-150, 150) / 100.0f;
+			to[k] = random.Range(-150, 150) / 100.0f;
+		}
+		for (int i = 0; i < frames; ++i)
+		{
+			float u = (float)i / (frames - 1);
+			float bend = (float)sin(3.14159265 * u) * 0.5f;
+			points[i][0] = from[0] + (to[0] - from[0]) * u + bend;
+			points[i][1] = from[1] + (to[1] - from[1]) * u - bend;
+			points[i][2] = from[2] + (to[2] - from[2]) * u;
+		}
+		char name[GESTURE_NAME_LENGTH];
+		sprintf(name, "distractor_%d", t);
+		pRecognizer->AddTemplate(name, GESTURE_NONE, t % 2 == 0 ? GESTURE_RIGHT_HAND : GESTURE_LEFT_HAND,
+			points, frames, 0.08f);
+	}
+}
+
+// Action a generated motion should trigger
+static GestureAction ExpectedAction(SkeletonMotion motion)
+{
+	switch (motion)
+	{
+		case MOTION_SWIPE_RIGHT:
+		case MOTION_SWIPE_LEFT:
+			return GESTURE_NEXT_MODE;
+		case MOTION_CIRCLE_RIGHT:
+			return GESTURE_OPEN_GRIPPER;
+		default:
+			return GESTURE_NONE;
+	}
+}
+
+// Generated users matched against the default templates and made up ones,
+// with and without LB_Keogh and early abandoning: time per user frame, how
+// templates were ruled out, and which motions were recognized as what. A
+// match counts for the motion the user was doing halfway through its window.
+static int RunGestureBenchmark()
+{
+	GestureRecognizer* pruned = new GestureRecognizer();
+	GestureRecognizer* full = new GestureRecognizer();
+	pruned->AddDefaultTemplates();
+	AddDistractorTemplates(pruned, g_gestureBenchTemplates - pruned->GetTemplateCount());
+	full->AddDefaultTemplates();
+	AddDistractorTemplates(full, g_gestureBenchTemplates - full->GetTemplateCount());
+	full->SetPruning(false);
+
+	SkeletonGeneratorSettings settings = MakeSkeletonSettings(MAX_USERS, 41);
+	settings.minMotionSeconds = 0.8;
+	settings.maxMotionSeconds = 1.2;
+	SkeletonGenerator generator(settings);
+	std::vector<SkeletonFrame> skeletons(MAX_USERS);
+	JointHistory* histories = new JointHistory[MAX_USERS];
+	std::vector<uint64_t> since(MAX_USERS, 0);
+	std::vector<std::vector<int> > motions(MAX_USERS, std::vector<int>(JOINT_HISTORY_FRAMES, MOTION_IDLE));
+	std::vector<std::vector<int> > starts(MAX_USERS, std::vector<int>(JOINT_HISTORY_FRAMES, -1));
+	std::vector<int> current(MAX_USERS, -1), lastHit(MAX_USERS, -1);
+
+	int episodes[MOTION_COUNT] = {0};
+	int recognized[MOTION_COUNT][3] = {{0}};
+	int hits[MOTION_COUNT] = {0};
+	uint64_t prunedMicros = 0, fullMicros = 0;
+	GestureCounters totals = {0, 0, 0, 0};
+	int disagreements = 0;
+	for (int frame = 0; frame < g_gestureBenchFrames; ++frame)
+	{
+		generator.Next(&skeletons[0]);
+		for (int user = 0; user < MAX_USERS; ++user)
+		{
+			SkeletonMotion motion = generator.GetMotion(user);
+			motions[user][frame % JOINT_HISTORY_FRAMES] = motion;
+			starts[user][frame % JOINT_HISTORY_FRAMES] = generator.GetMotionStart(user);
+			if (generator.GetMotionStart(user) != current[user])
+			{
+				episodes[motion]++;
+				current[user] = generator.GetMotionStart(user);
+			}
+			histories[user].Push(skeletons[user]);
+
+			GestureMatch match, check;
+			GestureCounters counters;
+			uint64_t start = GetTimeMicros();
+			bool found = pruned->Recognize(histories[user], since[user], &match, &counters);
+			uint64_t split = GetTimeMicros();
+			bool checked = full->Recognize(histories[user], since[user], &check);
+			fullMicros += GetTimeMicros() - split;
+			prunedMicros += split - start;
+			totals.templates += counters.templates;
+			totals.bounded += counters.bounded;
+			totals.abandoned += counters.abandoned;
+			totals.completed += counters.completed;
+			if (found != checked || (found && match.gesture != check.gesture))
+			{
+				disagreements++;
+			}
+			if (found)
+			{
+				since[user] = skeletons[user].timestamp;
+				int middle = (frame - GESTURE_MAX_FRAMES / 4 + JOINT_HISTORY_FRAMES) % JOINT_HISTORY_FRAMES;
+				int during = motions[user][middle];
+				recognized[during][match.action]++;
+				if (match.action == ExpectedAction((SkeletonMotion)during) && match.action != GESTURE_NONE
+					&& starts[user][middle] != lastHit[user])
+				{
+					hits[during]++;
+					lastHit[user] = starts[user][middle];
+				}
+			}
+		}
+	}
+	delete pruned;
+	delete full;
+	delete[] histories;
+
+	double userFrames = (double)g_gestureBenchFrames * MAX_USERS;
+	printf("%d users, %d templates, %d frames each\n", MAX_USERS, g_gestureBenchTemplates, g_gestureBenchFrames);
+	printf("%-24s %12s\n", "matching", "us/frame");
+	printf("%-24s %12.2f\n", "LB_Keogh + abandoning", prunedMicros / userFrames);
+	printf("%-24s %12.2f\n", "full warping", fullMicros / userFrames);
+	double templates = totals.templates > 0 ? totals.templates : 1;
+	printf("Templates tried: %.1f%% bounded, %.1f%% abandoned, %.1f%% warped to the end\n",
+		100 * totals.bounded / templates, 100 * totals.abandoned / templates, 100 * totals.completed / templates);
+	printf("Matches that differ without pruning: %d\n", disagreements);
+
+	const char* motionNames[] = {"idle", "raise right", "raise left", "push right", "push left",
+		"swipe right", "swipe left", "circle right", "circle left"};
+	printf("%-14s %9s %9s %10s %13s\n", "motion", "episodes", "none", "next mode", "open gripper");
+	int expectedEpisodes = 0, expectedHits = 0, wrong = 0;
+	for (int m = 0; m < MOTION_COUNT; ++m)
+	{
+		printf("%-14s %9d %9d %10d %13d\n", motionNames[m], episodes[m],
+			recognized[m][GESTURE_NONE], recognized[m][GESTURE_NEXT_MODE], recognized[m][GESTURE_OPEN_GRIPPER]);
+		GestureAction expected = ExpectedAction((SkeletonMotion)m);
+		for (int a = GESTURE_NEXT_MODE; a <= GESTURE_OPEN_GRIPPER; ++a)
+		{
+			if (a != expected)
+			{
+				wrong += recognized[m][a];
+			}
+		}
+		if (expected != GESTURE_NONE)
+		{
+			expectedEpisodes += episodes[m];
+			expectedHits += hits[m];
+		}
+	}
+	printf("Gestures recognized: %d of %d episodes, actions taken for the wrong motion: %d\n",
+		expectedHits, expectedEpisodes, wrong);
+	return disagreements == 0 ? 0 : 1;
+}
+
+// Gesture to command latency at every depth frame rate. Generated users
+// swipe and circle, matched with the frame step the viewer takes for the
+// rate. Latency runs from the first frame a whole template of the motion
+// could be matched in, when a template's length of it has passed or it
+// ended if shorter, to the frame its action was taken, plus the matching
+// time of that frame. Warping takes some motions from fewer frames; those
+// are counted as early and their latency is the matching time alone.
+// Resolution only changes what NiTE spends per frame, which the viewer's
+// tracker report shows on recordings.
+static int RunModeBenchmark()
+{
+	printf("%d users, %d s at every rate\n", MAX_USERS, g_modeBenchSeconds);
+	printf("%6s %6s %10s %10s %10s %14s %8s %10s\n", "fps", "step", "p50 ms", "p95 ms", "max ms", "recognized", "early",
+		"us/frame");
+	for (size_t r = 0; r < sizeof(g_modeBenchRates) / sizeof(g_modeBenchRates[0]); ++r)
+	{
+		int fps = g_modeBenchRates[r];
+		int step = (fps + GESTURE_FRAME_RATE / 2) / GESTURE_FRAME_RATE;
+		GestureRecognizer* recognizer = new GestureRecognizer();
+		recognizer->AddDefaultTemplates();
+		recognizer->SetFrameStep(step);
+
+		SkeletonGeneratorSettings settings = MakeSkeletonSettings(MAX_USERS, 46);
+		settings.frameRate = fps;
+		settings.minMotionSeconds = 0.8;
+		settings.maxMotionSeconds = 1.2;
+		SkeletonGenerator generator(settings);
+		std::vector<SkeletonFrame> skeletons(MAX_USERS);
+		JointHistory* histories = new JointHistory[MAX_USERS];
+		std::vector<uint64_t> since(MAX_USERS, 0);
+		std::vector<std::vector<int> > motions(MAX_USERS, std::vector<int>(JOINT_HISTORY_FRAMES, MOTION_IDLE));
+		std::vector<std::vector<int> > starts(MAX_USERS, std::vector<int>(JOINT_HISTORY_FRAMES, -1));
+		std::vector<std::vector<int> > ends(MAX_USERS, std::vector<int>(JOINT_HISTORY_FRAMES, 0));
+		std::vector<int> current(MAX_USERS, -1), lastHit(MAX_USERS, -1);
+
+		std::vector<double> latencies;
+		int episodes = 0, early = 0;
+		uint64_t matchMicros = 0;
+		int frames = g_modeBenchSeconds * fps;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			generator.Next(&skeletons[0]);
+			for (int user = 0; user < MAX_USERS; ++user)
+			{
+				SkeletonMotion motion = generator.GetMotion(user);
+				int ring = frame % JOINT_HISTORY_FRAMES;
+				motions[user][ring] = motion;
+				starts[user][ring] = generator.GetMotionStart(user);
+				ends[user][ring] = generator.GetMotionStart(user) + generator.GetMotionFrames(user);
+				if (generator.GetMotionStart(user) != current[user])
+				{
+					episodes += ExpectedAction(motion) != GESTURE_NONE ? 1 : 0;
+					current[user] = generator.GetMotionStart(user);
+				}
+				histories[user].Push(skeletons[user]);
+
+				GestureMatch match;
+				uint64_t start = GetTimeMicros();
+				bool found = recognizer->Recognize(histories[user], since[user], &match);
+				uint64_t spent = GetTimeMicros() - start;
+				matchMicros += spent;
+				if (!found)
+				{
+					continue;
+				}
+				since[user] = skeletons[user].timestamp;
+				int middle = (frame - step * GESTURE_MAX_FRAMES / 4 + JOINT_HISTORY_FRAMES) % JOINT_HISTORY_FRAMES;
+				int during = motions[user][middle];
+				if (match.action == ExpectedAction((SkeletonMotion)during) && match.action != GESTURE_NONE
+					&& starts[user][middle] != lastHit[user])
+				{
+					lastHit[user] = starts[user][middle];
+					// A whole template of motion is there to match from this frame on
+					int complete = starts[user][middle] + recognizer->GetFrames(match.gesture) * step;
+					complete = ends[user][middle] < complete ? ends[user][middle] : complete;
+					if (frame < complete)
+					{
+						early++;
+					}
+					int late = frame > complete ? frame - complete : 0;
+					latencies.push_back(late * 1000.0 / fps + spent / 1000.0);
+				}
+			}
+		}
+		delete recognizer;
+		delete[] histories;
+
+		int recognized = (int)latencies.size();
+		printf("%6d %6d %10.1f %10.1f %10.1f %7d of %4d %8d %10.2f\n", fps, step, Percentile(latencies, 0.5),
+			Percentile(latencies, 0.95), Percentile(latencies, 1.0), recognized, episodes, early,
+			(double)matchMicros / ((double)frames * MAX_USERS));
+	}
+	return 0;
+}
+
+#ifndef WIN32
+// Same measurement, but every frame crosses a pty to a fake brick: length
+// prefixes, the ring buffer and the epoll thread are all on the path
+static int RunSerialBenchmark()
+{
+	PrintLinkHeader("a pseudo terminal");
+	const char* names[] = {"acknowledged", "pipelined"};
+	RobotLinkMode modes[] = {LINK_ACKNOWLEDGED, LINK_PIPELINED};
+	for (int i = 0; i < 2; ++i)
+	{
+		MockTransport brick;
+		brick.SetLatency(MakeBluetoothLatency());
+		FakeBrick fake(&brick);
+		if (!fake.Start())
+		{
+			printf("Could not create a pseudo terminal\n");
+			return 1;
+		}
+		SerialTransport serial(fake.GetDevicePath());
+		LinkBenchResult result = MeasureLink(&serial, brick, modes[i]);
+		if (!PrintLinkResult(names[i], result))
+		{
+			return 1;
+		}
+		if (fake.GetFrameCount() < result.commands)
+		{
+			printf("%-14s only %d of %d frames reached the brick\n", names[i], fake.GetFrameCount(), result.commands);
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif
+
+static NxtOutputState RandomOutputState(FuzzRandom& random)
+{
+	NxtOutputState state;
+	state.port = random.Range(0, 2);
+	state.power = random.Range(-100, 100);
+	state.mode = random.Range(0, 7);
+	state.regulation = random.Range(0, 2);
+	state.turnRatio = random.Range(-100, 100);
+	state.runState = random.Next() % 2 ? NXT_RUNSTATE_RUNNING : NXT_RUNSTATE_IDLE;
+	state.tachoLimit = random.Next32() & 0xFFFFFFFFUL;
+	return state;
+}
+
+static bool SameOutputState(const NxtOutputState& a, const NxtOutputState& b)
+{
+	return a.port == b.port && a.power == b.power && a.mode == b.mode && a.regulation == b.regulation &&
+		a.turnRatio == b.turnRatio && a.runState == b.runState && a.tachoLimit == b.tachoLimit;
+}
+
+static int ClampBench(int value, int low, int high)
+{
+	return value < low ? low : (value > high ? high : value);
+}
+
+// What the brick reads of a message: clamped values, the ramp in steps of
+// 10 ms and the sequence counting 1..255
+static bool SameIntent(const IntentMessage& sent, const IntentMessage& decoded)
+{
+	return decoded.type == sent.type && decoded.sequence == (sent.sequence - 1) % 255 + 1 &&
+		decoded.speed == ClampBench(sent.speed, -100, 100) && decoded.turnRatio == ClampBench(sent.turnRatio, -100, 100) &&
+		decoded.rampMs == ClampBench(sent.rampMs, 0, INTENT_MAX_RAMP_MS) / 10 * 10 &&
+		decoded.gripperPower == ClampBench(sent.gripperPower, -100, 100) && decoded.brake == sent.brake;
+}
+
+// Every encoder against its decoder with random values, then random bytes
+// into every decoder. Returns the number of mismatches.
+static int FuzzCodec()
+{
+	FuzzRandom random(20150301);
+	int mismatches = 0;
+	for (int round = 0; round < g_codecFuzzRounds; ++round)
+	{
+		unsigned char frame[NXT_MAX_FRAME_SIZE];
+		NxtOutputState state = RandomOutputState(random), decodedState;
+		int length = EncodeSetOutputState(frame, state, random.Next() % 2 != 0);
+		if (!DecodeSetOutputState(frame, length, &decodedState) || !SameOutputState(state, decodedState) ||
+			DecodeSetOutputState(frame, length - 1, &decodedState))
+		{
+			mismatches++;
+		}
+
+		NxtOutputStatus status, decodedStatus;
+		status.state = RandomOutputState(random);
+		status.tachoCount = (long)(random.Next32() & 0x7FFFFFFF) - 0x3FFFFFFFL;
+		status.blockTachoCount = -(long)(random.Next32() & 0xFFFFFF);
+		status.rotationCount = (long)(random.Next32() & 0xFFFFFF);
+		length = EncodeOutputStateReply(frame, status);
+		if (!DecodeOutputStateReply(frame, length, &decodedStatus) || !SameOutputState(status.state, decodedStatus.state) ||
+			status.tachoCount != decodedStatus.tachoCount || status.blockTachoCount != decodedStatus.blockTachoCount ||
+			status.rotationCount != decodedStatus.rotationCount)
+		{
+			mismatches++;
+		}
+
+		unsigned char message[NXT_MAX_MESSAGE_SIZE];
+		int messageLength = random.Range(0, NXT_MAX_MESSAGE_SIZE - 1);
+		for (int i = 0; i < messageLength; ++i)
+		{
+			message[i] = (unsigned char)random.Range(1, 255);
+		}
+		int mailbox = random.Range(0, NXT_MAILBOX_COUNT - 1), decodedMailbox, decodedLength;
+		const unsigned char* pDecoded;
+		length = EncodeMessageWrite(frame, mailbox, message, messageLength, false);
+		if (!DecodeMessageWrite(frame, length, &decodedMailbox, &pDecoded, &decodedLength) ||
+			decodedMailbox != mailbox || decodedLength != messageLength || memcmp(pDecoded, message, messageLength) != 0)
+		{
+			mismatches++;
+		}
+
+		// Intents: clamped, never a zero byte for the brick's string, and
+		// rejected with a wrong checksum, a zero byte or a wrong length
+		IntentMessage intent, decodedIntent;
+		switch (random.Range(0, 2))
+		{
+			case 0:
+				intent = MakeDriveIntent(random.Range(-300, 300), random.Range(-300, 300), random.Range(-1000, 4000));
+				break;
+			case 1:
+				intent = MakeGripperIntent(random.Range(-300, 300));
+				break;
+			default:
+				intent = MakeStopIntent(random.Next() % 2 != 0);
+				break;
+		}
+		intent.sequence = random.Range(1, 1000);
+		unsigned char encoded[INTENT_MESSAGE_SIZE + 1], broken[INTENT_MESSAGE_SIZE];
+		length = EncodeIntent(intent, encoded);
+		encoded[INTENT_MESSAGE_SIZE] = 1;
+		if (length != INTENT_MESSAGE_SIZE || memchr(encoded, 0, INTENT_MESSAGE_SIZE) != NULL ||
+			!DecodeIntent(encoded, length, &decodedIntent) || !SameIntent(intent, decodedIntent))
+		{
+			mismatches++;
+		}
+		memcpy(broken, encoded, INTENT_MESSAGE_SIZE);
+		broken[INTENT_MESSAGE_SIZE - 1] = (unsigned char)(broken[INTENT_MESSAGE_SIZE - 1] % 255 + 1);
+		bool accepted = DecodeIntent(broken, INTENT_MESSAGE_SIZE, &decodedIntent);
+		memcpy(broken, encoded, INTENT_MESSAGE_SIZE);
+		broken[random.Range(0, INTENT_MESSAGE_SIZE - 1)] = 0;
+		accepted = accepted || DecodeIntent(broken, INTENT_MESSAGE_SIZE, &decodedIntent);
+		accepted = accepted || DecodeIntent(encoded, INTENT_MESSAGE_SIZE - 1, &decodedIntent);
+		accepted = accepted || DecodeIntent(encoded, INTENT_MESSAGE_SIZE + 1, &decodedIntent);
+		if (accepted)
+		{
+			mismatches++;
+		}
+
+		// Whole frames out of a batch in the order they went in
+		NxtBatch<128> batch;
+		int sizes[8], count = 0;
+		while (count < 8)
+		{
+			int size = random.Range(2, NXT_MAX_FRAME_SIZE);
+			for (int i = 0; i < size; ++i)
+			{
+				frame[i] = (unsigned char)(count + i);
+			}
+			if (!batch.Append(frame, size))
+			{
+				break;
+			}
+			sizes[count++] = size;
+		}
+		int offset = 0, index = 0, frameLength;
+		const unsigned char* pFrame;
+		while (NextBatchFrame(batch.GetData(), batch.GetLength(), &offset, &pFrame, &frameLength))
+		{
+			if (index >= count || frameLength != sizes[index] || pFrame[frameLength - 1] != (unsigned char)(index + frameLength - 1))
+			{
+				mismatches++;
+			}
+			index++;
+		}
+		if (index != count || offset != batch.GetLength())
+		{
+			mismatches++;
+		}
+
+		// Garbage must be rejected or decoded, never read past its length
+		length = random.Range(0, NXT_MAX_FRAME_SIZE);
+		for (int i = 0; i < length; ++i)
+		{
+			frame[i] = (unsigned char)random.Next();
+		}
+		int millivolts;
+		unsigned long sleepMs;
+		DecodeSetOutputState(frame, length, &decodedState);
+		DecodeOutputStateReply(frame, length, &decodedStatus);
+		DecodeMessageWrite(frame, length, &decodedMailbox, &pDecoded, &decodedLength);
+		DecodeBatteryLevelReply(frame, length, &millivolts);
+		DecodeKeepAliveReply(frame, length, &sleepMs);
+		DecodeIntent(frame, length, &decodedIntent);
+		offset = 0;
+		while (NextBatchFrame(frame, length, &offset, &pFrame, &frameLength))
+		{
+		}
+	}
+
+	// The sequence wraps from 255 to 1, never to 0
+	for (int sequence = 250; sequence <= 520; ++sequence)
+	{
+		unsigned char encoded[INTENT_MESSAGE_SIZE];
+		IntentMessage intent = MakeDriveIntent(50, 0, 0);
+		intent.sequence = sequence;
+		EncodeIntent(intent, encoded);
+		int expected = sequence % 255 == 0 ? 255 : sequence % 255;
+		if (encoded[1] != expected)
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+// Step of the mock brick run: what the simulated intent program must end up
+// running on OUT_B, OUT_C and the gripper port OUT_A
+struct IntentStep
+{
+	char call;			// 'd' Drive, 'g' Gripper, 's' Stop
+	int value;			// Speed or gripper power
+	int turnRatio;
+	int left;
+	int right;
+	int gripper;
+};
+
+// True once the brick ran that many intents and has the powers of the step,
+// the turn ratio too after a drive
+static bool WaitIntent(const MockTransport& mock, int intents, const IntentStep& step)
+{
+	uint64_t start = GetTimeMicros();
+	while (GetTimeMicros() - start < 2000000)
+	{
+		if (mock.GetIntentCount() == intents && mock.GetMotorPower(1) == step.left && mock.GetMotorPower(2) == step.right &&
+			mock.GetMotorPower(0) == step.gripper &&
+			(step.call != 'd' || (mock.GetTurnRatio(1) == step.turnRatio && mock.GetTurnRatio(2) == step.turnRatio)))
+		{
+			return true;
+		}
+		SleepMillis(1);
+	}
+	return false;
+}
+
+// IntentDrivetrain over a link to the simulated intent program: every call
+// must post exactly one message, and the brick must reach what it asked for
+// no sooner than the ramp allows. Returns the number of mismatches.
+static int CheckIntentBrick(int* pPosted, int* pRun)
+{
+	static const IntentStep steps[] =
+	{
+		{'d', 60, 0, 60, 60, 0},
+		{'d', 50, 30, 50, 20, 0},
+		{'g', 70, 0, 50, 20, 70},
+		{'d', -40, -50, 0, -40, 70},
+		{'g', 0, 0, 0, -40, 0},
+		{'s', 0, 0, 0, 0, 0},
+		{'d', 30, 100, 30, -30, 0},
+		{'s', 0, 0, 0, 0, 0}
+	};
+	int count = sizeof(steps) / sizeof(steps[0]);
+	*pPosted = 0;
+	*pRun = 0;
+	MockTransport mock;
+	mock.SetLatency(MakeBluetoothLatency());
+	RobotLink link(&mock, INTENT_PROGRAM_NAME, LINK_PIPELINED);
+	link.Start();
+	if (!WaitConnected(link))
+	{
+		return count;
+	}
+
+	IntentDrivetrain drive(&link, g_intentBenchRampMs);
+	int mismatches = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const IntentStep& step = steps[i];
+		uint64_t start = GetTimeMicros();
+		switch (step.call)
+		{
+			case 'd':
+				drive.Drive(step.value, step.turnRatio);
+				break;
+			case 'g':
+				drive.Gripper(step.value);
+				break;
+			default:
+				drive.Stop();
+				break;
+		}
+		(*pPosted)++;
+		bool reached = WaitIntent(mock, *pPosted, step);
+		if (!reached || (step.call == 'd' && GetTimeMicros() - start < g_intentBenchRampMs * 1000ULL))
+		{
+			mismatches++;
+		}
+	}
+	*pRun = mock.GetIntentCount();
+	link.Shutdown();
+	return mismatches;
+}
+
+// Encode, decode and batch rates of the codec in NxtProtocol.h
+static int RunCodecBenchmark()
+{
+	int mismatches = FuzzCodec();
+	printf("Codec round trips: %d rounds, %d mismatches\n", g_codecFuzzRounds, mismatches);
+	int posted, run;
+	int brickMismatches = CheckIntentBrick(&posted, &run);
+	printf("Intents on the mock brick: %d posted, %d run, %d mismatches\n", posted, run, brickMismatches);
+	mismatches += brickMismatches;
+
+	unsigned char frame[NXT_SETOUTPUTSTATE_SIZE];
+	NxtOutputState state = {1, 0, NXT_MODE_MOTORON | NXT_MODE_REGULATED, NXT_REGULATION_MOTOR_SYNC, 0, NXT_RUNSTATE_RUNNING, 0};
+	unsigned long sink = 0;
+	uint64_t start = GetTimeMicros();
+	for (int i = 0; i < g_codecBenchFrames; ++i)
+	{
+		state.power = i % 201 - 100;
+		EncodeSetOutputState(frame, state, false);
+		sink += frame[3];
+	}
+	double encodeSeconds = (GetTimeMicros() - start) / 1e6;
+
+	NxtOutputState decoded;
+	start = GetTimeMicros();
+	for (int i = 0; i < g_codecBenchFrames; ++i)
+	{
+		frame[3] = (unsigned char)i;
+		DecodeSetOutputState(frame, NXT_SETOUTPUTSTATE_SIZE, &decoded);
+		sink += decoded.power;
+	}
+	double decodeSeconds = (GetTimeMicros() - start) / 1e6;
+
+	// One steering update: both drive motors, the gripper and an intent
+	NxtBatch<LINK_BATCH_SIZE> batch;
+	unsigned char message[6] = {1, 1, 128, 128, 1, 1};
+	int batches = g_codecBenchFrames / 4;
+	start = GetTimeMicros();
+	for (int i = 0; i < batches; ++i)
+	{
+		batch.Clear();
+		for (int port = 0; port < MOTOR_PORT_COUNT; ++port)
+		{
+			state.port = port;
+			state.power = (i + port) % 101;
+			batch.Commit(EncodeSetOutputState(batch.Reserve(), state, false));
+		}
+		message[1] = (unsigned char)(i % 255 + 1);
+		batch.Commit(EncodeMessageWrite(batch.Reserve(), 0, message, sizeof(message), false));
+		sink += batch.GetLength();
+	}
+	double batchSeconds = (GetTimeMicros() - start) / 1e6;
+
+	printf("%-28s %14s %10s\n", "", "frames/s", "ns/frame");
+	printf("%-28s %14.0f %10.1f\n", "SETOUTPUTSTATE encode", g_codecBenchFrames / encodeSeconds, encodeSeconds * 1e9 / g_codecBenchFrames);
+	printf("%-28s %14.0f %10.1f\n", "SETOUTPUTSTATE decode", g_codecBenchFrames / decodeSeconds, decodeSeconds * 1e9 / g_codecBenchFrames);
+	printf("%-28s %14.0f %10.1f\n", "batch of 3 motors + message", batches * 4 / batchSeconds, batchSeconds * 1e9 / (batches * 4.0));
+	printf("(checksum %lu)\n", sink);
+	return mismatches == 0 ? 0 : 1;
+}
+
+int RunBenchmark(const char* name)
+{
+	if (strcmp(name, "link") == 0)
+	{
+		return RunLinkBenchmark();
+	}
+	if (strcmp(name, "codec") == 0)
+	{
+		return RunCodecBenchmark();
+	}
+	if (strcmp(name, "stop") == 0)
+	{
+		return RunStopBenchmark();
+	}
+	if (strcmp(name, "rate") == 0)
+	{
+		return RunRateBenchmark();
+	}
+	if (strcmp(name, "telemetry") == 0)
+	{
+		return RunTelemetryBenchmark();
+	}
+	if (strcmp(name, "speed") == 0)
+	{
+		return RunSpeedBenchmark();
+	}
+	if (strcmp(name, "bricks") == 0)
+	{
+		return RunBrickBenchmark();
+	}
+	if (strcmp(name, "load") == 0)
+	{
+		return RunLoadBenchmark();
+	}
+	if (strcmp(name, "skeleton") == 0)
+	{
+		return RunSkeletonBenchmark();
+	}
+	if (strcmp(name, "history") == 0)
+	{
+		return RunHistoryBenchmark();
+	}
+	if (strcmp(name, "gestures") == 0)
+	{
+		return RunGestureBenchmark();
+	}
+	if (strcmp(name, "modes") == 0)
+	{
+		return RunModeBenchmark();
+	}
+	if (strcmp(name, "merge") == 0)
+	{
+		return RunMergeBenchmark();
+	}
+	if (strcmp(name, "fusion") == 0)
+	{
+		return RunFusionBenchmark();
+	}
+	if (strcmp(name, "publish") == 0)
+	{
+		return RunPublishBenchmark();
+	}
+#ifndef WIN32
+	if (strcmp(name, "serial") == 0)
+	{
+		return RunSerialBenchmark();
+	}
+#endif
+	printf("Unknown benchmark: %s\n", name);
+	return 1;
+}
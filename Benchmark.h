@@ -0,0 +1,38 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Benchmarks run without camera or robot                  *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_BENCHMARK_H_
+#define _MINDSTORM_BENCHMARK_H_
+
+// Runs the named benchmark and prints its report. Returns the process exit
+// code, nonzero for an unknown name.
+//   link       robot link throughput and latency, acknowledged vs pipelined
+//   stop       time until all motors stop while the link is saturated
+//   rate       command staleness on a congested link, with and without rate control
+//   telemetry  command latency with and without battery and motor polling
+//   speed      wheel speed under load, open loop vs tachometer feedback
+//   bricks     per-brick latency percentiles with several bricks on one adapter
+//   load       users times robots through the steering code: CPU per stage,
+//              latency percentiles and dropped commands
+//   skeleton   synthetic skeleton frames per second, alone and through the
+//              steering methods, and a same-seed same-frames check
+//   history    joint history velocity, acceleration and range per frame vs the
+//              same from SkeletonFrame copies, and that both agree
+//   gestures   template matching time with and without LB_Keogh and early
+//              abandoning, and generated motions recognized as each action
+//   modes      gesture to command latency at the depth frame rates sensors offer
+//   merge      users walking between two sensors: merge time, people counted
+//              once and ids kept through handoffs
+//   fusion     three sensors calibrated from one user walking: transform errors,
+//              then fused vs single-sensor joint errors and merge time
+//   publish    shared-memory skeleton frames: publish time with and without
+//              readers spinning, and that no reader takes a torn frame
+//   codec      encode/decode/batch rates and random round trips of NxtProtocol.h
+//   serial     the same through SerialTransport and a fake brick on a pty (Linux)
+int RunBenchmark(const char* name);
+
+#endif // _MINDSTORM_BENCHMARK_H_
@@ -0,0 +1,169 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Bricks taking turns on one Bluetooth adapter            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "BrickScheduler.h"
+
+// Longest wait between checks for a turn handed over. In milliseconds.
+const unsigned int g_turnCheckInterval = 100;
+
+BrickScheduler::BrickScheduler(SchedulePolicy policy) :
+	m_policy(policy), m_brickCount(0), m_owner(-1), m_virtualTime(0)
+{
+	for (int i = 0; i < SCHEDULER_MAX_BRICKS; ++i)
+	{
+		Brick& brick = m_bricks[i];
+		brick.pLink = NULL;
+		brick.weight = 1;
+		brick.waiting = brick.urgent = false;
+		brick.start = brick.finish = 0;
+		brick.turns = brick.bytes = 0;
+	}
+}
+
+BrickScheduler::~BrickScheduler()
+{
+	Shutdown();
+	for (int i = 0; i < m_brickCount; ++i)
+	{
+		delete m_bricks[i].pLink;
+		m_bricks[i].pLink = NULL;
+	}
+}
+
+RobotLink* BrickScheduler::AddBrick(RobotTransport* pTransport, const char* programName, RobotLinkMode mode, int weight)
+{
+	if (m_brickCount >= SCHEDULER_MAX_BRICKS)
+	{
+		return NULL;
+	}
+	Brick& brick = m_bricks[m_brickCount];
+	brick.pLink = new RobotLink(pTransport, programName, mode);
+	brick.pLink->SetScheduler(this, m_brickCount);
+	brick.weight = weight > 0 ? weight : 1;
+	m_brickCount++;
+	return brick.pLink;
+}
+
+void BrickScheduler::Start()
+{
+	for (int i = 0; i < m_brickCount; ++i)
+	{
+		m_bricks[i].pLink->Start();
+	}
+}
+
+// Every link sends its last stops in its own turn
+void BrickScheduler::Shutdown()
+{
+	for (int i = 0; i < m_brickCount; ++i)
+	{
+		m_bricks[i].pLink->Shutdown();
+	}
+}
+
+int BrickScheduler::GetTurnCount(int brick) const
+{
+	ScopedLock lock(m_lock);
+	return m_bricks[brick].turns;
+}
+
+int BrickScheduler::GetSentBytes(int brick) const
+{
+	ScopedLock lock(m_lock);
+	return m_bricks[brick].bytes;
+}
+
+// A free adapter is taken at once; it is only free while nobody waits, since
+// Release() hands it straight to the next brick
+void BrickScheduler::Acquire(int brick)
+{
+	Brick& self = m_bricks[brick];
+	{
+		ScopedLock lock(m_lock);
+		// A brick back from idle starts level with the others, not ahead
+		self.start = self.finish > m_virtualTime ? self.finish : m_virtualTime;
+		if (m_owner < 0)
+		{
+			m_owner = brick;
+			m_virtualTime = self.start;
+			self.urgent = false;
+			self.turns++;
+			return;
+		}
+		self.waiting = true;
+	}
+	for (;;)
+	{
+		self.turn.Wait(g_turnCheckInterval);
+		ScopedLock lock(m_lock);
+		if (m_owner == brick)
+		{
+			return;
+		}
+	}
+}
+
+void BrickScheduler::Release(int brick, int bytes)
+{
+	ScopedLock lock(m_lock);
+	Brick& self = m_bricks[brick];
+	self.bytes += bytes;
+	self.finish = self.start + (double)bytes / self.weight;
+
+	int next = PickNext();
+	m_owner = next;
+	if (next >= 0)
+	{
+		Brick& other = m_bricks[next];
+		other.waiting = false;
+		other.urgent = false;
+		other.turns++;
+		m_virtualTime = other.start;
+		other.turn.Signal();
+	}
+}
+
+void BrickScheduler::Expedite(int brick)
+{
+	ScopedLock lock(m_lock);
+	m_bricks[brick].urgent = true;
+}
+
+// Stops first, then by policy. Round robin continues after the last owner,
+// fair queuing takes the earliest virtual start and breaks ties the same way.
+// Called with m_lock held.
+int BrickScheduler::PickNext() const
+{
+	int best = -1;
+	for (int i = 1; i <= m_brickCount; ++i)
+	{
+		int candidate = (m_owner + i) % m_brickCount;
+		const Brick& brick = m_bricks[candidate];
+		if (!brick.waiting)
+		{
+			continue;
+		}
+		if (best < 0)
+		{
+			best = candidate;
+			continue;
+		}
+		const Brick& chosen = m_bricks[best];
+		if (brick.urgent != chosen.urgent)
+		{
+			if (brick.urgent)
+			{
+				best = candidate;
+			}
+		}
+		else if (m_policy == SCHEDULE_FAIR && brick.start < chosen.start)
+		{
+			best = candidate;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,83 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Bricks taking turns on one Bluetooth adapter            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_BRICK_SCHEDULER_H_
+#define _MINDSTORM_BRICK_SCHEDULER_H_
+
+#include "Platform.h"
+#include "RobotLink.h"
+
+#define SCHEDULER_MAX_BRICKS	8
+
+enum SchedulePolicy
+{
+	SCHEDULE_ROUND_ROBIN,	// Waiting bricks get the adapter one after another
+	SCHEDULE_FAIR			// Weighted fair queuing on the bytes each brick sent
+};
+
+// One adapter carries the traffic of every paired brick, one write at a
+// time, while every RobotLink has its own thread. The scheduler owns the
+// links and hands the adapter out in turns. A link waits for its turn
+// before it reads what the tracker wants, so commands that arrive while it
+// waits replace the older ones instead of queuing behind them. A brick with
+// a stop waiting goes ahead of bricks with only motion to send.
+//
+// Round trips that confirm a link are not scheduled: their frame is tiny,
+// and holding the adapter until the reply would stall every other brick.
+class BrickScheduler
+{
+	public:
+		BrickScheduler(SchedulePolicy policy = SCHEDULE_FAIR);
+		~BrickScheduler();		// Shuts the links down and deletes them
+
+		// Creates the link to one more brick, NULL once SCHEDULER_MAX_BRICKS
+		// are added. The weight is its share under SCHEDULE_FAIR.
+		RobotLink* AddBrick(RobotTransport* pTransport, const char* programName,
+			RobotLinkMode mode = LINK_PIPELINED, int weight = 1);
+		int GetBrickCount() const { return m_brickCount; }
+		RobotLink* GetLink(int brick) const { return m_bricks[brick].pLink; }
+
+		void Start();
+		void Shutdown();
+
+		// Turns taken and bytes written by a brick, from any thread
+		int GetTurnCount(int brick) const;
+		int GetSentBytes(int brick) const;
+
+		// Called by the links only
+		void Acquire(int brick);
+		void Release(int brick, int bytes);
+		void Expedite(int brick);	// A stop is waiting to be sent
+
+	private:
+		BrickScheduler(const BrickScheduler&);
+		BrickScheduler& operator=(const BrickScheduler&);
+
+		struct Brick
+		{
+			RobotLink* pLink;
+			int weight;
+			bool waiting;
+			bool urgent;
+			double start;		// Virtual time the current turn started at
+			double finish;		// Virtual time the last turn ended at
+			int turns;
+			int bytes;
+			Event turn;			// Signalled when the adapter is handed over
+		};
+
+		int PickNext() const;
+
+		SchedulePolicy			m_policy;
+		mutable Mutex			m_lock;
+		Brick					m_bricks[SCHEDULER_MAX_BRICKS];
+		int						m_brickCount;
+		int						m_owner;		// Brick with the adapter, -1 when free
+		double					m_virtualTime;	// Start of the latest turn
+};
+
+#endif // _MINDSTORM_BRICK_SCHEDULER_H_
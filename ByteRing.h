@@ -0,0 +1,60 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Fixed size byte queue                                   *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_BYTE_RING_H_
+#define _MINDSTORM_BYTE_RING_H_
+
+// Bytes waiting for a non-blocking write. Capacity must be a power of two;
+// nothing is allocated after construction. Not thread safe by itself.
+template <unsigned int Capacity>
+class ByteRing
+{
+	public:
+		ByteRing() : m_head(0), m_tail(0) {}
+
+		unsigned int GetSize() const { return m_tail - m_head; }
+		unsigned int GetFree() const { return Capacity - GetSize(); }
+		bool IsEmpty() const { return m_head == m_tail; }
+		void Clear() { m_head = m_tail = 0; }
+
+		// All or nothing, false when there is not enough room
+		bool Push(const unsigned char* pData, unsigned int length)
+		{
+			if (length > GetFree())
+			{
+				return false;
+			}
+			for (unsigned int i = 0; i < length; ++i)
+			{
+				m_buffer[(m_tail + i) & (Capacity - 1)] = pData[i];
+			}
+			m_tail += length;
+			return true;
+		}
+
+		// Longest run of queued bytes that is contiguous in memory, for write()
+		const unsigned char* Peek(unsigned int* pLength) const
+		{
+			unsigned int start = m_head & (Capacity - 1);
+			unsigned int size = GetSize();
+			*pLength = size < Capacity - start ? size : Capacity - start;
+			return m_buffer + start;
+		}
+
+		void Consume(unsigned int length)
+		{
+			m_head += length < GetSize() ? length : GetSize();
+		}
+
+	private:
+		// Free running counters, wrapping is harmless for unsigned arithmetic
+		unsigned int			m_head;
+		unsigned int			m_tail;
+		unsigned char			m_buffer[Capacity];
+};
+
+#endif // _MINDSTORM_BYTE_RING_H_
@@ -0,0 +1,187 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Wheel speed regulated from tachometer feedback          *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "ClosedLoopDrivetrain.h"
+
+// NXT 1.0 kit wheels and the distance between their centers. In millimeters.
+const double g_wheelDiameter = 56;
+const double g_trackWidth = 120;
+// Speed asked for by Drive(100, 0). In mm/s.
+const double g_maxWheelSpeed = 400;
+// Speed at full power on fresh batteries, the feedforward guess. In mm/s.
+const double g_fullPowerSpeed = 440;
+// Control period of the wheel regulation. In milliseconds.
+const unsigned int g_controlPeriod = 20;
+// Proportional gain in power per mm/s, integral gain in power per mm/s per second
+const double g_speedGain = 0.05;
+const double g_integralGain = 0.4;
+// Largest correction the integral term may build up. In power.
+const double g_maxIntegral = 50;
+// Older wheel speeds are not trusted for the proportional term, unless
+// readings come further apart, as with NXT++: then older than two of their
+// intervals. In milliseconds.
+const unsigned int g_staleTelemetry = 250;
+
+static int ClampPower(double power)
+{
+	return power > 100 ? 100 : (power < -100 ? -100 : (int)(power + (power < 0 ? -0.5 : 0.5)));
+}
+
+ClosedLoopDrivetrain::ClosedLoopDrivetrain(RobotLink* pLink, int leftPort, int rightPort, int toolPort) :
+	Drivetrain(pLink, leftPort, rightPort, toolPort), m_running(1), m_leftTarget(0), m_rightTarget(0), m_reset(false),
+	m_odometry(g_wheelDiameter, g_trackWidth)
+{
+	Wheel left = {leftPort, 0, 0, 0};
+	Wheel right = {rightPort, 0, 0, 0};
+	m_left = left;
+	m_right = right;
+	m_pose.Write(m_odometry.GetPose());
+	m_thread.Start(ControlThread, this);
+}
+
+ClosedLoopDrivetrain::~ClosedLoopDrivetrain()
+{
+	m_running.Set(0);
+	m_thread.Join();
+}
+
+// Same split between the wheels as the brick's synchronized regulation
+void ClosedLoopDrivetrain::Drive(int speed, int turnRatio)
+{
+	m_speed = speed;
+	m_turnRatio = turnRatio < -100 ? -100 : (turnRatio > 100 ? 100 : turnRatio);
+	int left = speed, right = speed;
+	if (turnRatio > 0)
+	{
+		right = speed * (50 - (turnRatio > 100 ? 100 : turnRatio)) / 50;
+	}
+	else
+	{
+		left = speed * (50 + (turnRatio < -100 ? -100 : turnRatio)) / 50;
+	}
+
+	ScopedLock lock(m_lock);
+	m_leftTarget = left * g_maxWheelSpeed / 100;
+	m_rightTarget = right * g_maxWheelSpeed / 100;
+	if (speed == 0)
+	{
+		m_reset = true;
+	}
+}
+
+void ClosedLoopDrivetrain::EmergencyStop()
+{
+	{
+		ScopedLock lock(m_lock);
+		m_leftTarget = m_rightTarget = 0;
+		m_reset = true;
+	}
+	Drivetrain::EmergencyStop();
+}
+
+void ClosedLoopDrivetrain::ControlThread(void* pSelf)
+{
+	((ClosedLoopDrivetrain*)pSelf)->Control();
+}
+
+// Power is set every period from the latest targets, so a new speed is sent
+// right away; the feedback terms follow whenever a tachometer reading arrives
+void ClosedLoopDrivetrain::Control()
+{
+	uint64_t next = GetTimeMicros();
+	uint64_t lastReading = 0;
+	uint64_t staleAfter = g_staleTelemetry * 1000;
+	while (m_running.Get())
+	{
+		{
+			ScopedLock lock(m_lock);
+			if (m_reset || (m_left.target > 0) != (m_leftTarget > 0) || (m_left.target < 0) != (m_leftTarget < 0))
+			{
+				m_left.integral = 0;
+			}
+			if (m_reset || (m_right.target > 0) != (m_rightTarget > 0) || (m_right.target < 0) != (m_rightTarget < 0))
+			{
+				m_right.integral = 0;
+			}
+			m_left.target = m_leftTarget;
+			m_right.target = m_rightTarget;
+			m_reset = false;
+		}
+
+		RobotTelemetry telemetry = m_pLink->GetTelemetry();
+		if (m_odometry.Update(telemetry.motors[m_left.port], telemetry.motors[m_right.port]))
+		{
+			const RobotPose& pose = m_odometry.GetPose();
+			double seconds = lastReading != 0 ? (pose.time - lastReading) / 1e6 : 0;
+			if (lastReading != 0)
+			{
+				uint64_t interval = 2 * (pose.time - lastReading);
+				staleAfter = interval > g_staleTelemetry * 1000 ? interval : g_staleTelemetry * 1000;
+			}
+			lastReading = pose.time;
+			Regulate(m_left, pose.leftSpeed, seconds);
+			Regulate(m_right, pose.rightSpeed, seconds);
+			m_pose.Write(pose);
+		}
+
+		uint64_t now = GetTimeMicros();
+		bool fresh = lastReading != 0 && now - lastReading < staleAfter;
+		const RobotPose& pose = m_odometry.GetPose();
+		double leftPower = m_left.target * 100 / g_fullPowerSpeed + m_left.integral;
+		double rightPower = m_right.target * 100 / g_fullPowerSpeed + m_right.integral;
+		if (fresh)
+		{
+			leftPower += g_speedGain * (m_left.target - pose.leftSpeed);
+			rightPower += g_speedGain * (m_right.target - pose.rightSpeed);
+		}
+		m_left.power = m_left.target == 0 ? 0 : ClampPower(leftPower);
+		m_right.power = m_right.target == 0 ? 0 : ClampPower(rightPower);
+		Apply(m_left);
+		Apply(m_right);
+
+		// Fixed rate; after a long stall it restarts instead of catching up
+		next += g_controlPeriod * 1000;
+		now = GetTimeMicros();
+		if (next > now)
+		{
+			SleepMicros((unsigned int)(next - now));
+		}
+		else if (now - next > g_controlPeriod * 1000)
+		{
+			next = now;
+		}
+	}
+}
+
+// Integral term only grows on new readings, and not further into saturation
+void ClosedLoopDrivetrain::Regulate(Wheel& wheel, double speed, double seconds)
+{
+	if (wheel.target == 0 || seconds <= 0)
+	{
+		return;
+	}
+	double error = wheel.target - speed;
+	bool saturated = (wheel.power >= 100 && error > 0) || (wheel.power <= -100 && error < 0);
+	if (!saturated)
+	{
+		wheel.integral += g_integralGain * error * seconds;
+		wheel.integral = wheel.integral > g_maxIntegral ? g_maxIntegral : (wheel.integral < -g_maxIntegral ? -g_maxIntegral : wheel.integral);
+	}
+}
+
+// The link drops repeated states, so this is cheap every period
+void ClosedLoopDrivetrain::Apply(const Wheel& wheel)
+{
+	if (wheel.power == 0)
+	{
+		m_pLink->Stop(wheel.port, true);
+	}
+	else
+	{
+		m_pLink->SetForward(wheel.port, wheel.power);
+	}
+}
@@ -0,0 +1,67 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Wheel speed regulated from tachometer feedback          *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_CLOSED_LOOP_DRIVETRAIN_H_
+#define _MINDSTORM_CLOSED_LOOP_DRIVETRAIN_H_
+
+#include "Drivetrain.h"
+#include "Odometry.h"
+#include "SeqLock.h"
+
+// Drive() asks for a speed over the ground instead of a motor power. A
+// control thread with a fixed period, independent of the tracker frame rate,
+// feeds the link's telemetry into Odometry and adjusts each wheel's power
+// with a PI controller on top of a feedforward guess, so the robot keeps
+// its speed as the battery drains or the floor changes.
+class ClosedLoopDrivetrain : public Drivetrain
+{
+	public:
+		ClosedLoopDrivetrain(RobotLink* pLink, int leftPort, int rightPort, int toolPort);
+		virtual ~ClosedLoopDrivetrain();
+
+		// Same ranges as Drivetrain; speed 100 is g_maxWheelSpeed and the
+		// turn ratio splits it between the wheels like synchronized motors
+		virtual void Drive(int speed, int turnRatio);
+		virtual void EmergencyStop();
+
+		// Latest estimate, from any thread without blocking
+		RobotPose GetPose() const { return m_pose.Read(); }
+
+	private:
+		ClosedLoopDrivetrain(const ClosedLoopDrivetrain&);
+		ClosedLoopDrivetrain& operator=(const ClosedLoopDrivetrain&);
+
+		struct Wheel
+		{
+			int port;
+			double target;		// Over the ground, in mm/s
+			double integral;	// Power added by the integral term
+			int power;			// Last power sent
+		};
+
+		static void ControlThread(void* pSelf);
+		void Control();
+		void Regulate(Wheel& wheel, double speed, double seconds);
+		void Apply(const Wheel& wheel);
+
+		Thread					m_thread;
+		AtomicInt				m_running;
+
+		// Written by Drive(), read by the control thread
+		Mutex					m_lock;
+		double					m_leftTarget;
+		double					m_rightTarget;
+		bool					m_reset;		// Stopped, forget the integral terms
+
+		// Control thread only
+		Wheel					m_left;
+		Wheel					m_right;
+		Odometry				m_odometry;
+		SeqLock<RobotPose>		m_pose;
+};
+
+#endif // _MINDSTORM_CLOSED_LOOP_DRIVETRAIN_H_
@@ -0,0 +1,77 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Which of the people in view drives the robot            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "DriverSelector.h"
+
+DriverZone MakeDriverZone()
+{
+	DriverZone zone = {-1000, 1000, 1000, 3000};
+	return zone;
+}
+
+DriverSelector::DriverSelector(DriverPolicy policy, const DriverZone& zone) :
+	m_policy(policy), m_zone(zone), m_driver(0)
+{
+}
+
+// Could drive this frame: in the scene, and in the zone or with hands up
+bool DriverSelector::Qualifies(const DriverCandidate& candidate) const
+{
+	if (!candidate.visible || candidate.z <= 0)
+	{
+		return false;
+	}
+	if (m_policy == DRIVER_IN_ZONE)
+	{
+		return candidate.x >= m_zone.minX && candidate.x <= m_zone.maxX
+			&& candidate.z >= m_zone.minZ && candidate.z <= m_zone.maxZ;
+	}
+	return true;
+}
+
+int DriverSelector::Update(const DriverCandidate* pCandidates, int count)
+{
+	// The driver stays while still qualifying
+	for (int i = 0; i < count && m_driver != 0; ++i)
+	{
+		if (pCandidates[i].userId == m_driver)
+		{
+			if (Qualifies(pCandidates[i]))
+			{
+				return m_driver;
+			}
+			break;
+		}
+	}
+
+	m_driver = 0;
+	float closest = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const DriverCandidate& candidate = pCandidates[i];
+		if (!Qualifies(candidate) || (m_policy == DRIVER_RAISED_HANDS && !candidate.handsRaised))
+		{
+			continue;
+		}
+		bool better;
+		switch (m_policy)
+		{
+			case DRIVER_EVERYONE:
+				better = m_driver == 0 || candidate.userId < m_driver;
+				break;
+			default:
+				better = m_driver == 0 || candidate.z < closest;
+				break;
+		}
+		if (better)
+		{
+			m_driver = candidate.userId;
+			closest = candidate.z;
+		}
+	}
+	return m_driver;
+}
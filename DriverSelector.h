@@ -0,0 +1,68 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Which of the people in view drives the robot            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_DRIVER_SELECTOR_H_
+#define _MINDSTORM_DRIVER_SELECTOR_H_
+
+enum DriverPolicy
+{
+	DRIVER_RAISED_HANDS,	// First to raise both hands (NiTE's psi pose)
+	DRIVER_CLOSEST,			// Closest to the sensor
+	DRIVER_IN_ZONE,			// Closest of those standing in the driving zone
+	DRIVER_EVERYONE			// Everyone tracked, the first to come drives
+};
+
+// Floor area in front of the sensor. In millimeters, camera space.
+struct DriverZone
+{
+	float minX;
+	float maxX;
+	float minZ;
+	float maxZ;
+};
+
+// 1 m to either side, 1 to 3 m from the sensor
+DriverZone MakeDriverZone();
+
+// What the user tracker knows of a person without a skeleton
+struct DriverCandidate
+{
+	int userId;
+	bool visible;			// In the scene this frame
+	float x;				// Center of mass, in mm
+	float z;
+	bool handsRaised;		// Psi pose held, only looked for with DRIVER_RAISED_HANDS
+};
+
+// Picks one driver, who keeps driving until out of the scene (or out of the
+// zone), so spectators walking closer do not take over. Only the driver
+// needs a skeleton; with DRIVER_EVERYONE everyone gets one, as before.
+class DriverSelector
+{
+	public:
+		DriverSelector(DriverPolicy policy, const DriverZone& zone);
+
+		// Called once per frame with everyone the tracker reports, returns
+		// the driver's user id or 0 when nobody qualifies
+		int Update(const DriverCandidate* pCandidates, int count);
+
+		int GetDriver() const { return m_driver; }
+		DriverPolicy GetPolicy() const { return m_policy; }
+		// Whether everyone who does not drive needs psi pose detection or
+		// a skeleton, to be started on new users
+		bool WatchesHands() const { return m_policy == DRIVER_RAISED_HANDS; }
+		bool TracksEveryone() const { return m_policy == DRIVER_EVERYONE; }
+
+	private:
+		bool Qualifies(const DriverCandidate& candidate) const;
+
+		DriverPolicy			m_policy;
+		DriverZone				m_zone;
+		int						m_driver;
+};
+
+#endif // _MINDSTORM_DRIVER_SELECTOR_H_
@@ -0,0 +1,63 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Differential drive on two synchronized motors           *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "Drivetrain.h"
+
+Drivetrain::Drivetrain(RobotLink* pLink, int leftPort, int rightPort, int toolPort) :
+	m_pLink(pLink), m_leftPort(leftPort), m_rightPort(rightPort), m_toolPort(toolPort), m_speed(0), m_turnRatio(0),
+	m_gripperPower(0)
+{
+}
+
+void Drivetrain::Gripper(int power)
+{
+	m_gripperPower = power;
+	if (power > 0)
+	{
+		m_pLink->SetForward(m_toolPort, power);
+	}
+	else if (power < 0)
+	{
+		m_pLink->SetReverse(m_toolPort, -power);
+	}
+	else
+	{
+		m_pLink->Stop(m_toolPort, true);
+	}
+}
+
+void Drivetrain::EmergencyStop()
+{
+	m_speed = 0;
+	m_turnRatio = 0;
+	m_gripperPower = 0;
+	m_pLink->EmergencyStop(true);
+}
+
+void Drivetrain::Drive(int speed, int turnRatio)
+{
+	if (turnRatio > 100)
+	{
+		turnRatio = 100;
+	}
+	else if (turnRatio < -100)
+	{
+		turnRatio = -100;
+	}
+	m_speed = speed;
+	m_turnRatio = turnRatio;
+
+	// The brick measures the turn ratio from the lower numbered port
+	if (m_leftPort < m_rightPort)
+	{
+		m_pLink->SetSynchronized(m_leftPort, m_rightPort, speed, turnRatio);
+	}
+	else
+	{
+		m_pLink->SetSynchronized(m_rightPort, m_leftPort, speed, -turnRatio);
+	}
+}
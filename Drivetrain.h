@@ -0,0 +1,50 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Differential drive on two synchronized motors           *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_DRIVETRAIN_H_
+#define _MINDSTORM_DRIVETRAIN_H_
+
+#include "RobotLink.h"
+
+// Motion as (speed, turn ratio) instead of per motor commands. Both wheels
+// are driven by one synchronized state, so they start and stop together.
+class Drivetrain
+{
+	public:
+		Drivetrain(RobotLink* pLink, int leftPort, int rightPort, int toolPort);
+		virtual ~Drivetrain() {}
+
+		// Speed in -100..100, negative drives backwards. Turn ratio in
+		// -100..100: 0 is straight, 50 stops the right wheel, 100 spins with
+		// the left wheel forward and the right one in reverse.
+		virtual void Drive(int speed, int turnRatio);
+		// Tool motor power in -100..100, 0 stops it with the brake on
+		virtual void Gripper(int power);
+		// Wheels and tool, ahead of any motion still waiting to be sent
+		virtual void EmergencyStop();
+
+		void Forward(int speed) { Drive(speed, 0); }
+		void Reverse(int speed) { Drive(-speed, 0); }
+		void Stop() { Drive(0, 0); }
+
+		// Last asked for, turn ratio clamped, whatever was made of it since
+		int GetSpeed() const { return m_speed; }
+		int GetTurnRatio() const { return m_turnRatio; }
+		int GetGripperPower() const { return m_gripperPower; }
+
+	protected:
+		RobotLink*				m_pLink;
+		int						m_leftPort;
+		int						m_rightPort;
+		int						m_toolPort;
+		// Kept by every override of Drive() and Gripper()
+		int						m_speed;
+		int						m_turnRatio;
+		int						m_gripperPower;
+};
+
+#endif // _MINDSTORM_DRIVETRAIN_H_
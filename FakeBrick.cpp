@@ -0,0 +1,172 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Simulated brick behind a pseudo terminal                *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef WIN32
+
+#include "FakeBrick.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+FakeBrick::FakeBrick(MockTransport* pBrick) :
+	m_pBrick(pBrick), m_master(-1), m_running(0), m_frameCount(0), m_awaitedReplies(0), m_inputLength(0)
+{
+	m_devicePath[0] = 0;
+}
+
+FakeBrick::~FakeBrick()
+{
+	Stop();
+}
+
+bool FakeBrick::Start()
+{
+	m_master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (m_master < 0 || grantpt(m_master) != 0 || unlockpt(m_master) != 0 || ptsname(m_master) == NULL)
+	{
+		Stop();
+		return false;
+	}
+	strncpy(m_devicePath, ptsname(m_master), sizeof(m_devicePath) - 1);
+	m_devicePath[sizeof(m_devicePath) - 1] = 0;
+
+	struct termios tio;
+	if (tcgetattr(m_master, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		tcsetattr(m_master, TCSANOW, &tio);
+	}
+
+	m_pBrick->Open();
+	m_running.Set(1);
+	return m_thread.Start(BrickThread, this);
+}
+
+void FakeBrick::Stop()
+{
+	m_running.Set(0);
+	m_thread.Join();
+	if (m_master >= 0)
+	{
+		close(m_master);
+		m_master = -1;
+	}
+}
+
+void FakeBrick::BrickThread(void* pSelf)
+{
+	((FakeBrick*)pSelf)->Serve();
+}
+
+void FakeBrick::Serve()
+{
+	while (m_running.Get())
+	{
+		// Replies due from the model are picked up between reads
+		unsigned char reply[NXT_MAX_FRAME_SIZE];
+		int replyLength;
+		while (m_awaitedReplies > 0 && (replyLength = m_pBrick->ReceiveReply(reply, NXT_MAX_FRAME_SIZE)) > 0)
+		{
+			Reply(reply, replyLength);
+			m_awaitedReplies--;
+		}
+
+		struct pollfd master = {m_master, POLLIN, 0};
+		if (poll(&master, 1, m_awaitedReplies > 0 ? 1 : 100) <= 0)
+		{
+			continue;
+		}
+		if (!(master.revents & POLLIN))
+		{
+			// Nobody has the slave side open yet
+			SleepMillis(10);
+			continue;
+		}
+		ssize_t count = read(m_master, m_input + m_inputLength, sizeof(m_input) - m_inputLength);
+		if (count <= 0)
+		{
+			SleepMillis(10);
+			continue;
+		}
+		m_inputLength += (int)count;
+
+		while (m_inputLength >= NXT_BT_LENGTH_SIZE)
+		{
+			int length = m_input[0] | (m_input[1] << 8);
+			if (length < 2 || length > NXT_MAX_FRAME_SIZE)
+			{
+				// A real brick resets its Bluetooth stream on garbage
+				m_inputLength = 0;
+				break;
+			}
+			if (m_inputLength < NXT_BT_LENGTH_SIZE + length)
+			{
+				break;
+			}
+			Execute(m_input + NXT_BT_LENGTH_SIZE, length);
+			m_inputLength -= NXT_BT_LENGTH_SIZE + length;
+			memmove(m_input, m_input + NXT_BT_LENGTH_SIZE + length, m_inputLength);
+		}
+	}
+}
+
+// Frames asking for a reply are answered by the model once its turnaround
+// has passed, so the brick keeps reading frames behind them meanwhile
+void FakeBrick::Execute(const unsigned char* pFrame, int length)
+{
+	m_frameCount.Increment();
+	unsigned char reply[NXT_STATUS_REPLY_SIZE];
+	reply[0] = NXT_REPLY;
+	reply[1] = pFrame[1];
+	reply[2] = NXT_STATUS_SUCCESS;
+
+	if (pFrame[1] == NXT_OP_STARTPROGRAM && length >= NXT_STARTPROGRAM_SIZE)
+	{
+		char name[NXT_FILENAME_SIZE + 1];
+		memcpy(name, pFrame + 2, NXT_FILENAME_SIZE);
+		name[NXT_FILENAME_SIZE] = 0;
+		m_pBrick->StartProgram(name);
+		Reply(reply, NXT_STATUS_REPLY_SIZE);
+	}
+	else if (pFrame[1] == NXT_OP_STOPPROGRAM)
+	{
+		m_pBrick->StopProgram();
+		Reply(reply, NXT_STATUS_REPLY_SIZE);
+	}
+	else
+	{
+		m_pBrick->SendDirectCommand(pFrame, length);
+		if ((pFrame[0] & NXT_DIRECT_COMMAND_NO_REPLY) == 0)
+		{
+			m_awaitedReplies++;
+		}
+	}
+}
+
+void FakeBrick::Reply(const unsigned char* pReply, int length)
+{
+	unsigned char packet[NXT_BT_LENGTH_SIZE + NXT_MAX_FRAME_SIZE];
+	packet[0] = (unsigned char)(length & 0xFF);
+	packet[1] = (unsigned char)(length >> 8);
+	memcpy(packet + NXT_BT_LENGTH_SIZE, pReply, length);
+	int total = NXT_BT_LENGTH_SIZE + length;
+	for (int offset = 0; offset < total; )
+	{
+		ssize_t written = write(m_master, packet + offset, total - offset);
+		if (written < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			return;
+		}
+		offset += written > 0 ? (int)written : 0;
+	}
+}
+
+#endif // WIN32
@@ -0,0 +1,54 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Simulated brick behind a pseudo terminal                *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_FAKE_BRICK_H_
+#define _MINDSTORM_FAKE_BRICK_H_
+
+#ifndef WIN32
+
+#include "Platform.h"
+#include "MockTransport.h"
+#include "NxtProtocol.h"
+
+// Answers the Bluetooth byte stream on the master side of a pty, so a
+// SerialTransport opened on GetDevicePath() runs end to end like on
+// /dev/rfcomm0. Frames are executed by a MockTransport, which keeps the
+// motor state and its latency model.
+class FakeBrick
+{
+	public:
+		FakeBrick(MockTransport* pBrick);
+		~FakeBrick();
+
+		bool Start();
+		void Stop();
+		const char* GetDevicePath() const { return m_devicePath; }
+		int GetFrameCount() const { return m_frameCount.Get(); }
+
+	private:
+		FakeBrick(const FakeBrick&);
+		FakeBrick& operator=(const FakeBrick&);
+
+		static void BrickThread(void* pSelf);
+		void Serve();
+		void Execute(const unsigned char* pFrame, int length);
+		void Reply(const unsigned char* pReply, int length);
+
+		MockTransport*			m_pBrick;
+		int						m_master;
+		char					m_devicePath[64];
+		Thread					m_thread;
+		AtomicInt				m_running;
+		AtomicInt				m_frameCount;
+		int						m_awaitedReplies;	// Brick thread only
+		unsigned char			m_input[NXT_BT_LENGTH_SIZE + NXT_MAX_FRAME_SIZE];
+		int						m_inputLength;
+};
+
+#endif // WIN32
+
+#endif // _MINDSTORM_FAKE_BRICK_H_
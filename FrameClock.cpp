@@ -0,0 +1,52 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Frames skipped and how long the ones read waited        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "FrameClock.h"
+
+FrameClock::FrameClock()
+{
+	Reset();
+}
+
+void FrameClock::Reset()
+{
+	m_lastIndex = -1;
+	m_frames = 0;
+	m_dropped = 0;
+	m_hasOffset = false;
+	m_offset = 0;
+	m_ageMs = 0;
+	m_ageSumMs = 0;
+	m_ageMaxMs = 0;
+}
+
+uint64_t FrameClock::Receive(int frameIndex, uint64_t timestamp, uint64_t now)
+{
+	if (frameIndex <= m_lastIndex)
+	{
+		// A recording started over, with its own clock
+		m_hasOffset = false;
+	}
+	else if (m_lastIndex >= 0)
+	{
+		m_dropped += frameIndex - m_lastIndex - 1;
+	}
+	m_lastIndex = frameIndex;
+
+	int64_t offset = (int64_t)now - (int64_t)timestamp;
+	if (!m_hasOffset || offset < m_offset)
+	{
+		m_offset = offset;
+		m_hasOffset = true;
+	}
+	uint64_t captured = (uint64_t)((int64_t)timestamp + m_offset);
+	m_ageMs = (now - captured) / 1000.0;
+	m_ageSumMs += m_ageMs;
+	m_ageMaxMs = m_ageMs > m_ageMaxMs ? m_ageMs : m_ageMaxMs;
+	m_frames++;
+	return captured;
+}
@@ -0,0 +1,43 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Frames skipped and how long the ones read waited        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_FRAME_CLOCK_H_
+#define _MINDSTORM_FRAME_CLOCK_H_
+
+#include <stdint.h>
+
+// Frame freshness of one tracker: frames it had that were never read, and
+// how long the ones read waited. Host minus device time above the smallest
+// difference seen is time spent queued between the sensor and the reader.
+class FrameClock
+{
+	public:
+		FrameClock();
+
+		// Called with every frame read, returns the host time it was
+		// captured. Times are in microseconds.
+		uint64_t Receive(int frameIndex, uint64_t timestamp, uint64_t now);
+		void Reset();
+
+		int GetFrames() const { return m_frames; }
+		int GetDropped() const { return m_dropped; }
+		double GetAgeMs() const { return m_ageMs; }	// Latest frame
+		double GetMeanAgeMs() const { return m_frames > 0 ? m_ageSumMs / m_frames : 0; }
+		double GetMaxAgeMs() const { return m_ageMaxMs; }
+
+	private:
+		int						m_lastIndex;	// -1 before the first frame
+		int						m_frames;
+		int						m_dropped;
+		bool					m_hasOffset;
+		int64_t					m_offset;		// Smallest host minus device time of a frame
+		double					m_ageMs;
+		double					m_ageSumMs;
+		double					m_ageMaxMs;
+};
+
+#endif // _MINDSTORM_FRAME_CLOCK_H_
@@ -0,0 +1,411 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Hand gestures matched against recorded templates        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "GestureRecognizer.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// Larger than any distance, for cells outside the band and abandoned warps
+const float g_gestureInfinity = 1e30f;
+// Narrowest shoulders taken for a person. In millimeters.
+const float g_minShoulderWidth = 100;
+// Default templates: frames, the size of the circle in shoulder widths and
+// the largest mean squared distance per frame still taken
+const int g_defaultGestureFrames = 30;
+const float g_defaultCircleRadius = 0.7f;
+const float g_defaultThreshold = 0.08f;
+
+const char* g_gestureActionNames[] = {"none", "next_mode", "open_gripper"};
+const char* g_gestureHandNames[] = {"right", "left"};
+
+#ifdef JOINT_HISTORY_SSE
+// Sum of the four lanes
+static inline float SumLanes(__m128 value)
+{
+	__m128 sum = _mm_add_ps(value, _mm_movehl_ps(value, value));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+#endif
+
+// Between two padded points
+static inline float SquaredDistance(const float* pA, const float* pB)
+{
+#ifdef JOINT_HISTORY_SSE
+	__m128 delta = _mm_sub_ps(_mm_load_ps(pA), _mm_load_ps(pB));
+	return SumLanes(_mm_mul_ps(delta, delta));
+#else
+	float dx = pA[0] - pB[0], dy = pA[1] - pB[1], dz = pA[2] - pB[2];
+	return dx * dx + dy * dy + dz * dz;
+#endif
+}
+
+// Between a padded point and the box from pLower to pUpper, 0 inside it
+static inline float SquaredDistanceToBox(const float* pPoint, const float* pUpper, const float* pLower)
+{
+#ifdef JOINT_HISTORY_SSE
+	__m128 zero = _mm_setzero_ps();
+	__m128 point = _mm_load_ps(pPoint);
+	__m128 above = _mm_max_ps(_mm_sub_ps(point, _mm_load_ps(pUpper)), zero);
+	__m128 below = _mm_max_ps(_mm_sub_ps(_mm_load_ps(pLower), point), zero);
+	__m128 outside = _mm_add_ps(above, below);
+	return SumLanes(_mm_mul_ps(outside, outside));
+#else
+	float sum = 0;
+	for (int k = 0; k < 3; ++k)
+	{
+		float outside = pPoint[k] > pUpper[k] ? pPoint[k] - pUpper[k] : (pPoint[k] < pLower[k] ? pLower[k] - pPoint[k] : 0);
+		sum += outside * outside;
+	}
+	return sum;
+#endif
+}
+
+GestureRecognizer::GestureRecognizer() :
+	m_count(0), m_frameStep(1), m_pruning(true)
+{
+	memset(m_templates, 0, sizeof(m_templates));
+}
+
+int GestureRecognizer::AddTemplate(const char* name, GestureAction action, GestureHand hand,
+	const float (*pPoints)[3], int frames, float threshold)
+{
+	if (m_count >= GESTURE_MAX_TEMPLATES || frames < 2 || frames > GESTURE_MAX_FRAMES)
+	{
+		return -1;
+	}
+	Template& gesture = m_templates[m_count];
+	memset(&gesture, 0, sizeof(gesture));
+	strncpy(gesture.name, name, GESTURE_NAME_LENGTH - 1);
+	gesture.action = action;
+	gesture.hand = hand;
+	gesture.frames = frames;
+	gesture.band = frames / 4 > 1 ? frames / 4 : 1;
+	gesture.threshold = threshold;
+	for (int i = 0; i < frames; ++i)
+	{
+		memcpy(gesture.points[i], pPoints[i], sizeof(float) * 3);
+	}
+
+	// Everything a frame can be warped onto within the band
+	for (int i = 0; i < frames; ++i)
+	{
+		int first = i - gesture.band > 0 ? i - gesture.band : 0;
+		int last = i + gesture.band < frames - 1 ? i + gesture.band : frames - 1;
+		for (int k = 0; k < 3; ++k)
+		{
+			float upper = gesture.points[first][k];
+			float lower = upper;
+			for (int j = first + 1; j <= last; ++j)
+			{
+				upper = gesture.points[j][k] > upper ? gesture.points[j][k] : upper;
+				lower = gesture.points[j][k] < lower ? gesture.points[j][k] : lower;
+			}
+			gesture.upper[i][k] = upper;
+			gesture.lower[i][k] = lower;
+		}
+	}
+	return m_count++;
+}
+
+static float SmoothStep(float t)
+{
+	t = t < 0 ? 0 : (t > 1 ? 1 : t);
+	return t * t * (3 - 2 * t);
+}
+
+// The hand comes up from hanging, does the gesture in front of the body and
+// goes back down, as seen from the right shoulder. In shoulder widths.
+static void DefaultGesturePoint(bool circle, float t, float* pPoint)
+{
+	const float ramp = 0.3f;
+	float lift = SmoothStep(t / ramp) * SmoothStep((1 - t) / ramp);
+	float targetX, targetY, targetZ;
+	if (circle)
+	{
+		float angle = 2 * 3.14159265f * SmoothStep((t - ramp) / (1 - 2 * ramp));
+		targetX = (float)sin(angle) * g_defaultCircleRadius;
+		targetY = (float)cos(angle) * g_defaultCircleRadius;
+		targetZ = -1.1f;
+	}
+	else
+	{
+		targetX = 1.0f - 2.2f * SmoothStep(t);
+		targetY = 0.15f;
+		targetZ = -0.7f;
+	}
+	const float rest[3] = {0.05f, -1.4f, -0.15f};
+	pPoint[0] = rest[0] + (targetX - rest[0]) * lift;
+	pPoint[1] = rest[1] + (targetY - rest[1]) * lift;
+	pPoint[2] = rest[2] + (targetZ - rest[2]) * lift;
+}
+
+void GestureRecognizer::AddDefaultTemplates()
+{
+	float swipe[g_defaultGestureFrames][3], mirrored[g_defaultGestureFrames][3], circle[g_defaultGestureFrames][3];
+	for (int i = 0; i < g_defaultGestureFrames; ++i)
+	{
+		float t = (float)i / (g_defaultGestureFrames - 1);
+		DefaultGesturePoint(false, t, swipe[i]);
+		DefaultGesturePoint(true, t, circle[i]);
+		mirrored[i][0] = -swipe[i][0];
+		mirrored[i][1] = swipe[i][1];
+		mirrored[i][2] = swipe[i][2];
+	}
+	AddTemplate("swipe_right", GESTURE_NEXT_MODE, GESTURE_RIGHT_HAND, swipe, g_defaultGestureFrames, g_defaultThreshold);
+	AddTemplate("swipe_left", GESTURE_NEXT_MODE, GESTURE_LEFT_HAND, mirrored, g_defaultGestureFrames, g_defaultThreshold);
+	AddTemplate("circle_right", GESTURE_OPEN_GRIPPER, GESTURE_RIGHT_HAND, circle, g_defaultGestureFrames, g_defaultThreshold);
+}
+
+static int FindName(const char* const* names, int count, const char* name)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		if (strcmp(names[i], name) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool GestureRecognizer::LoadTemplates(const char* path)
+{
+	FILE* pFile = fopen(path, "r");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+	bool ok = true;
+	char line[256];
+	while (ok && fgets(line, sizeof(line), pFile) != NULL)
+	{
+		char name[GESTURE_NAME_LENGTH], action[32], hand[32];
+		float threshold;
+		int frames;
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+		{
+			continue;
+		}
+		if (sscanf(line, "gesture %31s %31s %31s %f %d", name, action, hand, &threshold, &frames) != 5)
+		{
+			ok = false;
+			break;
+		}
+		int actionIndex = FindName(g_gestureActionNames, 3, action);
+		int handIndex = FindName(g_gestureHandNames, 2, hand);
+		float points[GESTURE_MAX_FRAMES][3];
+		ok = actionIndex >= 0 && handIndex >= 0 && frames >= 2 && frames <= GESTURE_MAX_FRAMES;
+		for (int i = 0; ok && i < frames; ++i)
+		{
+			ok = fgets(line, sizeof(line), pFile) != NULL
+				&& sscanf(line, "%f %f %f", &points[i][0], &points[i][1], &points[i][2]) == 3;
+		}
+		ok = ok && AddTemplate(name, (GestureAction)actionIndex, (GestureHand)handIndex, points, frames, threshold) >= 0;
+	}
+	fclose(pFile);
+	return ok;
+}
+
+bool GestureRecognizer::SaveTemplate(const char* path, const char* name, GestureAction action, GestureHand hand,
+	float threshold, const JointHistory& history, int frames) const
+{
+	float window[GESTURE_MAX_FRAMES][4];
+	if (frames < 2 || frames > GESTURE_MAX_FRAMES || ReadWindow(history, hand, frames, m_frameStep, 0, window) < frames)
+	{
+		return false;
+	}
+	FILE* pFile = fopen(path, "a");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+	fprintf(pFile, "gesture %s %s %s %g %d\n", name, g_gestureActionNames[action], g_gestureHandNames[hand], threshold, frames);
+	for (int i = GESTURE_MAX_FRAMES - frames; i < GESTURE_MAX_FRAMES; ++i)
+	{
+		fprintf(pFile, "%.4f %.4f %.4f\n", window[i][0], window[i][1], window[i][2]);
+	}
+	fclose(pFile);
+	return true;
+}
+
+// Fills the end of pWindow, oldest frame first, with up to frames positions
+// of the hand relative to its shoulder, one every step history frames.
+// Returns how many frames, counted back from the latest, are newer than
+// since and sure of hand and shoulder.
+int GestureRecognizer::ReadWindow(const JointHistory& history, GestureHand hand, int frames, int step,
+	uint64_t since, float (*pWindow)[4])
+{
+	int handJoint = hand == GESTURE_RIGHT_HAND ? SKELETON_RIGHT_HAND : SKELETON_LEFT_HAND;
+	int shoulderJoint = hand == GESTURE_RIGHT_HAND ? SKELETON_RIGHT_SHOULDER : SKELETON_LEFT_SHOULDER;
+	if ((history.GetCount() + step - 1) / step < frames)
+	{
+		frames = (history.GetCount() + step - 1) / step;
+	}
+	if (frames == 0)
+	{
+		return 0;
+	}
+
+	const float* pX = history.GetX(0);
+	const float* pY = history.GetY(0);
+	const float* pZ = history.GetZ(0);
+	float dx = pX[SKELETON_RIGHT_SHOULDER] - pX[SKELETON_LEFT_SHOULDER];
+	float dy = pY[SKELETON_RIGHT_SHOULDER] - pY[SKELETON_LEFT_SHOULDER];
+	float dz = pZ[SKELETON_RIGHT_SHOULDER] - pZ[SKELETON_LEFT_SHOULDER];
+	float width = sqrtf(dx * dx + dy * dy + dz * dz);
+	if (width < g_minShoulderWidth)
+	{
+		return 0;
+	}
+	float scale = 1 / width;
+
+	int frame = 0;
+	for (; frame < frames; ++frame)
+	{
+		int age = frame * step;
+		const float* pConfidence = history.GetConfidence(age);
+		if (history.GetTimestamp(age) <= since || pConfidence[handJoint] <= .5f || pConfidence[shoulderJoint] <= .5f)
+		{
+			break;
+		}
+		float* pPoint = pWindow[GESTURE_MAX_FRAMES - 1 - frame];
+		pX = history.GetX(age);
+		pY = history.GetY(age);
+		pZ = history.GetZ(age);
+		pPoint[0] = (pX[handJoint] - pX[shoulderJoint]) * scale;
+		pPoint[1] = (pY[handJoint] - pY[shoulderJoint]) * scale;
+		pPoint[2] = (pZ[handJoint] - pZ[shoulderJoint]) * scale;
+		pPoint[3] = 0;
+	}
+	return frame;
+}
+
+// LB_Keogh: every window frame costs at least its distance to the envelope
+// of the template frames it can be warped onto
+float GestureRecognizer::LowerBound(const Template& gesture, const float (*pWindow)[4], float limit)
+{
+	float bound = 0;
+	for (int i = 0; i < gesture.frames; ++i)
+	{
+		bound += SquaredDistanceToBox(pWindow[i], gesture.upper[i], gesture.lower[i]);
+		if (bound > limit)
+		{
+			break;
+		}
+	}
+	return bound;
+}
+
+// Warping cost within the band, or infinity as soon as a whole row of the
+// cost matrix is above limit, as every path has to cross every row
+float GestureRecognizer::Warp(const Template& gesture, const float (*pWindow)[4], float limit)
+{
+	float rows[2][GESTURE_MAX_FRAMES + 1];
+	int frames = gesture.frames;
+	float* pPrevious = rows[0];
+	float* pCurrent = rows[1];
+	for (int j = 0; j <= frames; ++j)
+	{
+		pPrevious[j] = g_gestureInfinity;
+		pCurrent[j] = g_gestureInfinity;
+	}
+	pPrevious[0] = 0;
+
+	// Column j + 1 holds template frame j, column 0 the start
+	for (int i = 0; i < frames; ++i)
+	{
+		int first = i - gesture.band > 0 ? i - gesture.band : 0;
+		int last = i + gesture.band < frames - 1 ? i + gesture.band : frames - 1;
+		// Left of the band, the rest of the row is written before it is read
+		pCurrent[first] = g_gestureInfinity;
+		float rowMin = g_gestureInfinity;
+		for (int j = first; j <= last; ++j)
+		{
+			float best = pPrevious[j];
+			best = pPrevious[j + 1] < best ? pPrevious[j + 1] : best;
+			best = pCurrent[j] < best ? pCurrent[j] : best;
+			float cost = best + SquaredDistance(pWindow[i], gesture.points[j]);
+			pCurrent[j + 1] = cost;
+			rowMin = cost < rowMin ? cost : rowMin;
+		}
+		if (rowMin > limit)
+		{
+			return g_gestureInfinity;
+		}
+		float* pSwap = pPrevious;
+		pPrevious = pCurrent;
+		pCurrent = pSwap;
+	}
+	return pPrevious[frames];
+}
+
+bool GestureRecognizer::Recognize(const JointHistory& history, uint64_t since, GestureMatch* pMatch,
+	GestureCounters* pCounters) const
+{
+	JOINT_HISTORY_ALIGN float windows[2][GESTURE_MAX_FRAMES][4];
+	int available[2] = {-1, -1};
+	GestureCounters counters = {0, 0, 0, 0};
+	float best = g_gestureInfinity;
+	int found = -1;
+
+	for (int t = 0; t < m_count; ++t)
+	{
+		const Template& gesture = m_templates[t];
+		if (available[gesture.hand] < 0)
+		{
+			available[gesture.hand] = ReadWindow(history, gesture.hand, GESTURE_MAX_FRAMES, m_frameStep, since,
+				windows[gesture.hand]);
+		}
+		if (available[gesture.hand] < gesture.frames)
+		{
+			continue;
+		}
+		counters.templates++;
+
+		// Only a path cheaper than both the threshold and the best match helps
+		const float (*pWindow)[4] = windows[gesture.hand] + GESTURE_MAX_FRAMES - gesture.frames;
+		float limit = gesture.threshold;
+		if (m_pruning && best < limit)
+		{
+			limit = best;
+		}
+		limit *= gesture.frames;
+		if (m_pruning && LowerBound(gesture, pWindow, limit) > limit)
+		{
+			counters.bounded++;
+			continue;
+		}
+		float cost = Warp(gesture, pWindow, m_pruning ? limit : g_gestureInfinity);
+		if (cost >= g_gestureInfinity)
+		{
+			counters.abandoned++;
+			continue;
+		}
+		counters.completed++;
+		float distance = cost / gesture.frames;
+		if (distance <= gesture.threshold && distance < best)
+		{
+			best = distance;
+			found = t;
+		}
+	}
+
+	if (pCounters != NULL)
+	{
+		*pCounters = counters;
+	}
+	if (found < 0)
+	{
+		return false;
+	}
+	pMatch->gesture = found;
+	pMatch->action = m_templates[found].action;
+	pMatch->distance = best;
+	return true;
+}
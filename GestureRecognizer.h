@@ -0,0 +1,131 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Hand gestures matched against recorded templates        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_GESTURE_RECOGNIZER_H_
+#define _MINDSTORM_GESTURE_RECOGNIZER_H_
+
+#include "JointHistory.h"
+
+// Longest template, in frames. The window matched against it comes from
+// the joint history, so it has to fit there.
+#define GESTURE_MAX_FRAMES		48
+#define GESTURE_MAX_TEMPLATES	64
+#define GESTURE_NAME_LENGTH		32
+// Templates are recorded and matched at this rate, in frames per second
+#define GESTURE_FRAME_RATE		30
+
+enum GestureHand
+{
+	GESTURE_RIGHT_HAND,
+	GESTURE_LEFT_HAND
+};
+
+// What the viewer does when a gesture is seen
+enum GestureAction
+{
+	GESTURE_NONE,			// Recognized but ignored, e.g. a template to tell apart
+	GESTURE_NEXT_MODE,		// Next steering method
+	GESTURE_OPEN_GRIPPER	// Gripper on OUT_A opened
+};
+
+struct GestureMatch
+{
+	int gesture;			// Template index
+	GestureAction action;
+	float distance;			// Mean squared distance per frame, in shoulder widths
+};
+
+// Work done by the last Recognize() call
+struct GestureCounters
+{
+	int templates;		// Templates of a hand with a complete window
+	int bounded;		// Skipped on the LB_Keogh lower bound alone
+	int abandoned;		// Warping stopped once no path could stay under the limit
+	int completed;		// Warped to the end
+};
+
+// Dynamic time warping of the last frames of a hand against recorded
+// templates. A frame is the hand's position relative to its shoulder, in
+// shoulder widths, so templates work for users of any size and distance.
+//
+// Every template is tried on a window of the same length ending in the
+// latest frame, warped within a band of a quarter of its length, which
+// takes gestures about a third faster or slower than recorded. Templates
+// that cannot beat the best match so far are ruled out first by their
+// LB_Keogh bound and then by abandoning the warping early; distances are
+// taken four coordinates at a time with SSE.
+class JOINT_HISTORY_ALIGN GestureRecognizer
+{
+	public:
+		GestureRecognizer();
+
+		// Points are positions in shoulder widths, as SaveTemplate writes
+		// them. Threshold is the largest mean squared distance per frame
+		// still taken for the gesture. Returns the index or -1 when full.
+		int AddTemplate(const char* name, GestureAction action, GestureHand hand,
+			const float (*pPoints)[3], int frames, float threshold);
+		// Swipes with either hand for the next mode, a circle with the right
+		// hand for the gripper, made up to work without recording anything
+		void AddDefaultTemplates();
+		// Text files, one "gesture <name> <action> <hand> <threshold> <frames>"
+		// line and then one "x y z" line per frame for every template
+		bool LoadTemplates(const char* path);
+		// Appends the last frames of the history as a template
+		bool SaveTemplate(const char* path, const char* name, GestureAction action, GestureHand hand,
+			float threshold, const JointHistory& history, int frames) const;
+
+		int GetTemplateCount() const { return m_count; }
+		const char* GetName(int gesture) const { return m_templates[gesture].name; }
+		int GetFrames(int gesture) const { return m_templates[gesture].frames; }	// Template frames, not history frames
+		// Pruning off warps every template in full, to compare with
+		void SetPruning(bool enabled) { m_pruning = enabled; }
+		// History frames per template frame, 2 for a 60 fps depth mode, so
+		// templates take the same time at any rate
+		void SetFrameStep(int step) { m_frameStep = step < 1 ? 1 : step; }
+		int GetFrameStep() const { return m_frameStep; }
+
+		// Best template matching a window that ends in the latest frame and
+		// starts after since, so one motion is not taken twice. Windows with
+		// a hand or shoulder the tracker was unsure of are not matched.
+		bool Recognize(const JointHistory& history, uint64_t since, GestureMatch* pMatch,
+			GestureCounters* pCounters = NULL) const;
+
+#ifdef JOINT_HISTORY_SSE
+		static void* operator new(size_t size) { return _mm_malloc(size, 64); }
+		static void operator delete(void* p) { _mm_free(p); }
+#endif
+
+	private:
+		GestureRecognizer(const GestureRecognizer&);
+		GestureRecognizer& operator=(const GestureRecognizer&);
+
+		// Points padded to four floats for SSE, with the band's envelope
+		struct JOINT_HISTORY_ALIGN Template
+		{
+			float points[GESTURE_MAX_FRAMES][4];
+			float upper[GESTURE_MAX_FRAMES][4];
+			float lower[GESTURE_MAX_FRAMES][4];
+			char name[GESTURE_NAME_LENGTH];
+			GestureAction action;
+			GestureHand hand;
+			int frames;
+			int band;
+			float threshold;
+		};
+
+		static int ReadWindow(const JointHistory& history, GestureHand hand, int frames, int step,
+			uint64_t since, float (*pWindow)[4]);
+		static float LowerBound(const Template& gesture, const float (*pWindow)[4], float limit);
+		static float Warp(const Template& gesture, const float (*pWindow)[4], float limit);
+
+		Template				m_templates[GESTURE_MAX_TEMPLATES];
+		int						m_count;
+		int						m_frameStep;
+		bool					m_pruning;
+};
+
+#endif // _MINDSTORM_GESTURE_RECOGNIZER_H_
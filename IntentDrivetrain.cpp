@@ -0,0 +1,62 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Drivetrain executed by the program on the brick         *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "IntentDrivetrain.h"
+
+IntentDrivetrain::IntentDrivetrain(RobotLink* pLink, int rampMs) :
+	Drivetrain(pLink, -1, -1, -1), m_rampMs(rampMs), m_sequence(0)
+{
+	m_lastDrive = MakeStopIntent(true);
+	m_lastGripper = MakeGripperIntent(0);
+
+	// Sent by the link in place of intents decided from stale frames
+	unsigned char buffer[INTENT_MESSAGE_SIZE];
+	EncodeIntent(m_lastDrive, buffer);
+	m_pLink->SetStopMessage(INTENT_DRIVE_MAILBOX, buffer, INTENT_MESSAGE_SIZE);
+	EncodeIntent(m_lastGripper, buffer);
+	m_pLink->SetStopMessage(INTENT_GRIPPER_MAILBOX, buffer, INTENT_MESSAGE_SIZE);
+}
+
+void IntentDrivetrain::Drive(int speed, int turnRatio)
+{
+	m_speed = speed;
+	m_turnRatio = turnRatio < -100 ? -100 : (turnRatio > 100 ? 100 : turnRatio);
+	IntentMessage message = (speed == 0) ? MakeStopIntent(true) : MakeDriveIntent(speed, turnRatio, m_rampMs);
+	if (message.type == m_lastDrive.type && message.speed == m_lastDrive.speed && message.turnRatio == m_lastDrive.turnRatio)
+	{
+		return;
+	}
+	m_lastDrive = message;
+	Post(INTENT_DRIVE_MAILBOX, message);
+}
+
+void IntentDrivetrain::Gripper(int power)
+{
+	m_gripperPower = power;
+	if (power == m_lastGripper.gripperPower)
+	{
+		return;
+	}
+	m_lastGripper = MakeGripperIntent(power);
+	Post(INTENT_GRIPPER_MAILBOX, m_lastGripper);
+}
+
+void IntentDrivetrain::EmergencyStop()
+{
+	Drive(0, 0);
+	Gripper(0);
+}
+
+// Stopping intents travel in the link's stop lane
+void IntentDrivetrain::Post(int mailbox, IntentMessage message)
+{
+	unsigned char buffer[INTENT_MESSAGE_SIZE];
+	message.sequence = ++m_sequence;
+	EncodeIntent(message, buffer);
+	bool urgent = message.type == INTENT_STOP || (message.type == INTENT_GRIPPER && message.gripperPower == 0);
+	m_pLink->WriteMailbox(mailbox, buffer, INTENT_MESSAGE_SIZE, urgent);
+}
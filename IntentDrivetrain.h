@@ -0,0 +1,39 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Drivetrain executed by the program on the brick         *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_INTENT_DRIVETRAIN_H_
+#define _MINDSTORM_INTENT_DRIVETRAIN_H_
+
+#include "Drivetrain.h"
+#include "IntentMessage.h"
+
+// Program on the brick that executes intents, built from Brick/intent.nxc
+#define INTENT_PROGRAM_NAME "intent"
+
+// Instead of driving motors directly, every change becomes one intent
+// message in a mailbox of Brick/intent.nxc, which owns the motors and
+// ramps to the new speed by itself. The ports are chosen by that program.
+class IntentDrivetrain : public Drivetrain
+{
+	public:
+		IntentDrivetrain(RobotLink* pLink, int rampMs);
+
+		virtual void Drive(int speed, int turnRatio);
+		virtual void Gripper(int power);
+		virtual void EmergencyStop();
+
+	private:
+		void Post(int mailbox, IntentMessage message);
+
+		int						m_rampMs;
+		int						m_sequence;
+		// Last intent per mailbox, repeated frames post nothing
+		IntentMessage			m_lastDrive;
+		IntentMessage			m_lastGripper;
+};
+
+#endif // _MINDSTORM_INTENT_DRIVETRAIN_H_
@@ -0,0 +1,105 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Intent messages for the program on the brick            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "IntentMessage.h"
+
+static int Clamp(int value, int low, int high)
+{
+	return value < low ? low : (value > high ? high : value);
+}
+
+static unsigned char Checksum(const unsigned char* pBuffer)
+{
+	int sum = 0;
+	for (int i = 0; i < INTENT_MESSAGE_SIZE - 1; ++i)
+	{
+		sum += pBuffer[i];
+	}
+	return (unsigned char)(sum % 255 + 1);
+}
+
+IntentMessage MakeDriveIntent(int speed, int turnRatio, int rampMs)
+{
+	IntentMessage message = {INTENT_DRIVE, 1, speed, turnRatio, rampMs, 0, false};
+	return message;
+}
+
+IntentMessage MakeGripperIntent(int power)
+{
+	IntentMessage message = {INTENT_GRIPPER, 1, 0, 0, 0, power, false};
+	return message;
+}
+
+IntentMessage MakeStopIntent(bool brake)
+{
+	IntentMessage message = {INTENT_STOP, 1, 0, 0, 0, 0, brake};
+	return message;
+}
+
+int EncodeIntent(const IntentMessage& message, unsigned char* pBuffer)
+{
+	pBuffer[0] = (unsigned char)message.type;
+	pBuffer[1] = (unsigned char)((unsigned int)(message.sequence - 1) % 255 + 1);
+	pBuffer[3] = 128;
+	pBuffer[4] = 1;
+	switch (message.type)
+	{
+		case INTENT_DRIVE:
+			pBuffer[2] = (unsigned char)(Clamp(message.speed, -100, 100) + 128);
+			pBuffer[3] = (unsigned char)(Clamp(message.turnRatio, -100, 100) + 128);
+			pBuffer[4] = (unsigned char)(Clamp(message.rampMs, 0, INTENT_MAX_RAMP_MS) / 10 + 1);
+			break;
+		case INTENT_GRIPPER:
+			pBuffer[2] = (unsigned char)(Clamp(message.gripperPower, -100, 100) + 128);
+			break;
+		case INTENT_STOP:
+			pBuffer[2] = message.brake ? 2 : 1;
+			break;
+	}
+	pBuffer[5] = Checksum(pBuffer);
+	return INTENT_MESSAGE_SIZE;
+}
+
+bool DecodeIntent(const unsigned char* pBuffer, int length, IntentMessage* pMessage)
+{
+	if (length != INTENT_MESSAGE_SIZE || pBuffer[5] != Checksum(pBuffer))
+	{
+		return false;
+	}
+	for (int i = 0; i < INTENT_MESSAGE_SIZE; ++i)
+	{
+		if (pBuffer[i] == 0)
+		{
+			return false;
+		}
+	}
+
+	pMessage->sequence = pBuffer[1];
+	pMessage->speed = 0;
+	pMessage->turnRatio = 0;
+	pMessage->rampMs = 0;
+	pMessage->gripperPower = 0;
+	pMessage->brake = false;
+	switch (pBuffer[0])
+	{
+		case INTENT_DRIVE:
+			pMessage->type = INTENT_DRIVE;
+			pMessage->speed = Clamp(pBuffer[2] - 128, -100, 100);
+			pMessage->turnRatio = Clamp(pBuffer[3] - 128, -100, 100);
+			pMessage->rampMs = (pBuffer[4] - 1) * 10;
+			return true;
+		case INTENT_GRIPPER:
+			pMessage->type = INTENT_GRIPPER;
+			pMessage->gripperPower = Clamp(pBuffer[2] - 128, -100, 100);
+			return true;
+		case INTENT_STOP:
+			pMessage->type = INTENT_STOP;
+			pMessage->brake = (pBuffer[2] == 2);
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Intent messages for the program on the brick            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_INTENT_MESSAGE_H_
+#define _MINDSTORM_INTENT_MESSAGE_H_
+
+// Wire format, read by Brick/intent.nxc as a mailbox string, so no byte
+// may be zero:
+//   0  type
+//   1  sequence number 1..255
+//   2  drive: speed + 128       gripper: power + 128     stop: 1 coast, 2 brake
+//   3  drive: turn ratio + 128  otherwise 128
+//   4  drive: ramp / 10 + 1     otherwise 1
+//   5  checksum, sum of bytes 0..4 modulo 255, plus 1
+#define INTENT_MESSAGE_SIZE		6
+
+// Drive and stop share a mailbox so a stop replaces a pending drive
+#define INTENT_DRIVE_MAILBOX	0
+#define INTENT_GRIPPER_MAILBOX	1
+
+#define INTENT_MAX_RAMP_MS		2540
+
+enum IntentType
+{
+	INTENT_DRIVE = 1,
+	INTENT_GRIPPER = 2,
+	INTENT_STOP = 3
+};
+
+struct IntentMessage
+{
+	IntentType type;
+	int sequence;
+	int speed;			// Drive, -100..100
+	int turnRatio;		// Drive, -100..100 as in NXT synchronized regulation
+	int rampMs;			// Drive, time for the brick to reach the new speed
+	int gripperPower;	// Gripper, -100..100, 0 stops the tool motor
+	bool brake;			// Stop
+};
+
+IntentMessage MakeDriveIntent(int speed, int turnRatio, int rampMs);
+IntentMessage MakeGripperIntent(int power);
+IntentMessage MakeStopIntent(bool brake);
+
+// Writes INTENT_MESSAGE_SIZE bytes, values out of range are clamped
+int EncodeIntent(const IntentMessage& message, unsigned char* pBuffer);
+// False unless exactly INTENT_MESSAGE_SIZE bytes, none of them zero, with
+// the checksum right
+bool DecodeIntent(const unsigned char* pBuffer, int length, IntentMessage* pMessage);
+
+#endif // _MINDSTORM_INTENT_MESSAGE_H_
@@ -0,0 +1,161 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Recent joint positions of one tracked user              *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "JointHistory.h"
+#include <string.h>
+
+JointHistory::JointHistory()
+{
+	memset(m_x, 0, sizeof(m_x));
+	memset(m_y, 0, sizeof(m_y));
+	memset(m_z, 0, sizeof(m_z));
+	memset(m_confidence, 0, sizeof(m_confidence));
+	memset(m_timestamps, 0, sizeof(m_timestamps));
+	Clear();
+}
+
+void JointHistory::Clear()
+{
+	m_head = JOINT_HISTORY_FRAMES - 1;
+	m_count = 0;
+}
+
+// The padding lanes stay zero from the constructor
+void JointHistory::Push(const SkeletonFrame& frame)
+{
+	m_head = (m_head + 1) & (JOINT_HISTORY_FRAMES - 1);
+	float* pX = m_x[m_head];
+	float* pY = m_y[m_head];
+	float* pZ = m_z[m_head];
+	float* pConfidence = m_confidence[m_head];
+	for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+	{
+		pX[i] = frame.joints[i].x;
+		pY[i] = frame.joints[i].y;
+		pZ[i] = frame.joints[i].z;
+		pConfidence[i] = frame.joints[i].confidence;
+	}
+	m_timestamps[m_head] = frame.timestamp;
+	if (m_count < JOINT_HISTORY_FRAMES)
+	{
+		m_count++;
+	}
+}
+
+// pOut = (pNew - pOld) * scale for a whole row
+void JointHistory::Difference(const float* pNew, const float* pOld, float scale, float* pOut)
+{
+#ifdef JOINT_HISTORY_SSE
+	__m128 factor = _mm_set1_ps(scale);
+	for (int i = 0; i < JOINT_HISTORY_LANES; i += 4)
+	{
+		__m128 delta = _mm_sub_ps(_mm_load_ps(pNew + i), _mm_load_ps(pOld + i));
+		_mm_store_ps(pOut + i, _mm_mul_ps(delta, factor));
+	}
+#else
+	for (int i = 0; i < JOINT_HISTORY_LANES; ++i)
+	{
+		pOut[i] = (pNew[i] - pOld[i]) * scale;
+	}
+#endif
+}
+
+bool JointHistory::GetVelocity(int span, JointVectors* pVelocity) const
+{
+	if (span < 1 || span >= m_count)
+	{
+		return false;
+	}
+	int now = Row(0);
+	int then = Row(span);
+	uint64_t elapsed = m_timestamps[now] - m_timestamps[then];
+	if (m_timestamps[now] <= m_timestamps[then])
+	{
+		return false;
+	}
+	float scale = (float)(1e6 / elapsed);
+	Difference(m_x[now], m_x[then], scale, pVelocity->x);
+	Difference(m_y[now], m_y[then], scale, pVelocity->y);
+	Difference(m_z[now], m_z[then], scale, pVelocity->z);
+	return true;
+}
+
+bool JointHistory::GetAcceleration(int span, JointVectors* pAcceleration) const
+{
+	if (span < 1 || 2 * span >= m_count)
+	{
+		return false;
+	}
+	int now = Row(0);
+	int middle = Row(span);
+	int then = Row(2 * span);
+	if (m_timestamps[now] <= m_timestamps[middle] || m_timestamps[middle] <= m_timestamps[then])
+	{
+		return false;
+	}
+	// Velocities of the two halves, taken at their middles
+	double late = (double)(m_timestamps[now] - m_timestamps[middle]) / 1e6;
+	double early = (double)(m_timestamps[middle] - m_timestamps[then]) / 1e6;
+	float lateScale = (float)(1 / late);
+	float earlyScale = (float)(1 / early);
+	float scale = (float)(2 / (late + early));
+
+	JOINT_HISTORY_ALIGN float lateVelocity[JOINT_HISTORY_LANES];
+	JOINT_HISTORY_ALIGN float earlyVelocity[JOINT_HISTORY_LANES];
+	const float (*rows[3])[JOINT_HISTORY_LANES] = {m_x, m_y, m_z};
+	float* outputs[3] = {pAcceleration->x, pAcceleration->y, pAcceleration->z};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		Difference(rows[axis][now], rows[axis][middle], lateScale, lateVelocity);
+		Difference(rows[axis][middle], rows[axis][then], earlyScale, earlyVelocity);
+		Difference(lateVelocity, earlyVelocity, scale, outputs[axis]);
+	}
+	return true;
+}
+
+bool JointHistory::GetRange(int frames, JointVectors* pMin, JointVectors* pMax) const
+{
+	if (frames < 1 || frames > m_count)
+	{
+		return false;
+	}
+	const float (*rows[3])[JOINT_HISTORY_LANES] = {m_x, m_y, m_z};
+	float* lows[3] = {pMin->x, pMin->y, pMin->z};
+	float* highs[3] = {pMax->x, pMax->y, pMax->z};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float (*pRows)[JOINT_HISTORY_LANES] = rows[axis];
+#ifdef JOINT_HISTORY_SSE
+		for (int i = 0; i < JOINT_HISTORY_LANES; i += 4)
+		{
+			__m128 low = _mm_load_ps(pRows[Row(0)] + i);
+			__m128 high = low;
+			for (int age = 1; age < frames; ++age)
+			{
+				__m128 value = _mm_load_ps(pRows[Row(age)] + i);
+				low = _mm_min_ps(low, value);
+				high = _mm_max_ps(high, value);
+			}
+			_mm_store_ps(lows[axis] + i, low);
+			_mm_store_ps(highs[axis] + i, high);
+		}
+#else
+		memcpy(lows[axis], pRows[Row(0)], sizeof(float) * JOINT_HISTORY_LANES);
+		memcpy(highs[axis], pRows[Row(0)], sizeof(float) * JOINT_HISTORY_LANES);
+		for (int age = 1; age < frames; ++age)
+		{
+			const float* pValues = pRows[Row(age)];
+			for (int i = 0; i < JOINT_HISTORY_LANES; ++i)
+			{
+				lows[axis][i] = pValues[i] < lows[axis][i] ? pValues[i] : lows[axis][i];
+				highs[axis][i] = pValues[i] > highs[axis][i] ? pValues[i] : highs[axis][i];
+			}
+		}
+#endif
+	}
+	return true;
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Recent joint positions of one tracked user              *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_JOINT_HISTORY_H_
+#define _MINDSTORM_JOINT_HISTORY_H_
+
+#include "Skeleton.h"
+#include <stddef.h>
+
+// SSE is there on every x86 and x64 processor the tracker runs on
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+	#define JOINT_HISTORY_SSE
+	#include <xmmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+	#define JOINT_HISTORY_ALIGN __declspec(align(64))
+#else
+	#define JOINT_HISTORY_ALIGN __attribute__((aligned(64)))
+#endif
+
+// Frames kept, about 2 s at 60 frames per second. A power of two.
+#define JOINT_HISTORY_FRAMES	128
+// Joints of a row, SKELETON_JOINT_COUNT rounded up to whole SSE registers.
+// The 16 floats of a row fill one 64 byte cache line.
+#define JOINT_HISTORY_LANES		16
+
+// One value per joint, indexed by SkeletonJointId
+struct JOINT_HISTORY_ALIGN JointVectors
+{
+	float x[JOINT_HISTORY_LANES];
+	float y[JOINT_HISTORY_LANES];
+	float z[JOINT_HISTORY_LANES];
+};
+
+// Ring of the last JOINT_HISTORY_FRAMES frames of every joint, stored as
+// structure of arrays: for every frame one cache line of x, one of y, one of
+// z and one of confidence. A new frame is four line writes, and the helpers
+// below work on four joints per instruction straight from the ring, so
+// nothing is copied to look back.
+//
+// Positions are stored as the tracker gives them, joints it was not sure of
+// included; check the confidence rows before trusting a value. Keep
+// histories in static storage or create them with new, both are aligned.
+class JOINT_HISTORY_ALIGN JointHistory
+{
+	public:
+		JointHistory();
+
+		void Clear();		// New or lost user
+		void Push(const SkeletonFrame& frame);
+
+		int GetCount() const { return m_count; }
+		// Age 0 is the latest frame, up to GetCount() - 1
+		uint64_t GetTimestamp(int age) const { return m_timestamps[Row(age)]; }
+		const float* GetX(int age) const { return m_x[Row(age)]; }
+		const float* GetY(int age) const { return m_y[Row(age)]; }
+		const float* GetZ(int age) const { return m_z[Row(age)]; }
+		const float* GetConfidence(int age) const { return m_confidence[Row(age)]; }
+
+		// Every joint's velocity over the last span frames, in mm/s. False
+		// until more than span frames are stored.
+		bool GetVelocity(int span, JointVectors* pVelocity) const;
+		// From the two velocities over the last 2 * span frames, in mm/s^2
+		bool GetAcceleration(int span, JointVectors* pAcceleration) const;
+		// Smallest and largest position of every joint over the last frames
+		bool GetRange(int frames, JointVectors* pMin, JointVectors* pMax) const;
+
+#ifdef JOINT_HISTORY_SSE
+		static void* operator new(size_t size) { return _mm_malloc(size, 64); }
+		static void* operator new[](size_t size) { return _mm_malloc(size, 64); }
+		static void operator delete(void* p) { _mm_free(p); }
+		static void operator delete[](void* p) { _mm_free(p); }
+#endif
+
+	private:
+		int Row(int age) const { return (m_head - age) & (JOINT_HISTORY_FRAMES - 1); }
+		static void Difference(const float* pNew, const float* pOld, float scale, float* pOut);
+
+		float					m_x[JOINT_HISTORY_FRAMES][JOINT_HISTORY_LANES];
+		float					m_y[JOINT_HISTORY_FRAMES][JOINT_HISTORY_LANES];
+		float					m_z[JOINT_HISTORY_FRAMES][JOINT_HISTORY_LANES];
+		float					m_confidence[JOINT_HISTORY_FRAMES][JOINT_HISTORY_LANES];
+		uint64_t				m_timestamps[JOINT_HISTORY_FRAMES];
+		int						m_head;		// Row of the latest frame
+		int						m_count;
+};
+
+#endif // _MINDSTORM_JOINT_HISTORY_H_
@@ -0,0 +1,654 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Simulated brick for running without a robot            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "MockTransport.h"
+#include "NxtProtocol.h"
+#include "IntentMessage.h"
+#include <string.h>
+
+// Ports driven by Brick/intent.nxc
+#define INTENT_LEFT_PORT	1
+#define INTENT_RIGHT_PORT	2
+#define INTENT_TOOL_PORT	0
+
+// Battery level reported to GETBATTERYLEVEL. In millivolts.
+const int g_mockBatteryLevel = 8000;
+// Motor speed at full power, about an NXT motor under load. In degrees per second.
+const double g_mockFullSpeed = 900;
+
+MockLatency MakeBluetoothLatency()
+{
+	MockLatency latency = {1000, 87, 30000, 0};
+	return latency;
+}
+
+MockLatency MakeCongestedLatency()
+{
+	MockLatency latency = {2000, 1500, 30000, 4096};
+	return latency;
+}
+
+MockLatency MakeNoLatency()
+{
+	MockLatency latency = {0, 0, 0, 0};
+	return latency;
+}
+
+MockTransport::MockTransport(unsigned int connectDelayMs) :
+	m_connectDelayMs(connectDelayMs), m_latency(MakeNoLatency()), m_pAir(NULL), m_asyncReplies(true), m_linkUp(true), m_upMs(0), m_downMs(0), m_cycleOrigin(GetTimeMicros()),
+	m_open(false), m_programRunning(false), m_speedFactor(1), m_intentCount(0), m_commandCount(0), m_replyCount(0), m_connectCount(0),
+	m_radioHead(0), m_radioCount(0), m_radioBytes(0), m_radioFreeAt(0), m_sentSerial(0), m_deliveredSerial(0), m_radioRunning(0),
+	m_pendingHead(0), m_pendingCount(0)
+{
+	for (int i = 0; i < MOTOR_PORT_COUNT; ++i)
+	{
+		m_tacho[i] = 0;
+		m_tachoPower[i] = 0;
+		m_tachoTime[i] = m_cycleOrigin;
+		m_power[i] = 0;
+		m_rampFrom[i] = 0;
+		m_rampStart[i] = 0;
+		m_rampMs[i] = 0;
+		m_turnRatio[i] = 0;
+	}
+}
+
+MockTransport::~MockTransport()
+{
+	m_radioRunning.Set(0);
+	m_radioWake.Signal();
+	m_radioThread.Join();
+}
+
+bool MockTransport::Open()
+{
+	if (m_connectDelayMs > 0)
+	{
+		SleepMillis(m_connectDelayMs);
+	}
+	ScopedLock lock(m_lock);
+	if (!IsLinkUp())
+	{
+		return false;
+	}
+	m_open = true;
+	m_connectCount++;
+	return true;
+}
+
+// Whatever was still in the send buffer is lost with the link, and so are
+// replies on their way back
+void MockTransport::Close()
+{
+	ScopedLock lock(m_lock);
+	m_open = false;
+	m_deliveredSerial += m_radioCount;
+	m_radioCount = 0;
+	m_radioBytes = 0;
+	m_pendingCount = 0;
+}
+
+bool MockTransport::StartProgram(const char* /*name*/)
+{
+	ScopedLock lock(m_lock);
+	if (!Deliver())
+	{
+		return false;
+	}
+	m_programRunning = true;
+	return true;
+}
+
+bool MockTransport::StopProgram()
+{
+	ScopedLock lock(m_lock);
+	if (!Deliver())
+	{
+		return false;
+	}
+	m_programRunning = false;
+	return true;
+}
+
+bool MockTransport::SendDirectCommand(const unsigned char* pFrame, int length)
+{
+	int serial;
+	if (m_latency.bufferBytes > 0)
+	{
+		return Transmit(pFrame, length, true, &serial);
+	}
+	Wire(length);
+	ScopedLock lock(m_lock);
+	if (!Deliver())
+	{
+		return false;
+	}
+	Execute(pFrame, length);
+	Answer(pFrame, length, GetTimeMicros());
+	return true;
+}
+
+bool MockTransport::SendBatch(const unsigned char* pPackets, int length)
+{
+	const unsigned char* pFrame;
+	int offset = 0, frameLength, serial;
+	if (m_latency.bufferBytes > 0)
+	{
+		while (NextBatchFrame(pPackets, length, &offset, &pFrame, &frameLength))
+		{
+			if (!Transmit(pFrame, frameLength, true, &serial))
+			{
+				return false;
+			}
+		}
+		return offset == length;
+	}
+
+	Wire(length);
+	ScopedLock lock(m_lock);
+	uint64_t now = GetTimeMicros();
+	while (NextBatchFrame(pPackets, length, &offset, &pFrame, &frameLength))
+	{
+		if (!Deliver())
+		{
+			return false;
+		}
+		Execute(pFrame, frameLength);
+		Answer(pFrame, frameLength, now);
+	}
+	return offset == length;
+}
+
+// Buffered, the reply only comes once everything written before the frame
+// and the frame itself went over the air
+bool MockTransport::Transact(const unsigned char* pFrame, int length, unsigned char* pReply, int replyLength)
+{
+	if (replyLength < NXT_STATUS_REPLY_SIZE)
+	{
+		return false;
+	}
+	if (m_latency.bufferBytes > 0)
+	{
+		int serial;
+		if (!Transmit(pFrame, length, false, &serial) || !WaitDelivered(serial))
+		{
+			return false;
+		}
+		SleepMicros(m_latency.turnaroundUs + replyLength * m_latency.byteUs);
+		ScopedLock lock(m_lock);
+		if (!m_open || !IsLinkUp())
+		{
+			return false;
+		}
+		BuildReply(pFrame, pReply, replyLength);
+		return true;
+	}
+
+	// The brick runs the command on arrival, the turnaround only delays the reply
+	Wire(length);
+	unsigned int replyUs;
+	{
+		ScopedLock lock(m_lock);
+		if (!Deliver())
+		{
+			return false;
+		}
+		Execute(pFrame, length);
+		replyUs = m_latency.turnaroundUs + replyLength * m_latency.byteUs;
+	}
+	SleepMicros(replyUs);
+	ScopedLock lock(m_lock);
+	if (!m_open || !IsLinkUp())
+	{
+		return false;
+	}
+	BuildReply(pFrame, pReply, replyLength);
+	return true;
+}
+
+int MockTransport::GetQueuedBytes() const
+{
+	ScopedLock lock(m_lock);
+	return m_radioBytes;
+}
+
+// Replies come back in the order the requests were sent
+int MockTransport::ReceiveReply(unsigned char* pReply, int maxLength)
+{
+	ScopedLock lock(m_lock);
+	if (!m_open)
+	{
+		return -1;
+	}
+	if (!IsLinkUp())
+	{
+		m_open = false;
+		return -1;
+	}
+	if (m_pendingCount == 0 || GetTimeMicros() < m_pending[m_pendingHead].readyAt)
+	{
+		return 0;
+	}
+	const unsigned char* pRequest = m_pending[m_pendingHead].request;
+	int length = GetReplySize(pRequest[1]);
+	if (length > maxLength)
+	{
+		return -1;
+	}
+	BuildReply(pRequest, pReply, length);
+	m_pendingHead = (m_pendingHead + 1) % MOCK_PENDING_REPLIES;
+	m_pendingCount--;
+	return length;
+}
+
+// Called with m_lock held
+void MockTransport::BuildReply(const unsigned char* pFrame, unsigned char* pReply, int replyLength)
+{
+	m_replyCount++;
+	for (int i = 0; i < replyLength; ++i)
+	{
+		pReply[i] = 0;
+	}
+	pReply[0] = NXT_REPLY;
+	pReply[1] = pFrame[1];
+	pReply[2] = NXT_STATUS_SUCCESS;
+	if (pFrame[1] == NXT_OP_GETBATTERYLEVEL && replyLength >= NXT_BATTERY_REPLY_SIZE)
+	{
+		pReply[3] = (unsigned char)(g_mockBatteryLevel & 0xFF);
+		pReply[4] = (unsigned char)(g_mockBatteryLevel >> 8);
+	}
+	else if (pFrame[1] == NXT_OP_GETOUTPUTSTATE && replyLength >= NXT_OUTPUTSTATE_REPLY_SIZE && pFrame[2] < MOTOR_PORT_COUNT)
+	{
+		int port = pFrame[2];
+		UpdateTacho(port);
+		NxtOutputStatus status;
+		status.state.port = port;
+		status.state.power = CurrentPower(port);
+		status.state.mode = status.state.power != 0 ? NXT_MODE_MOTORON | NXT_MODE_REGULATED : 0;
+		status.state.regulation = m_turnRatio[port] != 0 ? NXT_REGULATION_MOTOR_SYNC : NXT_REGULATION_MOTOR_SPEED;
+		status.state.turnRatio = m_turnRatio[port];
+		status.state.runState = status.state.power != 0 ? NXT_RUNSTATE_RUNNING : NXT_RUNSTATE_IDLE;
+		status.state.tachoLimit = 0;
+		status.tachoCount = status.blockTachoCount = status.rotationCount = (long)m_tacho[port];
+		EncodeOutputStateReply(pReply, status);
+	}
+}
+
+void MockTransport::SetLatency(const MockLatency& latency)
+{
+	{
+		ScopedLock lock(m_lock);
+		m_latency = latency;
+	}
+	if (latency.bufferBytes > 0 && !m_radioThread.IsStarted())
+	{
+		m_radioRunning.Set(1);
+		m_radioThread.Start(RadioThread, this);
+	}
+}
+
+// Queues the frame behind everything already buffered. Like a blocking
+// serial port, waits while the buffer is full.
+bool MockTransport::Transmit(const unsigned char* pFrame, int length, bool answer, int* pSerial)
+{
+	for (;;)
+	{
+		{
+			ScopedLock lock(m_lock);
+			if (!m_open)
+			{
+				return false;
+			}
+			if (m_radioBytes + length <= (int)m_latency.bufferBytes && m_radioCount < MOCK_RADIO_FRAMES)
+			{
+				Airborne& airborne = m_radio[(m_radioHead + m_radioCount) % MOCK_RADIO_FRAMES];
+				memcpy(airborne.frame, pFrame, length);
+				airborne.length = length;
+				airborne.answer = answer;
+				uint64_t now = GetTimeMicros();
+				airborne.deliverAt = (m_radioFreeAt > now ? m_radioFreeAt : now) +
+					m_latency.frameUs + (NXT_BT_LENGTH_SIZE + length) * m_latency.byteUs;
+				m_radioFreeAt = airborne.deliverAt;
+				m_radioCount++;
+				m_radioBytes += length;
+				*pSerial = ++m_sentSerial;
+				break;
+			}
+		}
+		m_radioDelivered.Wait(10);
+	}
+	m_radioWake.Signal();
+	return true;
+}
+
+bool MockTransport::WaitDelivered(int serial)
+{
+	for (;;)
+	{
+		{
+			ScopedLock lock(m_lock);
+			if (m_deliveredSerial >= serial)
+			{
+				return m_open;
+			}
+			if (!m_open)
+			{
+				return false;
+			}
+		}
+		m_radioDelivered.Wait(10);
+	}
+}
+
+void MockTransport::RadioThread(void* pSelf)
+{
+	((MockTransport*)pSelf)->Broadcast();
+}
+
+// Hands buffered frames to the brick at the time the radio gets them there
+void MockTransport::Broadcast()
+{
+	while (m_radioRunning.Get())
+	{
+		uint64_t wait = 0;
+		{
+			ScopedLock lock(m_lock);
+			if (m_radioCount > 0)
+			{
+				Airborne& airborne = m_radio[m_radioHead];
+				uint64_t now = GetTimeMicros();
+				if (now >= airborne.deliverAt)
+				{
+					if (Deliver())
+					{
+						Execute(airborne.frame, airborne.length);
+						if (airborne.answer)
+						{
+							Answer(airborne.frame, airborne.length, airborne.deliverAt);
+						}
+					}
+					m_radioHead = (m_radioHead + 1) % MOCK_RADIO_FRAMES;
+					m_radioCount--;
+					m_radioBytes -= airborne.length;
+					m_deliveredSerial++;
+				}
+				else
+				{
+					wait = airborne.deliverAt - now;
+				}
+			}
+			else
+			{
+				wait = 50000;
+			}
+		}
+		if (wait == 0)
+		{
+			m_radioDelivered.Signal();
+		}
+		else if (wait >= 50000)
+		{
+			m_radioWake.Wait(50);
+		}
+		else
+		{
+			SleepMicros((unsigned int)wait);
+		}
+	}
+}
+
+// The radio is only used by the link thread, so waiting here serializes
+// calls the same way a real serial port does. A shared adapter also makes
+// the write wait for the other bricks' writes.
+void MockTransport::Wire(int bytesWritten)
+{
+	MockLatency latency;
+	Mutex* pAir;
+	{
+		ScopedLock lock(m_lock);
+		latency = m_latency;
+		pAir = m_pAir;
+	}
+	unsigned int us = latency.frameUs + bytesWritten * latency.byteUs;
+	if (us == 0)
+	{
+		return;
+	}
+	if (pAir != NULL)
+	{
+		ScopedLock air(*pAir);
+		SleepMicros(us);
+	}
+	else
+	{
+		SleepMicros(us);
+	}
+}
+
+// Output state frames move the motors, mailbox messages go to the simulated
+// intent program. Called with m_lock held.
+void MockTransport::Execute(const unsigned char* pFrame, int length)
+{
+	NxtOutputState state;
+	int mailbox, messageLength;
+	const unsigned char* pMessage;
+	if (DecodeSetOutputState(pFrame, length, &state) && state.port < MOTOR_PORT_COUNT)
+	{
+		SetTarget(state.port, (state.mode & NXT_MODE_MOTORON) ? state.power : 0, 0);
+		m_turnRatio[state.port] = state.regulation == NXT_REGULATION_MOTOR_SYNC ? state.turnRatio : 0;
+	}
+	else if (DecodeMessageWrite(pFrame, length, &mailbox, &pMessage, &messageLength) && m_programRunning)
+	{
+		RunIntent(mailbox, pMessage, messageLength);
+	}
+}
+
+// Frames asking for a reply get one after the brick's turnaround and the
+// time the reply takes over the air. Called with m_lock held.
+void MockTransport::Answer(const unsigned char* pFrame, int length, uint64_t deliveredAt)
+{
+	if ((pFrame[0] & NXT_DIRECT_COMMAND_NO_REPLY) != 0 || m_pendingCount >= MOCK_PENDING_REPLIES)
+	{
+		return;
+	}
+	PendingReply& pending = m_pending[(m_pendingHead + m_pendingCount) % MOCK_PENDING_REPLIES];
+	memcpy(pending.request, pFrame, length);
+	pending.readyAt = deliveredAt + m_latency.turnaroundUs +
+		(NXT_BT_LENGTH_SIZE + GetReplySize(pFrame[1])) * m_latency.byteUs;
+	m_pendingCount++;
+}
+
+// Does what Brick/intent.nxc does with a message. Called with m_lock held.
+void MockTransport::RunIntent(int mailbox, const unsigned char* pMessage, int length)
+{
+	IntentMessage intent;
+	if ((mailbox != INTENT_DRIVE_MAILBOX && mailbox != INTENT_GRIPPER_MAILBOX) || !DecodeIntent(pMessage, length, &intent))
+	{
+		return;
+	}
+	m_intentCount++;
+
+	switch (intent.type)
+	{
+		case INTENT_DRIVE:
+		{
+			// Same split as the brick's synchronized regulation
+			int left = intent.speed, right = intent.speed;
+			if (intent.turnRatio > 0)
+			{
+				right = intent.speed * (50 - intent.turnRatio) / 50;
+			}
+			else
+			{
+				left = intent.speed * (50 + intent.turnRatio) / 50;
+			}
+			SetTarget(INTENT_LEFT_PORT, left, intent.rampMs);
+			SetTarget(INTENT_RIGHT_PORT, right, intent.rampMs);
+			m_turnRatio[INTENT_LEFT_PORT] = m_turnRatio[INTENT_RIGHT_PORT] = intent.turnRatio;
+			break;
+		}
+		case INTENT_STOP:
+			SetTarget(INTENT_LEFT_PORT, 0, 0);
+			SetTarget(INTENT_RIGHT_PORT, 0, 0);
+			break;
+		case INTENT_GRIPPER:
+			SetTarget(INTENT_TOOL_PORT, intent.gripperPower, 0);
+			break;
+	}
+}
+
+// Called with m_lock held
+void MockTransport::SetTarget(int port, int power, int rampMs)
+{
+	UpdateTacho(port);
+	m_rampFrom[port] = CurrentPower(port);
+	m_rampStart[port] = GetTimeMicros();
+	m_rampMs[port] = rampMs;
+	m_power[port] = power;
+	m_tachoPower[port] = CurrentPower(port);
+}
+
+// Power changes linearly during a ramp, so the average of both ends is exact
+// unless a ramp ended in between. Called with m_lock held.
+double MockTransport::CurrentTacho(int port, uint64_t now) const
+{
+	double averagePower = (m_tachoPower[port] + CurrentPower(port)) / 2.0;
+	return m_tacho[port] + averagePower * g_mockFullSpeed * m_speedFactor / 100 * (now - m_tachoTime[port]) / 1e6;
+}
+
+// Called with m_lock held
+void MockTransport::UpdateTacho(int port)
+{
+	uint64_t now = GetTimeMicros();
+	m_tacho[port] = CurrentTacho(port, now);
+	m_tachoPower[port] = CurrentPower(port);
+	m_tachoTime[port] = now;
+}
+
+// Called with m_lock held
+int MockTransport::CurrentPower(int port) const
+{
+	if (m_rampMs[port] == 0)
+	{
+		return m_power[port];
+	}
+	uint64_t elapsedMs = (GetTimeMicros() - m_rampStart[port]) / 1000;
+	if (elapsedMs >= (uint64_t)m_rampMs[port])
+	{
+		return m_power[port];
+	}
+	return m_rampFrom[port] + (m_power[port] - m_rampFrom[port]) * (int)elapsedMs / m_rampMs[port];
+}
+
+void MockTransport::SetLinkUp(bool up)
+{
+	ScopedLock lock(m_lock);
+	m_linkUp = up;
+}
+
+void MockTransport::SetDropCycle(unsigned int upMs, unsigned int downMs)
+{
+	ScopedLock lock(m_lock);
+	m_upMs = upMs;
+	m_downMs = downMs;
+	m_cycleOrigin = GetTimeMicros();
+}
+
+void MockTransport::ShareAir(Mutex* pAir)
+{
+	ScopedLock lock(m_lock);
+	m_pAir = pAir;
+}
+
+void MockTransport::SetLoad(double speedFactor)
+{
+	ScopedLock lock(m_lock);
+	for (int port = 0; port < MOTOR_PORT_COUNT; ++port)
+	{
+		UpdateTacho(port);
+	}
+	m_speedFactor = speedFactor;
+}
+
+int MockTransport::GetMotorPower(int port) const
+{
+	ScopedLock lock(m_lock);
+	return CurrentPower(port);
+}
+
+int MockTransport::GetTurnRatio(int port) const
+{
+	ScopedLock lock(m_lock);
+	return m_turnRatio[port];
+}
+
+long MockTransport::GetTachoCount(int port) const
+{
+	ScopedLock lock(m_lock);
+	return (long)CurrentTacho(port, GetTimeMicros());
+}
+
+bool MockTransport::IsProgramRunning() const
+{
+	ScopedLock lock(m_lock);
+	return m_programRunning;
+}
+
+int MockTransport::GetCommandCount() const
+{
+	ScopedLock lock(m_lock);
+	return m_commandCount;
+}
+
+int MockTransport::GetReplyCount() const
+{
+	ScopedLock lock(m_lock);
+	return m_replyCount;
+}
+
+int MockTransport::GetIntentCount() const
+{
+	ScopedLock lock(m_lock);
+	return m_intentCount;
+}
+
+int MockTransport::GetConnectCount() const
+{
+	ScopedLock lock(m_lock);
+	return m_connectCount;
+}
+
+// Called with m_lock held
+bool MockTransport::IsLinkUp()
+{
+	if (!m_linkUp)
+	{
+		return false;
+	}
+	if (m_upMs == 0 || m_downMs == 0)
+	{
+		return true;
+	}
+	uint64_t phaseMs = (GetTimeMicros() - m_cycleOrigin) / 1000 % (m_upMs + m_downMs);
+	return phaseMs < m_upMs;
+}
+
+// Called with m_lock held
+bool MockTransport::Deliver()
+{
+	if (!m_open)
+	{
+		return false;
+	}
+	if (!IsLinkUp())
+	{
+		m_open = false;
+		return false;
+	}
+	m_commandCount++;
+	return true;
+}
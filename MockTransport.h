@@ -0,0 +1,161 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Simulated brick for running without a robot            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_MOCK_TRANSPORT_H_
+#define _MINDSTORM_MOCK_TRANSPORT_H_
+
+#include "Platform.h"
+#include "RobotTransport.h"
+#include "NxtProtocol.h"
+
+// Time the simulated radio takes for every call
+struct MockLatency
+{
+	unsigned int frameUs;		// Fixed cost of every write, a batch is one write
+	unsigned int byteUs;		// Per byte written or read
+	unsigned int turnaroundUs;	// Wait before a reply starts to arrive
+	unsigned int bufferBytes;	// Send buffer in front of the radio, 0 makes
+								// every write wait until it is on the air
+};
+
+// NXT over Bluetooth: serial port profile at 115200 baud and about 30 ms
+// for the brick's radio to switch from receiving to sending a reply
+MockLatency MakeBluetoothLatency();
+// Bluetooth sharing the air with other traffic, writes land in a 4 KB send
+// buffer and the radio drains it at about 40 frames per second
+MockLatency MakeCongestedLatency();
+MockLatency MakeNoLatency();
+
+#define MOCK_RADIO_FRAMES		512
+#define MOCK_PENDING_REPLIES	16
+
+class MockTransport : public RobotTransport
+{
+	public:
+		MockTransport(unsigned int connectDelayMs = 0);
+		virtual ~MockTransport();
+
+		virtual bool Open();
+		virtual void Close();
+
+		virtual bool StartProgram(const char* name);
+		virtual bool StopProgram();
+		virtual bool SendDirectCommand(const unsigned char* pFrame, int length);
+		virtual bool SendBatch(const unsigned char* pPackets, int length);
+		virtual bool Transact(const unsigned char* pFrame, int length, unsigned char* pReply, int replyLength);
+		virtual int GetQueuedBytes() const;
+		virtual bool HasAsyncReplies() const { return m_asyncReplies; }
+		virtual int ReceiveReply(unsigned char* pReply, int maxLength);
+
+		void SetLatency(const MockLatency& latency);
+		// Off, only Transact() gets replies, as with NXT++. Set before the
+		// link starts.
+		void SetAsyncReplies(bool async) { m_asyncReplies = async; }
+
+		// Simulated radio, may be called from any thread
+		void SetLinkUp(bool up);
+		// Link goes down for downMs after every upMs, 0 disables the cycle
+		void SetDropCycle(unsigned int upMs, unsigned int downMs);
+		// Share of the nominal speed the motors reach, below 1 for a weak
+		// battery or a floor that drags
+		void SetLoad(double speedFactor);
+		// Bricks paired with the same adapter share the air: unbuffered
+		// writes of every transport given the same mutex go out one at a time
+		void ShareAir(Mutex* pAir);
+
+		// What the brick is doing, may be called from any thread
+		int GetMotorPower(int port) const;
+		int GetTurnRatio(int port) const;	// Set by synchronized commands
+		long GetTachoCount(int port) const;	// Degrees turned since the start
+		bool IsProgramRunning() const;
+		int GetCommandCount() const;
+		int GetReplyCount() const;
+		int GetIntentCount() const;		// Intent messages run by the simulated program
+		int GetConnectCount() const;
+
+	private:
+		MockTransport(const MockTransport&);
+		MockTransport& operator=(const MockTransport&);
+
+		// Frame written to the send buffer, on the brick at deliverAt
+		struct Airborne
+		{
+			unsigned char frame[NXT_MAX_FRAME_SIZE];
+			int length;
+			uint64_t deliverAt;
+			bool answer;	// Reply goes to ReceiveReply()
+		};
+
+		// Request sent with SendBatch(), answered at readyAt
+		struct PendingReply
+		{
+			unsigned char request[NXT_MAX_FRAME_SIZE];
+			uint64_t readyAt;
+		};
+
+		static void RadioThread(void* pSelf);
+		void Broadcast();
+		bool Transmit(const unsigned char* pFrame, int length, bool answer, int* pSerial);
+		bool WaitDelivered(int serial);
+		void BuildReply(const unsigned char* pFrame, unsigned char* pReply, int replyLength);
+		void Execute(const unsigned char* pFrame, int length);
+		void Answer(const unsigned char* pFrame, int length, uint64_t deliveredAt);
+		void RunIntent(int mailbox, const unsigned char* pMessage, int length);
+		void SetTarget(int port, int power, int rampMs);
+		int CurrentPower(int port) const;
+		double CurrentTacho(int port, uint64_t now) const;
+		void UpdateTacho(int port);
+		void Wire(int bytesWritten);
+		bool IsLinkUp();
+		bool Deliver();		// Fails and closes the link when the radio is down
+
+		mutable Mutex			m_lock;
+		unsigned int			m_connectDelayMs;
+		MockLatency				m_latency;
+		Mutex*					m_pAir;
+		bool					m_asyncReplies;
+		bool					m_linkUp;
+		unsigned int			m_upMs;
+		unsigned int			m_downMs;
+		uint64_t				m_cycleOrigin;
+		bool					m_open;
+		bool					m_programRunning;
+		// Power ramps from m_rampFrom to m_power over m_rampMs
+		int						m_power[MOTOR_PORT_COUNT];
+		int						m_rampFrom[MOTOR_PORT_COUNT];
+		uint64_t				m_rampStart[MOTOR_PORT_COUNT];
+		int						m_rampMs[MOTOR_PORT_COUNT];
+		int						m_turnRatio[MOTOR_PORT_COUNT];
+		// Position integrated from the power, updated on every change
+		double					m_tacho[MOTOR_PORT_COUNT];
+		int						m_tachoPower[MOTOR_PORT_COUNT];
+		uint64_t				m_tachoTime[MOTOR_PORT_COUNT];
+		double					m_speedFactor;
+		int						m_intentCount;
+		int						m_commandCount;
+		int						m_replyCount;
+		int						m_connectCount;
+
+		// Send buffer, only used when m_latency.bufferBytes is set
+		Airborne				m_radio[MOCK_RADIO_FRAMES];
+		int						m_radioHead;
+		int						m_radioCount;
+		int						m_radioBytes;
+		uint64_t				m_radioFreeAt;	// When the last buffered frame is on the air
+		int						m_sentSerial;
+		int						m_deliveredSerial;
+		Thread					m_radioThread;
+		AtomicInt				m_radioRunning;
+		Event					m_radioWake;
+		Event					m_radioDelivered;
+
+		PendingReply			m_pending[MOCK_PENDING_REPLIES];
+		int						m_pendingHead;
+		int						m_pendingCount;
+};
+
+#endif // _MINDSTORM_MOCK_TRANSPORT_H_
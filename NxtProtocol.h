@@ -0,0 +1,395 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - NXT direct command framing                              *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_NXT_PROTOCOL_H_
+#define _MINDSTORM_NXT_PROTOCOL_H_
+
+#include <stddef.h>
+
+// Layout follows the LEGO MINDSTORMS NXT Direct Commands appendix.
+// Frames below start with the command type byte; the Bluetooth length
+// prefix is added by the transport.
+
+// Command type, first byte of every frame
+#define NXT_DIRECT_COMMAND				0x00
+#define NXT_DIRECT_COMMAND_NO_REPLY		0x80
+#define NXT_REPLY						0x02
+
+// Direct command opcodes
+#define NXT_OP_STARTPROGRAM				0x00
+#define NXT_OP_STOPPROGRAM				0x01
+#define NXT_OP_SETOUTPUTSTATE			0x04
+#define NXT_OP_GETOUTPUTSTATE			0x06
+#define NXT_OP_MESSAGEWRITE				0x09
+#define NXT_OP_GETBATTERYLEVEL			0x0B
+#define NXT_OP_KEEPALIVE				0x0D
+
+// Output mode bits
+#define NXT_MODE_MOTORON				0x01
+#define NXT_MODE_BRAKE					0x02
+#define NXT_MODE_REGULATED				0x04
+
+// Regulation modes
+#define NXT_REGULATION_IDLE				0x00
+#define NXT_REGULATION_MOTOR_SPEED		0x01
+#define NXT_REGULATION_MOTOR_SYNC		0x02
+
+// Run states
+#define NXT_RUNSTATE_IDLE				0x00
+#define NXT_RUNSTATE_RUNNING			0x20
+
+// Bluetooth packets carry at most 64 bytes of command
+#define NXT_MAX_FRAME_SIZE				64
+#define NXT_SETOUTPUTSTATE_SIZE			12
+#define NXT_GETOUTPUTSTATE_SIZE			3
+#define NXT_GETBATTERYLEVEL_SIZE		2
+#define NXT_KEEPALIVE_SIZE				2
+#define NXT_STOPPROGRAM_SIZE			2
+// File names are 15.3 characters plus the terminating zero
+#define NXT_FILENAME_SIZE				20
+#define NXT_STARTPROGRAM_SIZE			(2 + NXT_FILENAME_SIZE)
+
+// Over Bluetooth every frame is preceded by its length, little endian
+#define NXT_BT_LENGTH_SIZE				2
+
+// Replies: type, opcode, status and the returned values
+#define NXT_STATUS_REPLY_SIZE			3
+#define NXT_BATTERY_REPLY_SIZE			5
+#define NXT_OUTPUTSTATE_REPLY_SIZE		25
+#define NXT_KEEPALIVE_REPLY_SIZE		7
+#define NXT_STATUS_SUCCESS				0x00
+
+// Mailboxes of the running program, messages include a terminating zero
+#define NXT_MAILBOX_COUNT				10
+#define NXT_MAX_MESSAGE_SIZE			58
+#define NXT_MESSAGEWRITE_HEADER_SIZE	4
+
+struct NxtOutputState
+{
+	int port;
+	int power;			// -100..100
+	int mode;
+	int regulation;
+	int turnRatio;		// -100..100, only used with NXT_REGULATION_MOTOR_SYNC
+	int runState;
+	unsigned long tachoLimit;	// 0 runs forever
+};
+
+// GETOUTPUTSTATE reply, counts in degrees
+struct NxtOutputStatus
+{
+	NxtOutputState state;
+	long tachoCount;		// Since the last reset of the motor position
+	long blockTachoCount;	// Since the last program block
+	long rotationCount;		// Since the last program reset
+};
+
+inline void PutUInt32(unsigned char* pBuffer, unsigned long value)
+{
+	pBuffer[0] = (unsigned char)(value & 0xFF);
+	pBuffer[1] = (unsigned char)((value >> 8) & 0xFF);
+	pBuffer[2] = (unsigned char)((value >> 16) & 0xFF);
+	pBuffer[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+inline unsigned long GetUInt32(const unsigned char* pBuffer)
+{
+	return (unsigned long)pBuffer[0] | ((unsigned long)pBuffer[1] << 8) |
+		((unsigned long)pBuffer[2] << 16) | ((unsigned long)pBuffer[3] << 24);
+}
+
+inline long GetInt32(const unsigned char* pBuffer)
+{
+	unsigned long value = GetUInt32(pBuffer);
+	return value & 0x80000000UL ? -(long)(0xFFFFFFFFUL - value) - 1 : (long)value;
+}
+
+// Writes NXT_SETOUTPUTSTATE_SIZE bytes
+inline int EncodeSetOutputState(unsigned char* pFrame, const NxtOutputState& state, bool reply)
+{
+	pFrame[0] = reply ? NXT_DIRECT_COMMAND : NXT_DIRECT_COMMAND_NO_REPLY;
+	pFrame[1] = NXT_OP_SETOUTPUTSTATE;
+	pFrame[2] = (unsigned char)state.port;
+	pFrame[3] = (unsigned char)(signed char)state.power;
+	pFrame[4] = (unsigned char)state.mode;
+	pFrame[5] = (unsigned char)state.regulation;
+	pFrame[6] = (unsigned char)(signed char)state.turnRatio;
+	pFrame[7] = (unsigned char)state.runState;
+	PutUInt32(pFrame + 8, state.tachoLimit);
+	return NXT_SETOUTPUTSTATE_SIZE;
+}
+
+inline bool DecodeSetOutputState(const unsigned char* pFrame, int length, NxtOutputState* pState)
+{
+	if (length < NXT_SETOUTPUTSTATE_SIZE || (pFrame[0] & 0x7F) != NXT_DIRECT_COMMAND || pFrame[1] != NXT_OP_SETOUTPUTSTATE)
+	{
+		return false;
+	}
+	pState->port = pFrame[2];
+	pState->power = (signed char)pFrame[3];
+	pState->mode = pFrame[4];
+	pState->regulation = pFrame[5];
+	pState->turnRatio = (signed char)pFrame[6];
+	pState->runState = pFrame[7];
+	pState->tachoLimit = GetUInt32(pFrame + 8);
+	return true;
+}
+
+inline int EncodeGetOutputState(unsigned char* pFrame, int port)
+{
+	pFrame[0] = NXT_DIRECT_COMMAND;
+	pFrame[1] = NXT_OP_GETOUTPUTSTATE;
+	pFrame[2] = (unsigned char)port;
+	return NXT_GETOUTPUTSTATE_SIZE;
+}
+
+// Writes NXT_OUTPUTSTATE_REPLY_SIZE bytes, as the brick answers GETOUTPUTSTATE
+inline int EncodeOutputStateReply(unsigned char* pReply, const NxtOutputStatus& status)
+{
+	pReply[0] = NXT_REPLY;
+	pReply[1] = NXT_OP_GETOUTPUTSTATE;
+	pReply[2] = NXT_STATUS_SUCCESS;
+	pReply[3] = (unsigned char)status.state.port;
+	pReply[4] = (unsigned char)(signed char)status.state.power;
+	pReply[5] = (unsigned char)status.state.mode;
+	pReply[6] = (unsigned char)status.state.regulation;
+	pReply[7] = (unsigned char)(signed char)status.state.turnRatio;
+	pReply[8] = (unsigned char)status.state.runState;
+	PutUInt32(pReply + 9, status.state.tachoLimit);
+	PutUInt32(pReply + 13, (unsigned long)status.tachoCount);
+	PutUInt32(pReply + 17, (unsigned long)status.blockTachoCount);
+	PutUInt32(pReply + 21, (unsigned long)status.rotationCount);
+	return NXT_OUTPUTSTATE_REPLY_SIZE;
+}
+
+inline bool DecodeOutputStateReply(const unsigned char* pReply, int length, NxtOutputStatus* pStatus)
+{
+	if (length < NXT_OUTPUTSTATE_REPLY_SIZE || pReply[0] != NXT_REPLY || pReply[1] != NXT_OP_GETOUTPUTSTATE || pReply[2] != NXT_STATUS_SUCCESS)
+	{
+		return false;
+	}
+	pStatus->state.port = pReply[3];
+	pStatus->state.power = (signed char)pReply[4];
+	pStatus->state.mode = pReply[5];
+	pStatus->state.regulation = pReply[6];
+	pStatus->state.turnRatio = (signed char)pReply[7];
+	pStatus->state.runState = pReply[8];
+	pStatus->state.tachoLimit = GetUInt32(pReply + 9);
+	pStatus->tachoCount = GetInt32(pReply + 13);
+	pStatus->blockTachoCount = GetInt32(pReply + 17);
+	pStatus->rotationCount = GetInt32(pReply + 21);
+	return true;
+}
+
+inline int EncodeGetBatteryLevel(unsigned char* pFrame)
+{
+	pFrame[0] = NXT_DIRECT_COMMAND;
+	pFrame[1] = NXT_OP_GETBATTERYLEVEL;
+	return NXT_GETBATTERYLEVEL_SIZE;
+}
+
+// Battery voltage in millivolts
+inline bool DecodeBatteryLevelReply(const unsigned char* pReply, int length, int* pMillivolts)
+{
+	if (length < NXT_BATTERY_REPLY_SIZE || pReply[0] != NXT_REPLY || pReply[1] != NXT_OP_GETBATTERYLEVEL || pReply[2] != NXT_STATUS_SUCCESS)
+	{
+		return false;
+	}
+	*pMillivolts = pReply[3] | (pReply[4] << 8);
+	return true;
+}
+
+inline int EncodeKeepAlive(unsigned char* pFrame)
+{
+	pFrame[0] = NXT_DIRECT_COMMAND;
+	pFrame[1] = NXT_OP_KEEPALIVE;
+	return NXT_KEEPALIVE_SIZE;
+}
+
+// Adds the .rxe extension when the name has none. Returns the frame size or
+// 0 if the name is too long.
+inline int EncodeStartProgram(unsigned char* pFrame, const char* name)
+{
+	static const char extension[] = ".rxe";
+	int length = 0;
+	bool hasExtension = false;
+	for (; name[length] != 0; ++length)
+	{
+		if (name[length] == '.')
+		{
+			hasExtension = true;
+		}
+	}
+	int total = length + (hasExtension ? 0 : 4);
+	if (total + 1 > NXT_FILENAME_SIZE)
+	{
+		return 0;
+	}
+	pFrame[0] = NXT_DIRECT_COMMAND;
+	pFrame[1] = NXT_OP_STARTPROGRAM;
+	for (int i = 0; i < NXT_FILENAME_SIZE; ++i)
+	{
+		char c = 0;
+		if (i < length)
+		{
+			c = name[i];
+		}
+		else if (i < total)
+		{
+			c = extension[i - length];
+		}
+		pFrame[2 + i] = (unsigned char)c;
+	}
+	return NXT_STARTPROGRAM_SIZE;
+}
+
+inline int EncodeStopProgram(unsigned char* pFrame)
+{
+	pFrame[0] = NXT_DIRECT_COMMAND;
+	pFrame[1] = NXT_OP_STOPPROGRAM;
+	return NXT_STOPPROGRAM_SIZE;
+}
+
+// Current sleep time limit of the brick, in milliseconds
+inline bool DecodeKeepAliveReply(const unsigned char* pReply, int length, unsigned long* pSleepMs)
+{
+	if (length < NXT_KEEPALIVE_REPLY_SIZE || pReply[0] != NXT_REPLY || pReply[1] != NXT_OP_KEEPALIVE || pReply[2] != NXT_STATUS_SUCCESS)
+	{
+		return false;
+	}
+	*pSleepMs = GetUInt32(pReply + 3);
+	return true;
+}
+
+// True for a successful reply to the given opcode
+inline bool IsReplyOk(const unsigned char* pReply, int length, int opcode)
+{
+	return length >= NXT_STATUS_REPLY_SIZE && pReply[0] == NXT_REPLY && pReply[1] == opcode && pReply[2] == NXT_STATUS_SUCCESS;
+}
+
+// Size of the brick's reply to a frame with this opcode
+inline int GetReplySize(int opcode)
+{
+	switch (opcode)
+	{
+		case NXT_OP_GETOUTPUTSTATE:
+			return NXT_OUTPUTSTATE_REPLY_SIZE;
+		case NXT_OP_GETBATTERYLEVEL:
+			return NXT_BATTERY_REPLY_SIZE;
+		case NXT_OP_KEEPALIVE:
+			return NXT_KEEPALIVE_REPLY_SIZE;
+	}
+	return NXT_STATUS_REPLY_SIZE;
+}
+
+// Message gets a terminating zero appended, programs on the brick read it
+// as a string. Returns the frame size or 0 if the message does not fit.
+inline int EncodeMessageWrite(unsigned char* pFrame, int mailbox, const unsigned char* pMessage, int length, bool reply)
+{
+	if (length < 0 || length + 1 > NXT_MAX_MESSAGE_SIZE)
+	{
+		return 0;
+	}
+	pFrame[0] = reply ? NXT_DIRECT_COMMAND : NXT_DIRECT_COMMAND_NO_REPLY;
+	pFrame[1] = NXT_OP_MESSAGEWRITE;
+	pFrame[2] = (unsigned char)mailbox;
+	pFrame[3] = (unsigned char)(length + 1);
+	for (int i = 0; i < length; ++i)
+	{
+		pFrame[NXT_MESSAGEWRITE_HEADER_SIZE + i] = pMessage[i];
+	}
+	pFrame[NXT_MESSAGEWRITE_HEADER_SIZE + length] = 0;
+	return NXT_MESSAGEWRITE_HEADER_SIZE + length + 1;
+}
+
+// Points into the frame, the length excludes the terminating zero
+inline bool DecodeMessageWrite(const unsigned char* pFrame, int length, int* pMailbox, const unsigned char** ppMessage, int* pMessageLength)
+{
+	if (length < NXT_MESSAGEWRITE_HEADER_SIZE + 1 || (pFrame[0] & 0x7F) != NXT_DIRECT_COMMAND || pFrame[1] != NXT_OP_MESSAGEWRITE ||
+		pFrame[3] < 1 || NXT_MESSAGEWRITE_HEADER_SIZE + pFrame[3] > length)
+	{
+		return false;
+	}
+	*pMailbox = pFrame[2];
+	*ppMessage = pFrame + NXT_MESSAGEWRITE_HEADER_SIZE;
+	*pMessageLength = pFrame[3] - 1;
+	return true;
+}
+
+// Several frames packed back to back with their Bluetooth length prefixes,
+// so a transport can hand them over in one write. The buffer lives inside
+// the batch; nothing is allocated.
+template <int Capacity>
+class NxtBatch
+{
+	public:
+		NxtBatch() : m_length(0), m_count(0) {}
+
+		const unsigned char* GetData() const { return m_buffer; }
+		int GetLength() const { return m_length; }
+		int GetCount() const { return m_count; }
+		bool IsEmpty() const { return m_count == 0; }
+		void Clear() { m_length = m_count = 0; }
+
+		// False when the frame does not fit any more
+		bool Append(const unsigned char* pFrame, int length)
+		{
+			unsigned char* pTarget = Reserve();
+			if (pTarget == NULL || length < 1 || length > GetRoom())
+			{
+				return false;
+			}
+			for (int i = 0; i < length; ++i)
+			{
+				pTarget[i] = pFrame[i];
+			}
+			Commit(length);
+			return true;
+		}
+
+		// For encoding in place: space for the next frame, at most GetRoom()
+		// bytes, or NULL when full. Commit() then adds the length prefix.
+		unsigned char* Reserve() { return GetRoom() > 0 ? m_buffer + m_length + NXT_BT_LENGTH_SIZE : NULL; }
+		int GetRoom() const
+		{
+			int room = Capacity - m_length - NXT_BT_LENGTH_SIZE;
+			return room < 0 ? 0 : (room > NXT_MAX_FRAME_SIZE ? NXT_MAX_FRAME_SIZE : room);
+		}
+		void Commit(int length)
+		{
+			m_buffer[m_length] = (unsigned char)(length & 0xFF);
+			m_buffer[m_length + 1] = (unsigned char)(length >> 8);
+			m_length += NXT_BT_LENGTH_SIZE + length;
+			m_count++;
+		}
+
+	private:
+		unsigned char			m_buffer[Capacity];
+		int						m_length;
+		int						m_count;
+};
+
+// Walks the frames of a packed batch. Returns false at the end, or when the
+// next length prefix runs past the data.
+inline bool NextBatchFrame(const unsigned char* pData, int length, int* pOffset, const unsigned char** ppFrame, int* pFrameLength)
+{
+	if (*pOffset + NXT_BT_LENGTH_SIZE > length)
+	{
+		return false;
+	}
+	int frameLength = pData[*pOffset] | (pData[*pOffset + 1] << 8);
+	if (frameLength < 1 || frameLength > NXT_MAX_FRAME_SIZE || *pOffset + NXT_BT_LENGTH_SIZE + frameLength > length)
+	{
+		return false;
+	}
+	*ppFrame = pData + *pOffset + NXT_BT_LENGTH_SIZE;
+	*pFrameLength = frameLength;
+	*pOffset += NXT_BT_LENGTH_SIZE + frameLength;
+	return true;
+}
+
+#endif // _MINDSTORM_NXT_PROTOCOL_H_
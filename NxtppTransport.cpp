@@ -0,0 +1,81 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Bluetooth transport using NXT++                         *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "NxtppTransport.h"
+#include "NxtProtocol.h"
+#include <string.h>
+
+NxtppTransport::NxtppTransport() : m_open(false)
+{
+}
+
+NxtppTransport::~NxtppTransport()
+{
+	Close();
+}
+
+bool NxtppTransport::Open()
+{
+	m_open = NXT::OpenBT(&m_comm);
+	return m_open;
+}
+
+void NxtppTransport::Close()
+{
+	if (m_open)
+	{
+		NXT::Close(&m_comm);
+		m_open = false;
+	}
+}
+
+bool NxtppTransport::StartProgram(const char* name)
+{
+	if (!m_open)
+	{
+		return false;
+	}
+	NXT::StartProgram(&m_comm, name);
+	return true;
+}
+
+bool NxtppTransport::StopProgram()
+{
+	if (!m_open)
+	{
+		return false;
+	}
+	NXT::StopProgram(&m_comm);
+	return true;
+}
+
+// NXT++ adds the command type byte itself, always the no-reply one here
+bool NxtppTransport::SendDirectCommand(const unsigned char* pFrame, int length)
+{
+	unsigned char body[NXT_MAX_FRAME_SIZE];
+	if (!m_open || length < 2 || length > NXT_MAX_FRAME_SIZE)
+	{
+		return false;
+	}
+	memcpy(body, pFrame + 1, length - 1);
+	NXT::SendDirectCommand(&m_comm, false, (ViBuf)body, length - 1, NULL, 0);
+	return true;
+}
+
+// A dead link leaves the reply buffer empty, which fails the status check
+bool NxtppTransport::Transact(const unsigned char* pFrame, int length, unsigned char* pReply, int replyLength)
+{
+	unsigned char body[NXT_MAX_FRAME_SIZE];
+	if (!m_open || length < 2 || length > NXT_MAX_FRAME_SIZE)
+	{
+		return false;
+	}
+	memcpy(body, pFrame + 1, length - 1);
+	memset(pReply, 0, replyLength);
+	NXT::SendDirectCommand(&m_comm, true, (ViBuf)body, length - 1, (ViBuf)pReply, replyLength);
+	return IsReplyOk(pReply, replyLength, pFrame[1]);
+}
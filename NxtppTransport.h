@@ -0,0 +1,36 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Bluetooth transport using NXT++                         *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_NXTPP_TRANSPORT_H_
+#define _MINDSTORM_NXTPP_TRANSPORT_H_
+
+#include "NXT++.h"
+#include "RobotTransport.h"
+
+class NxtppTransport : public RobotTransport
+{
+	public:
+		NxtppTransport();
+		virtual ~NxtppTransport();
+
+		virtual bool Open();
+		virtual void Close();
+
+		virtual bool StartProgram(const char* name);
+		virtual bool StopProgram();
+		virtual bool SendDirectCommand(const unsigned char* pFrame, int length);
+		virtual bool Transact(const unsigned char* pFrame, int length, unsigned char* pReply, int replyLength);
+
+	private:
+		NxtppTransport(const NxtppTransport&);
+		NxtppTransport& operator=(const NxtppTransport&);
+
+		Comm::NXTComm			m_comm;
+		bool					m_open;
+};
+
+#endif // _MINDSTORM_NXTPP_TRANSPORT_H_
@@ -0,0 +1,74 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Robot pose from the wheel tachometers                   *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "Odometry.h"
+#include <math.h>
+#include <string.h>
+
+// Weight of a new sample in the wheel speeds. One tachometer degree is a
+// few percent of a 50 ms step, the filter evens that out.
+const double g_speedFilter = 0.5;
+
+Odometry::Odometry(double wheelDiameter, double trackWidth) :
+	m_millimetersPerDegree(wheelDiameter * 3.14159265358979 / 360), m_trackWidth(trackWidth)
+{
+	Reset();
+}
+
+void Odometry::Reset()
+{
+	m_started = false;
+	memset(&m_lastLeft, 0, sizeof(m_lastLeft));
+	memset(&m_lastRight, 0, sizeof(m_lastRight));
+	memset(&m_pose, 0, sizeof(m_pose));
+}
+
+bool Odometry::Update(const MotorTelemetry& left, const MotorTelemetry& right)
+{
+	// Both wheels are read in the same telemetry round, so the pair moves together
+	if (left.time == 0 || right.time == 0 || left.time == m_lastLeft.time || right.time == m_lastRight.time)
+	{
+		return false;
+	}
+	if (!m_started)
+	{
+		m_started = true;
+		m_lastLeft = left;
+		m_lastRight = right;
+		m_pose.time = left.time > right.time ? left.time : right.time;
+		return true;
+	}
+
+	double leftDistance = (left.tachoCount - m_lastLeft.tachoCount) * m_millimetersPerDegree;
+	double rightDistance = (right.tachoCount - m_lastRight.tachoCount) * m_millimetersPerDegree;
+	m_pose.leftSpeed = UpdateSpeed(m_pose.leftSpeed, leftDistance, left.time, m_lastLeft.time);
+	m_pose.rightSpeed = UpdateSpeed(m_pose.rightSpeed, rightDistance, right.time, m_lastRight.time);
+
+	// Midpoint heading, exact for an arc walked at constant wheel speeds
+	double distance = (leftDistance + rightDistance) / 2;
+	double turn = (rightDistance - leftDistance) / m_trackWidth;
+	double heading = m_pose.heading + turn / 2;
+	m_pose.x += distance * cos(heading);
+	m_pose.y += distance * sin(heading);
+	m_pose.heading = atan2(sin(m_pose.heading + turn), cos(m_pose.heading + turn));
+	m_pose.time = left.time > right.time ? left.time : right.time;
+
+	m_lastLeft = left;
+	m_lastRight = right;
+	return true;
+}
+
+double Odometry::UpdateSpeed(double speed, double distance, uint64_t time, uint64_t lastTime)
+{
+	if (time <= lastTime)
+	{
+		return speed;
+	}
+
+	double sample = distance * 1e6 / (double)(time - lastTime);
+	return speed + g_speedFilter * (sample - speed);
+}
@@ -0,0 +1,49 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Robot pose from the wheel tachometers                   *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_ODOMETRY_H_
+#define _MINDSTORM_ODOMETRY_H_
+
+#include "Telemetry.h"
+
+// Where the robot is relative to where odometry started: x ahead, y to the
+// left, heading counterclockwise. In millimeters, radians and mm/s.
+struct RobotPose
+{
+	double x;
+	double y;
+	double heading;
+	double leftSpeed;		// Wheel speeds over the ground, filtered
+	double rightSpeed;
+	uint64_t time;			// Of the latest tachometer reading, 0 before any
+};
+
+// Dead reckoning for a differential drive. Every new pair of tachometer
+// readings moves the pose along an arc by the distance each wheel turned.
+class Odometry
+{
+	public:
+		Odometry(double wheelDiameter, double trackWidth);
+
+		// Next readings start a new pose at the origin
+		void Reset();
+		// False until both wheels have a reading newer than the last update
+		bool Update(const MotorTelemetry& left, const MotorTelemetry& right);
+		const RobotPose& GetPose() const { return m_pose; }
+
+	private:
+		static double UpdateSpeed(double speed, double distance, uint64_t time, uint64_t lastTime);
+
+		double					m_millimetersPerDegree;
+		double					m_trackWidth;
+		bool					m_started;
+		MotorTelemetry			m_lastLeft;
+		MotorTelemetry			m_lastRight;
+		RobotPose				m_pose;
+};
+
+#endif // _MINDSTORM_ODOMETRY_H_
@@ -0,0 +1,476 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Threads, locks and clocks                               *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "Platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+	#include <time.h>
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#pragma region Clock
+#ifdef WIN32
+uint64_t GetTimeMicros()
+{
+	static LARGE_INTEGER frequency = {0};
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / frequency.QuadPart) * 1000000 +
+		(uint64_t)(now.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+void SleepMillis(unsigned int ms)
+{
+	Sleep(ms);
+}
+
+void SleepMicros(unsigned int us)
+{
+	Sleep((us + 999) / 1000);
+}
+
+// FILETIME counts in 100 ns units
+static uint64_t ToMicros(const FILETIME& time)
+{
+	return (((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) / 10;
+}
+
+uint64_t GetThreadCpuMicros()
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+	{
+		return 0;
+	}
+	return ToMicros(kernel) + ToMicros(user);
+}
+
+uint64_t GetProcessCpuMicros()
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+	{
+		return 0;
+	}
+	return ToMicros(kernel) + ToMicros(user);
+}
+#else
+uint64_t GetTimeMicros()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void SleepMillis(unsigned int ms)
+{
+	usleep(ms * 1000);
+}
+
+void SleepMicros(unsigned int us)
+{
+	usleep(us);
+}
+
+uint64_t GetThreadCpuMicros()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+uint64_t GetProcessCpuMicros()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+#endif
+#pragma endregion
+#pragma region AtomicInt
+#ifdef WIN32
+void MemoryFence()
+{
+	MemoryBarrier();
+}
+
+int AtomicInt::Get() const
+{
+	return InterlockedCompareExchange(&m_value, 0, 0);
+}
+
+void AtomicInt::Set(int value)
+{
+	InterlockedExchange(&m_value, value);
+}
+
+int AtomicInt::Increment()
+{
+	return InterlockedIncrement(&m_value);
+}
+
+int AtomicInt::Add(int delta)
+{
+	return InterlockedExchangeAdd(&m_value, delta) + delta;
+}
+#else
+void MemoryFence()
+{
+	__sync_synchronize();
+}
+
+int AtomicInt::Get() const
+{
+	return __sync_fetch_and_add(&m_value, 0);
+}
+
+void AtomicInt::Set(int value)
+{
+	__sync_lock_test_and_set(&m_value, value);
+	__sync_synchronize();
+}
+
+int AtomicInt::Increment()
+{
+	return __sync_add_and_fetch(&m_value, 1);
+}
+
+int AtomicInt::Add(int delta)
+{
+	return __sync_add_and_fetch(&m_value, delta);
+}
+#endif
+#pragma endregion
+#pragma region Mutex
+#ifdef WIN32
+Mutex::Mutex()
+{
+	InitializeCriticalSection(&m_section);
+}
+
+Mutex::~Mutex()
+{
+	DeleteCriticalSection(&m_section);
+}
+
+void Mutex::Lock()
+{
+	EnterCriticalSection(&m_section);
+}
+
+void Mutex::Unlock()
+{
+	LeaveCriticalSection(&m_section);
+}
+#else
+Mutex::Mutex()
+{
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+Mutex::~Mutex()
+{
+	pthread_mutex_destroy(&m_mutex);
+}
+
+void Mutex::Lock()
+{
+	pthread_mutex_lock(&m_mutex);
+}
+
+void Mutex::Unlock()
+{
+	pthread_mutex_unlock(&m_mutex);
+}
+#endif
+#pragma endregion
+#pragma region Event
+#ifdef WIN32
+Event::Event()
+{
+	m_handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+Event::~Event()
+{
+	CloseHandle(m_handle);
+}
+
+void Event::Signal()
+{
+	SetEvent(m_handle);
+}
+
+bool Event::Wait(unsigned int timeoutMs)
+{
+	return WaitForSingleObject(m_handle, timeoutMs) == WAIT_OBJECT_0;
+}
+#else
+Event::Event() : m_signalled(false)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+}
+
+Event::~Event()
+{
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+void Event::Signal()
+{
+	pthread_mutex_lock(&m_mutex);
+	m_signalled = true;
+	pthread_cond_signal(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool Event::Wait(unsigned int timeoutMs)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&m_mutex);
+	while (!m_signalled)
+	{
+		if (pthread_cond_timedwait(&m_cond, &m_mutex, &deadline) != 0)
+		{
+			break;
+		}
+	}
+	bool signalled = m_signalled;
+	m_signalled = false;
+	pthread_mutex_unlock(&m_mutex);
+	return signalled;
+}
+#endif
+#pragma endregion
+#pragma region Thread
+Thread::Thread() : m_routine(NULL), m_pArg(NULL), m_started(false)
+{
+}
+
+Thread::~Thread()
+{
+	Join();
+}
+
+#ifdef WIN32
+DWORD WINAPI Thread::Entry(LPVOID pSelf)
+{
+	Thread* pThread = (Thread*)pSelf;
+	pThread->m_routine(pThread->m_pArg);
+	return 0;
+}
+
+bool Thread::Start(Routine routine, void* pArg)
+{
+	if (m_started)
+	{
+		return false;
+	}
+	m_routine = routine;
+	m_pArg = pArg;
+	m_handle = CreateThread(NULL, 0, Entry, this, 0, NULL);
+	m_started = (m_handle != NULL);
+	return m_started;
+}
+
+void Thread::Join()
+{
+	if (m_started)
+	{
+		WaitForSingleObject(m_handle, INFINITE);
+		CloseHandle(m_handle);
+		m_started = false;
+	}
+}
+#else
+void* Thread::Entry(void* pSelf)
+{
+	Thread* pThread = (Thread*)pSelf;
+	pThread->m_routine(pThread->m_pArg);
+	return NULL;
+}
+
+bool Thread::Start(Routine routine, void* pArg)
+{
+	if (m_started)
+	{
+		return false;
+	}
+	m_routine = routine;
+	m_pArg = pArg;
+	m_started = (pthread_create(&m_handle, NULL, Entry, this) == 0);
+	return m_started;
+}
+
+void Thread::Join()
+{
+	if (m_started)
+	{
+		pthread_join(m_handle, NULL);
+		m_started = false;
+	}
+}
+#endif
+#pragma endregion
+#pragma region SharedMemory
+SharedMemory::SharedMemory() : m_pData(NULL), m_size(0)
+{
+#ifdef WIN32
+	m_handle = NULL;
+#else
+	m_name[0] = '\0';
+#endif
+}
+
+SharedMemory::~SharedMemory()
+{
+	Close();
+}
+
+#ifdef WIN32
+// Local\ keeps the name to the login session, no privileges needed. The
+// name lasts while anyone has it open, a creator that crashed included.
+bool SharedMemory::Create(const char* name, size_t size, bool takeOver)
+{
+	char path[MAX_PATH];
+	_snprintf_s(path, sizeof(path), _TRUNCATE, "Local\\%s", name);
+	m_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, path);
+	if (m_handle == NULL)
+	{
+		return false;
+	}
+	if (GetLastError() == ERROR_ALREADY_EXISTS && !takeOver)
+	{
+		Close();
+		return false;
+	}
+	m_pData = MapViewOfFile(m_handle, FILE_MAP_WRITE, 0, 0, size);
+	if (m_pData == NULL)
+	{
+		Close();
+		return false;
+	}
+	m_size = size;
+	return true;
+}
+
+bool SharedMemory::Open(const char* name, size_t size)
+{
+	char path[MAX_PATH];
+	_snprintf_s(path, sizeof(path), _TRUNCATE, "Local\\%s", name);
+	m_handle = OpenFileMappingA(FILE_MAP_READ, FALSE, path);
+	if (m_handle == NULL)
+	{
+		return false;
+	}
+	m_pData = MapViewOfFile(m_handle, FILE_MAP_READ, 0, 0, size);
+	if (m_pData == NULL)
+	{
+		Close();
+		return false;
+	}
+	m_size = size;
+	return true;
+}
+
+void SharedMemory::Close()
+{
+	if (m_pData != NULL)
+	{
+		UnmapViewOfFile(m_pData);
+		m_pData = NULL;
+	}
+	if (m_handle != NULL)
+	{
+		CloseHandle(m_handle);
+		m_handle = NULL;
+	}
+	m_size = 0;
+}
+#else
+// The name outlives a creator that crashed, until unlinked
+bool SharedMemory::Create(const char* name, size_t size, bool takeOver)
+{
+	snprintf(m_name, sizeof(m_name), "/%s", name);
+	int fd = shm_open(m_name, takeOver ? O_CREAT | O_RDWR : O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		m_name[0] = '\0';
+		return false;
+	}
+	void* pData = ftruncate(fd, (off_t)size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (pData == MAP_FAILED)
+	{
+		shm_unlink(m_name);
+		m_name[0] = '\0';
+		return false;
+	}
+	m_pData = pData;
+	m_size = size;
+	return true;
+}
+
+bool SharedMemory::Open(const char* name, size_t size)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/%s", name);
+	int fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	void* pData = fstat(fd, &info) == 0 && (size_t)info.st_size >= size ?
+		mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (pData == MAP_FAILED)
+	{
+		return false;
+	}
+	m_pData = pData;
+	m_size = size;
+	return true;
+}
+
+void SharedMemory::Close()
+{
+	if (m_pData != NULL)
+	{
+		munmap(m_pData, m_size);
+		m_pData = NULL;
+	}
+	if (m_name[0] != '\0')
+	{
+		shm_unlink(m_name);
+		m_name[0] = '\0';
+	}
+	m_size = 0;
+}
+#endif
+#pragma endregion
@@ -0,0 +1,176 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Threads, locks and clocks                               *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_PLATFORM_H_
+#define _MINDSTORM_PLATFORM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else // linux
+	#include <pthread.h>
+#endif // WIN32
+
+// Monotonic clock in microseconds, arbitrary origin
+uint64_t GetTimeMicros();
+void SleepMillis(unsigned int ms);
+void SleepMicros(unsigned int us);	// Rounded up to whole milliseconds on Windows
+// Processor time used so far, user and kernel, in microseconds. Windows
+// only counts it in scheduler ticks of about 15 ms.
+uint64_t GetThreadCpuMicros();		// Calling thread
+uint64_t GetProcessCpuMicros();		// All threads
+
+// Full barrier for plain loads and stores, e.g. of memory other processes
+// share, where AtomicInt's read-modify-write would need write access
+void MemoryFence();
+
+// Integer shared between threads without taking a lock
+class AtomicInt
+{
+	public:
+		AtomicInt(int value = 0) : m_value(value) {}
+
+		int Get() const;
+		void Set(int value);
+		int Increment();	// Returns the new value
+		int Add(int delta);	// Returns the new value
+
+	private:
+		AtomicInt(const AtomicInt&);
+		AtomicInt& operator=(const AtomicInt&);
+
+#ifdef WIN32
+		mutable volatile LONG	m_value;
+#else
+		mutable volatile int	m_value;
+#endif
+};
+
+class Mutex
+{
+	public:
+		Mutex();
+		~Mutex();
+		void Lock();
+		void Unlock();
+
+	private:
+		Mutex(const Mutex&);
+		Mutex& operator=(const Mutex&);
+
+#ifdef WIN32
+		CRITICAL_SECTION		m_section;
+#else
+		pthread_mutex_t			m_mutex;
+#endif
+};
+
+class ScopedLock
+{
+	public:
+		ScopedLock(Mutex& mutex) : m_mutex(mutex) { m_mutex.Lock(); }
+		~ScopedLock() { m_mutex.Unlock(); }
+
+	private:
+		ScopedLock(const ScopedLock&);
+		ScopedLock& operator=(const ScopedLock&);
+
+		Mutex&					m_mutex;
+};
+
+// Auto-reset event, wakes up a single waiting thread
+class Event
+{
+	public:
+		Event();
+		~Event();
+		void Signal();
+		bool Wait(unsigned int timeoutMs);	// False on timeout
+
+	private:
+		Event(const Event&);
+		Event& operator=(const Event&);
+
+#ifdef WIN32
+		HANDLE					m_handle;
+#else
+		pthread_mutex_t			m_mutex;
+		pthread_cond_t			m_cond;
+		bool					m_signalled;
+#endif
+};
+
+class Thread
+{
+	public:
+		typedef void (*Routine)(void* pArg);
+
+		Thread();
+		~Thread();	// Joins a still running thread
+
+		bool Start(Routine routine, void* pArg);
+		void Join();
+		bool IsStarted() const { return m_started; }
+
+	private:
+		Thread(const Thread&);
+		Thread& operator=(const Thread&);
+
+#ifdef WIN32
+		static DWORD WINAPI Entry(LPVOID pSelf);
+		HANDLE					m_handle;
+#else
+		static void* Entry(void* pSelf);
+		pthread_t				m_handle;
+#endif
+		Routine					m_routine;
+		void*					m_pArg;
+		bool					m_started;
+};
+
+// Named memory other processes on the machine map as well. Whoever creates
+// it may write; everyone else maps it read-only, so they can never change
+// what it holds, nor hold up its creator.
+class SharedMemory
+{
+	public:
+		SharedMemory();
+		~SharedMemory();	// Close()
+
+		// Fails when the name is taken, unless takeOver: the memory there is
+		// then written as it is, and unlinked by this one on Linux. Zeroed
+		// when new.
+		bool Create(const char* name, size_t size, bool takeOver);
+		bool Open(const char* name, size_t size);		// Read-only
+		// Unmaps, and the creator takes the name away on Linux; mappings
+		// others still have stay valid, but nothing is written to them
+		void Close();
+		void* GetData() const { return m_pData; }
+		bool IsOpen() const { return m_pData != NULL; }
+
+	private:
+		SharedMemory(const SharedMemory&);
+		SharedMemory& operator=(const SharedMemory&);
+
+#ifdef WIN32
+		HANDLE					m_handle;
+#else
+		char					m_name[64];		// Unlinked by the creator only, empty for others
+#endif
+		void*					m_pData;
+		size_t					m_size;
+};
+
+#endif // _MINDSTORM_PLATFORM_H_
@@ -0,0 +1,139 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Command rate limit adapted to the link round trip       *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "RateController.h"
+
+// Limits of the rate. In commands per second.
+const double g_minRate = 5;
+const double g_maxRate = 500;
+const double g_startRate = 100;
+// Added per round trip while the link keeps up. In commands per second.
+const double g_rateIncrease = 5;
+// Growth per round trip until the link first falls behind
+const double g_slowStartIncrease = 1.5;
+// Applied at most once per round trip when the link falls behind
+const double g_rateDecrease = 0.7;
+// Commands allowed to wait in front of the radio
+const int g_maxQueuedCommands = 2;
+// More than this many waiting at a round trip means the limit lets in more
+// than the radio carries, so the queue would sit at the cap
+const int g_behindQueuedCommands = 1;
+// Round trips longer than the base by this much mean a queue is building. In microseconds.
+const double g_queueingDelay = 20000;
+
+RateController::RateController() :
+	m_enabled(true), m_rate(g_startRate), m_tokens(0), m_lastRefill(0), m_lastDecrease(0), m_slowStart(true), m_queueBlocked(false),
+	m_rtt(0), m_baseRtt(0), m_rttSampleCount(0), m_sendRate(0), m_sendWindowStart(0), m_sendWindowCount(0)
+{
+}
+
+void RateController::Reset(uint64_t now)
+{
+	m_rate = g_startRate;
+	m_tokens = 2;
+	m_lastRefill = now;
+	m_lastDecrease = now;
+	m_slowStart = true;
+	m_queueBlocked = false;
+	m_rtt = 0;
+	m_baseRtt = 0;
+	m_rttSampleCount = 0;
+	m_sendWindowStart = now;
+	m_sendWindowCount = 0;
+}
+
+void RateController::Refill(uint64_t now)
+{
+	// One round trip worth of commands, never less than a synchronized pair
+	double capacity = m_rate * m_baseRtt / 1e6;
+	if (capacity < 2)
+	{
+		capacity = 2;
+	}
+	m_tokens += m_rate * (now - m_lastRefill) / 1e6;
+	if (m_tokens > capacity)
+	{
+		m_tokens = capacity;
+	}
+	m_lastRefill = now;
+}
+
+bool RateController::Admit(int commands, int queuedCommands, uint64_t now)
+{
+	if (!m_enabled)
+	{
+		return true;
+	}
+	Refill(now);
+	m_queueBlocked = queuedCommands + commands > g_maxQueuedCommands;
+	if (m_queueBlocked || m_tokens < commands)
+	{
+		return false;
+	}
+	m_tokens -= commands;
+	return true;
+}
+
+unsigned int RateController::GetRetryDelay() const
+{
+	if (m_queueBlocked)
+	{
+		// The radio sends a frame every few milliseconds
+		return 5;
+	}
+	double missing = m_tokens < 1 ? 1 - m_tokens : 0;
+	unsigned int delay = (unsigned int)(missing * 1000 / m_rate) + 1;
+	return delay;
+}
+
+void RateController::OnSent(int commands, uint64_t now)
+{
+	m_sendWindowCount += commands;
+	if (now - m_sendWindowStart >= 1000000)
+	{
+		m_sendRate = m_sendWindowCount * 1e6 / (now - m_sendWindowStart);
+		m_sendWindowStart = now;
+		m_sendWindowCount = 0;
+	}
+}
+
+void RateController::OnRoundTrip(uint64_t rttMicros, int queuedCommands, uint64_t now)
+{
+	m_rtt = m_rtt == 0 ? rttMicros : m_rtt * 7 / 8 + rttMicros / 8.0;
+
+	// Base is the shortest of the recent round trips, so it follows a link
+	// that got slower for good instead of backing off forever
+	m_rttSamples[m_rttSampleCount % 16] = rttMicros;
+	m_rttSampleCount++;
+	int samples = m_rttSampleCount < 16 ? m_rttSampleCount : 16;
+	m_baseRtt = (double)m_rttSamples[0];
+	for (int i = 1; i < samples; ++i)
+	{
+		if (m_rttSamples[i] < m_baseRtt)
+		{
+			m_baseRtt = (double)m_rttSamples[i];
+		}
+	}
+
+	bool behind = queuedCommands > g_behindQueuedCommands || rttMicros > m_baseRtt + g_queueingDelay;
+	if (behind)
+	{
+		m_slowStart = false;
+		if (now - m_lastDecrease >= (uint64_t)m_rtt)
+		{
+			m_rate = m_rate * g_rateDecrease > g_minRate ? m_rate * g_rateDecrease : g_minRate;
+			m_lastDecrease = now;
+		}
+	}
+	else
+	{
+		// Round trips are a few hundred milliseconds apart, so a fresh link
+		// finds its rate by doubling-like steps before probing additively
+		double rate = m_slowStart ? m_rate * g_slowStartIncrease : m_rate + g_rateIncrease;
+		m_rate = rate < g_maxRate ? rate : g_maxRate;
+	}
+}
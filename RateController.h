@@ -0,0 +1,62 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Command rate limit adapted to the link round trip       *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_RATE_CONTROLLER_H_
+#define _MINDSTORM_RATE_CONTROLLER_H_
+
+#include <stdint.h>
+
+// Keeps commands from piling up in front of a slow or congested radio.
+// The rate limit grows quickly on a new link and then additively while
+// round trips stay near the smallest one seen, and is cut multiplicatively
+// once they stretch or more than one command is still queued when a reply
+// comes back (AIMD). Commands are admitted from a token bucket filled at
+// that rate and sized to what the link carries in one round trip, and never
+// beyond two queued in front of the radio.
+class RateController
+{
+	public:
+		RateController();
+
+		void Reset(uint64_t now);		// New connection, forget the old link
+		void SetEnabled(bool enabled) { m_enabled = enabled; }
+		bool IsEnabled() const { return m_enabled; }
+
+		// False when the commands have to wait: no tokens left, or they would
+		// make more than a couple of commands queued in front of the radio
+		bool Admit(int commands, int queuedCommands, uint64_t now);
+		// How long to wait before Admit() can succeed again. In milliseconds.
+		unsigned int GetRetryDelay() const;
+
+		void OnSent(int commands, uint64_t now);
+		void OnRoundTrip(uint64_t rttMicros, int queuedCommands, uint64_t now);
+
+		double GetRate() const { return m_rate; }				// Commands per second
+		double GetSendRate() const { return m_sendRate; }		// Commands per second actually sent
+		double GetRtt() const { return m_rtt / 1000.0; }		// Smoothed, in milliseconds
+		double GetBaseRtt() const { return m_baseRtt / 1000.0; }
+
+	private:
+		void Refill(uint64_t now);
+
+		bool					m_enabled;
+		double					m_rate;
+		double					m_tokens;
+		uint64_t				m_lastRefill;
+		uint64_t				m_lastDecrease;
+		bool					m_slowStart;		// No decrease since Reset()
+		bool					m_queueBlocked;		// Last Admit() failed on the queue
+		double					m_rtt;				// In microseconds
+		double					m_baseRtt;
+		uint64_t				m_rttSamples[16];	// Recent round trips, for the base
+		int						m_rttSampleCount;
+		double					m_sendRate;
+		uint64_t				m_sendWindowStart;
+		int						m_sendWindowCount;
+};
+
+#endif // _MINDSTORM_RATE_CONTROLLER_H_
@@ -0,0 +1,853 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Robot link supervisor                                   *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "RobotLink.h"
+#include "BrickScheduler.h"
+#include <string.h>
+
+// Probe the brick when nothing else was sent for this long. In milliseconds.
+const unsigned int g_keepAliveInterval = 500;
+// Pipelined frames sent before a round trip confirms the brick still listens
+const int g_confirmEvery = 16;
+// Longest time between round trips while commands are sent, they also
+// measure the link for the rate control. In milliseconds.
+const unsigned int g_roundTripInterval = 200;
+// Shortest time between telemetry round trips on transports without
+// asynchronous replies, which hold back commands while they wait. Over
+// Bluetooth they then take under a third of the link's time. In milliseconds.
+const unsigned int g_syncTelemetryInterval = 80;
+// Reconnect backoff limits. In milliseconds.
+const unsigned int g_minReconnectDelay = 250;
+const unsigned int g_maxReconnectDelay = 8000;
+// Sent version of a mailbox whose stop message went out in place of it
+const int g_stopMessageVersion = -1;
+
+RobotLink::RobotLink(RobotTransport* pTransport, const char* programName, RobotLinkMode mode) :
+	m_pTransport(pTransport), m_programName(programName), m_mode(mode), m_pScheduler(NULL), m_brick(0), m_running(0), m_state(LINK_IDLE),
+	m_reconnectCount(0), m_stopPending(0), m_commandCount(0), m_confirmCount(0), m_telemetryOn(1), m_firstConnectTime(0),
+	m_decisionTime(0), m_maxAge(0), m_staleAction(STALE_STOP), m_droppedChanges(0),
+	m_sentValid(false), m_lastContact(0), m_unconfirmed(0), m_inStopLane(false),
+	m_throttled(false), m_firstPort(0), m_lastConfirm(0), m_inTurn(false), m_turnBytes(0),
+	m_stale(false), m_staleCount(0)
+{
+	RobotLinkMetrics metrics = {0, 0, 0, 0, 0, 0, 0, 0};
+	m_metrics = metrics;
+	for (int i = 0; i < MOTOR_PORT_COUNT; ++i)
+	{
+		m_wanted[i].power = 0;
+		m_wanted[i].brake = false;
+		m_wanted[i].syncPort = -1;
+		m_wanted[i].turnRatio = 0;
+		m_sent[i] = m_wanted[i];
+		m_pendingPorts[i] = 0;
+	}
+	for (int i = 0; i < NXT_MAILBOX_COUNT; ++i)
+	{
+		m_mailboxes[i].length = 0;
+		m_mailboxes[i].version = 0;
+		m_mailboxes[i].urgent = false;
+		m_mailboxes[i].stopLength = 0;
+		m_sentVersions[i] = 0;
+		m_pendingMailboxes[i] = 0;
+	}
+}
+
+RobotLink::~RobotLink()
+{
+	Shutdown();
+}
+
+bool RobotLink::Start()
+{
+	if (m_thread.IsStarted())
+	{
+		return false;
+	}
+	m_running.Set(1);
+	m_state.Set(LINK_CONNECTING);
+	return m_thread.Start(LinkThread, this);
+}
+
+void RobotLink::Shutdown()
+{
+	if (!m_thread.IsStarted())
+	{
+		return;
+	}
+	m_running.Set(0);
+	m_wake.Signal();
+	m_thread.Join();
+
+	if (GetState() == LINK_CONNECTED)
+	{
+		MotorState stop = {0, true, -1, 0};
+		BeginTurn();
+		m_inStopLane = true;
+		for (int port = 0; port < MOTOR_PORT_COUNT; ++port)
+		{
+			SendMotor(port, stop);
+		}
+		FlushBatch();
+		m_inStopLane = false;
+		EndTurn();
+		m_pTransport->StopProgram();
+	}
+	m_pTransport->Close();
+	m_state.Set(LINK_IDLE);
+}
+
+void RobotLink::SetForward(int port, int power)
+{
+	SetMotor(port, power, false);
+}
+
+void RobotLink::SetReverse(int port, int power)
+{
+	SetMotor(port, -power, false);
+}
+
+void RobotLink::Stop(int port, bool brake)
+{
+	SetMotor(port, 0, brake);
+}
+
+void RobotLink::SetMotor(int port, int power, bool brake)
+{
+	if (port < 0 || port >= MOTOR_PORT_COUNT)
+	{
+		return;
+	}
+	{
+		ScopedLock lock(m_lock);
+		MotorState& wanted = m_wanted[port];
+		if (wanted.power == power && wanted.brake == brake && wanted.syncPort < 0)
+		{
+			return;
+		}
+		if (wanted.syncPort >= 0)
+		{
+			// Partner keeps running on its own regulation
+			m_wanted[wanted.syncPort].syncPort = -1;
+			m_wanted[wanted.syncPort].turnRatio = 0;
+		}
+		wanted.power = power;
+		wanted.brake = brake;
+		wanted.syncPort = -1;
+		wanted.turnRatio = 0;
+		m_pendingPorts[port]++;
+		if (IsStop(wanted))
+		{
+			RaiseStop();
+		}
+	}
+	m_wake.Signal();
+}
+
+void RobotLink::SetSynchronized(int firstPort, int secondPort, int power, int turnRatio)
+{
+	if (firstPort < 0 || firstPort >= MOTOR_PORT_COUNT || secondPort < 0 || secondPort >= MOTOR_PORT_COUNT || firstPort == secondPort)
+	{
+		return;
+	}
+	{
+		ScopedLock lock(m_lock);
+		MotorState& first = m_wanted[firstPort];
+		MotorState& second = m_wanted[secondPort];
+		if (first.syncPort == secondPort && first.power == power && first.turnRatio == turnRatio)
+		{
+			return;
+		}
+		if (first.syncPort >= 0 && first.syncPort != secondPort)
+		{
+			m_wanted[first.syncPort].syncPort = -1;
+		}
+		if (second.syncPort >= 0 && second.syncPort != firstPort)
+		{
+			m_wanted[second.syncPort].syncPort = -1;
+		}
+		first.power = second.power = power;
+		first.brake = second.brake = (power == 0);
+		first.turnRatio = second.turnRatio = turnRatio;
+		first.syncPort = secondPort;
+		second.syncPort = firstPort;
+		m_pendingPorts[firstPort < secondPort ? firstPort : secondPort]++;
+		if (IsStop(first))
+		{
+			RaiseStop();
+		}
+	}
+	m_wake.Signal();
+}
+
+void RobotLink::EmergencyStop(bool brake)
+{
+	{
+		ScopedLock lock(m_lock);
+		for (int port = 0; port < MOTOR_PORT_COUNT; ++port)
+		{
+			// Synchronized pairs stay paired, so both wheels stop together
+			m_wanted[port].power = 0;
+			m_wanted[port].brake = brake;
+			m_wanted[port].turnRatio = 0;
+		}
+		RaiseStop();
+	}
+	m_wake.Signal();
+}
+
+void RobotLink::WriteMailbox(int mailbox, const unsigned char* pMessage, int length, bool urgent)
+{
+	if (mailbox < 0 || mailbox >= NXT_MAILBOX_COUNT || length < 0 || length >= NXT_MAX_MESSAGE_SIZE)
+	{
+		return;
+	}
+	{
+		ScopedLock lock(m_lock);
+		memcpy(m_mailboxes[mailbox].message, pMessage, length);
+		m_mailboxes[mailbox].length = length;
+		m_mailboxes[mailbox].version++;
+		m_mailboxes[mailbox].urgent = urgent;
+		m_pendingMailboxes[mailbox]++;
+		if (urgent)
+		{
+			RaiseStop();
+		}
+	}
+	m_wake.Signal();
+}
+
+void RobotLink::SetFreshness(unsigned int maxAgeMs, StaleAction action)
+{
+	ScopedLock lock(m_lock);
+	m_maxAge = (uint64_t)maxAgeMs * 1000;
+	m_staleAction = action;
+}
+
+void RobotLink::SetDecisionTime(uint64_t frameTime)
+{
+	ScopedLock lock(m_lock);
+	m_decisionTime = frameTime;
+}
+
+void RobotLink::SetStopMessage(int mailbox, const unsigned char* pMessage, int length)
+{
+	if (mailbox < 0 || mailbox >= NXT_MAILBOX_COUNT || length < 0 || length >= NXT_MAX_MESSAGE_SIZE)
+	{
+		return;
+	}
+	ScopedLock lock(m_lock);
+	memcpy(m_mailboxes[mailbox].stopMessage, pMessage, length);
+	m_mailboxes[mailbox].stopLength = length;
+}
+
+// Called with m_lock held
+bool RobotLink::IsStale(uint64_t now) const
+{
+	return m_maxAge > 0 && m_decisionTime != 0 && now > m_decisionTime + m_maxAge;
+}
+
+// Called with m_lock held. Milliseconds until the latest decision goes
+// stale, g_keepAliveInterval when it never will.
+unsigned int RobotLink::GetStaleDelay(uint64_t now) const
+{
+	if (m_maxAge == 0 || m_decisionTime == 0 || now > m_decisionTime + m_maxAge)
+	{
+		return g_keepAliveInterval;
+	}
+	return (unsigned int)((m_decisionTime + m_maxAge - now) / 1000) + 1;
+}
+
+// Called with m_lock held
+void RobotLink::RaiseStop()
+{
+	m_stopPending.Set(1);
+	if (m_pScheduler != NULL)
+	{
+		m_pScheduler->Expedite(m_brick);
+	}
+}
+
+void RobotLink::SetScheduler(BrickScheduler* pScheduler, int brick)
+{
+	m_pScheduler = pScheduler;
+	m_brick = brick;
+}
+
+void RobotLink::SetRateControl(bool enabled)
+{
+	ScopedLock lock(m_lock);
+	m_rate.SetEnabled(enabled);
+}
+
+RobotLinkMetrics RobotLink::GetMetrics() const
+{
+	ScopedLock lock(m_lock);
+	return m_metrics;
+}
+
+void RobotLink::LinkThread(void* pSelf)
+{
+	((RobotLink*)pSelf)->Supervise();
+}
+
+void RobotLink::Supervise()
+{
+	unsigned int reconnectDelay = g_minReconnectDelay;
+
+	while (m_running.Get())
+	{
+		if (GetState() != LINK_CONNECTED)
+		{
+			if (!Connect())
+			{
+				// Shutdown() cuts the wait short
+				m_wake.Wait(reconnectDelay);
+				reconnectDelay = reconnectDelay * 2 < g_maxReconnectDelay ? reconnectDelay * 2 : g_maxReconnectDelay;
+				continue;
+			}
+			reconnectDelay = g_minReconnectDelay;
+		}
+
+		// The turn is taken before the wanted state is read, so whatever
+		// arrives while waiting for it goes out instead of older commands
+		int commands = m_commandCount.Get();
+		bool turn = m_pScheduler != NULL && HasChanges();
+		if (turn)
+		{
+			BeginTurn();
+		}
+		bool sent = SendChanges();
+		if (turn)
+		{
+			EndTurn();
+		}
+		if (!sent)
+		{
+			Disconnect();
+			continue;
+		}
+		bool idle = m_commandCount.Get() == commands;
+
+		if (IsPreempted())
+		{
+			// The stop lane goes first, the round trip can wait
+			continue;
+		}
+		uint64_t now = GetTimeMicros();
+		if (m_unconfirmed >= g_confirmEvery || now - m_lastContact >= g_keepAliveInterval * 1000 ||
+			(m_unconfirmed > 0 && now - m_lastConfirm >= g_roundTripInterval * 1000))
+		{
+			if (!Confirm())
+			{
+				Disconnect();
+				continue;
+			}
+		}
+		if (!PollTelemetry(idle))
+		{
+			Disconnect();
+			continue;
+		}
+		UpdateMetrics();
+
+		unsigned int wait = m_throttled ? m_rate.GetRetryDelay() : g_keepAliveInterval;
+		{
+			// Stale motion is caught without waiting for the tracker
+			ScopedLock lock(m_lock);
+			unsigned int staleDelay = GetStaleDelay(GetTimeMicros());
+			wait = staleDelay < wait ? staleDelay : wait;
+		}
+		if (m_telemetryOn.Get())
+		{
+			unsigned int pollDelay = m_telemetry.GetPollDelay(GetTimeMicros());
+			wait = pollDelay < wait ? pollDelay : wait;
+		}
+		m_wake.Wait(wait);
+	}
+}
+
+bool RobotLink::Connect()
+{
+	m_batch.Clear();
+	if (!m_pTransport->Open() || !m_pTransport->StartProgram(m_programName))
+	{
+		m_pTransport->Close();
+		return false;
+	}
+
+	// Whatever the brick did before, everything wanted must be sent again.
+	// Motion held back as stale is compared with a program that just
+	// started, so it goes out once fresh.
+	m_sentValid = false;
+	for (int i = 0; i < MOTOR_PORT_COUNT; ++i)
+	{
+		MotorState idle = {0, false, -1, 0};
+		m_sent[i] = idle;
+	}
+	for (int i = 0; i < NXT_MAILBOX_COUNT; ++i)
+	{
+		m_sentVersions[i] = 0;
+	}
+	m_unconfirmed = 0;
+	m_lastContact = GetTimeMicros();
+	m_lastConfirm = m_lastContact;
+	m_telemetry.Reset();
+	{
+		ScopedLock lock(m_lock);
+		m_rate.Reset(m_lastContact);
+	}
+	if (m_firstConnectTime == 0)
+	{
+		m_firstConnectTime = m_lastContact;
+	}
+	else
+	{
+		m_reconnectCount.Increment();
+	}
+	m_state.Set(LINK_CONNECTED);
+	return true;
+}
+
+bool RobotLink::SendChanges()
+{
+	// Stops raised after this point preempt the motion lane below
+	m_stopPending.Set(0);
+	m_throttled = false;
+	MotorState wanted[MOTOR_PORT_COUNT];
+	int pickedPorts[MOTOR_PORT_COUNT];
+	int pickedMailboxes[NXT_MAILBOX_COUNT];
+	StaleAction staleAction = STALE_STOP;
+	{
+		ScopedLock lock(m_lock);
+		for (int i = 0; i < MOTOR_PORT_COUNT; ++i)
+		{
+			wanted[i] = m_wanted[i];
+			pickedPorts[i] = m_pendingPorts[i];
+		}
+		for (int i = 0; i < NXT_MAILBOX_COUNT; ++i)
+		{
+			pickedMailboxes[i] = m_pendingMailboxes[i];
+		}
+		bool stale = IsStale(GetTimeMicros());
+		m_staleCount += (stale && !m_stale) ? 1 : 0;
+		m_stale = stale;
+		staleAction = m_staleAction;
+	}
+	if (m_stale && staleAction == STALE_STOP)
+	{
+		// Pairs stay paired, as in EmergencyStop(). The wanted state itself
+		// is kept and goes out again once decisions are fresh.
+		for (int i = 0; i < MOTOR_PORT_COUNT; ++i)
+		{
+			wanted[i].power = 0;
+			wanted[i].brake = true;
+			wanted[i].turnRatio = 0;
+		}
+	}
+
+	// Stop lane: one write, no waiting for replies even when acknowledged;
+	// the round trip that follows confirms it
+	m_inStopLane = true;
+	bool stopped = SendLane(true, wanted) && FlushBatch();
+	m_inStopLane = false;
+	if (!stopped)
+	{
+		return false;
+	}
+	if (m_mode == LINK_ACKNOWLEDGED && m_unconfirmed > 0 && !Confirm())
+	{
+		return false;
+	}
+
+	// Stale motion is not sent at all, whatever the action
+	if (!m_stale && (!SendLane(false, wanted) || !FlushBatch()))
+	{
+		return false;
+	}
+	if (!IsPreempted())
+	{
+		m_sentValid = true;
+	}
+	if (!m_stale && !m_throttled && !IsPreempted())
+	{
+		// Everything picked up went out, changes beyond one per port or
+		// mailbox were overtaken before they could
+		ScopedLock lock(m_lock);
+		for (int i = 0; i < MOTOR_PORT_COUNT; ++i)
+		{
+			m_droppedChanges += pickedPorts[i] > 1 ? pickedPorts[i] - 1 : 0;
+			m_pendingPorts[i] -= pickedPorts[i];
+		}
+		for (int i = 0; i < NXT_MAILBOX_COUNT; ++i)
+		{
+			m_droppedChanges += pickedMailboxes[i] > 1 ? pickedMailboxes[i] - 1 : 0;
+			m_pendingMailboxes[i] -= pickedMailboxes[i];
+		}
+	}
+	return true;
+}
+
+// Only asked with a shared adapter, so a brick with nothing new does not
+// wait for a turn
+bool RobotLink::HasChanges() const
+{
+	if (!m_sentValid)
+	{
+		return true;
+	}
+	ScopedLock lock(m_lock);
+	if (IsStale(GetTimeMicros()) != m_stale)
+	{
+		return true;
+	}
+	for (int port = 0; port < MOTOR_PORT_COUNT; ++port)
+	{
+		if (!SameState(m_wanted[port], m_sent[port]))
+		{
+			return true;
+		}
+	}
+	for (int mailbox = 0; mailbox < NXT_MAILBOX_COUNT; ++mailbox)
+	{
+		if (m_mailboxes[mailbox].version != 0 && m_mailboxes[mailbox].version != m_sentVersions[mailbox])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void RobotLink::BeginTurn()
+{
+	if (m_pScheduler != NULL)
+	{
+		m_pScheduler->Acquire(m_brick);
+		m_inTurn = true;
+		m_turnBytes = 0;
+	}
+}
+
+void RobotLink::EndTurn()
+{
+	if (m_inTurn)
+	{
+		m_inTurn = false;
+		m_pScheduler->Release(m_brick, m_turnBytes);
+	}
+}
+
+// Sends the wanted ports and mailboxes of one lane that differ from what the
+// brick has. The motion lane stops early when a stop is waiting.
+bool RobotLink::SendLane(bool stops, const MotorState* pWanted)
+{
+	// A throttled motion lane resumes where it stopped, so every port gets its turn
+	int firstPort = stops ? 0 : m_firstPort;
+	for (int i = 0; i < MOTOR_PORT_COUNT; ++i)
+	{
+		int port = (firstPort + i) % MOTOR_PORT_COUNT;
+		const MotorState& state = pWanted[port];
+		if (IsStop(state) != stops || (m_sentValid && SameState(state, m_sent[port])))
+		{
+			continue;
+		}
+		// The pair is handled by its lower port
+		if (state.syncPort >= 0 && state.syncPort < port)
+		{
+			continue;
+		}
+		if (!stops && (IsPreempted() || !AdmitMotion(state.syncPort >= 0 ? 2 : 1)))
+		{
+			m_firstPort = port;
+			return true;
+		}
+		if (state.syncPort >= 0)
+		{
+			if (!SendSynchronized(port, state.syncPort, state))
+			{
+				return false;
+			}
+			m_sent[state.syncPort] = pWanted[state.syncPort];
+		}
+		else if (!SendMotor(port, state))
+		{
+			return false;
+		}
+		m_sent[port] = state;
+	}
+	return SendMessages(stops);
+}
+
+bool RobotLink::SendMessages(bool stops)
+{
+	for (int mailbox = 0; mailbox < NXT_MAILBOX_COUNT; ++mailbox)
+	{
+		unsigned char frame[NXT_MAX_FRAME_SIZE];
+		int length = 0;
+		int version = 0;
+		{
+			ScopedLock lock(m_lock);
+			const Mailbox& wanted = m_mailboxes[mailbox];
+			if (m_stale && m_staleAction == STALE_STOP && wanted.stopLength > 0)
+			{
+				// In place of the wanted message, which differs from the
+				// sent version afterwards and so goes out again once fresh
+				if (!stops || (m_sentValid && m_sentVersions[mailbox] == g_stopMessageVersion))
+				{
+					continue;
+				}
+				length = EncodeMessageWrite(frame, mailbox, wanted.stopMessage, wanted.stopLength, false);
+				version = g_stopMessageVersion;
+			}
+			else if (wanted.version == 0 || wanted.urgent != stops || (m_sentValid && wanted.version == m_sentVersions[mailbox]))
+			{
+				continue;
+			}
+			else
+			{
+				length = EncodeMessageWrite(frame, mailbox, wanted.message, wanted.length, false);
+				version = wanted.version;
+			}
+		}
+		if (!stops && (IsPreempted() || !AdmitMotion(1)))
+		{
+			return true;
+		}
+		if (!SendFrame(frame, length))
+		{
+			return false;
+		}
+		m_sentVersions[mailbox] = version;
+	}
+	return true;
+}
+
+// Same output state as NXT::Motor::SetForward/SetReverse/Stop: speed
+// regulation while running, coasting leaves the motor idle
+bool RobotLink::SendMotor(int port, const MotorState& state)
+{
+	NxtOutputState output;
+	output.port = port;
+	output.power = state.power;
+	output.turnRatio = 0;
+	output.tachoLimit = 0;
+	if (state.power == 0 && !state.brake)
+	{
+		output.mode = 0;
+		output.regulation = NXT_REGULATION_IDLE;
+		output.runState = NXT_RUNSTATE_IDLE;
+	}
+	else
+	{
+		output.mode = NXT_MODE_MOTORON | NXT_MODE_BRAKE | NXT_MODE_REGULATED;
+		output.regulation = NXT_REGULATION_MOTOR_SPEED;
+		output.runState = NXT_RUNSTATE_RUNNING;
+	}
+
+	unsigned char frame[NXT_SETOUTPUTSTATE_SIZE];
+	EncodeSetOutputState(frame, output, false);
+	return SendFrame(frame, NXT_SETOUTPUTSTATE_SIZE);
+}
+
+// Both ports get the same power and turn ratio; the brick then keeps them in
+// step, so neither motor starts ahead of the other. No reply is requested.
+bool RobotLink::SendSynchronized(int firstPort, int secondPort, const MotorState& state)
+{
+	NxtOutputState output;
+	output.power = state.power;
+	output.mode = NXT_MODE_MOTORON | NXT_MODE_REGULATED | (state.brake ? NXT_MODE_BRAKE : 0);
+	output.regulation = NXT_REGULATION_MOTOR_SYNC;
+	output.turnRatio = state.turnRatio;
+	output.runState = NXT_RUNSTATE_RUNNING;
+	output.tachoLimit = 0;
+
+	unsigned char frames[2][NXT_SETOUTPUTSTATE_SIZE];
+	output.port = firstPort;
+	EncodeSetOutputState(frames[0], output, false);
+	output.port = secondPort;
+	EncodeSetOutputState(frames[1], output, false);
+
+	return SendFrame(frames[0], NXT_SETOUTPUTSTATE_SIZE) && SendFrame(frames[1], NXT_SETOUTPUTSTATE_SIZE);
+}
+
+// Frames come encoded without a reply. Pipelined, they are collected into
+// one batch that FlushBatch() writes at once, without waiting for the brick;
+// acknowledged, each one asks for its status reply first.
+bool RobotLink::SendFrame(unsigned char* pFrame, int length)
+{
+	if (m_mode == LINK_PIPELINED || m_inStopLane)
+	{
+		pFrame[0] = NXT_DIRECT_COMMAND_NO_REPLY;
+		if (m_batch.Append(pFrame, length))
+		{
+			return true;
+		}
+		return FlushBatch() && m_batch.Append(pFrame, length);
+	}
+
+	unsigned char reply[NXT_STATUS_REPLY_SIZE];
+	pFrame[0] = NXT_DIRECT_COMMAND;
+	uint64_t sent = GetTimeMicros();
+	m_turnBytes += NXT_BT_LENGTH_SIZE + length;
+	if (!m_pTransport->Transact(pFrame, length, reply, NXT_STATUS_REPLY_SIZE))
+	{
+		return false;
+	}
+	m_commandCount.Increment();
+	m_unconfirmed = 0;
+	m_lastContact = GetTimeMicros();
+	m_rate.OnSent(1, m_lastContact);
+	m_rate.OnRoundTrip(m_lastContact - sent, GetQueuedCommands(), m_lastContact);
+	return true;
+}
+
+bool RobotLink::FlushBatch()
+{
+	if (m_batch.IsEmpty())
+	{
+		return true;
+	}
+	int count = m_batch.GetCount();
+	m_turnBytes += m_batch.GetLength();
+	bool sent = m_pTransport->SendBatch(m_batch.GetData(), m_batch.GetLength());
+	m_batch.Clear();
+	if (!sent)
+	{
+		return false;
+	}
+	m_commandCount.Add(count);
+	m_unconfirmed += count;
+	m_lastContact = GetTimeMicros();
+	m_rate.OnSent(count, m_lastContact);
+	return true;
+}
+
+// One round trip; the reply also proves every pipelined frame before it was
+// received, since the brick handles commands in order. Transports without
+// asynchronous replies read telemetry here, on a round trip made anyway.
+bool RobotLink::Confirm()
+{
+	unsigned char frame[NXT_MAX_FRAME_SIZE];
+	unsigned char reply[NXT_MAX_FRAME_SIZE];
+	uint64_t sent = GetTimeMicros();
+	bool telemetry = m_telemetryOn.Get() && !m_pTransport->HasAsyncReplies();
+	int length = telemetry ? m_telemetry.EncodeRequest(frame, sent) : EncodeKeepAlive(frame);
+	int replyLength = GetReplySize(frame[1]);
+	if (!m_pTransport->Transact(frame, length, reply, replyLength))
+	{
+		return false;
+	}
+	m_confirmCount.Increment();
+	m_unconfirmed = 0;
+	m_lastContact = m_lastConfirm = GetTimeMicros();
+	if (telemetry)
+	{
+		m_telemetry.OnReply(reply, replyLength, m_lastContact);
+	}
+	m_rate.OnRoundTrip(m_lastContact - sent, GetQueuedCommands(), m_lastContact);
+	return true;
+}
+
+// Telemetry has the lowest priority: requests only go out on a pass that had
+// no command to send and with nothing waiting in front of the radio, so they
+// never hold back a command. A link saturated by motion gets no telemetry.
+// Replies are collected without waiting. Transports without asynchronous
+// replies make a round trip for each request instead, on an idle pass and
+// never closer than g_syncTelemetryInterval to the last round trip.
+bool RobotLink::PollTelemetry(bool idle)
+{
+	if (!m_pTransport->HasAsyncReplies())
+	{
+		uint64_t now = GetTimeMicros();
+		if (!m_telemetryOn.Get() || !idle || m_throttled || IsPreempted() ||
+			now - m_lastConfirm < g_syncTelemetryInterval * 1000 || !m_telemetry.WantsRequest(now))
+		{
+			return true;
+		}
+		return Confirm();
+	}
+	unsigned char reply[NXT_MAX_FRAME_SIZE];
+	int length;
+	while ((length = m_pTransport->ReceiveReply(reply, NXT_MAX_FRAME_SIZE)) > 0)
+	{
+		m_lastContact = GetTimeMicros();
+		m_telemetry.OnReply(reply, length, m_lastContact);
+	}
+	if (length < 0)
+	{
+		return false;
+	}
+
+	uint64_t now = GetTimeMicros();
+	if (!m_telemetryOn.Get() || !idle || m_throttled || IsPreempted() || m_pTransport->GetQueuedBytes() > 0)
+	{
+		return true;
+	}
+	NxtBatch<TELEMETRY_MAX_IN_FLIGHT * (NXT_BT_LENGTH_SIZE + NXT_GETOUTPUTSTATE_SIZE)> requests;
+	while (m_telemetry.WantsRequest(now))
+	{
+		requests.Commit(m_telemetry.EncodeRequest(requests.Reserve(), now));
+	}
+	if (requests.IsEmpty())
+	{
+		return true;
+	}
+	BeginTurn();
+	m_turnBytes += requests.GetLength();
+	bool sent = m_pTransport->SendBatch(requests.GetData(), requests.GetLength());
+	EndTurn();
+	return sent;
+}
+
+// Frames still in the batch count as queued too
+bool RobotLink::AdmitMotion(int commands)
+{
+	bool admitted;
+	{
+		ScopedLock lock(m_lock);
+		admitted = m_rate.Admit(commands, GetQueuedCommands() + m_batch.GetCount(), GetTimeMicros());
+	}
+	if (!admitted)
+	{
+		m_throttled = true;
+	}
+	return admitted;
+}
+
+// Measured in output state frames. Transports that cannot tell, like
+// NXT++, leave it to the round trip time.
+int RobotLink::GetQueuedCommands() const
+{
+	const int frameSize = NXT_BT_LENGTH_SIZE + NXT_SETOUTPUTSTATE_SIZE;
+	return (m_pTransport->GetQueuedBytes() + frameSize - 1) / frameSize;
+}
+
+void RobotLink::UpdateMetrics()
+{
+	RobotLinkMetrics metrics;
+	ScopedLock lock(m_lock);
+	metrics.rateLimit = m_rate.IsEnabled() ? m_rate.GetRate() : 0;
+	metrics.sendRate = m_rate.GetSendRate();
+	metrics.rttMs = m_rate.GetRtt();
+	metrics.baseRttMs = m_rate.GetBaseRtt();
+	metrics.queueDepth = GetQueuedCommands();
+	metrics.droppedChanges = m_droppedChanges;
+	metrics.staleCount = m_staleCount;
+	metrics.decisionAgeMs = m_decisionTime != 0 ? (GetTimeMicros() - m_decisionTime) / 1000.0 : 0;
+	m_metrics = metrics;
+}
+
+bool RobotLink::SameState(const MotorState& a, const MotorState& b)
+{
+	return a.power == b.power && a.brake == b.brake && a.syncPort == b.syncPort && a.turnRatio == b.turnRatio;
+}
+
+void RobotLink::Disconnect()
+{
+	m_pTransport->Close();
+	m_sentValid = false;
+	m_state.Set(LINK_RECONNECTING);
+}
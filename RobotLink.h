@@ -0,0 +1,230 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Robot link supervisor                                   *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_ROBOT_LINK_H_
+#define _MINDSTORM_ROBOT_LINK_H_
+
+#include "Platform.h"
+#include "RobotTransport.h"
+#include "NxtProtocol.h"
+#include "RateController.h"
+#include "Telemetry.h"
+
+class BrickScheduler;
+
+enum RobotLinkState
+{
+	LINK_IDLE,			// Start() not called yet, or Shutdown() done
+	LINK_CONNECTING,	// First connection attempt in progress
+	LINK_CONNECTED,
+	LINK_RECONNECTING	// Link was lost, retrying with backoff
+};
+
+// Bytes of pipelined frames handed to the transport in one write
+#define LINK_BATCH_SIZE		256
+
+enum RobotLinkMode
+{
+	LINK_PIPELINED,		// Commands go out without replies, a status round trip
+						// every few commands confirms the link
+	LINK_ACKNOWLEDGED	// Every command waits for its reply
+};
+
+// What the link sends once the wanted motion was decided from a frame older
+// than the freshness limit
+enum StaleAction
+{
+	STALE_HOLD,			// Nothing new, the motors keep the last fresh command
+	STALE_STOP			// Motors and mailboxes with a stop message stopped
+};
+
+// Live view of the link for the display, refreshed by the link thread
+struct RobotLinkMetrics
+{
+	double rateLimit;		// Commands per second allowed, 0 when not limited
+	double sendRate;		// Commands per second sent over the last second
+	double rttMs;			// Smoothed round trip
+	double baseRttMs;		// Shortest recent round trip
+	int queueDepth;			// Commands waiting in front of the radio
+	int droppedChanges;		// Wanted states replaced before they went out
+	int staleCount;			// Times the wanted motion went stale
+	double decisionAgeMs;	// Age of the latest decision, 0 without SetDecisionTime()
+};
+
+// Owns the transport on a background thread. The tracker only records the
+// motor state it wants; the link thread sends it, notices when the brick
+// stops answering, reconnects with exponential backoff and then resends
+// the latest wanted state. Nothing here blocks the caller on Bluetooth.
+//
+// Changes go out in two lanes. Stops (power 0 and urgent messages) are
+// sent first, in one write without waiting for replies. Motion follows,
+// and is abandoned as soon as a new stop arrives, which then overtakes it.
+// Motion is also held back by a RateController, so on a congested link
+// intermediate states are skipped instead of queued. Telemetry requests
+// only use passes that had nothing else to send.
+class RobotLink
+{
+	public:
+		RobotLink(RobotTransport* pTransport, const char* programName, RobotLinkMode mode = LINK_PIPELINED);
+		~RobotLink();
+
+		bool Start();
+		void Shutdown();	// Stops the motors and the program, closes the link
+
+		// Same meaning as the NXT::Motor calls, only the latest state is sent
+		void SetForward(int port, int power);
+		void SetReverse(int port, int power);
+		void Stop(int port, bool brake);
+
+		// Runs two motors under the brick's synchronized regulation. Turn ratio
+		// in -100..100: 0 drives straight, 100 spins with the lower numbered
+		// port forward and the other in reverse. Power 0 brakes both.
+		void SetSynchronized(int firstPort, int secondPort, int power, int turnRatio);
+
+		// Message for a mailbox of the program on the brick. Only the latest
+		// message per mailbox is sent, and sent again after a reconnect.
+		// Urgent messages, like a stop intent, go in the stop lane.
+		void WriteMailbox(int mailbox, const unsigned char* pMessage, int length, bool urgent = false);
+
+		// Every motor to 0 at once, ahead of anything else waiting
+		void EmergencyStop(bool brake);
+
+		// Steering freshness, off until SetDecisionTime() is first called.
+		// Motion decided from a frame older than maxAgeMs is not sent and
+		// the action taken instead; the link thread checks on its own, so a
+		// stalled tracker is caught too. 0 turns it off.
+		void SetFreshness(unsigned int maxAgeMs, StaleAction action);
+		// Host time the frame behind the wanted state was captured, given
+		// with every tracker frame whether the wanted state changed or not
+		void SetDecisionTime(uint64_t frameTime);
+		// Message that stops what the mailbox drives, sent in its place
+		// while decisions are stale under STALE_STOP
+		void SetStopMessage(int mailbox, const unsigned char* pMessage, int length);
+
+		RobotLinkState GetState() const { return (RobotLinkState)m_state.Get(); }
+		bool IsConnected() const { return GetState() == LINK_CONNECTED; }
+		int GetReconnectCount() const { return m_reconnectCount.Get(); }
+		// Time of the first successful connection, valid once connected
+		uint64_t GetFirstConnectTime() const { return m_firstConnectTime; }
+		// Frames sent, and round trips made to confirm the link
+		int GetCommandCount() const { return m_commandCount.Get(); }
+		int GetConfirmCount() const { return m_confirmCount.Get(); }
+
+		// Adaptive rate control of motion commands, on by default
+		void SetRateControl(bool enabled);
+		RobotLinkMetrics GetMetrics() const;
+
+		// Battery and motor readings, on by default. GetTelemetry() never
+		// blocks, the steering and display code may call it every frame.
+		void SetTelemetry(bool enabled) { m_telemetryOn.Set(enabled ? 1 : 0); }
+		RobotTelemetry GetTelemetry() const { return m_telemetry.Read(); }
+
+		// Set by BrickScheduler::AddBrick() before Start(). Sends then wait
+		// for the brick's turn on the shared adapter; an acknowledged link
+		// holds it through the replies to its commands.
+		void SetScheduler(BrickScheduler* pScheduler, int brick);
+
+	private:
+		RobotLink(const RobotLink&);
+		RobotLink& operator=(const RobotLink&);
+
+		struct MotorState
+		{
+			int power;
+			bool brake;
+			int syncPort;	// Partner port under synchronized regulation, -1 if none
+			int turnRatio;
+		};
+
+		struct Mailbox
+		{
+			unsigned char message[NXT_MAX_MESSAGE_SIZE];
+			int length;
+			int version;	// Bumped by every post, 0 when never posted
+			bool urgent;
+			unsigned char stopMessage[NXT_MAX_MESSAGE_SIZE];
+			int stopLength;	// 0 without a stop message
+		};
+
+		static void LinkThread(void* pSelf);
+		void Supervise();
+		bool Connect();
+		bool SendChanges();
+		bool HasChanges() const;
+		bool IsStale(uint64_t now) const;
+		unsigned int GetStaleDelay(uint64_t now) const;
+		void BeginTurn();
+		void EndTurn();
+		bool SendLane(bool stops, const MotorState* pWanted);
+		bool SendMotor(int port, const MotorState& state);
+		bool SendSynchronized(int firstPort, int secondPort, const MotorState& state);
+		bool SendMessages(bool stops);
+		bool SendFrame(unsigned char* pFrame, int length);
+		bool FlushBatch();
+		bool Confirm();
+		bool PollTelemetry(bool idle);
+		bool AdmitMotion(int commands);
+		int GetQueuedCommands() const;
+		void UpdateMetrics();
+		static bool SameState(const MotorState& a, const MotorState& b);
+		static bool IsStop(const MotorState& state) { return state.power == 0; }
+		bool IsPreempted() const { return m_stopPending.Get() != 0; }
+		void Disconnect();
+		void SetMotor(int port, int power, bool brake);
+		void RaiseStop();
+
+		RobotTransport*			m_pTransport;
+		const char*				m_programName;
+		RobotLinkMode			m_mode;
+		BrickScheduler*			m_pScheduler;	// NULL when the adapter is not shared
+		int						m_brick;
+
+		Thread					m_thread;
+		Event					m_wake;
+		AtomicInt				m_running;
+		AtomicInt				m_state;
+		AtomicInt				m_reconnectCount;
+		AtomicInt				m_stopPending;	// Set by stops the link thread has not picked up
+		AtomicInt				m_commandCount;
+		AtomicInt				m_confirmCount;
+		AtomicInt				m_telemetryOn;
+		uint64_t				m_firstConnectTime;
+
+		// Written by the tracker, read by the link thread
+		mutable Mutex			m_lock;
+		MotorState				m_wanted[MOTOR_PORT_COUNT];
+		Mailbox					m_mailboxes[NXT_MAILBOX_COUNT];
+		// Changes since the last complete send, per port and mailbox. A
+		// synchronized pair counts on its lower port.
+		int						m_pendingPorts[MOTOR_PORT_COUNT];
+		int						m_pendingMailboxes[NXT_MAILBOX_COUNT];
+		uint64_t				m_decisionTime;		// 0 until SetDecisionTime()
+		uint64_t				m_maxAge;			// In microseconds, 0 for no limit
+		StaleAction				m_staleAction;
+		int						m_droppedChanges;	// Written by the link thread
+		RobotLinkMetrics		m_metrics;		// Written by the link thread
+
+		// Link thread only
+		MotorState				m_sent[MOTOR_PORT_COUNT];
+		int						m_sentVersions[NXT_MAILBOX_COUNT];
+		bool					m_sentValid;
+		uint64_t				m_lastContact;
+		int						m_unconfirmed;	// Frames sent since the last round trip
+		NxtBatch<LINK_BATCH_SIZE> m_batch;		// Pipelined frames not written yet
+		bool					m_inStopLane;	// Frames are batched whatever the mode
+		RateController			m_rate;
+		bool					m_throttled;	// Motion lane waits for the rate limit
+		int						m_firstPort;	// Where the motion lane resumes
+		uint64_t				m_lastConfirm;
+		TelemetryPoller			m_telemetry;	// Read() from any thread
+		bool					m_inTurn;
+		int						m_turnBytes;	// Written in the current turn
+		bool					m_stale;		// Last pass sent no motion for staleness
+		int						m_staleCount;
+};
+
+#endif // _MINDSTORM_ROBOT_LINK_H_
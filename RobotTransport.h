@@ -0,0 +1,66 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Connection to a single NXT brick                        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_ROBOT_TRANSPORT_H_
+#define _MINDSTORM_ROBOT_TRANSPORT_H_
+
+#include "NxtProtocol.h"
+
+// NXT output ports, same numbering as OUT_A..OUT_C in NXT++
+#define MOTOR_PORT_COUNT 3
+
+// All calls are blocking and made from the robot link thread only.
+// Every call returns false once the link is gone; the caller is
+// expected to Close() and Open() again.
+class RobotTransport
+{
+	public:
+		virtual ~RobotTransport() {}
+
+		virtual bool Open() = 0;
+		virtual void Close() = 0;
+
+		virtual bool StartProgram(const char* name) = 0;
+		virtual bool StopProgram() = 0;
+
+		// Raw direct command frame starting with the command type byte,
+		// see NxtProtocol.h. Sent without waiting for a reply.
+		virtual bool SendDirectCommand(const unsigned char* pFrame, int length) = 0;
+
+		// No-reply frames packed by NxtBatch. Transports that can write them
+		// in one go override this; by default they go out one by one.
+		virtual bool SendBatch(const unsigned char* pPackets, int length)
+		{
+			const unsigned char* pFrame;
+			int offset = 0, frameLength;
+			while (NextBatchFrame(pPackets, length, &offset, &pFrame, &frameLength))
+			{
+				if (!SendDirectCommand(pFrame, frameLength))
+				{
+					return false;
+				}
+			}
+			return offset == length;
+		}
+
+		// Bytes written but not yet sent by the device, 0 when unknown
+		virtual int GetQueuedBytes() const { return 0; }
+
+		// True when SendBatch() may also carry frames that ask for a reply,
+		// without waiting for it; their replies come in with ReceiveReply().
+		// NXT++ only returns a reply to the call that sent the frame.
+		virtual bool HasAsyncReplies() const { return false; }
+		// Next reply to a frame sent with SendBatch(), never waits. Returns its
+		// length, 0 when none has arrived yet, -1 once the link is gone.
+		virtual int ReceiveReply(unsigned char* /*pReply*/, int /*maxLength*/) { return 0; }
+
+		// Sends a frame that asks for a reply and waits for it. Replies have a
+		// fixed size per opcode, replyLength bytes are stored in pReply.
+		virtual bool Transact(const unsigned char* pFrame, int length, unsigned char* pReply, int replyLength) = 0;
+};
+
+#endif // _MINDSTORM_ROBOT_TRANSPORT_H_
@@ -0,0 +1,331 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Where a sensor stands, from people others see too       *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "SensorCalibration.h"
+#include <math.h>
+#include <stdio.h>
+
+// Fewest pairs Solve() works from, about two seconds of one person
+const int g_calibrationMinPairs = 60 * CALIBRATION_FRAME_POINTS;
+// Points must spread at least this far across the second widest direction,
+// or the rotation around the widest one is left to noise. In millimeters.
+const double g_calibrationMinSpread = 300;
+
+// Joints averaged into each paired point, the same joint twice on the
+// center line
+const int g_calibrationJoints[CALIBRATION_FRAME_POINTS][2] =
+{
+	{ SKELETON_HEAD, SKELETON_HEAD },
+	{ SKELETON_NECK, SKELETON_NECK },
+	{ SKELETON_TORSO, SKELETON_TORSO },
+	{ SKELETON_LEFT_SHOULDER, SKELETON_RIGHT_SHOULDER },
+	{ SKELETON_LEFT_HIP, SKELETON_RIGHT_HIP },
+	{ SKELETON_LEFT_KNEE, SKELETON_RIGHT_KNEE },
+	{ SKELETON_LEFT_FOOT, SKELETON_RIGHT_FOOT }
+};
+
+// Eigenvalues of the symmetric size x size matrix a, at most 4 x 4, into
+// pValues and their eigenvectors into the columns of vectors. a is
+// destroyed. Cyclic Jacobi rotations.
+static void SolveEigen(double a[4][4], int size, double* pValues, double vectors[4][4])
+{
+	for (int i = 0; i < size; ++i)
+	{
+		for (int j = 0; j < size; ++j)
+		{
+			vectors[i][j] = i == j ? 1 : 0;
+		}
+	}
+	for (int sweep = 0; sweep < 50; ++sweep)
+	{
+		double off = 0;
+		for (int p = 0; p < size; ++p)
+		{
+			for (int q = p + 1; q < size; ++q)
+			{
+				off += a[p][q] * a[p][q];
+			}
+		}
+		if (off < 1e-22)
+		{
+			break;
+		}
+		for (int p = 0; p < size; ++p)
+		{
+			for (int q = p + 1; q < size; ++q)
+			{
+				if (a[p][q] == 0)
+				{
+					continue;
+				}
+				double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+				double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+				double c = 1 / sqrt(t * t + 1);
+				double s = t * c;
+				for (int k = 0; k < size; ++k)
+				{
+					double akp = a[k][p];
+					double akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for (int k = 0; k < size; ++k)
+				{
+					double apk = a[p][k];
+					double aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for (int k = 0; k < size; ++k)
+				{
+					double vkp = vectors[k][p];
+					double vkq = vectors[k][q];
+					vectors[k][p] = c * vkp - s * vkq;
+					vectors[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < size; ++i)
+	{
+		pValues[i] = a[i][i];
+	}
+}
+
+SensorCalibration::SensorCalibration()
+{
+	Clear();
+}
+
+void SensorCalibration::Clear()
+{
+	m_count = 0;
+	m_next = 0;
+}
+
+int SensorCalibration::AddFrame(const SkeletonFrame& reference, const SkeletonFrame& other)
+{
+	if (!reference.tracked || !other.tracked)
+	{
+		return 0;
+	}
+	int added = 0;
+	for (int i = 0; i < CALIBRATION_FRAME_POINTS; ++i)
+	{
+		const SkeletonJoint& referenceA = reference.joints[g_calibrationJoints[i][0]];
+		const SkeletonJoint& referenceB = reference.joints[g_calibrationJoints[i][1]];
+		const SkeletonJoint& otherA = other.joints[g_calibrationJoints[i][0]];
+		const SkeletonJoint& otherB = other.joints[g_calibrationJoints[i][1]];
+		float weight = referenceA.confidence;
+		weight = referenceB.confidence < weight ? referenceB.confidence : weight;
+		weight = otherA.confidence < weight ? otherA.confidence : weight;
+		weight = otherB.confidence < weight ? otherB.confidence : weight;
+		if (weight <= 0)
+		{
+			continue;
+		}
+		m_reference[m_next][0] = (referenceA.x + referenceB.x) / 2;
+		m_reference[m_next][1] = (referenceA.y + referenceB.y) / 2;
+		m_reference[m_next][2] = (referenceA.z + referenceB.z) / 2;
+		m_other[m_next][0] = (otherA.x + otherB.x) / 2;
+		m_other[m_next][1] = (otherA.y + otherB.y) / 2;
+		m_other[m_next][2] = (otherA.z + otherB.z) / 2;
+		m_weight[m_next] = weight;
+		m_next = (m_next + 1) % CALIBRATION_MAX_PAIRS;
+		if (m_count < CALIBRATION_MAX_PAIRS)
+		{
+			++m_count;
+		}
+		++added;
+	}
+	return added;
+}
+
+bool SensorCalibration::Solve(SensorTransform* pTransform, float* pRmsError) const
+{
+	if (m_count < g_calibrationMinPairs)
+	{
+		return false;
+	}
+
+	double total = 0;
+	double referenceMean[3] = { 0, 0, 0 };
+	double otherMean[3] = { 0, 0, 0 };
+	for (int i = 0; i < m_count; ++i)
+	{
+		total += m_weight[i];
+		for (int k = 0; k < 3; ++k)
+		{
+			referenceMean[k] += m_weight[i] * m_reference[i][k];
+			otherMean[k] += m_weight[i] * m_other[i][k];
+		}
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		referenceMean[k] /= total;
+		otherMean[k] /= total;
+	}
+
+	// Cross covariance of the pairs, and the spread of this sensor's points
+	double s[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+	double spread[4][4] = { { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 0, 0, 0, 0 } };
+	for (int i = 0; i < m_count; ++i)
+	{
+		double o[3], r[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			o[k] = m_other[i][k] - otherMean[k];
+			r[k] = m_reference[i][k] - referenceMean[k];
+		}
+		for (int a = 0; a < 3; ++a)
+		{
+			for (int b = 0; b < 3; ++b)
+			{
+				s[a][b] += m_weight[i] * o[a] * r[b];
+				spread[a][b] += m_weight[i] * o[a] * o[b];
+			}
+		}
+	}
+
+	double spreadValues[4], spreadVectors[4][4];
+	for (int a = 0; a < 3; ++a)
+	{
+		for (int b = 0; b < 3; ++b)
+		{
+			spread[a][b] /= total;
+		}
+	}
+	SolveEigen(spread, 3, spreadValues, spreadVectors);
+	// Of three variances the second largest is the one neither largest
+	// nor smallest
+	double widest = spreadValues[0], narrowest = spreadValues[0];
+	for (int i = 1; i < 3; ++i)
+	{
+		widest = spreadValues[i] > widest ? spreadValues[i] : widest;
+		narrowest = spreadValues[i] < narrowest ? spreadValues[i] : narrowest;
+	}
+	double second = spreadValues[0] + spreadValues[1] + spreadValues[2] - widest - narrowest;
+	if (second < g_calibrationMinSpread * g_calibrationMinSpread)
+	{
+		return false;
+	}
+
+	// The rotation is the unit quaternion that is the eigenvector of the
+	// largest eigenvalue of n
+	double n[4][4] =
+	{
+		{ s[0][0] + s[1][1] + s[2][2], s[1][2] - s[2][1], s[2][0] - s[0][2], s[0][1] - s[1][0] },
+		{ s[1][2] - s[2][1], s[0][0] - s[1][1] - s[2][2], s[0][1] + s[1][0], s[2][0] + s[0][2] },
+		{ s[2][0] - s[0][2], s[0][1] + s[1][0], -s[0][0] + s[1][1] - s[2][2], s[1][2] + s[2][1] },
+		{ s[0][1] - s[1][0], s[2][0] + s[0][2], s[1][2] + s[2][1], -s[0][0] - s[1][1] + s[2][2] }
+	};
+	double values[4], vectors[4][4];
+	SolveEigen(n, 4, values, vectors);
+	int best = 0;
+	for (int i = 1; i < 4; ++i)
+	{
+		if (values[i] > values[best])
+		{
+			best = i;
+		}
+	}
+	double w = vectors[0][best], x = vectors[1][best], y = vectors[2][best], z = vectors[3][best];
+	double length = sqrt(w * w + x * x + y * y + z * z);
+	w /= length;
+	x /= length;
+	y /= length;
+	z /= length;
+
+	SensorTransform transform;
+	float* r = transform.rotation;
+	r[0] = (float)(w * w + x * x - y * y - z * z);
+	r[1] = (float)(2 * (x * y - w * z));
+	r[2] = (float)(2 * (x * z + w * y));
+	r[3] = (float)(2 * (x * y + w * z));
+	r[4] = (float)(w * w - x * x + y * y - z * z);
+	r[5] = (float)(2 * (y * z - w * x));
+	r[6] = (float)(2 * (x * z - w * y));
+	r[7] = (float)(2 * (y * z + w * x));
+	r[8] = (float)(w * w - x * x - y * y + z * z);
+	for (int k = 0; k < 3; ++k)
+	{
+		transform.translation[k] = (float)(referenceMean[k]
+			- (r[k * 3] * otherMean[0] + r[k * 3 + 1] * otherMean[1] + r[k * 3 + 2] * otherMean[2]));
+	}
+
+	if (pRmsError != NULL)
+	{
+		double error = 0;
+		for (int i = 0; i < m_count; ++i)
+		{
+			float world[3];
+			TransformPoint(transform, m_other[i], world);
+			for (int k = 0; k < 3; ++k)
+			{
+				double d = world[k] - m_reference[i][k];
+				error += m_weight[i] * d * d;
+			}
+		}
+		*pRmsError = (float)sqrt(error / total);
+	}
+	*pTransform = transform;
+	return true;
+}
+
+bool SaveTransforms(const char* path, const SensorTransform* pTransforms, int count)
+{
+	FILE* pFile = fopen(path, "w");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+	fprintf(pFile, "# sensor index, rotation row by row, translation in mm\n");
+	for (int i = 0; i < count; ++i)
+	{
+		const float* r = pTransforms[i].rotation;
+		const float* t = pTransforms[i].translation;
+		fprintf(pFile, "sensor %d %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.1f %.1f %.1f\n", i,
+			r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], t[0], t[1], t[2]);
+	}
+	fclose(pFile);
+	return true;
+}
+
+int LoadTransforms(const char* path, SensorTransform* pTransforms, int count)
+{
+	FILE* pFile = fopen(path, "r");
+	if (pFile == NULL)
+	{
+		return -1;
+	}
+	int loaded = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), pFile) != NULL)
+	{
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+		{
+			continue;
+		}
+		int sensor;
+		SensorTransform transform;
+		float* r = transform.rotation;
+		float* t = transform.translation;
+		if (sscanf(line, "sensor %d %f %f %f %f %f %f %f %f %f %f %f %f", &sensor,
+			&r[0], &r[1], &r[2], &r[3], &r[4], &r[5], &r[6], &r[7], &r[8], &t[0], &t[1], &t[2]) != 13)
+		{
+			loaded = -1;
+			break;
+		}
+		if (sensor >= 0 && sensor < count)
+		{
+			pTransforms[sensor] = transform;
+			++loaded;
+		}
+	}
+	fclose(pFile);
+	return loaded;
+}
@@ -0,0 +1,59 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Where a sensor stands, from people others see too       *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SENSOR_CALIBRATION_H_
+#define _MINDSTORM_SENSOR_CALIBRATION_H_
+
+#include "UserMerger.h"
+
+// Point pairs kept for one sensor, the oldest are overwritten
+#define CALIBRATION_MAX_PAIRS	4096
+// Body points paired in every frame
+#define CALIBRATION_FRAME_POINTS	7
+
+// Finds the rigid transform of a sensor from people it and a reference
+// sensor track at the same time. Every frame adds pairs of the same body
+// points as each sensor sees them, and Solve() finds the rotation and
+// translation that best take this sensor's points onto the reference's, in
+// closed form (Horn's quaternion method) weighted by confidence. Only
+// points that stay where they are when left and right swap are used: head,
+// neck, torso and the middles between shoulders, hips, knees and feet, so a
+// sensor seeing people from behind calibrates as well. The points of one
+// frame lie close to one vertical line; people walking around give the rest.
+class SensorCalibration
+{
+	public:
+		SensorCalibration();
+
+		void Clear();
+		// The same person at the same moment, reference in world space and
+		// other in the calibrated sensor's camera space. Returns the pairs
+		// added.
+		int AddFrame(const SkeletonFrame& reference, const SkeletonFrame& other);
+		int GetPairCount() const { return m_count; }
+
+		// False while the pairs are too few or too close together to tell
+		// the rotation. pRmsError gets the distance left between the pairs,
+		// in mm. Takes time in proportion to the pairs.
+		bool Solve(SensorTransform* pTransform, float* pRmsError) const;
+
+	private:
+		float					m_reference[CALIBRATION_MAX_PAIRS][3];
+		float					m_other[CALIBRATION_MAX_PAIRS][3];
+		float					m_weight[CALIBRATION_MAX_PAIRS];
+		int						m_count;
+		int						m_next;		// Slot the next pair goes to
+};
+
+// Transforms of sensors 0..count-1, one line each
+bool SaveTransforms(const char* path, const SensorTransform* pTransforms, int count);
+// Reads the sensors the file has into pTransforms[0..count-1], the others
+// are left as they are. Returns how many were read, -1 when the file is
+// missing or broken.
+int LoadTransforms(const char* path, SensorTransform* pTransforms, int count);
+
+#endif // _MINDSTORM_SENSOR_CALIBRATION_H_
@@ -0,0 +1,173 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - One depth sensor tracked on its own thread              *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "SensorTracker.h"
+#include <stdio.h>
+
+// Longest wait for NiTE's next frame before the thread checks whether it
+// should stop. In milliseconds.
+const unsigned int g_sensorFrameWait = 100;
+
+void ReadSkeleton(const nite::UserData& user, uint64_t timestamp, SkeletonFrame* pSkeleton)
+{
+	const nite::Skeleton& skeleton = user.getSkeleton();
+	pSkeleton->userId = user.getId();
+	pSkeleton->tracked = skeleton.getState() == nite::SKELETON_TRACKED;
+	pSkeleton->timestamp = timestamp;
+	for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+	{
+		const nite::SkeletonJoint& joint = skeleton.getJoint((nite::JointType)i);
+		pSkeleton->joints[i].x = joint.getPosition().x;
+		pSkeleton->joints[i].y = joint.getPosition().y;
+		pSkeleton->joints[i].z = joint.getPosition().z;
+		pSkeleton->joints[i].confidence = joint.getPositionConfidence();
+	}
+}
+
+SensorTracker::SensorTracker(int index, const char* deviceUri, Event* pFrameReady) : m_index(index),
+	m_deviceUri(deviceUri), m_running(0), m_pFrameReady(pFrameReady)
+{
+	m_next.frameIndex = -1;
+	m_next.userCount = 0;
+	m_latest.frameIndex = -1;
+	m_latest.userCount = 0;
+}
+
+SensorTracker::~SensorTracker()
+{
+	Stop();
+	m_trackerFrame.release();
+	m_tracker.destroy();
+	m_device.close();
+}
+
+openni::Status SensorTracker::Open()
+{
+	return m_device.open(m_deviceUri);
+}
+
+bool SensorTracker::Start()
+{
+	if (m_tracker.create(&m_device) != nite::STATUS_OK)
+	{
+		return false;
+	}
+	m_tracker.addNewFrameListener(this);
+	m_running.Set(1);
+	if (!m_thread.Start(TrackerThread, this))
+	{
+		m_running.Set(0);
+		m_tracker.removeNewFrameListener(this);
+		return false;
+	}
+	return true;
+}
+
+void SensorTracker::Stop()
+{
+	if (!m_thread.IsStarted())
+	{
+		return;
+	}
+	m_running.Set(0);
+	m_newFrame.Signal();
+	m_thread.Join();
+	m_tracker.removeNewFrameListener(this);
+}
+
+// Called on NiTE's own thread
+void SensorTracker::onNewFrame(nite::UserTracker& /*tracker*/)
+{
+	m_newFrame.Signal();
+}
+
+void SensorTracker::TrackerThread(void* pSelf)
+{
+	((SensorTracker*)pSelf)->Track();
+}
+
+void SensorTracker::Track()
+{
+	while (m_running.Get() != 0)
+	{
+		if (!m_newFrame.Wait(g_sensorFrameWait))
+		{
+			continue;
+		}
+		nite::UserTrackerFrameRef trackerFrame;
+		if (m_running.Get() == 0 || m_tracker.readFrame(&trackerFrame) != nite::STATUS_OK)
+		{
+			continue;
+		}
+		uint64_t captured = m_clock.Receive(trackerFrame.getFrameIndex(), trackerFrame.getTimestamp(), GetTimeMicros());
+		ReadUsers(trackerFrame, captured);
+		{
+			ScopedLock lock(m_lock);
+			m_latest = m_next;
+			m_latestClock = m_clock;
+			m_trackerFrame = trackerFrame;
+		}
+		m_pFrameReady->Signal();
+	}
+}
+
+void SensorTracker::ReadUsers(const nite::UserTrackerFrameRef& trackerFrame, uint64_t captured)
+{
+	m_next.frameIndex = trackerFrame.getFrameIndex();
+	m_next.timestamp = trackerFrame.getTimestamp();
+	m_next.captured = captured;
+	m_next.userCount = 0;
+
+	const nite::Array<nite::UserData>& users = trackerFrame.getUsers();
+	for (int i = 0; i < users.getSize(); ++i)
+	{
+		const nite::UserData& user = users[i];
+		if (user.isNew())
+		{
+			m_tracker.startSkeletonTracking(user.getId());
+		}
+		if (user.isLost() || m_next.userCount == SENSOR_MAX_USERS)
+		{
+			continue;
+		}
+		SensorUser& sensorUser = m_next.users[m_next.userCount++];
+		sensorUser.userId = user.getId();
+		sensorUser.visible = user.isVisible();
+		sensorUser.x = user.getCenterOfMass().x;
+		sensorUser.y = user.getCenterOfMass().y;
+		sensorUser.z = user.getCenterOfMass().z;
+		ReadSkeleton(user, trackerFrame.getTimestamp(), &sensorUser.skeleton);
+	}
+}
+
+bool SensorTracker::GetFrame(SensorFrame* pFrame) const
+{
+	ScopedLock lock(m_lock);
+	if (m_latest.frameIndex < 0)
+	{
+		return false;
+	}
+	*pFrame = m_latest;
+	return true;
+}
+
+FrameClock SensorTracker::GetClock() const
+{
+	ScopedLock lock(m_lock);
+	return m_latestClock;
+}
+
+nite::UserTrackerFrameRef& SensorTracker::LockTrackerFrame()
+{
+	m_lock.Lock();
+	return m_trackerFrame;
+}
+
+void SensorTracker::UnlockTrackerFrame()
+{
+	m_lock.Unlock();
+}
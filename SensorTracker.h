@@ -0,0 +1,78 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - One depth sensor tracked on its own thread              *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SENSOR_TRACKER_H_
+#define _MINDSTORM_SENSOR_TRACKER_H_
+
+#include "NiTE.h"
+#include "Platform.h"
+#include "FrameClock.h"
+#include "UserMerger.h"
+
+// Everything the steering code needs from NiTE
+void ReadSkeleton(const nite::UserData& user, uint64_t timestamp, SkeletonFrame* pSkeleton);
+
+// One sensor with its own device and user tracker, read on a thread of its
+// own. The thread starts skeleton tracking for everyone who shows up, as
+// nobody knows yet which sensor the driver will be seen best by, and keeps
+// only the latest frame for whoever merges the sensors.
+class SensorTracker : private nite::UserTracker::NewFrameListener
+{
+	public:
+		// pFrameReady is signalled after every frame, and may be shared by
+		// all sensors
+		SensorTracker(int index, const char* deviceUri, Event* pFrameReady);
+		~SensorTracker();	// Stops the thread, closes tracker and device
+
+		// OpenNI has to be initialized for Open() and NiTE for Start(),
+		// which creates the tracker and then starts its thread
+		openni::Status Open();
+		bool Start();
+		void Stop();
+
+		int GetIndex() const { return m_index; }
+		const char* GetDeviceUri() const { return m_deviceUri; }
+		// Joint to depth coordinates for drawing, safe from any thread
+		const nite::UserTracker& GetUserTracker() const { return m_tracker; }
+
+		// Copy of the latest frame, false while there is none yet
+		bool GetFrame(SensorFrame* pFrame) const;
+		FrameClock GetClock() const;
+		// Latest tracker frame, for its depth image and user map. The
+		// thread does not publish frames until it is unlocked again.
+		nite::UserTrackerFrameRef& LockTrackerFrame();
+		void UnlockTrackerFrame();
+
+	private:
+		SensorTracker(const SensorTracker&);
+		SensorTracker& operator=(const SensorTracker&);
+
+		static void TrackerThread(void* pSelf);
+		void Track();
+		void ReadUsers(const nite::UserTrackerFrameRef& trackerFrame, uint64_t captured);
+		virtual void onNewFrame(nite::UserTracker& tracker);
+
+		int						m_index;
+		const char*				m_deviceUri;
+		openni::Device			m_device;
+		nite::UserTracker		m_tracker;
+		Thread					m_thread;
+		AtomicInt				m_running;
+		Event					m_newFrame;		// From NiTE, the thread waits on it
+		Event*					m_pFrameReady;
+
+		// Tracker thread only
+		FrameClock				m_clock;
+		SensorFrame				m_next;
+
+		mutable Mutex			m_lock;			// Guards what is published
+		SensorFrame				m_latest;
+		FrameClock				m_latestClock;
+		nite::UserTrackerFrameRef	m_trackerFrame;
+};
+
+#endif // _MINDSTORM_SENSOR_TRACKER_H_
@@ -0,0 +1,58 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Latest value shared without locks                       *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SEQLOCK_H_
+#define _MINDSTORM_SEQLOCK_H_
+
+#include "Platform.h"
+
+// One writer thread publishes a plain struct, any thread reads the latest
+// copy. The sequence is odd while a write is in progress; a reader that saw
+// it change copies again, so neither side ever waits on the other. The
+// AtomicInt calls are full barriers on both platforms.
+template <typename T>
+class SeqLock
+{
+	public:
+		SeqLock() : m_sequence(0), m_value() {}
+
+		// Writer thread only
+		void Write(const T& value)
+		{
+			m_sequence.Increment();
+			m_value = value;
+			m_sequence.Increment();
+		}
+
+		T Read() const
+		{
+			for (;;)
+			{
+				int before = m_sequence.Get();
+				if ((before & 1) == 0)
+				{
+					T value = m_value;
+					if (m_sequence.Get() == before)
+					{
+						return value;
+					}
+				}
+			}
+		}
+
+		// Number of writes so far, tells readers whether anything changed
+		int GetVersion() const { return m_sequence.Get() / 2; }
+
+	private:
+		SeqLock(const SeqLock&);
+		SeqLock& operator=(const SeqLock&);
+
+		AtomicInt				m_sequence;
+		T						m_value;
+};
+
+#endif // _MINDSTORM_SEQLOCK_H_
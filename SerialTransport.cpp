@@ -0,0 +1,364 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - NXT over a Linux serial or RFCOMM device                *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef WIN32
+
+#include "SerialTransport.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// Longest wait for a reply, the brick answers within ~60 ms over Bluetooth. In milliseconds.
+const unsigned int g_replyTimeout = 1000;
+// How often the I/O thread checks whether it should stop. In milliseconds.
+const int g_ioPollInterval = 100;
+
+SerialTransport::SerialTransport(const char* devicePath) :
+	m_devicePath(devicePath), m_fd(-1), m_epoll(-1), m_wakeFd(-1), m_running(0), m_failed(0),
+	m_bytesWritten(0), m_queueFullCount(0), m_writeInterest(false), m_awaitedOpcode(-1),
+	m_replyLength(0), m_asyncHead(0), m_asyncCount(0), m_inputLength(0)
+{
+}
+
+SerialTransport::~SerialTransport()
+{
+	Close();
+}
+
+bool SerialTransport::Open()
+{
+	Close();
+	m_fd = open(m_devicePath, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (m_fd < 0)
+	{
+		return false;
+	}
+
+	// RFCOMM ttys and ptys both default to line discipline processing
+	struct termios tio;
+	if (tcgetattr(m_fd, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, B115200);
+		cfsetospeed(&tio, B115200);
+		tcsetattr(m_fd, TCSANOW, &tio);
+	}
+
+	m_epoll = epoll_create1(0);
+	m_wakeFd = eventfd(0, EFD_NONBLOCK);
+	struct epoll_event device = {0}, wake = {0};
+	device.events = EPOLLIN;
+	device.data.fd = m_fd;
+	wake.events = EPOLLIN;
+	wake.data.fd = m_wakeFd;
+	if (m_epoll < 0 || m_wakeFd < 0 ||
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_fd, &device) != 0 ||
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeFd, &wake) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_output.Clear();
+	m_writeInterest = false;
+	m_awaitedOpcode = -1;
+	m_asyncCount = 0;
+	m_inputLength = 0;
+	m_failed.Set(0);
+	m_running.Set(1);
+	if (!m_thread.Start(IoThread, this))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SerialTransport::Close()
+{
+	if (m_thread.IsStarted())
+	{
+		m_running.Set(0);
+		uint64_t one = 1;
+		write(m_wakeFd, &one, sizeof(one));
+		m_thread.Join();
+	}
+	if (m_wakeFd >= 0)
+	{
+		close(m_wakeFd);
+		m_wakeFd = -1;
+	}
+	if (m_epoll >= 0)
+	{
+		close(m_epoll);
+		m_epoll = -1;
+	}
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+}
+
+// A program left running from before a reconnect makes the brick refuse to
+// start another one; like NXT++, any reply counts as success
+bool SerialTransport::StartProgram(const char* name)
+{
+	unsigned char frame[NXT_STARTPROGRAM_SIZE];
+	unsigned char reply[NXT_STATUS_REPLY_SIZE];
+	int length = EncodeStartProgram(frame, name);
+	return length > 0 && (Transact(frame, length, reply, NXT_STATUS_REPLY_SIZE) || reply[0] == NXT_REPLY);
+}
+
+bool SerialTransport::StopProgram()
+{
+	unsigned char frame[NXT_STOPPROGRAM_SIZE];
+	unsigned char reply[NXT_STATUS_REPLY_SIZE];
+	EncodeStopProgram(frame);
+	return Transact(frame, NXT_STOPPROGRAM_SIZE, reply, NXT_STATUS_REPLY_SIZE) || reply[0] == NXT_REPLY;
+}
+
+bool SerialTransport::SendDirectCommand(const unsigned char* pFrame, int length)
+{
+	NxtBatch<NXT_BT_LENGTH_SIZE + NXT_MAX_FRAME_SIZE> packet;
+	return packet.Append(pFrame, length) && Queue(packet.GetData(), packet.GetLength());
+}
+
+// Already length prefixed, goes into the ring as one piece
+bool SerialTransport::SendBatch(const unsigned char* pPackets, int length)
+{
+	return Queue(pPackets, length);
+}
+
+bool SerialTransport::Transact(const unsigned char* pFrame, int length, unsigned char* pReply, int replyLength)
+{
+	memset(pReply, 0, replyLength);
+	{
+		ScopedLock lock(m_lock);
+		m_awaitedOpcode = pFrame[1];
+		m_replyLength = 0;
+	}
+	if (!SendDirectCommand(pFrame, length))
+	{
+		ScopedLock lock(m_lock);
+		m_awaitedOpcode = -1;
+		return false;
+	}
+
+	uint64_t deadline = GetTimeMicros() + g_replyTimeout * 1000;
+	for (;;)
+	{
+		{
+			ScopedLock lock(m_lock);
+			if (m_replyLength > 0)
+			{
+				memcpy(pReply, m_reply, m_replyLength < replyLength ? m_replyLength : replyLength);
+				m_awaitedOpcode = -1;
+				return IsReplyOk(pReply, replyLength, pFrame[1]);
+			}
+		}
+		uint64_t now = GetTimeMicros();
+		if (now >= deadline || IsFailed())
+		{
+			ScopedLock lock(m_lock);
+			m_awaitedOpcode = -1;
+			return false;
+		}
+		m_replyReady.Wait((unsigned int)((deadline - now + 999) / 1000));
+	}
+}
+
+int SerialTransport::ReceiveReply(unsigned char* pReply, int maxLength)
+{
+	ScopedLock lock(m_lock);
+	if (m_asyncCount == 0)
+	{
+		return m_fd < 0 || IsFailed() ? -1 : 0;
+	}
+	int length = m_asyncLengths[m_asyncHead];
+	if (length > maxLength)
+	{
+		return -1;
+	}
+	memcpy(pReply, m_asyncReplies[m_asyncHead], length);
+	m_asyncHead = (m_asyncHead + 1) % SERIAL_ASYNC_REPLIES;
+	m_asyncCount--;
+	return length;
+}
+
+// Writes what the device takes right away; the rest is left to the I/O thread
+bool SerialTransport::Queue(const unsigned char* pPackets, int length)
+{
+	if (m_fd < 0 || IsFailed() || length <= 0)
+	{
+		return false;
+	}
+
+	ScopedLock lock(m_lock);
+	if (!m_output.Push(pPackets, length))
+	{
+		// The brick stopped reading long ago, treat it like a dead link
+		m_queueFullCount.Increment();
+		return false;
+	}
+	if (!Flush())
+	{
+		return false;
+	}
+	if (!m_output.IsEmpty() && !m_writeInterest)
+	{
+		uint64_t one = 1;
+		write(m_wakeFd, &one, sizeof(one));
+	}
+	return true;
+}
+
+// Called with m_lock held. write() never blocks on the O_NONBLOCK device.
+bool SerialTransport::Flush()
+{
+	while (!m_output.IsEmpty())
+	{
+		unsigned int length;
+		const unsigned char* pData = m_output.Peek(&length);
+		ssize_t written = write(m_fd, pData, length);
+		if (written < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return true;
+			}
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			m_failed.Set(1);
+			return false;
+		}
+		m_output.Consume((unsigned int)written);
+		m_bytesWritten.Add((int)written);
+	}
+	return true;
+}
+
+void SerialTransport::IoThread(void* pSelf)
+{
+	((SerialTransport*)pSelf)->Serve();
+}
+
+void SerialTransport::Serve()
+{
+	while (m_running.Get() && !IsFailed())
+	{
+		struct epoll_event events[4];
+		int count = epoll_wait(m_epoll, events, 4, g_ioPollInterval);
+		if (count < 0 && errno != EINTR)
+		{
+			m_failed.Set(1);
+			break;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			if (events[i].data.fd == m_wakeFd)
+			{
+				uint64_t value;
+				read(m_wakeFd, &value, sizeof(value));
+				continue;
+			}
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+			{
+				m_failed.Set(1);
+			}
+			if ((events[i].events & EPOLLIN) && !ReadReplies())
+			{
+				m_failed.Set(1);
+			}
+		}
+
+		ScopedLock lock(m_lock);
+		if (!Flush())
+		{
+			break;
+		}
+		UpdateInterest(!m_output.IsEmpty());
+	}
+	// Wake a Transact() waiting on a dead link
+	m_replyReady.Signal();
+}
+
+// Called with m_lock held. EPOLLOUT only while bytes wait, or epoll spins.
+void SerialTransport::UpdateInterest(bool wantWrite)
+{
+	if (wantWrite == m_writeInterest)
+	{
+		return;
+	}
+	struct epoll_event device = {0};
+	device.events = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+	device.data.fd = m_fd;
+	epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_fd, &device);
+	m_writeInterest = wantWrite;
+}
+
+// Splits the byte stream into length prefixed packets and completes the
+// waiting Transact(). Other replies are queued for ReceiveReply(); when the
+// queue is full, e.g. nobody collects them, they are dropped.
+bool SerialTransport::ReadReplies()
+{
+	for (;;)
+	{
+		ssize_t count = read(m_fd, m_input + m_inputLength, sizeof(m_input) - m_inputLength);
+		if (count < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		if (count == 0)
+		{
+			return false;
+		}
+		m_inputLength += (int)count;
+
+		while (m_inputLength >= NXT_BT_LENGTH_SIZE)
+		{
+			int length = m_input[0] | (m_input[1] << 8);
+			if (length < 2 || length > NXT_MAX_FRAME_SIZE)
+			{
+				// Lost framing, nothing after this can be trusted
+				return false;
+			}
+			if (m_inputLength < NXT_BT_LENGTH_SIZE + length)
+			{
+				break;
+			}
+			const unsigned char* pPacket = m_input + NXT_BT_LENGTH_SIZE;
+			{
+				ScopedLock lock(m_lock);
+				if (pPacket[0] == NXT_REPLY && pPacket[1] == m_awaitedOpcode)
+				{
+					memcpy(m_reply, pPacket, length);
+					m_replyLength = length;
+					m_awaitedOpcode = -1;
+					m_replyReady.Signal();
+				}
+				else if (pPacket[0] == NXT_REPLY && m_asyncCount < SERIAL_ASYNC_REPLIES)
+				{
+					int slot = (m_asyncHead + m_asyncCount) % SERIAL_ASYNC_REPLIES;
+					memcpy(m_asyncReplies[slot], pPacket, length);
+					m_asyncLengths[slot] = length;
+					m_asyncCount++;
+				}
+			}
+			m_inputLength -= NXT_BT_LENGTH_SIZE + length;
+			memmove(m_input, m_input + NXT_BT_LENGTH_SIZE + length, m_inputLength);
+		}
+	}
+}
+
+#endif // WIN32
@@ -0,0 +1,90 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - NXT over a Linux serial or RFCOMM device                *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SERIAL_TRANSPORT_H_
+#define _MINDSTORM_SERIAL_TRANSPORT_H_
+
+#ifndef WIN32
+
+#include "Platform.h"
+#include "RobotTransport.h"
+#include "NxtProtocol.h"
+#include "ByteRing.h"
+
+#define SERIAL_OUTPUT_SIZE		4096
+#define SERIAL_ASYNC_REPLIES	16
+
+// Speaks the direct command protocol on a tty, e.g. /dev/rfcomm0 bound to
+// the brick with `rfcomm bind`. The device is non-blocking and owned by an
+// I/O thread waiting in epoll: senders only queue bytes in a ring buffer and
+// wake it, so the link thread never blocks in read() or write(). Transact()
+// waits for the reply to be completed by the I/O thread, with a timeout;
+// any other reply is kept for ReceiveReply().
+class SerialTransport : public RobotTransport
+{
+	public:
+		SerialTransport(const char* devicePath);
+		virtual ~SerialTransport();
+
+		virtual bool Open();
+		virtual void Close();
+
+		virtual bool StartProgram(const char* name);
+		virtual bool StopProgram();
+		virtual bool SendDirectCommand(const unsigned char* pFrame, int length);
+		virtual bool SendBatch(const unsigned char* pPackets, int length);
+		virtual bool Transact(const unsigned char* pFrame, int length, unsigned char* pReply, int replyLength);
+		virtual bool HasAsyncReplies() const { return true; }
+		virtual int ReceiveReply(unsigned char* pReply, int maxLength);
+
+		// Bytes written by the I/O thread, and times the queue was full
+		int GetBytesWritten() const { return m_bytesWritten.Get(); }
+		int GetQueueFullCount() const { return m_queueFullCount.Get(); }
+
+	private:
+		SerialTransport(const SerialTransport&);
+		SerialTransport& operator=(const SerialTransport&);
+
+		static void IoThread(void* pSelf);
+		void Serve();
+		bool Queue(const unsigned char* pPackets, int length);
+		bool Flush();		// Called with m_lock held
+		bool ReadReplies();
+		void UpdateInterest(bool wantWrite);
+		bool IsFailed() const { return m_failed.Get() != 0; }
+
+		const char*				m_devicePath;
+		int						m_fd;
+		int						m_epoll;
+		int						m_wakeFd;		// eventfd, written by senders
+		Thread					m_thread;
+		AtomicInt				m_running;
+		AtomicInt				m_failed;		// Hang up or I/O error seen
+		AtomicInt				m_bytesWritten;
+		AtomicInt				m_queueFullCount;
+
+		// Shared between senders and the I/O thread
+		Mutex					m_lock;
+		ByteRing<SERIAL_OUTPUT_SIZE> m_output;
+		bool					m_writeInterest;
+		int						m_awaitedOpcode;	// -1 when no Transact() is waiting
+		unsigned char			m_reply[NXT_MAX_FRAME_SIZE];
+		int						m_replyLength;
+		Event					m_replyReady;
+		unsigned char			m_asyncReplies[SERIAL_ASYNC_REPLIES][NXT_MAX_FRAME_SIZE];
+		int						m_asyncLengths[SERIAL_ASYNC_REPLIES];
+		int						m_asyncHead;
+		int						m_asyncCount;
+
+		// I/O thread only, partial packets between reads
+		unsigned char			m_input[NXT_BT_LENGTH_SIZE + NXT_MAX_FRAME_SIZE];
+		int						m_inputLength;
+};
+
+#endif // WIN32
+
+#endif // _MINDSTORM_SERIAL_TRANSPORT_H_
@@ -0,0 +1,80 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Tracked skeletons as other processes see them           *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SHARED_SKELETONS_H_
+#define _MINDSTORM_SHARED_SKELETONS_H_
+
+#include <stdint.h>
+
+// Layout of the shared memory -publish fills, the same for 32 and 64 bit
+// builds. Anything that changes it changes the version too.
+#define SHARED_SKELETONS_NAME		"MindstormSkeletons"
+#define SHARED_SKELETONS_MAGIC		0x534B4D4D	// "MMKS"
+#define SHARED_SKELETONS_VERSION	1
+// Frames kept, a reader may fall this far behind before frames are lost
+#define SHARED_SKELETONS_SLOTS		8
+#define SHARED_SKELETONS_USERS		16
+#define SHARED_SKELETONS_ROBOTS		8
+#define SHARED_SKELETONS_JOINTS		15		// As SkeletonJointId, head to right foot
+
+struct SharedJoint
+{
+	float x;					// Camera or, with several sensors, world space, in mm
+	float y;
+	float z;
+	float confidence;			// 0..1
+};
+
+struct SharedUser
+{
+	int32_t userId;
+	int32_t tracked;			// 1 while the joints are valid
+	int32_t visible;
+	int32_t sensors;			// Bit mask of the sensors seeing the user
+	float x;					// Center of mass, in mm
+	float y;
+	float z;
+	SharedJoint joints[SHARED_SKELETONS_JOINTS];
+};
+
+// What the viewer last told a robot, after this frame's steering
+struct SharedRobot
+{
+	int32_t driver;				// User id, 0 while nobody steers it
+	int32_t connected;			// 1 while the link is up
+	int32_t speed;				// -100..100
+	int32_t turnRatio;			// -100..100, as Drivetrain::Drive()
+	int32_t gripperPower;		// -100..100
+	int32_t reserved;
+};
+
+// One tracker frame. The sequence is odd while the viewer writes the slot;
+// a reader that sees it odd or changed once done reading drops what it read.
+struct SharedFrame
+{
+	volatile int32_t sequence;
+	int32_t number;				// Frames published before this one
+	int32_t frameIndex;			// Of the tracker, or of the merge with several sensors
+	int32_t steeringMode;
+	uint64_t timestamp;			// Of the joints, in microseconds
+	uint64_t published;			// Host clock of the viewer (GetTimeMicros()) once written
+	int32_t userCount;
+	int32_t robotCount;
+	SharedUser users[SHARED_SKELETONS_USERS];
+	SharedRobot robots[SHARED_SKELETONS_ROBOTS];
+};
+
+struct SharedSkeletons
+{
+	int32_t magic;
+	int32_t version;
+	volatile int32_t publishing;	// 0 once the viewer has stopped
+	volatile int32_t published;		// Frames so far, frame n is in slot n % SHARED_SKELETONS_SLOTS
+	SharedFrame frames[SHARED_SKELETONS_SLOTS];
+};
+
+#endif // _MINDSTORM_SHARED_SKELETONS_H_
@@ -0,0 +1,60 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Tracked user skeleton without the NiTE types            *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SKELETON_H_
+#define _MINDSTORM_SKELETON_H_
+
+#include <stdint.h>
+
+// Camera users the viewer keeps state for, indexed by NiTE user id.
+// Define MAX_USERS in the project settings to raise it.
+#ifndef MAX_USERS
+	#define MAX_USERS 5
+#endif
+
+// Same numbering as nite::JointType
+enum SkeletonJointId
+{
+	SKELETON_HEAD,
+	SKELETON_NECK,
+	SKELETON_LEFT_SHOULDER,
+	SKELETON_RIGHT_SHOULDER,
+	SKELETON_LEFT_ELBOW,
+	SKELETON_RIGHT_ELBOW,
+	SKELETON_LEFT_HAND,
+	SKELETON_RIGHT_HAND,
+	SKELETON_TORSO,
+	SKELETON_LEFT_HIP,
+	SKELETON_RIGHT_HIP,
+	SKELETON_LEFT_KNEE,
+	SKELETON_RIGHT_KNEE,
+	SKELETON_LEFT_FOOT,
+	SKELETON_RIGHT_FOOT,
+	SKELETON_JOINT_COUNT
+};
+
+// Position in the camera's real world space, as NiTE reports it: x to the
+// right, y up, z away from the sensor. In millimeters.
+struct SkeletonJoint
+{
+	float x;
+	float y;
+	float z;
+	float confidence;	// 0..1, NiTE's position confidence
+};
+
+// One user in one tracker frame. The steering code only ever sees this, so
+// recorded or generated skeletons drive it the same way as the camera.
+struct SkeletonFrame
+{
+	int userId;
+	bool tracked;			// NiTE's SKELETON_TRACKED, joints are only valid then
+	uint64_t timestamp;		// In microseconds
+	SkeletonJoint joints[SKELETON_JOINT_COUNT];
+};
+
+#endif // _MINDSTORM_SKELETON_H_
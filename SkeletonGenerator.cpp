@@ -0,0 +1,219 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Synthetic skeletons for benchmarks without a camera     *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "SkeletonGenerator.h"
+#include <math.h>
+
+// Joints of a 1.75 m user with the arms hanging, relative to the point
+// under the torso at the height of the camera. In millimeters.
+const float g_restPose[SKELETON_JOINT_COUNT][3] =
+{
+	{0, 650, 0},		// Head
+	{0, 500, 0},		// Neck
+	{-180, 400, 0},		// Left shoulder
+	{180, 400, 0},		// Right shoulder
+	{-220, 150, 0},		// Left elbow
+	{220, 150, 0},		// Right elbow
+	{-200, -100, -50},	// Left hand
+	{200, -100, -50},	// Right hand
+	{0, 200, 0},		// Torso
+	{-100, -200, 0},	// Left hip
+	{100, -200, 0},		// Right hip
+	{-100, -600, 0},	// Left knee
+	{100, -600, 0},		// Right knee
+	{-100, -950, 0},	// Left foot
+	{100, -950, 0}		// Right foot
+};
+// Distance between neighbouring users and from the camera. In millimeters.
+const float g_userSpacing = 700;
+const float g_userDistance = 2000;
+// Body sway while standing. In millimeters and cycles per second.
+const float g_swayAmplitude = 20;
+const double g_swayFrequency = 0.3;
+// Size of the circles drawn with one hand. In millimeters.
+const float g_circleRadius = 250;
+// Share of a raise or push spent lifting the hand and putting it down
+const float g_motionRamp = 0.3f;
+
+SkeletonGeneratorSettings MakeSkeletonSettings(int users, unsigned long seed)
+{
+	SkeletonGeneratorSettings settings = {users, 30, seed, 10, 0.5, 1.5, 0.5, 0.2};
+	return settings;
+}
+
+SkeletonGenerator::SkeletonGenerator(const SkeletonGeneratorSettings& settings) :
+	m_settings(settings), m_pUsers(NULL), m_frame(0), m_dropoutChance(0)
+{
+	if (m_settings.users < 0)
+	{
+		m_settings.users = 0;
+	}
+	m_pUsers = new User[m_settings.users > 0 ? m_settings.users : 1];
+	double chance = m_settings.frameRate > 0 ? m_settings.dropoutsPerSecond / m_settings.frameRate : 0;
+	m_dropoutChance = (int)(chance * 65536);
+	Reset();
+}
+
+SkeletonGenerator::~SkeletonGenerator()
+{
+	delete[] m_pUsers;
+}
+
+void SkeletonGenerator::Reset()
+{
+	m_frame = 0;
+	for (int i = 0; i < m_settings.users; ++i)
+	{
+		User& user = m_pUsers[i];
+		user.random = (m_settings.seed * 7919 + i * 104729 + 1) & 0xFFFFFFFFUL;
+		user.x = (i - (m_settings.users - 1) / 2.0f) * g_userSpacing;
+		user.z = g_userDistance + RandomRange(user, -200, 200);
+		user.height = RandomRange(user, 0.9f, 1.1f);
+		user.dropoutJoint = -1;
+		user.dropoutEnd = 0;
+		StartMotion(user);
+	}
+}
+
+void SkeletonGenerator::Next(SkeletonFrame* pFrames)
+{
+	for (int i = 0; i < m_settings.users; ++i)
+	{
+		User& user = m_pUsers[i];
+		if (m_frame - user.motionStart >= user.motionFrames)
+		{
+			StartMotion(user);
+		}
+		if (user.dropoutJoint >= 0 && m_frame >= user.dropoutEnd)
+		{
+			user.dropoutJoint = -1;
+		}
+		if (user.dropoutJoint < 0 && (int)(NextRandom(user) & 0xFFFF) < m_dropoutChance)
+		{
+			user.dropoutJoint = NextRandom(user) % SKELETON_JOINT_COUNT;
+			user.dropoutEnd = m_frame + (int)(m_settings.dropoutSeconds * m_settings.frameRate + 0.5);
+		}
+
+		pFrames[i].userId = i + 1;
+		pFrames[i].tracked = true;
+		pFrames[i].timestamp = (uint64_t)(m_frame * 1e6 / m_settings.frameRate);
+		Pose(user, &pFrames[i]);
+	}
+	m_frame++;
+}
+
+// Same generator on every platform, unsigned long is 64 bits on Linux
+unsigned int SkeletonGenerator::NextRandom(User& user)
+{
+	user.random = (user.random * 1664525UL + 1013904223UL) & 0xFFFFFFFFUL;
+	return (unsigned int)(user.random >> 8);
+}
+
+float SkeletonGenerator::RandomRange(User& user, float low, float high)
+{
+	return low + (high - low) * (NextRandom(user) & 0xFFFF) / 65535.0f;
+}
+
+void SkeletonGenerator::StartMotion(User& user)
+{
+	user.motion = (SkeletonMotion)(NextRandom(user) % MOTION_COUNT);
+	user.motionStart = m_frame;
+	double seconds = m_settings.minMotionSeconds +
+		(m_settings.maxMotionSeconds - m_settings.minMotionSeconds) * (NextRandom(user) & 0xFFFF) / 65535.0;
+	user.motionFrames = (int)(seconds * m_settings.frameRate + 0.5);
+	if (user.motionFrames < 1)
+	{
+		user.motionFrames = 1;
+	}
+}
+
+static float SmoothStep(float t)
+{
+	t = t < 0 ? 0 : (t > 1 ? 1 : t);
+	return t * t * (3 - 2 * t);
+}
+
+// Rest pose, then the moving hand and its elbow, then sway, jitter and dropout
+void SkeletonGenerator::Pose(User& user, SkeletonFrame* pFrame)
+{
+	float sway = g_swayAmplitude * (float)sin(2 * 3.14159265358979 * g_swayFrequency * m_frame / m_settings.frameRate + user.x / g_userSpacing);
+	for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+	{
+		SkeletonJoint& joint = pFrame->joints[i];
+		joint.x = user.x + g_restPose[i][0] * user.height + sway;
+		joint.y = g_restPose[i][1] * user.height;
+		joint.z = user.z + g_restPose[i][2] * user.height;
+		joint.confidence = 1;
+	}
+
+	if (user.motion != MOTION_IDLE)
+	{
+		bool right = user.motion == MOTION_RAISE_RIGHT || user.motion == MOTION_PUSH_RIGHT || user.motion == MOTION_SWIPE_RIGHT
+			|| user.motion == MOTION_CIRCLE_RIGHT;
+		float side = right ? 1.0f : -1.0f;
+		const SkeletonJoint& shoulder = pFrame->joints[right ? SKELETON_RIGHT_SHOULDER : SKELETON_LEFT_SHOULDER];
+		const SkeletonJoint& head = pFrame->joints[SKELETON_HEAD];
+		SkeletonJoint& hand = pFrame->joints[right ? SKELETON_RIGHT_HAND : SKELETON_LEFT_HAND];
+		SkeletonJoint& elbow = pFrame->joints[right ? SKELETON_RIGHT_ELBOW : SKELETON_LEFT_ELBOW];
+
+		float t = (float)(m_frame - user.motionStart) / user.motionFrames;
+		float lift = SmoothStep(t / g_motionRamp) * SmoothStep((1 - t) / g_motionRamp);
+		float targetX, targetY, targetZ;
+		switch (user.motion)
+		{
+			case MOTION_RAISE_RIGHT:
+			case MOTION_RAISE_LEFT:
+				targetX = shoulder.x + side * 40;
+				targetY = head.y + 150 * user.height;
+				targetZ = shoulder.z;
+				break;
+			case MOTION_PUSH_RIGHT:
+			case MOTION_PUSH_LEFT:
+				targetX = shoulder.x - side * 60;
+				targetY = shoulder.y - 50 * user.height;
+				targetZ = shoulder.z - 500 * user.height;
+				break;
+			case MOTION_CIRCLE_RIGHT:
+			case MOTION_CIRCLE_LEFT:
+			{
+				// Clockwise as the user sees it, starting and ending at the top
+				float angle = 2 * 3.14159265f * SmoothStep((t - g_motionRamp) / (1 - 2 * g_motionRamp));
+				targetX = shoulder.x + side * (float)sin(angle) * g_circleRadius * user.height;
+				targetY = shoulder.y + (float)cos(angle) * g_circleRadius * user.height;
+				targetZ = shoulder.z - 400 * user.height;
+				break;
+			}
+			default:
+				// Swipes sweep from the outside to across the body while raised
+				targetX = shoulder.x + side * (350 - 800 * SmoothStep(t)) * user.height;
+				targetY = shoulder.y + 50 * user.height;
+				targetZ = shoulder.z - 250 * user.height;
+				break;
+		}
+		hand.x += (targetX - hand.x) * lift;
+		hand.y += (targetY - hand.y) * lift;
+		hand.z += (targetZ - hand.z) * lift;
+		elbow.x = (shoulder.x + hand.x) / 2 + side * 40;
+		elbow.y = (shoulder.y + hand.y) / 2 - 40;
+		elbow.z = (shoulder.z + hand.z) / 2;
+	}
+
+	if (m_settings.noise > 0)
+	{
+		for (int i = 0; i < SKELETON_JOINT_COUNT; ++i)
+		{
+			SkeletonJoint& joint = pFrame->joints[i];
+			joint.x += RandomRange(user, -m_settings.noise, m_settings.noise);
+			joint.y += RandomRange(user, -m_settings.noise, m_settings.noise);
+			joint.z += RandomRange(user, -m_settings.noise, m_settings.noise);
+		}
+	}
+	if (user.dropoutJoint >= 0)
+	{
+		pFrame->joints[user.dropoutJoint].confidence = 0;
+	}
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Synthetic skeletons for benchmarks without a camera     *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SKELETON_GENERATOR_H_
+#define _MINDSTORM_SKELETON_GENERATOR_H_
+
+#include "Skeleton.h"
+
+// What a generated user is doing with the arms
+enum SkeletonMotion
+{
+	MOTION_IDLE,			// Arms hanging
+	MOTION_RAISE_RIGHT,		// Right hand up above the head and back down
+	MOTION_RAISE_LEFT,
+	MOTION_PUSH_RIGHT,		// Right hand pushed from the chest towards the camera
+	MOTION_PUSH_LEFT,
+	MOTION_SWIPE_RIGHT,		// Right hand across the body at shoulder height
+	MOTION_SWIPE_LEFT,
+	MOTION_CIRCLE_RIGHT,	// Right hand once round a circle in front of the shoulder
+	MOTION_CIRCLE_LEFT,
+	MOTION_COUNT
+};
+
+struct SkeletonGeneratorSettings
+{
+	int users;
+	double frameRate;			// Frames per second, sets the timestamps
+	unsigned long seed;
+	float noise;				// Largest jitter added to every coordinate, in mm
+	double minMotionSeconds;	// Every user picks a new motion after this
+	double maxMotionSeconds;	// long, at random in between
+	double dropoutsPerSecond;	// Per user, one joint loses its confidence
+	double dropoutSeconds;		// for this long
+};
+
+// 30 frames per second, 10 mm jitter, motions of 0.5 to 1.5 s and a joint
+// dropping out every other second for 0.2 s, like a user 2 m from an Xtion
+SkeletonGeneratorSettings MakeSkeletonSettings(int users, unsigned long seed);
+
+// Users standing side by side in front of the camera, each going through a
+// random sequence of motions. Every frame is computed from the frame index
+// and the state of a per-user random generator, so the same settings always
+// give the same frames, however fast they are read.
+class SkeletonGenerator
+{
+	public:
+		SkeletonGenerator(const SkeletonGeneratorSettings& settings);
+		~SkeletonGenerator();
+
+		void Reset();	// Back to the first frame
+		// Writes the next frame of every user to pFrames[0..users-1]
+		void Next(SkeletonFrame* pFrames);
+
+		int GetUserCount() const { return m_settings.users; }
+		int GetFrameIndex() const { return m_frame; }
+		// Motion of the frame last written, to check gesture recognition
+		SkeletonMotion GetMotion(int user) const { return m_pUsers[user].motion; }
+		// Frame index the motion started at, tells repeated motions apart
+		int GetMotionStart(int user) const { return m_pUsers[user].motionStart; }
+		int GetMotionFrames(int user) const { return m_pUsers[user].motionFrames; }
+
+	private:
+		SkeletonGenerator(const SkeletonGenerator&);
+		SkeletonGenerator& operator=(const SkeletonGenerator&);
+
+		struct User
+		{
+			unsigned long random;
+			float x;				// Where the user stands, in mm
+			float z;
+			float height;			// Scale of a 1.75 m body
+			SkeletonMotion motion;
+			int motionStart;		// Frame indices
+			int motionFrames;
+			int dropoutJoint;		// -1 when none
+			int dropoutEnd;
+		};
+
+		static unsigned int NextRandom(User& user);
+		static float RandomRange(User& user, float low, float high);
+		void StartMotion(User& user);
+		void Pose(User& user, SkeletonFrame* pFrame);
+
+		SkeletonGeneratorSettings	m_settings;
+		User*						m_pUsers;
+		int							m_frame;
+		int							m_dropoutChance;	// Per frame, out of 65536
+};
+
+#endif // _MINDSTORM_SKELETON_GENERATOR_H_
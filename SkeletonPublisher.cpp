@@ -0,0 +1,139 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Tracked skeletons published to other processes          *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "SkeletonPublisher.h"
+
+SkeletonPublisher::SkeletonPublisher() : m_pShared(NULL), m_pFrame(NULL), m_published(0)
+{
+}
+
+SkeletonPublisher::~SkeletonPublisher()
+{
+	Close();
+}
+
+// Memory taken over is written as it is, and readers still holding it see
+// the count start over
+bool SkeletonPublisher::Open(const char* name, bool takeOver)
+{
+	if (!m_memory.Create(name, sizeof(SharedSkeletons), takeOver))
+	{
+		return false;
+	}
+	m_pShared = (SharedSkeletons*)m_memory.GetData();
+	m_pShared->magic = SHARED_SKELETONS_MAGIC;
+	m_pShared->version = SHARED_SKELETONS_VERSION;
+	m_pShared->published = 0;
+	for (int i = 0; i < SHARED_SKELETONS_SLOTS; ++i)
+	{
+		SharedFrame& frame = m_pShared->frames[i];
+		frame.sequence = frame.sequence | 1;
+		MemoryFence();
+		frame.number = -1;
+		MemoryFence();
+		frame.sequence = frame.sequence + 1;
+	}
+	MemoryFence();
+	m_pShared->publishing = 1;
+	m_published = 0;
+	return true;
+}
+
+void SkeletonPublisher::Close()
+{
+	if (m_pShared == NULL)
+	{
+		return;
+	}
+	if (m_pFrame != NULL)
+	{
+		EndFrame();
+	}
+	m_pShared->publishing = 0;
+	MemoryFence();
+	m_pShared = NULL;
+	m_memory.Close();
+}
+
+void SkeletonPublisher::BeginFrame(int frameIndex, uint64_t timestamp, int steeringMode)
+{
+	if (m_pShared == NULL)
+	{
+		return;
+	}
+	// A frame never ended is written over
+	if (m_pFrame == NULL)
+	{
+		m_pFrame = &m_pShared->frames[m_published % SHARED_SKELETONS_SLOTS];
+		m_pFrame->sequence = m_pFrame->sequence + 1;
+		MemoryFence();
+	}
+	m_pFrame->number = m_published;
+	m_pFrame->frameIndex = frameIndex;
+	m_pFrame->steeringMode = steeringMode;
+	m_pFrame->timestamp = timestamp;
+	m_pFrame->userCount = 0;
+	m_pFrame->robotCount = 0;
+}
+
+void SkeletonPublisher::AddUser(const SkeletonFrame& skeleton, bool visible, float x, float y, float z, int sensors)
+{
+	if (m_pFrame == NULL || m_pFrame->userCount == SHARED_SKELETONS_USERS)
+	{
+		return;
+	}
+	SharedUser& user = m_pFrame->users[m_pFrame->userCount++];
+	user.userId = skeleton.userId;
+	user.tracked = skeleton.tracked ? 1 : 0;
+	user.visible = visible ? 1 : 0;
+	user.sensors = sensors;
+	user.x = x;
+	user.y = y;
+	user.z = z;
+	for (int j = 0; j < SHARED_SKELETONS_JOINTS; ++j)
+	{
+		user.joints[j].x = skeleton.joints[j].x;
+		user.joints[j].y = skeleton.joints[j].y;
+		user.joints[j].z = skeleton.joints[j].z;
+		user.joints[j].confidence = skeleton.joints[j].confidence;
+	}
+}
+
+void SkeletonPublisher::SetRobot(int robot, int driver, bool connected, int speed, int turnRatio, int gripperPower)
+{
+	if (m_pFrame == NULL || robot < 0 || robot >= SHARED_SKELETONS_ROBOTS)
+	{
+		return;
+	}
+	for (int r = m_pFrame->robotCount; r < robot; ++r)
+	{
+		SharedRobot none = {0, 0, 0, 0, 0, 0};
+		m_pFrame->robots[r] = none;
+	}
+	SharedRobot& shared = m_pFrame->robots[robot];
+	shared.driver = driver;
+	shared.connected = connected ? 1 : 0;
+	shared.speed = speed;
+	shared.turnRatio = turnRatio;
+	shared.gripperPower = gripperPower;
+	shared.reserved = 0;
+	m_pFrame->robotCount = robot + 1 > m_pFrame->robotCount ? robot + 1 : m_pFrame->robotCount;
+}
+
+void SkeletonPublisher::EndFrame()
+{
+	if (m_pFrame == NULL)
+	{
+		return;
+	}
+	m_pFrame->published = GetTimeMicros();
+	MemoryFence();
+	m_pFrame->sequence = m_pFrame->sequence + 1;
+	MemoryFence();
+	m_pShared->published = ++m_published;
+	m_pFrame = NULL;
+}
@@ -0,0 +1,52 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Tracked skeletons published to other processes          *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SKELETON_PUBLISHER_H_
+#define _MINDSTORM_SKELETON_PUBLISHER_H_
+
+#include "Platform.h"
+#include "Skeleton.h"
+#include "SharedSkeletons.h"
+
+// Writes every tracker frame's users and steering into a ring of frames in
+// shared memory, straight into the slot readers will read it from. Every
+// slot is a sequence lock of its own: the viewer never waits for anyone,
+// and readers map the memory read-only, so the slowest or stuck reader can
+// only lose frames, never hold up the tracker. All calls from the thread
+// that tracks.
+class SkeletonPublisher
+{
+	public:
+		SkeletonPublisher();
+		~SkeletonPublisher();	// Tells readers it stopped
+
+		// Fails while another publisher has the name, unless takeOver, as
+		// after a viewer that crashed
+		bool Open(const char* name, bool takeOver);
+		void Close();
+		bool IsOpen() const { return m_pShared != NULL; }
+
+		// A frame is what is added between these two. Users past
+		// SHARED_SKELETONS_USERS are left out.
+		void BeginFrame(int frameIndex, uint64_t timestamp, int steeringMode);
+		void AddUser(const SkeletonFrame& skeleton, bool visible, float x, float y, float z, int sensors);
+		void SetRobot(int robot, int driver, bool connected, int speed, int turnRatio, int gripperPower);
+		void EndFrame();
+
+		int GetPublished() const { return m_published; }
+
+	private:
+		SkeletonPublisher(const SkeletonPublisher&);
+		SkeletonPublisher& operator=(const SkeletonPublisher&);
+
+		SharedMemory			m_memory;
+		SharedSkeletons*		m_pShared;
+		SharedFrame*			m_pFrame;		// Being written, NULL between frames
+		int						m_published;
+};
+
+#endif // _MINDSTORM_SKELETON_PUBLISHER_H_
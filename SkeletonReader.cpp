@@ -0,0 +1,86 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Reads the skeletons another process publishes           *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "SkeletonReader.h"
+
+SkeletonReader::SkeletonReader() : m_pShared(NULL)
+{
+}
+
+bool SkeletonReader::Open(const char* name)
+{
+	Close();
+	if (!m_memory.Open(name, sizeof(SharedSkeletons)))
+	{
+		return false;
+	}
+	const SharedSkeletons* pShared = (const SharedSkeletons*)m_memory.GetData();
+	if (pShared->magic != SHARED_SKELETONS_MAGIC || pShared->version != SHARED_SKELETONS_VERSION)
+	{
+		m_memory.Close();
+		return false;
+	}
+	m_pShared = pShared;
+	return true;
+}
+
+void SkeletonReader::Close()
+{
+	m_pShared = NULL;
+	m_memory.Close();
+}
+
+bool SkeletonReader::IsPublishing() const
+{
+	return m_pShared != NULL && m_pShared->publishing != 0;
+}
+
+int SkeletonReader::GetLatest() const
+{
+	if (m_pShared == NULL)
+	{
+		return -1;
+	}
+	int latest = m_pShared->published - 1;
+	MemoryFence();
+	return latest;
+}
+
+const SharedFrame* SkeletonReader::BeginRead(int frame, int* pSequence) const
+{
+	if (m_pShared == NULL || frame < 0)
+	{
+		return NULL;
+	}
+	const SharedFrame* pFrame = &m_pShared->frames[frame % SHARED_SKELETONS_SLOTS];
+	int sequence = pFrame->sequence;
+	MemoryFence();
+	if ((sequence & 1) != 0 || pFrame->number != frame)
+	{
+		return NULL;
+	}
+	*pSequence = sequence;
+	return pFrame;
+}
+
+bool SkeletonReader::EndRead(const SharedFrame* pFrame, int sequence) const
+{
+	MemoryFence();
+	return pFrame->sequence == sequence;
+}
+
+bool SkeletonReader::Read(int frame, SharedFrame* pCopy) const
+{
+	int sequence;
+	const SharedFrame* pFrame = BeginRead(frame, &sequence);
+	if (pFrame == NULL)
+	{
+		return false;
+	}
+	*pCopy = *pFrame;
+	return EndRead(pFrame, sequence);
+}
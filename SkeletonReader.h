@@ -0,0 +1,49 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Reads the skeletons another process publishes           *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SKELETON_READER_H_
+#define _MINDSTORM_SKELETON_READER_H_
+
+#include "Platform.h"
+#include "SharedSkeletons.h"
+
+// Reader side of SkeletonPublisher, all another program needs next to
+// Platform.cpp. Frames are read where they lie in shared memory: BeginRead()
+// gives the slot, EndRead() tells whether the viewer wrote over it in the
+// meantime, in which case whatever was read has to be dropped. Nothing here
+// writes to the shared memory or waits on the viewer.
+class SkeletonReader
+{
+	public:
+		SkeletonReader();
+
+		// False while no viewer publishes under the name, or publishes another
+		// version
+		bool Open(const char* name);
+		void Close();
+		bool IsOpen() const { return m_pShared != NULL; }
+		// False once the viewer has stopped; a new one needs Open() again
+		bool IsPublishing() const;
+
+		// Newest complete frame, -1 before the first. Frames older than
+		// SHARED_SKELETONS_SLOTS behind it are gone.
+		int GetLatest() const;
+		// NULL when frame is not there, not yet or not anymore
+		const SharedFrame* BeginRead(int frame, int* pSequence) const;
+		bool EndRead(const SharedFrame* pFrame, int sequence) const;
+		// Both around a copy, for readers that keep the frame
+		bool Read(int frame, SharedFrame* pCopy) const;
+
+	private:
+		SkeletonReader(const SkeletonReader&);
+		SkeletonReader& operator=(const SkeletonReader&);
+
+		SharedMemory			m_memory;
+		const SharedSkeletons*	m_pShared;
+};
+
+#endif // _MINDSTORM_SKELETON_READER_H_
@@ -0,0 +1,167 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Sample reader of the published skeletons                *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "SkeletonWatch.h"
+#include "SkeletonReader.h"
+#include <stdio.h>
+
+// How often the shared memory is looked at. A reader polling slower than
+// SHARED_SKELETONS_SLOTS frames loses some. In milliseconds.
+const unsigned int g_watchPoll = 5;
+// Without a new frame this long the viewer is taken for gone and the
+// memory opened again, in case a new one has started. In microseconds.
+const uint64_t g_watchReopen = 2000000;
+
+// What one second of frames looked like
+struct WatchSummary
+{
+	int frames;
+	int missed;				// Overwritten before they were read
+	int torn;				// Overwritten while being read
+	double behindMs;		// Summed time from publishing to reading
+	double mostBehindMs;
+	int frameIndex;			// Of the latest frame
+	int users;
+	int tracked;
+	int driver;				// Of the first robot
+	int speed;
+	int turnRatio;
+	float head[3];			// The driver's
+};
+
+// Reads the frame where it lies; false when it was written over meanwhile
+static bool ReadFrame(const SkeletonReader& reader, int number, WatchSummary* pSummary)
+{
+	int sequence;
+	const SharedFrame* pFrame = reader.BeginRead(number, &sequence);
+	if (pFrame == NULL)
+	{
+		pSummary->missed++;
+		return false;
+	}
+	int users = pFrame->userCount < SHARED_SKELETONS_USERS ? pFrame->userCount : SHARED_SKELETONS_USERS;
+	int tracked = 0;
+	int driver = pFrame->robotCount > 0 ? pFrame->robots[0].driver : 0;
+	float head[3] = {0, 0, 0};
+	for (int i = 0; i < users; ++i)
+	{
+		const SharedUser& user = pFrame->users[i];
+		tracked += user.tracked;
+		if (user.userId == driver && user.tracked)
+		{
+			head[0] = user.joints[0].x;
+			head[1] = user.joints[0].y;
+			head[2] = user.joints[0].z;
+		}
+	}
+	int frameIndex = pFrame->frameIndex;
+	int speed = pFrame->robotCount > 0 ? pFrame->robots[0].speed : 0;
+	int turnRatio = pFrame->robotCount > 0 ? pFrame->robots[0].turnRatio : 0;
+	uint64_t published = pFrame->published;
+	if (!reader.EndRead(pFrame, sequence))
+	{
+		pSummary->torn++;
+		return false;
+	}
+
+	uint64_t now = GetTimeMicros();
+	double behindMs = now > published ? (now - published) / 1000.0 : 0;
+	pSummary->frames++;
+	pSummary->behindMs += behindMs;
+	pSummary->mostBehindMs = behindMs > pSummary->mostBehindMs ? behindMs : pSummary->mostBehindMs;
+	pSummary->frameIndex = frameIndex;
+	pSummary->users = users;
+	pSummary->tracked = tracked;
+	pSummary->driver = driver;
+	pSummary->speed = speed;
+	pSummary->turnRatio = turnRatio;
+	for (int k = 0; k < 3; ++k)
+	{
+		pSummary->head[k] = head[k];
+	}
+	return true;
+}
+
+static void PrintSummary(const WatchSummary& summary)
+{
+	printf("frame %d: %d users, %d tracked", summary.frameIndex, summary.users, summary.tracked);
+	if (summary.driver != 0)
+	{
+		printf(", user %d drives at %d turning %d, head at %.0f %.0f %.0f", summary.driver, summary.speed,
+			summary.turnRatio, summary.head[0], summary.head[1], summary.head[2]);
+	}
+	printf(" | %d frames, %d missed, %d torn, %.1f ms behind (%.1f at most)\n", summary.frames, summary.missed,
+		summary.torn, summary.frames > 0 ? summary.behindMs / summary.frames : 0, summary.mostBehindMs);
+}
+
+int RunSkeletonWatch(const char* name, int seconds)
+{
+	SkeletonReader reader;
+	WatchSummary second = {0};
+	int total = 0, missed = 0, torn = 0;
+	int next = 0;
+	bool waiting = false;
+	uint64_t start = GetTimeMicros(), lastReport = start, lastFrame = start;
+	while (seconds <= 0 || GetTimeMicros() - start < (uint64_t)seconds * 1000000)
+	{
+		uint64_t now = GetTimeMicros();
+		if (!reader.IsPublishing() || now - lastFrame > g_watchReopen)
+		{
+			if (!reader.Open(name))
+			{
+				if (!waiting)
+				{
+					printf("Waiting for a viewer started with -publish\n");
+					waiting = true;
+				}
+				SleepMillis(500);
+				continue;
+			}
+			printf("Reading skeletons from %s\n", name);
+			waiting = false;
+			next = reader.GetLatest() + 1;
+			lastFrame = now;
+		}
+
+		int latest = reader.GetLatest();
+		if (latest < next - 1)
+		{
+			// The viewer started over in the same memory
+			next = latest + 1;
+		}
+		if (latest - next >= SHARED_SKELETONS_SLOTS)
+		{
+			second.missed += latest - next + 1 - SHARED_SKELETONS_SLOTS;
+			next = latest + 1 - SHARED_SKELETONS_SLOTS;
+		}
+		for (; next <= latest; ++next)
+		{
+			ReadFrame(reader, next, &second);
+			lastFrame = now;
+		}
+
+		if (now - lastReport >= 1000000)
+		{
+			if (second.frames > 0 || second.missed > 0 || second.torn > 0)
+			{
+				PrintSummary(second);
+			}
+			total += second.frames;
+			missed += second.missed;
+			torn += second.torn;
+			WatchSummary empty = {0};
+			second = empty;
+			lastReport = now;
+		}
+		SleepMillis(g_watchPoll);
+	}
+	total += second.frames;
+	missed += second.missed;
+	torn += second.torn;
+	printf("%d frames read, %d missed, %d written over while read\n", total, missed, torn);
+	return 0;
+}
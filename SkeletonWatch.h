@@ -0,0 +1,18 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Sample reader of the published skeletons                *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_SKELETON_WATCH_H_
+#define _MINDSTORM_SKELETON_WATCH_H_
+
+// Follows the skeletons a viewer started with -publish shares under name,
+// as any other program would with SkeletonReader, and prints once a second
+// what it saw: the people, who drives what and how far behind the tracker
+// it is. Waits for a viewer to start, and for the next one after it stops.
+// Runs for seconds, or until killed for 0. Returns the process exit code.
+int RunSkeletonWatch(const char* name, int seconds);
+
+#endif // _MINDSTORM_SKELETON_WATCH_H_
@@ -0,0 +1,201 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Arm positions turned into robot motion                  *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "Steering.h"
+#include <map>
+#include <string>
+#include <math.h>
+
+using namespace std;
+
+// Steering constants
+const float precisionX = 100;
+const float precisionY = 50;
+const int speed = 40;
+
+// Hand joystick: no motion this close to the start, full speed this far.
+// In millimeters.
+const float g_handDeadZone = 60;
+const float g_handFullScale = 250;
+const int g_handMaxSpeed = 60;
+// Speeds and turn ratios are rounded to this, so hand jitter is not sent
+const int g_handStep = 10;
+
+// Joints the steering methods look at, by the names they use
+struct NamedJoint
+{
+	const char* name;
+	SkeletonJointId joint;
+};
+
+const NamedJoint g_steeringJoints[] =
+{
+	{"right_hand", SKELETON_RIGHT_HAND},
+	{"right_shoulder", SKELETON_RIGHT_SHOULDER},
+	{"left_hand", SKELETON_LEFT_HAND},
+	{"left_shoulder", SKELETON_LEFT_SHOULDER},
+	{"right_elbow", SKELETON_RIGHT_ELBOW},
+	{"left_elbow", SKELETON_LEFT_ELBOW},
+	{"torso", SKELETON_TORSO},
+	{"left_hip", SKELETON_LEFT_HIP}
+};
+
+static void RunSteeringMethodOne(map<string, map<char, float>> positions, Drivetrain* pDrive)
+{
+	if(positions["right_hand"]['y'] > positions["right_shoulder"]['y'])
+	{
+		if(positions["right_hand"]['x'] > (positions["right_shoulder"]['x'] + precisionX)) 
+		{
+			pDrive->Drive(speed, -100); // OUT_B back, OUT_C forward
+		} 
+		else if(positions["right_hand"]['x'] < (positions["right_shoulder"]['x'] - precisionX)) 
+		{
+			pDrive->Drive(speed, 100); // OUT_B forward, OUT_C back
+		}  
+		else 
+		{
+			pDrive->Forward(speed);
+		}
+	} 
+	else if(positions["left_hand"]['y'] > positions["left_shoulder"]['y'])
+	{
+		pDrive->Reverse(speed);
+	} 
+	else 
+	{
+		pDrive->Stop();
+	}
+}
+
+static void RunSteeringMethodTwo(map<string, map<char, float>> positions, Drivetrain* pDrive)
+{
+	if(positions["left_hand"]['z'] > positions["right_hand"]['z'] + precisionX 
+		&& positions["right_hand"]['y'] > positions["torso"]['y'] + precisionY)
+	{
+		pDrive->Forward(speed);
+	}
+						
+	else if(positions["right_hand"]['z'] > positions["left_hand"]['z'] + precisionX 
+		&& positions["left_hand"]['y'] > positions["torso"]['y'] + precisionY)
+	{
+		pDrive->Reverse(speed);
+	}
+	else if(positions["right_hand"]['x'] > positions["right_shoulder"]['x'] + precisionX 
+		&& positions["right_hand"]['y'] < positions["right_shoulder"]['y'] - precisionY 
+		&& positions["right_hand"]['y'] > positions["left_hip"]['y'] + precisionY)
+	{
+		pDrive->Drive(speed, -100); // OUT_B back, OUT_C forward
+	}
+	else if(positions["left_hand"]['x'] < positions["left_shoulder"]['x'] - precisionX 
+		&& positions["left_hand"]['y'] < positions["left_shoulder"]['y'] - precisionY 
+		&& positions["left_hand"]['y'] > positions["left_hip"]['y'] + precisionY)
+	{
+		pDrive->Drive(speed, 100); // OUT_B forward, OUT_C back
+	}
+	else
+	{
+		pDrive->Stop();
+	}
+}
+
+static void RunSteeringMethodThree(map<string, map<char, float>> positions, Drivetrain* pDrive)
+{
+	if(positions["right_hand"]['y'] > positions["right_shoulder"]['y'])
+	{
+		pDrive->Gripper(10);
+	} 
+	else if(positions["left_hand"]['y'] > (positions["left_shoulder"]['y'] - precisionY)) 
+	{
+		pDrive->Gripper(-10);
+	}  
+	else if(positions["right_hand"]['x'] > positions["right_hip"]['x'] + precisionX
+		&& positions["right_hand"]['y'] < positions["right_shoulder"]['y'])
+	{
+		pDrive->Forward(speed);
+	}
+	else if(positions["left_hand"]['x'] + 100 < positions["left_hip"]['x'] - precisionY
+		&& positions["left_hand"]['y'] < positions["left_shoulder"]['y'])
+	{
+		pDrive->Reverse(speed);
+	}
+	else if(positions["left_hand"]['z'] + precisionX < positions["right_hand"]['z']
+		&& positions["left_hand"]['y'] < positions["torso"]['y']
+		&& positions["right_hand"]['y'] < positions["torso"]['y'])
+	{
+		pDrive->Drive(speed, 100); // OUT_B forward, OUT_C back
+	}
+	else if(positions["left_hand"]['z'] - precisionX > positions["right_hand"]['z']
+		&& positions["right_hand"]['y'] < positions["torso"]['y']
+		&& positions["left_hand"]['y'] < positions["torso"]['y'])
+	{
+		pDrive->Drive(speed, -100); // OUT_B back, OUT_C forward
+	}
+	else
+	{
+		pDrive->Gripper(0);
+		pDrive->Stop();
+	}
+}
+
+void RunSteering(int method, const SkeletonFrame& skeleton, Drivetrain* pDrive)
+{
+	// Joints left out read as 0, as they always have
+	map<string, map<char, float>> positions;
+	for (size_t i = 0; i < sizeof(g_steeringJoints) / sizeof(g_steeringJoints[0]); ++i)
+	{
+		const SkeletonJoint& joint = skeleton.joints[g_steeringJoints[i].joint];
+		if (joint.confidence > .5)
+		{
+			map<char, float>& position = positions[g_steeringJoints[i].name];
+			position['x'] = joint.x;
+			position['y'] = joint.y;
+			position['z'] = joint.z;
+		}
+	}
+
+	switch (method)
+	{
+		case 0:
+			RunSteeringMethodOne(positions, pDrive);
+			break;
+		case 1:
+			RunSteeringMethodTwo(positions, pDrive);
+			break;
+		case 2:
+			RunSteeringMethodThree(positions, pDrive);
+			break;
+	}
+}
+
+// Share of full past the dead zone, in steps, with the offset's sign
+static int HandAxis(float offset, int full)
+{
+	float beyond = (float)fabs(offset) - g_handDeadZone;
+	if (beyond <= 0)
+	{
+		return 0;
+	}
+	float share = beyond / (g_handFullScale - g_handDeadZone);
+	share = share > 1 ? 1 : share;
+	int value = (int)(share * full / g_handStep + .5f) * g_handStep;
+	return offset < 0 ? -value : value;
+}
+
+void RunHandSteering(const SkeletonJoint& hand, const SkeletonJoint& origin, Drivetrain* pDrive)
+{
+	int forward = HandAxis(origin.z - hand.z, g_handMaxSpeed);
+	// Hand to the right turns like the right arm of method 0
+	int turn = -HandAxis(hand.x - origin.x, 100);
+	if (forward == 0 && turn != 0)
+	{
+		pDrive->Drive(HandAxis((float)fabs(hand.x - origin.x), g_handMaxSpeed), turn < 0 ? -100 : 100);
+	}
+	else
+	{
+		pDrive->Drive(forward, turn);
+	}
+}
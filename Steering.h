@@ -0,0 +1,29 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Arm positions turned into robot motion                  *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_STEERING_H_
+#define _MINDSTORM_STEERING_H_
+
+#include "Skeleton.h"
+#include "Drivetrain.h"
+
+// Methods offered by the menu and -steering:
+//   0  simple steering, right arm drives and turns, left arm reverses
+//   1  depth steering, one hand pushed ahead of the other
+//   2  steering with the gripper on OUT_A
+#define STEERING_METHOD_COUNT 3
+
+// Runs one steering method on the driver's skeleton. Joints with a position
+// confidence of 0.5 or less are left out, as the tracker made them up.
+void RunSteering(int method, const SkeletonFrame& skeleton, Drivetrain* pDrive);
+
+// Hand mode: the tracked hand as a joystick around where it started. Pushed
+// towards the camera drives, pulled back reverses, sideways turns or, with
+// no speed, spins in place. Speed grows with the distance past a dead zone.
+void RunHandSteering(const SkeletonJoint& hand, const SkeletonJoint& origin, Drivetrain* pDrive);
+
+#endif // _MINDSTORM_STEERING_H_
@@ -0,0 +1,120 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Battery and motor readings polled from the brick        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "Telemetry.h"
+#include "NxtProtocol.h"
+#include <string.h>
+
+// Time between the starts of two rounds. In milliseconds.
+const unsigned int g_telemetryInterval = 50;
+// The battery changes slowly, it is read every this many rounds
+const int g_batteryEvery = 20;
+// Replies missing this long are taken as lost. In milliseconds.
+const unsigned int g_telemetryTimeout = 1000;
+// How often replies are collected while requests are in flight. In milliseconds.
+const unsigned int g_replyPollInterval = 5;
+
+TelemetryPoller::TelemetryPoller() :
+	m_inFlight(0), m_lastRequest(0), m_next(0), m_round(0), m_roundStart(0)
+{
+	memset(&m_latest, 0, sizeof(m_latest));
+	m_published.Write(m_latest);
+}
+
+void TelemetryPoller::Reset()
+{
+	m_inFlight = 0;
+	m_next = 0;
+	m_round = 0;
+	m_roundStart = 0;
+}
+
+bool TelemetryPoller::WantsRequest(uint64_t now)
+{
+	if (m_inFlight > 0 && now - m_lastRequest >= g_telemetryTimeout * 1000)
+	{
+		// Dropped by a transport that ran out of room, ask again
+		m_inFlight = 0;
+	}
+	if (m_inFlight >= TELEMETRY_MAX_IN_FLIGHT)
+	{
+		return false;
+	}
+	return m_next > 0 || m_roundStart == 0 || now - m_roundStart >= g_telemetryInterval * 1000;
+}
+
+// Ports first, so every round has a consistent set of tachometer readings
+int TelemetryPoller::EncodeRequest(unsigned char* pFrame, uint64_t now)
+{
+	if (m_next == 0)
+	{
+		m_roundStart = now;
+	}
+	int length;
+	if (m_next < MOTOR_PORT_COUNT)
+	{
+		length = EncodeGetOutputState(pFrame, m_next);
+	}
+	else
+	{
+		length = EncodeGetBatteryLevel(pFrame);
+	}
+	if (++m_next >= GetRoundLength())
+	{
+		m_next = 0;
+		m_round++;
+	}
+	m_inFlight++;
+	m_lastRequest = now;
+	return length;
+}
+
+bool TelemetryPoller::OnReply(const unsigned char* pReply, int length, uint64_t now)
+{
+	NxtOutputStatus status;
+	int millivolts;
+	if (DecodeOutputStateReply(pReply, length, &status) && status.state.port < MOTOR_PORT_COUNT)
+	{
+		MotorTelemetry& motor = m_latest.motors[status.state.port];
+		motor.power = status.state.power;
+		motor.runState = status.state.runState;
+		motor.tachoCount = status.tachoCount;
+		motor.rotationCount = status.rotationCount;
+		motor.time = now;
+	}
+	else if (DecodeBatteryLevelReply(pReply, length, &millivolts))
+	{
+		m_latest.batteryMillivolts = millivolts;
+		m_latest.batteryTime = now;
+	}
+	else
+	{
+		return false;
+	}
+	if (m_inFlight > 0)
+	{
+		m_inFlight--;
+	}
+	m_latest.replyCount++;
+	m_published.Write(m_latest);
+	return true;
+}
+
+unsigned int TelemetryPoller::GetPollDelay(uint64_t now) const
+{
+	if (m_inFlight > 0 || m_next > 0)
+	{
+		return g_replyPollInterval;
+	}
+	uint64_t due = m_roundStart + g_telemetryInterval * 1000;
+	return due > now ? (unsigned int)((due - now + 999) / 1000) : 1;
+}
+
+int TelemetryPoller::GetRoundLength() const
+{
+	return m_round % g_batteryEvery == 0 ? MOTOR_PORT_COUNT + 1 : MOTOR_PORT_COUNT;
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Battery and motor readings polled from the brick        *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_TELEMETRY_H_
+#define _MINDSTORM_TELEMETRY_H_
+
+#include "Platform.h"
+#include "RobotTransport.h"
+#include "SeqLock.h"
+
+// Requests sent before the first of them is answered
+#define TELEMETRY_MAX_IN_FLIGHT		4
+
+// Times are GetTimeMicros() when the reply arrived, 0 before the first one
+struct MotorTelemetry
+{
+	int power;				// What the brick applies, -100..100
+	int runState;
+	long tachoCount;		// Degrees since the motor position was reset
+	long rotationCount;		// Degrees since the program started
+	uint64_t time;
+};
+
+struct RobotTelemetry
+{
+	MotorTelemetry motors[MOTOR_PORT_COUNT];
+	int batteryMillivolts;	// 0 until the first reading
+	uint64_t batteryTime;
+	int replyCount;
+};
+
+// Asks the brick for its motor states and battery level in rounds: one
+// GETOUTPUTSTATE per port, plus GETBATTERYLEVEL every few rounds. Several
+// requests may be in flight; replies come back in order. Used by the link
+// thread only, except Read(), which any thread may call without a lock.
+class TelemetryPoller
+{
+	public:
+		TelemetryPoller();
+
+		// Link (re)connected, requests in flight were lost with the old one
+		void Reset();
+
+		// A round is due, or under way, and another request may go out
+		bool WantsRequest(uint64_t now);
+		// Next request of the round, encoded in place. Returns its size.
+		int EncodeRequest(unsigned char* pFrame, uint64_t now);
+		// False when the reply is not an answer to a telemetry request
+		bool OnReply(const unsigned char* pReply, int length, uint64_t now);
+		int GetInFlight() const { return m_inFlight; }
+		// Longest the link thread may sleep and still poll in time. In milliseconds.
+		unsigned int GetPollDelay(uint64_t now) const;
+
+		RobotTelemetry Read() const { return m_published.Read(); }
+		int GetVersion() const { return m_published.GetVersion(); }
+
+	private:
+		TelemetryPoller(const TelemetryPoller&);
+		TelemetryPoller& operator=(const TelemetryPoller&);
+
+		int GetRoundLength() const;
+
+		int						m_inFlight;
+		uint64_t				m_lastRequest;
+		int						m_next;			// Request of the round sent next
+		int						m_round;
+		uint64_t				m_roundStart;
+		RobotTelemetry			m_latest;
+		SeqLock<RobotTelemetry>	m_published;
+};
+
+#endif // _MINDSTORM_TELEMETRY_H_
@@ -0,0 +1,354 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Users of several sensors merged into one table          *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#include "UserMerger.h"
+#include <math.h>
+#include <string.h>
+
+// Users of different sensors closer than this on the floor are one person,
+// and a person seen by several sensors splits up once their views are
+// further apart than the second. In millimeters.
+const float g_mergeDistance = 400;
+const float g_splitDistance = 700;
+// Added to every joint's weight, so joints no sensor is sure of end up at
+// the plain mean
+const float g_fusionMinWeight = 0.001f;
+
+// Joint on the other side of the body, the same one on the center line
+const int g_mirrorJoint[SKELETON_JOINT_COUNT] =
+{
+	SKELETON_HEAD, SKELETON_NECK,
+	SKELETON_RIGHT_SHOULDER, SKELETON_LEFT_SHOULDER,
+	SKELETON_RIGHT_ELBOW, SKELETON_LEFT_ELBOW,
+	SKELETON_RIGHT_HAND, SKELETON_LEFT_HAND,
+	SKELETON_TORSO,
+	SKELETON_RIGHT_HIP, SKELETON_LEFT_HIP,
+	SKELETON_RIGHT_KNEE, SKELETON_LEFT_KNEE,
+	SKELETON_RIGHT_FOOT, SKELETON_LEFT_FOOT
+};
+
+SensorPose MakeSensorPose()
+{
+	SensorPose pose = {0, 0, 0, 0};
+	return pose;
+}
+
+SensorTransform MakeSensorTransform(const SensorPose& pose)
+{
+	float radians = pose.yaw * 3.14159265f / 180;
+	float c = cosf(radians);
+	float s = sinf(radians);
+	SensorTransform transform =
+	{
+		{c, 0, s,
+		 0, 1, 0,
+		 -s, 0, c},
+		{pose.x, pose.y, pose.z}
+	};
+	return transform;
+}
+
+void TransformPoint(const SensorTransform& transform, const float* pPoint, float* pWorld)
+{
+	const float* r = transform.rotation;
+	float x = pPoint[0], y = pPoint[1], z = pPoint[2];
+	pWorld[0] = r[0] * x + r[1] * y + r[2] * z + transform.translation[0];
+	pWorld[1] = r[3] * x + r[4] * y + r[5] * z + transform.translation[1];
+	pWorld[2] = r[6] * x + r[7] * y + r[8] * z + transform.translation[2];
+}
+
+UserMerger::UserMerger() : m_linkCount(0)
+{
+	for (int s = 0; s < MERGE_MAX_SENSORS; ++s)
+	{
+		SetPose(s, MakeSensorPose());
+	}
+}
+
+void UserMerger::ToWorld(int sensor, float x, float y, float z, float* pWorld) const
+{
+	float point[3] = {x, y, z};
+	TransformPoint(m_transforms[sensor], point, pWorld);
+}
+
+// The rotation's transpose is its inverse
+void UserMerger::ToSensor(int sensor, float x, float y, float z, float* pCamera) const
+{
+	const SensorTransform& transform = m_transforms[sensor];
+	const float* r = transform.rotation;
+	float dx = x - transform.translation[0];
+	float dy = y - transform.translation[1];
+	float dz = z - transform.translation[2];
+	pCamera[0] = r[0] * dx + r[3] * dy + r[6] * dz;
+	pCamera[1] = r[1] * dx + r[4] * dy + r[7] * dz;
+	pCamera[2] = r[2] * dx + r[5] * dy + r[8] * dz;
+}
+
+int UserMerger::FindLink(int sensor, int userId) const
+{
+	for (int i = 0; i < m_linkCount; ++i)
+	{
+		if (m_links[i].sensor == sensor && m_links[i].userId == userId)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+int UserMerger::GetMergedId(int sensor, int userId) const
+{
+	int link = FindLink(sensor, userId);
+	return link >= 0 ? m_links[link].mergedId : 0;
+}
+
+// Smallest id neither given out this frame nor held by anyone last frame,
+// who may still be merged later in this one
+int UserMerger::NewId(const MergedUser* pUsers, int count) const
+{
+	for (int id = 1; ; ++id)
+	{
+		bool used = false;
+		for (int m = 0; m < count && !used; ++m)
+		{
+			used = pUsers[m].userId == id;
+		}
+		for (int i = 0; i < m_linkCount && !used; ++i)
+		{
+			used = m_links[i].mergedId == id;
+		}
+		if (!used)
+		{
+			return id;
+		}
+	}
+}
+
+// Adds a skeleton to the merged user's joint sums. NiTE takes everyone to
+// face the sensor, so a sensor behind the user swaps left and right; a
+// skeleton that fits the ones added before better the other way round is
+// added mirrored.
+void UserMerger::AddSkeleton(int sensor, uint64_t captured, const SkeletonFrame& skeleton, int merged, MergedUser* pUsers)
+{
+	MergedUser& user = pUsers[merged];
+	float (*pSums)[5] = m_joints[merged];
+	if (user.skeletonSensors == 0)
+	{
+		memset(pSums, 0, sizeof(m_joints[merged]));
+		m_confidence[merged] = -1;
+		user.skeleton.timestamp = captured;
+	}
+
+	float world[SKELETON_JOINT_COUNT][3];
+	float confidence = 0;
+	for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+	{
+		ToWorld(sensor, skeleton.joints[j].x, skeleton.joints[j].y, skeleton.joints[j].z, world[j]);
+		confidence += skeleton.joints[j].confidence;
+	}
+	confidence /= SKELETON_JOINT_COUNT;
+
+	bool mirrored = false;
+	if (user.skeletonSensors != 0)
+	{
+		float same = 0, swapped = 0;
+		for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+		{
+			int other = g_mirrorJoint[j];
+			if (other == j || pSums[j][4] <= 0 || skeleton.joints[j].confidence <= 0 || skeleton.joints[other].confidence <= 0)
+			{
+				continue;
+			}
+			float mean[3] = {pSums[j][0] / pSums[j][3], pSums[j][1] / pSums[j][3], pSums[j][2] / pSums[j][3]};
+			for (int k = 0; k < 3; ++k)
+			{
+				same += (mean[k] - world[j][k]) * (mean[k] - world[j][k]);
+				swapped += (mean[k] - world[other][k]) * (mean[k] - world[other][k]);
+			}
+		}
+		mirrored = swapped < same;
+	}
+
+	for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+	{
+		int from = mirrored ? g_mirrorJoint[j] : j;
+		float jointConfidence = skeleton.joints[from].confidence;
+		float weight = jointConfidence + g_fusionMinWeight;
+		pSums[j][0] += weight * world[from][0];
+		pSums[j][1] += weight * world[from][1];
+		pSums[j][2] += weight * world[from][2];
+		pSums[j][3] += weight;
+		pSums[j][4] = jointConfidence > pSums[j][4] ? jointConfidence : pSums[j][4];
+	}
+
+	if (confidence > m_confidence[merged])
+	{
+		m_confidence[merged] = confidence;
+		user.skeletonSensor = sensor;
+	}
+	user.skeletonSensors |= 1 << sensor;
+	user.skeleton.tracked = true;
+	user.skeleton.timestamp = captured > user.skeleton.timestamp ? captured : user.skeleton.timestamp;
+}
+
+int UserMerger::Merge(const SensorFrame* pFrames, int sensorCount, MergedUser* pUsers)
+{
+	float sums[MERGE_MAX_USERS][3];
+	int members[MERGE_MAX_USERS];
+	Link links[MERGE_MAX_USERS];	// mergedId is an index into pUsers until all are merged
+	int linkCount = 0;
+	int count = 0;
+	sensorCount = sensorCount < MERGE_MAX_SENSORS ? sensorCount : MERGE_MAX_SENSORS;
+
+	for (int s = 0; s < sensorCount; ++s)
+	{
+		const SensorFrame& frame = pFrames[s];
+		float world[SENSOR_MAX_USERS][3];
+		int assigned[SENSOR_MAX_USERS];
+		int userCount = frame.userCount < SENSOR_MAX_USERS ? frame.userCount : SENSOR_MAX_USERS;
+		for (int i = 0; i < userCount; ++i)
+		{
+			const SensorUser& user = frame.users[i];
+			ToWorld(s, user.x, user.y, user.z, world[i]);
+			assigned[i] = user.visible ? -1 : -2;
+		}
+
+		// Pairs of this sensor's users and the people the sensors before
+		// it see, closest first. The person a user was part of last frame
+		// counts as closer, so crossing paths rarely swap anyone.
+		struct Pair
+		{
+			float distance;
+			int user;
+			int merged;
+		};
+		Pair pairs[SENSOR_MAX_USERS * MERGE_MAX_USERS];
+		int pairCount = 0;
+		for (int i = 0; i < userCount; ++i)
+		{
+			int link = assigned[i] == -1 ? FindLink(s, frame.users[i].userId) : -1;
+			for (int m = 0; m < count && assigned[i] == -1; ++m)
+			{
+				float dx = sums[m][0] / members[m] - world[i][0];
+				float dz = sums[m][2] / members[m] - world[i][2];
+				float distance = sqrtf(dx * dx + dz * dz);
+				if (link >= 0 && pUsers[m].userId == m_links[link].mergedId)
+				{
+					distance -= g_splitDistance - g_mergeDistance;
+				}
+				if (distance < g_mergeDistance)
+				{
+					Pair pair = {distance, i, m};
+					pairs[pairCount++] = pair;
+				}
+			}
+		}
+		for (int pass = 0; pass < pairCount; ++pass)
+		{
+			int best = -1;
+			for (int p = 0; p < pairCount; ++p)
+			{
+				if (assigned[pairs[p].user] == -1 && (pUsers[pairs[p].merged].sensors & (1 << s)) == 0 &&
+					(best < 0 || pairs[p].distance < pairs[best].distance))
+				{
+					best = p;
+				}
+			}
+			if (best < 0)
+			{
+				break;
+			}
+			assigned[pairs[best].user] = pairs[best].merged;
+			pUsers[pairs[best].merged].sensors |= 1 << s;
+		}
+
+		// Everyone left is someone the sensors before did not see
+		for (int i = 0; i < userCount; ++i)
+		{
+			if (assigned[i] == -1 && count < MERGE_MAX_USERS)
+			{
+				MergedUser& added = pUsers[count];
+				added.userId = 0;
+				added.sensors = 1 << s;
+				added.skeletonSensors = 0;
+				added.skeletonSensor = -1;
+				added.skeleton.tracked = false;
+				added.skeleton.timestamp = frame.captured;
+				sums[count][0] = sums[count][1] = sums[count][2] = 0;
+				members[count] = 0;
+				assigned[i] = count++;
+			}
+		}
+
+		// A person takes the id any of its users had last frame, unless
+		// someone else did first. Ids are given out only once all sensors
+		// are merged, so a person seen by a later sensor before keeps the
+		// id on coming into an earlier sensor's view.
+		for (int i = 0; i < userCount; ++i)
+		{
+			int link = assigned[i] >= 0 ? FindLink(s, frame.users[i].userId) : -1;
+			if (link < 0 || pUsers[assigned[i]].userId != 0)
+			{
+				continue;
+			}
+			bool taken = false;
+			for (int m = 0; m < count && !taken; ++m)
+			{
+				taken = pUsers[m].userId == m_links[link].mergedId;
+			}
+			pUsers[assigned[i]].userId = taken ? 0 : m_links[link].mergedId;
+		}
+
+		for (int i = 0; i < userCount; ++i)
+		{
+			int merged = assigned[i];
+			if (merged < 0)
+			{
+				continue;
+			}
+			sums[merged][0] += world[i][0];
+			sums[merged][1] += world[i][1];
+			sums[merged][2] += world[i][2];
+			members[merged]++;
+			Link added = {s, frame.users[i].userId, merged};
+			links[linkCount++] = added;
+			if (frame.users[i].skeleton.tracked)
+			{
+				AddSkeleton(s, frame.captured, frame.users[i].skeleton, merged, pUsers);
+			}
+		}
+	}
+
+	for (int m = 0; m < count; ++m)
+	{
+		if (pUsers[m].userId == 0)
+		{
+			pUsers[m].userId = NewId(pUsers, count);
+		}
+		pUsers[m].x = sums[m][0] / members[m];
+		pUsers[m].y = sums[m][1] / members[m];
+		pUsers[m].z = sums[m][2] / members[m];
+
+		SkeletonFrame& skeleton = pUsers[m].skeleton;
+		skeleton.userId = pUsers[m].userId;
+		for (int j = 0; j < SKELETON_JOINT_COUNT && pUsers[m].skeletonSensors != 0; ++j)
+		{
+			const float* pSum = m_joints[m][j];
+			skeleton.joints[j].x = pSum[0] / pSum[3];
+			skeleton.joints[j].y = pSum[1] / pSum[3];
+			skeleton.joints[j].z = pSum[2] / pSum[3];
+			skeleton.joints[j].confidence = pSum[4];
+		}
+	}
+	for (int i = 0; i < linkCount; ++i)
+	{
+		links[i].mergedId = pUsers[links[i].mergedId].userId;
+	}
+	memcpy(m_links, links, linkCount * sizeof(Link));
+	m_linkCount = linkCount;
+	return count;
+}
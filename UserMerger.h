@@ -0,0 +1,130 @@
+/*******************************************************************************
+*                                                                              *
+*   Mindstorm Viewer - Users of several sensors merged into one table          *
+*   Copyright (C) 2014-15 Kolo naukowe robotyki UWM Olsztyn                    *
+*                                                                              *
+*******************************************************************************/
+
+#ifndef _MINDSTORM_USER_MERGER_H_
+#define _MINDSTORM_USER_MERGER_H_
+
+#include "Skeleton.h"
+
+// Users one sensor reports in one frame, NiTE tracks fewer
+#define SENSOR_MAX_USERS	16
+#define MERGE_MAX_SENSORS	4
+#define MERGE_MAX_USERS		(MERGE_MAX_SENSORS * SENSOR_MAX_USERS)
+
+// One user as one sensor sees it, in that sensor's camera space
+struct SensorUser
+{
+	int userId;				// The sensor's own NiTE id
+	bool visible;
+	float x;				// Center of mass, in mm
+	float y;
+	float z;
+	SkeletonFrame skeleton;	// Joints only valid when tracked
+};
+
+// Latest frame of one sensor
+struct SensorFrame
+{
+	int frameIndex;			// -1 before the first frame
+	uint64_t timestamp;		// Device time, in microseconds
+	uint64_t captured;		// Host time the frame was taken, in microseconds
+	int userCount;
+	SensorUser users[SENSOR_MAX_USERS];
+};
+
+// Where a sensor stands in world space and how far it is turned around the
+// vertical axis, positive to the right. In mm and degrees. The default puts
+// it at the origin looking along z, so the first sensor usually defines
+// world space and the others are placed relative to it.
+struct SensorPose
+{
+	float x;
+	float y;
+	float z;
+	float yaw;
+};
+
+SensorPose MakeSensorPose();
+
+// A sensor's camera space into world space: world = rotation * camera +
+// translation. Rotation row by row, translation in mm.
+struct SensorTransform
+{
+	float rotation[9];
+	float translation[3];
+};
+
+// Sensor at the pose, held level
+SensorTransform MakeSensorTransform(const SensorPose& pose);
+void TransformPoint(const SensorTransform& transform, const float* pPoint, float* pWorld);
+
+// One person, however many sensors see them
+struct MergedUser
+{
+	int userId;				// Stays the same while any sensor keeps the person
+	int sensors;			// Bit mask of the sensors seeing the person
+	float x;				// Mean center of mass, world space
+	float y;
+	float z;
+	int skeletonSensors;	// Bit mask of the sensors whose skeletons are fused
+	int skeletonSensor;		// The most confident of them, -1 for none
+	// World space, userId is the merged id and timestamp the host time
+	// the newest of its frames was captured, so one person's frames stay
+	// in order whichever sensors they come from. Joint confidence is the
+	// highest any sensor has.
+	SkeletonFrame skeleton;
+};
+
+// Merges the users of several sensors by where they stand. Every user is
+// put into world space by the transform of its sensor, and users of
+// different sensors standing close together on the floor are one person. A
+// person keeps the merged id while any sensor that saw them last frame
+// still does, so drivers and joint histories survive walking from one
+// sensor's view into another's. Their skeletons are fused joint by joint,
+// weighted by how sure each tracker is of the joint. Storage is fixed, and
+// a frame takes time in proportion to the users of every sensor times the
+// people merged at most.
+class UserMerger
+{
+	public:
+		UserMerger();
+
+		void SetPose(int sensor, const SensorPose& pose) { SetTransform(sensor, MakeSensorTransform(pose)); }
+		void SetTransform(int sensor, const SensorTransform& transform) { m_transforms[sensor] = transform; }
+		const SensorTransform& GetTransform(int sensor) const { return m_transforms[sensor]; }
+		void ToWorld(int sensor, float x, float y, float z, float* pWorld) const;
+		void ToSensor(int sensor, float x, float y, float z, float* pCamera) const;
+
+		// Everyone the sensors see, pFrames indexed by sensor. Writes up to
+		// MERGE_MAX_USERS users and returns how many.
+		int Merge(const SensorFrame* pFrames, int sensorCount, MergedUser* pUsers);
+		// Merged id the last Merge() gave a sensor's user, 0 for none
+		int GetMergedId(int sensor, int userId) const;
+
+	private:
+		// Which merged user a sensor's user is part of
+		struct Link
+		{
+			int sensor;
+			int userId;
+			int mergedId;
+		};
+
+		int FindLink(int sensor, int userId) const;
+		int NewId(const MergedUser* pUsers, int count) const;
+		void AddSkeleton(int sensor, uint64_t captured, const SkeletonFrame& skeleton, int merged, MergedUser* pUsers);
+
+		SensorTransform			m_transforms[MERGE_MAX_SENSORS];
+		Link					m_links[MERGE_MAX_USERS];	// Of the last Merge()
+		int						m_linkCount;
+		// While merging, every merged user's joint sums weighted by
+		// confidence: x, y, z, the weights and the highest confidence
+		float					m_joints[MERGE_MAX_USERS][SKELETON_JOINT_COUNT][5];
+		float					m_confidence[MERGE_MAX_USERS];	// Of the most confident skeleton
+};
+
+#endif // _MINDSTORM_USER_MERGER_H_
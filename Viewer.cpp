@@ -15,6 +15,22 @@
 #pragma region Definitions
 #include "NXT++.h"
 #include "Viewer.h"
+#include "RobotLink.h"
+#include "Drivetrain.h"
+#include "ClosedLoopDrivetrain.h"
+#include "IntentDrivetrain.h"
+#include "Steering.h"
+#include "JointHistory.h"
+#include "GestureRecognizer.h"
+#include "DriverSelector.h"
+#include "ArenaMap.h"
+#include "BrickScheduler.h"
+#include <vector>
+#include "NxtppTransport.h"
+#include "MockTransport.h"
+#include "SerialTransport.h"
+#include "FrameClock.h"
+#include "SensorCalibration.h"
 #include<map>
 
 #if (defined _WIN32)
@@ -46,25 +62,61 @@
 	printf("[%08" PRIu64 "] User #%d:\t%s\n", ts, user.getId(), msg);\
 }
 
-// Max camera users
-#define MAX_USERS 5
-
 using namespace std;
 #pragma endregion
 #pragma region Constants
 // time to hold in pose to exit program. In milliseconds.
 const int g_poseTimeoutToExit = 2000;
 
-// Steering constants
-const float precisionX = 100;
-const float precisionY = 50;
-const int speed = 40;
+// Time for the brick to reach a new speed in intent mode. In milliseconds.
+const int g_intentRampMs = 200;
+// Battery level below which the motors lose speed under load. In millivolts.
+const int g_lowBatteryLevel = 6800;
+// Gripper opened by a gesture: power on OUT_A and for how long. In microseconds.
+const int g_gripperOpenPower = 10;
+const uint64_t g_gripperOpenTime = 1000000;
+// Gestures recorded with the 'g' key: file, length in frames, threshold
+const char* g_recordedGesturesFile = "gestures.txt";
+const int g_recordedGestureFrames = 30;
+const float g_recordedGestureThreshold = 0.08f;
+// Arena mode: zones side by side in front of the camera, one per robot. In millimeters.
+const float g_arenaZoneWidth = 1200;
+const float g_arenaNearZ = 1000;
+const float g_arenaFarZ = 3500;
+// Floor planes NiTE is less sure of are ignored and the camera taken as level
+const float g_floorConfidence = 0.5f;
+// Empty scene before the sensor slows down, unless -idle is given. In seconds.
+const int g_defaultIdleSeconds = 30;
+// Oldest frame steering may still come from, unless -maxage is given. In milliseconds.
+const unsigned int g_defaultMaxDecisionAge = 250;
+// Multi-sensor mode: longest wait for any sensor's next frame. In milliseconds.
+const unsigned int g_mergeFrameWait = 100;
+// Hands above the head count as raised when NiTE is this sure of them and the head. 0..1.
+const float g_raisedHandConfidence = 0.5f;
+// Where -calibrate writes the sensor transforms it finds
+const char* g_calibrationFile = "calibration.txt";
+// Calibration pairs frames of two sensors taken at most this far apart. In microseconds.
+const uint64_t g_calibrationMaxSkew = 20000;
+// Merged frames between two solves of every calibration
+const int g_calibrationSolveFrames = 30;
+// A solved transform replaces the one in use while its points are at most this far off. In mm rms.
+const float g_calibrationMaxError = 60;
 #pragma endregion
 #pragma region Variables
 // NXT variables
-Comm::NXTComm comm;
-bool mindstrom_connection_open = false;
-int steering_mode = 0; // User selected steering method
+RobotTransport* transports[SCHEDULER_MAX_BRICKS] = {NULL}; // Bluetooth or simulated brick of every robot
+RobotLink* robot = NULL; // Sends motor commands and keeps the link alive
+Drivetrain* drive = NULL; // OUT_B left and OUT_C right wheel, OUT_A gripper
+Drivetrain* drives[SCHEDULER_MAX_BRICKS] = {NULL}; // Every robot, drive is the first
+int robot_count = 1;
+BrickScheduler* bricks = NULL; // Arena mode: robots taking turns on one adapter, robot is the first
+ArenaMap* arena = NULL; // Arena mode: who stands in which robot's zone
+Mutex arena_air; // Simulated arena robots share one adapter
+ClosedLoopDrivetrain* speedControl = NULL; // Same as drive when wheel speeds are regulated
+RobotLinkState robot_reported_state = LINK_IDLE;
+bool robot_battery_low = false; // Low battery already reported
+int steering_mode = -1; // User selected steering method, -1 until chosen
+bool driver_steering[ARENA_MAX_ZONES] = {false}; // Driver of every robot was steering in the previous frame
 
 // Skeleton variables
 nite::SkeletonState g_skeletonStates[MAX_USERS] = {nite::SKELETON_NONE};
@@ -75,7 +127,30 @@ bool g_drawBoundingBox = false;
 bool g_drawBackground = true;
 bool g_drawDepth = true;
 bool g_drawFrameId = false;
+bool g_drawLinkMetrics = false;
 bool g_visibleUsers[MAX_USERS] = {false};
+JointHistory g_jointHistories[MAX_USERS]; // Last frames of every tracked user, emptied when tracking stops
+GestureRecognizer* gestures = NULL; // Driver's swipes and circles
+DriverSelector* driverSelector = NULL; // Who of the people in view steers
+uint64_t g_gestureSince[MAX_USERS] = {0}; // Last gesture seen, so it is taken once
+uint64_t gripper_open_until = 0; // Gripper opening until this tracker time, 0 when not
+int g_frameLimit = 0; // Tracker frames before exiting, 0 runs until the exit pose
+int g_trackerFrames = 0;
+int g_trackerPeople = 0; // Summed over frames: users in view, skeletons tracked
+int g_trackerSkeletons = 0;
+uint64_t g_trackerCpuStart = 0; // Process CPU and wall time at the first frame
+uint64_t g_trackerTimeStart = 0;
+int g_drawnFrames = 0; // Tracker frames colored and drawn, the rest were idle
+
+FrameClock g_frameClock; // Frames the tracker had that were never read, and how long the ones read waited
+
+// Idle mode: nobody in view for a while, depth at a low rate and nothing drawn
+uint64_t g_idleAfter = 0; // Tracker time without visible users before idling, 0 never idles
+uint64_t g_lastUserTime = 0; // Tracker time someone was last in view
+bool sensor_idle = false;
+int g_idleSwitches = 0; // Times the sensor went idle
+uint64_t g_idleStart = 0; // Wall time the current idle period started
+uint64_t g_idleMicros = 0; // Wall time spent idle, periods before the current one
 
 // Camera variables
 int colorCount = 3; // Number of colors
@@ -87,19 +162,285 @@ char g_userStatusLabels[MAX_USERS][100] = {{0}};
 char g_generalMessage[100] = {0};
 SampleViewer* SampleViewer::ms_self = NULL;
 
+#pragma endregion
+#pragma region Startup profiling
+enum StartupPhaseId
+{
+	PHASE_OPENNI_INIT,
+	PHASE_DEVICE_OPEN,
+	PHASE_NITE_INIT,
+	PHASE_TRACKER_CREATE,
+	PHASE_STEERING_MENU,
+	PHASE_MINDSTORM_CONNECT,
+	PHASE_FIRST_FRAME,
+	PHASE_FIRST_COMMAND,
+	PHASE_COUNT
+};
+
+struct StartupPhase
+{
+	const char* name;
+	uint64_t begin;
+	uint64_t end;
+};
+
+// Every phase is written by exactly one startup thread
+StartupPhase g_startupPhases[PHASE_COUNT] =
+{
+	{"OpenNI initialize", 0, 0},
+	{"Device open", 0, 0},
+	{"NiTE initialize", 0, 0},
+	{"Tracker create", 0, 0},
+	{"Steering mode menu", 0, 0},
+	{"Mindstorm connect", 0, 0},
+	{"First tracker frame", 0, 0},
+	{"First steering command", 0, 0}
+};
+uint64_t g_startupOrigin = 0;
+
+void BeginPhase(StartupPhaseId phase)
+{
+	g_startupPhases[phase].begin = GetTimeMicros();
+}
+
+void EndPhase(StartupPhaseId phase)
+{
+	g_startupPhases[phase].end = GetTimeMicros();
+}
+
+void PrintStartupPhase(StartupPhaseId phase)
+{
+	const StartupPhase& p = g_startupPhases[phase];
+	if (p.begin == 0)
+	{
+		return;
+	}
+	if (p.end == 0)
+	{
+		printf("  %-24s started at %5d ms, still running\n", p.name, (int)((p.begin - g_startupOrigin) / 1000));
+		return;
+	}
+	printf("  %-24s %5d ms .. %5d ms (%d ms)\n", p.name,
+		(int)((p.begin - g_startupOrigin) / 1000), (int)((p.end - g_startupOrigin) / 1000), (int)((p.end - p.begin) / 1000));
+}
+
+// Robot phases are only read once the robot thread published its final state
+void PrintStartupReport()
+{
+	printf("Startup timing:\n");
+	for (int i = 0; i < PHASE_MINDSTORM_CONNECT; ++i)
+	{
+		PrintStartupPhase((StartupPhaseId)i);
+	}
+	if (robot->GetState() == LINK_CONNECTED)
+	{
+		g_startupPhases[PHASE_MINDSTORM_CONNECT].end = robot->GetFirstConnectTime();
+		PrintStartupPhase(PHASE_MINDSTORM_CONNECT);
+	}
+	else
+	{
+		printf("  %-24s still running\n", g_startupPhases[PHASE_MINDSTORM_CONNECT].name);
+	}
+}
+
+// Called every frame, prints robot link changes and a low battery
+void ReportMindstormState()
+{
+	int battery = robot->GetTelemetry().batteryMillivolts;
+	if (battery > 0 && (battery < g_lowBatteryLevel) != robot_battery_low)
+	{
+		robot_battery_low = !robot_battery_low;
+		if (robot_battery_low)
+		{
+			printf("Mindstorm battery low (%.1f V)\n", battery / 1000.0);
+		}
+	}
+
+	RobotLinkState state = robot->GetState();
+	if (state == robot_reported_state)
+	{
+		return;
+	}
+	robot_reported_state = state;
+	if (state == LINK_CONNECTED && robot->GetReconnectCount() == 0)
+	{
+		printf("Mindstorm connected after %d ms\n", (int)((robot->GetFirstConnectTime() - g_startupOrigin) / 1000));
+	}
+	else if (state == LINK_CONNECTED)
+	{
+		printf("Mindstorm link restored (reconnect #%d)\n", robot->GetReconnectCount());
+	}
+	else if (state == LINK_RECONNECTING)
+	{
+		printf("Mindstorm link lost, reconnecting...\n");
+	}
+}
+
+// Link of every robot, the first one is robot
+RobotLink* GetLink(int robotIndex)
+{
+	return bricks != NULL ? bricks->GetLink(robotIndex) : robot;
+}
+
+// Called with every tracker frame, before anything is drawn. Steering from
+// here on is decided from this frame, so the links learn when it was taken.
+void StartTrackerFrame(int frameIndex, uint64_t timestamp)
+{
+	uint64_t captured = g_frameClock.Receive(frameIndex, timestamp, GetTimeMicros());
+	for (int r = 0; r < robot_count; ++r)
+	{
+		GetLink(r)->SetDecisionTime(captured);
+	}
+
+	if (g_startupPhases[PHASE_FIRST_FRAME].end == 0)
+	{
+		g_startupPhases[PHASE_FIRST_FRAME].begin = g_startupOrigin;
+		EndPhase(PHASE_FIRST_FRAME);
+		printf("First tracker frame after %d ms\n", (int)((g_startupPhases[PHASE_FIRST_FRAME].end - g_startupOrigin) / 1000));
+		g_trackerCpuStart = GetProcessCpuMicros();
+		g_trackerTimeStart = GetTimeMicros();
+	}
+	g_trackerFrames++;
+	ReportMindstormState();
+}
+
+// Drivetrain of one robot as the command line asks for
+Drivetrain* CreateDrivetrain(RobotLink* pLink, bool useIntents, bool closedLoop)
+{
+	if (useIntents)
+	{
+		// Steering runs on the brick, the PC only sends what it wants
+		return new IntentDrivetrain(pLink, g_intentRampMs);
+	}
+	if (closedLoop)
+	{
+		return new ClosedLoopDrivetrain(pLink, OUT_B, OUT_C, OUT_A);
+	}
+	return new Drivetrain(pLink, OUT_B, OUT_C, OUT_A);
+}
+
+// Called once per frame and robot with whether its driver steered in it
+void UpdateDriver(int robotIndex, bool driverSeen)
+{
+	if (driverSeen && g_startupPhases[PHASE_FIRST_COMMAND].end == 0)
+	{
+		g_startupPhases[PHASE_FIRST_COMMAND].begin = g_startupOrigin;
+		EndPhase(PHASE_FIRST_COMMAND);
+		printf("First steering command after %d ms\n", (int)((g_startupPhases[PHASE_FIRST_COMMAND].end - g_startupOrigin) / 1000));
+	}
+
+	// Nobody else would ever stop the robot once the driver is lost
+	if (driver_steering[robotIndex] && !driverSeen)
+	{
+		if (robot_count > 1)
+		{
+			printf("Driver of robot %d lost, stopping it\n", robotIndex);
+		}
+		else
+		{
+			printf("Driver lost, stopping the robot\n");
+		}
+		drives[robotIndex]->EmergencyStop();
+	}
+	driver_steering[robotIndex] = driverSeen;
+}
+
+// What the tracker cost, to compare hand and skeleton mode on a recording
+void PrintTrackerReport()
+{
+	if (g_trackerFrames == 0)
+	{
+		return;
+	}
+	double seconds = (GetTimeMicros() - g_trackerTimeStart) / 1e6;
+	double cpu = (GetProcessCpuMicros() - g_trackerCpuStart) / 1e6;
+	printf("Tracker: %d frames in %.1f s, process CPU %.0f%% of one core, %.1f ms per frame\n", g_trackerFrames,
+		seconds, seconds > 0 ? 100 * cpu / seconds : 0, 1000 * cpu / g_trackerFrames);
+	if (g_trackerPeople > 0)
+	{
+		printf("  %.1f people in view, %.1f skeletons tracked per frame\n", (double)g_trackerPeople / g_trackerFrames,
+			(double)g_trackerSkeletons / g_trackerFrames);
+	}
+	printf("  %d frames never read, frame age %.1f ms mean, %.1f ms max\n", g_frameClock.GetDropped(),
+		g_frameClock.GetMeanAgeMs(), g_frameClock.GetMaxAgeMs());
+	for (int r = 0; r < robot_count; ++r)
+	{
+		RobotLinkMetrics metrics = GetLink(r)->GetMetrics();
+		printf("  robot %d: %d commands overtaken before sending, stale %d times\n", r, metrics.droppedChanges,
+			metrics.staleCount);
+	}
+	if (g_idleSwitches > 0)
+	{
+		uint64_t idle = g_idleMicros + (sensor_idle ? GetTimeMicros() - g_idleStart : 0);
+		printf("  idle %.0f%% of the time in %d periods, %d frames drawn\n", seconds > 0 ? 100 * idle / 1e6 / seconds : 0,
+			g_idleSwitches, g_drawnFrames);
+	}
+	PrintStartupPhase(PHASE_FIRST_FRAME);
+	PrintStartupPhase(PHASE_FIRST_COMMAND);
+}
 #pragma endregion
 
 #pragma region Constructor
-SampleViewer::SampleViewer(const char* strSampleName) : m_poseUser(0)
+SampleViewer::SampleViewer(const char* strSampleName) : m_pDepthHist(NULL), m_nDepthHistSize(0), m_pTexMap(NULL), m_useHands(false), m_driverHand(0), m_hasIdleMode(false), m_depthWidth(0), m_depthHeight(0), m_depthFps(0), m_deviceUri(openni::ANY_DEVICE), m_sensorStatus(openni::STATUS_OK), m_sensorCount(0), m_mergeFrames(0), m_sharedUsers(0), m_poseUser(0)
 {
 	ms_self = this;
 	strncpy_s(m_strSampleName, strSampleName, ONI_MAX_STR);
+	for (int i = 0; i < ARENA_MAX_ZONES; ++i)
+	{
+		m_drivers[i] = 0;
+	}
+	for (int s = 0; s < MERGE_MAX_SENSORS; ++s)
+	{
+		m_pSensors[s] = NULL;
+		m_sensorUris[s] = NULL;
+		m_sensorFrames[s].frameIndex = -1;
+		m_sensorFrames[s].userCount = 0;
+		m_sensorUnmerged[s] = 0;
+		m_pCalibrations[s] = NULL;
+		m_calibrationErrors[s] = -1;
+	}
 	m_pUserTracker = new nite::UserTracker;
+	m_pHandTracker = new nite::HandTracker;
 }
 
 void SampleViewer::Finalize()
 {
+	//Mindstorm end of program, stops motors and program and closes the link
+	if (bricks != NULL)
+	{
+		bricks->Shutdown();
+	}
+	else if (robot != NULL)
+	{
+		robot->Shutdown();
+	}
+
+	PrintTrackerReport();
+	PrintSensorReport();
+	SaveCalibration();
+	if (m_publisher.IsOpen())
+	{
+		printf("  %d frames published to other processes\n", m_publisher.GetPublished());
+		m_publisher.Close();
+	}
+	g_trackerFrames = 0;
+	g_trackerPeople = 0;
+	g_trackerSkeletons = 0;
+	g_drawnFrames = 0;
+	g_idleSwitches = 0;
+
 	delete m_pUserTracker;
+	delete m_pHandTracker;
+	m_pUserTracker = NULL;
+	m_pHandTracker = NULL;
+	for (int s = 0; s < MERGE_MAX_SENSORS; ++s)
+	{
+		delete m_pSensors[s];
+		m_pSensors[s] = NULL;
+		delete m_pCalibrations[s];
+		m_pCalibrations[s] = NULL;
+	}
+	m_depthStream.destroy();
 	nite::NiTE::shutdown();
 	openni::OpenNI::shutdown();
 }
@@ -150,13 +491,12 @@ void updateUserState(const nite::UserData& user, uint64_t ts)
 	}
 }
 
-openni::Status SampleViewer::Init(int argc, char **argv)
+// Camera chain: OpenNI, device and NiTE must come up in this order
+openni::Status SampleViewer::InitSensor(const char* deviceUri)
 {
-	m_pTexMap = NULL;
-
-	#pragma region Camera initialization
-	printf("Initialization, please wait...\n");	
+	BeginPhase(PHASE_OPENNI_INIT);
 	openni::Status rc = openni::OpenNI::initialize();
+	EndPhase(PHASE_OPENNI_INIT);
 
 	// Check if camera connection is established
 	if (rc != openni::STATUS_OK)
@@ -164,192 +504,779 @@ openni::Status SampleViewer::Init(int argc, char **argv)
 		printf("Failed to initialize OpenNI\n%s\n", openni::OpenNI::getExtendedError());
 		return rc;
 	}
-	
-	const char* deviceUri = openni::ANY_DEVICE;
-	for (int i = 1; i < argc-1; ++i)
+	if (m_sensorCount > 1)
 	{
-		if (strcmp(argv[i], "-device") == 0)
-		{
-			deviceUri = argv[i+1];
-			break;
-		}
+		return InitSensors();
 	}
 
 	// Check if selected camera connection is established
+	BeginPhase(PHASE_DEVICE_OPEN);
 	rc = m_device.open(deviceUri);
+	EndPhase(PHASE_DEVICE_OPEN);
 	if (rc != openni::STATUS_OK)
 	{
 		printf("Failed to open device\n%s\n", openni::OpenNI::getExtendedError());
 		return rc;
 	}
 
-	nite::NiTE::initialize();
+	// OpenNI shares one stream per sensor between everyone who creates it,
+	// so a mode set on this one before the tracker starts is what NiTE reads
+	if (m_depthStream.create(m_device, openni::SENSOR_DEPTH) == openni::STATUS_OK && m_depthFps > 0 &&
+		!SelectDepthMode(m_depthWidth, m_depthHeight, m_depthFps))
+	{
+		printf("No %dx%d depth mode at %d fps, -depthmode list shows what there is\n", m_depthWidth, m_depthHeight, m_depthFps);
+	}
 
-	if (m_pUserTracker->create(&m_device) != nite::STATUS_OK)
+	BeginPhase(PHASE_NITE_INIT);
+	nite::NiTE::initialize();
+	EndPhase(PHASE_NITE_INIT);
+
+	// Loads NiTE2/Data, the slowest part of the camera chain. The hand
+	// tracker only needs HandAlgorithms.ini and no body calibration.
+	BeginPhase(PHASE_TRACKER_CREATE);
+	nite::Status niteRc = m_useHands ? m_pHandTracker->create(&m_device) : m_pUserTracker->create(&m_device);
+	EndPhase(PHASE_TRACKER_CREATE);
+	if (niteRc != nite::STATUS_OK)
 	{
+		printf("Failed to create %s tracker\n", m_useHands ? "hand" : "user");
 		return openni::STATUS_ERROR;
 	}
-	#pragma endregion
-	#pragma region Mindstorm initialization	
-	printf("Connecting to Mindstorm...\n");
-	if(NXT::OpenBT(&comm)) //initialize the NXT and continue if it succeeds
+	if (m_useHands)
 	{
-		NXT::StartProgram(&comm,"program1");
-		mindstrom_connection_open = true;
-	} 
-	else 
+		m_pHandTracker->startGestureDetection(nite::GESTURE_WAVE);
+		m_pHandTracker->startGestureDetection(nite::GESTURE_CLICK);
+	}
+	else if (g_idleAfter > 0)
 	{
-		printf("Can't connect to Mindstorm");
-		return openni::STATUS_ERROR;
+		FindIdleMode();
 	}
-	#pragma endregion
-	#pragma region Menu
-	system("cls");
-	printf("Please select steering mode:\n");
-	printf("0. Simple steering\n");
-	printf("1. Depth steering\n");
-	printf("2. Steering with clutches support\n");
-	printf("Enter number: ");
-	cin >> steering_mode; // Get user value for steering
-	#pragma endregion
-
-	return InitOpenGL(argc, argv);
+	return openni::STATUS_OK;
 }
 
-SampleViewer::~SampleViewer()
+// Multi-sensor mode: a device, user tracker and thread for every sensor
+openni::Status SampleViewer::InitSensors()
 {
-	Finalize();
+	openni::Status rc = openni::STATUS_OK;
+	BeginPhase(PHASE_DEVICE_OPEN);
+	for (int s = 0; s < m_sensorCount && rc == openni::STATUS_OK; ++s)
+	{
+		m_pSensors[s] = new SensorTracker(s, m_sensorUris[s], &m_sensorFrameReady);
+		rc = m_pSensors[s]->Open();
+	}
+	EndPhase(PHASE_DEVICE_OPEN);
+	if (rc != openni::STATUS_OK)
+	{
+		printf("Failed to open device\n%s\n", openni::OpenNI::getExtendedError());
+		return rc;
+	}
 
-	delete[] m_pTexMap;
-	ms_self = NULL;
+	BeginPhase(PHASE_NITE_INIT);
+	nite::NiTE::initialize();
+	EndPhase(PHASE_NITE_INIT);
 
-	//Mindstorm end of program
-	if(mindstrom_connection_open)
+	// Every tracker loads NiTE2/Data for itself
+	BeginPhase(PHASE_TRACKER_CREATE);
+	bool started = true;
+	for (int s = 0; s < m_sensorCount && started; ++s)
 	{
-		NXT::Motor::Stop(&comm, OUT_B, true);
-		NXT::Motor::Stop(&comm, OUT_C, true);
-		NXT::StopProgram(&comm);	
-		NXT::Close(&comm); //close communication with NXT
+		started = m_pSensors[s]->Start();
+		if (!started)
+		{
+			printf("Failed to start the user tracker of %s\n", m_sensorUris[s]);
+		}
 	}
+	EndPhase(PHASE_TRACKER_CREATE);
+	return started ? openni::STATUS_OK : openni::STATUS_ERROR;
 }
-#pragma endregion
-#pragma region Methods
-#pragma region Skeleton drawing
-#ifndef USE_GLES
-void glPrintString(void *font, const char *str)
-{
-	int i,l = (int)strlen(str);
-
-	for(i=0; i<l; i++)
-	{   
-		glutBitmapCharacter(font,*str++);
-	}   
-}
-#endif
 
-void DrawStatusLabel(nite::UserTracker* pUserTracker, const nite::UserData& user)
+// The idle mode keeps the resolution and format the tracker was started
+// with, at the lowest rate
+void SampleViewer::FindIdleMode()
 {
-	int color = user.getId() % colorCount;
-	glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
-
-	float x,y;
-	pUserTracker->convertJointCoordinatesToDepth(user.getCenterOfMass().x, user.getCenterOfMass().y, user.getCenterOfMass().z, &x, &y);
-	x *= GL_WIN_SIZE_X/(float)g_nXRes;
-	y *= GL_WIN_SIZE_Y/(float)g_nYRes;
-	char *msg = g_userStatusLabels[user.getId()];
-	glRasterPos2i(x-((strlen(msg)/2)*8),y);
-	glPrintString(GLUT_BITMAP_HELVETICA_18, msg);
+	if (!m_depthStream.isValid())
+	{
+		return;
+	}
+	m_fullDepthMode = m_depthStream.getVideoMode();
+	const openni::Array<openni::VideoMode>& modes = m_depthStream.getSensorInfo().getSupportedVideoModes();
+	for (int i = 0; i < modes.getSize(); ++i)
+	{
+		const openni::VideoMode& mode = modes[i];
+		if (mode.getResolutionX() == m_fullDepthMode.getResolutionX() && mode.getResolutionY() == m_fullDepthMode.getResolutionY() &&
+			mode.getPixelFormat() == m_fullDepthMode.getPixelFormat() &&
+			mode.getFps() < (m_hasIdleMode ? m_idleDepthMode.getFps() : m_fullDepthMode.getFps()))
+		{
+			m_idleDepthMode = mode;
+			m_hasIdleMode = true;
+		}
+	}
 }
 
-void DrawFrameId(int frameId)
+// Mode of the given resolution and rate, in millimeters if the sensor has
+// it, as NiTE prefers them. Recordings keep the mode they were made in.
+bool SampleViewer::SelectDepthMode(int width, int height, int fps)
 {
-	char buffer[80] = "";
-	sprintf_s(buffer, "%d", frameId);
-	glColor3f(1.0f, 0.0f, 0.0f);
-	glRasterPos2i(20, 20);
-	glPrintString(GLUT_BITMAP_HELVETICA_18, buffer);
+	const openni::Array<openni::VideoMode>& modes = m_depthStream.getSensorInfo().getSupportedVideoModes();
+	int best = -1;
+	for (int i = 0; i < modes.getSize(); ++i)
+	{
+		const openni::VideoMode& mode = modes[i];
+		if (mode.getResolutionX() == width && mode.getResolutionY() == height && mode.getFps() == fps &&
+			(best < 0 || mode.getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_1_MM))
+		{
+			best = i;
+		}
+	}
+	return best >= 0 && m_depthStream.setVideoMode(modes[best]) == openni::STATUS_OK;
 }
 
-void DrawCenterOfMass(nite::UserTracker* pUserTracker, const nite::UserData& user)
+void SampleViewer::ListDepthModes()
 {
-	glColor3f(1.0f, 1.0f, 1.0f);
-
-	float coordinates[3] = {0};
-
-	pUserTracker->convertJointCoordinatesToDepth(user.getCenterOfMass().x, user.getCenterOfMass().y, user.getCenterOfMass().z, &coordinates[0], &coordinates[1]);
-
-	coordinates[0] *= GL_WIN_SIZE_X/(float)g_nXRes;
-	coordinates[1] *= GL_WIN_SIZE_Y/(float)g_nYRes;
-	glPointSize(8);
-	glVertexPointer(3, GL_FLOAT, 0, coordinates);
-	glDrawArrays(GL_POINTS, 0, 1);
-
+	if (!m_depthStream.isValid())
+	{
+		return;
+	}
+	openni::VideoMode current = m_depthStream.getVideoMode();
+	const openni::Array<openni::VideoMode>& modes = m_depthStream.getSensorInfo().getSupportedVideoModes();
+	printf("Depth modes (-depthmode <width>x<height>@<fps>), * in use:\n");
+	for (int i = 0; i < modes.getSize(); ++i)
+	{
+		const openni::VideoMode& mode = modes[i];
+		bool inUse = mode.getResolutionX() == current.getResolutionX() && mode.getResolutionY() == current.getResolutionY() &&
+			mode.getFps() == current.getFps() && mode.getPixelFormat() == current.getPixelFormat();
+		printf("  %c %dx%d@%d\t%s\n", inUse ? '*' : ' ', mode.getResolutionX(), mode.getResolutionY(), mode.getFps(),
+			mode.getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_1_MM ? "1 mm" :
+			(mode.getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_100_UM ? "100 um" : "shift"));
+	}
 }
-void DrawBoundingBox(const nite::UserData& user)
-{
-	glColor3f(1.0f, 1.0f, 1.0f);
 
-	float coordinates[] =
+// Texture map and histogram big enough for frames of the mode. Frames of
+// 100 um depth go up to 65535, millimeters stay below MAX_DEPTH.
+void SampleViewer::FitBuffers(const openni::VideoMode& mode)
+{
+	unsigned int texMapX = MIN_CHUNKS_SIZE(mode.getResolutionX(), TEXTURE_SIZE);
+	unsigned int texMapY = MIN_CHUNKS_SIZE(mode.getResolutionY(), TEXTURE_SIZE);
+	if (m_pTexMap == NULL || texMapX > m_nTexMapX || texMapY > m_nTexMapY)
 	{
-		user.getBoundingBox().max.x, user.getBoundingBox().max.y, 0,
-		user.getBoundingBox().max.x, user.getBoundingBox().min.y, 0,
-		user.getBoundingBox().min.x, user.getBoundingBox().min.y, 0,
-		user.getBoundingBox().min.x, user.getBoundingBox().max.y, 0,
-	};
-	coordinates[0]  *= GL_WIN_SIZE_X/(float)g_nXRes;
-	coordinates[1]  *= GL_WIN_SIZE_Y/(float)g_nYRes;
-	coordinates[3]  *= GL_WIN_SIZE_X/(float)g_nXRes;
-	coordinates[4]  *= GL_WIN_SIZE_Y/(float)g_nYRes;
-	coordinates[6]  *= GL_WIN_SIZE_X/(float)g_nXRes;
-	coordinates[7]  *= GL_WIN_SIZE_Y/(float)g_nYRes;
-	coordinates[9]  *= GL_WIN_SIZE_X/(float)g_nXRes;
-	coordinates[10] *= GL_WIN_SIZE_Y/(float)g_nYRes;
-
-	glPointSize(2);
-	glVertexPointer(3, GL_FLOAT, 0, coordinates);
-	glDrawArrays(GL_LINE_LOOP, 0, 4);
+		delete[] m_pTexMap;
+		m_nTexMapX = texMapX;
+		m_nTexMapY = texMapY;
+		m_pTexMap = new openni::RGB888Pixel[m_nTexMapX * m_nTexMapY];
+	}
 
+	int histSize = mode.getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_100_UM ? 65536 : MAX_DEPTH;
+	if (histSize > m_nDepthHistSize)
+	{
+		delete[] m_pDepthHist;
+		m_nDepthHistSize = histSize;
+		m_pDepthHist = new float[m_nDepthHistSize];
+	}
 }
-void DrawLimb(nite::UserTracker* pUserTracker, const nite::SkeletonJoint& joint1, const nite::SkeletonJoint& joint2, int color)
-{
-	float coordinates[6] = {0};
-	pUserTracker->convertJointCoordinatesToDepth(joint1.getPosition().x, joint1.getPosition().y, joint1.getPosition().z, &coordinates[0], &coordinates[1]);
-	pUserTracker->convertJointCoordinatesToDepth(joint2.getPosition().x, joint2.getPosition().y, joint2.getPosition().z, &coordinates[3], &coordinates[4]);
-
-	coordinates[0] *= GL_WIN_SIZE_X/(float)g_nXRes;
-	coordinates[1] *= GL_WIN_SIZE_Y/(float)g_nYRes;
-	coordinates[3] *= GL_WIN_SIZE_X/(float)g_nXRes;
-	coordinates[4] *= GL_WIN_SIZE_Y/(float)g_nYRes;
 
-	if (joint1.getPositionConfidence() == 1 && joint2.getPositionConfidence() == 1)
+// Called with every user tracker frame. Returns true while idle: the frame
+// is not colored or drawn and the last picture stays on screen.
+bool SampleViewer::UpdateIdleMode(const nite::Array<nite::UserData>& users, uint64_t timestamp)
+{
+	if (g_idleAfter == 0)
 	{
-		glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
+		return false;
 	}
-	else if (joint1.getPositionConfidence() < 0.5f || joint2.getPositionConfidence() < 0.5f)
+	bool someone = false;
+	for (int i = 0; i < users.getSize(); ++i)
 	{
-		return;
+		someone = someone || users[i].isNew() || users[i].isVisible();
 	}
-	else
+	// A recording played in a loop starts its timestamps over
+	if (someone || g_lastUserTime == 0 || timestamp < g_lastUserTime)
 	{
-		glColor3f(.5, .5, .5);
+		g_lastUserTime = timestamp;
 	}
-	glPointSize(2);
-	glVertexPointer(3, GL_FLOAT, 0, coordinates);
-	glDrawArrays(GL_LINES, 0, 2);
 
-	glPointSize(10);
-	if (joint1.getPositionConfidence() == 1)
+	if (sensor_idle && someone)
 	{
-		glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
+		sensor_idle = false;
+		g_idleMicros += GetTimeMicros() - g_idleStart;
+		if (m_hasIdleMode)
+		{
+			m_depthStream.setVideoMode(m_fullDepthMode);
+		}
+		g_generalMessage[0] = '\0';
+		printf("[%08" PRIu64 "] Someone in view, depth back at %d fps\n", timestamp, m_fullDepthMode.getFps());
 	}
-	else
+	else if (!sensor_idle && timestamp - g_lastUserTime >= g_idleAfter)
 	{
-		glColor3f(.5, .5, .5);
+		// This frame is still drawn, with the message
+		sensor_idle = true;
+		g_idleSwitches++;
+		g_idleStart = GetTimeMicros();
+		if (m_hasIdleMode && m_depthStream.setVideoMode(m_idleDepthMode) == openni::STATUS_OK)
+		{
+			printf("[%08" PRIu64 "] Nobody in view, depth down to %d fps\n", timestamp, m_idleDepthMode.getFps());
+		}
+		else
+		{
+			printf("[%08" PRIu64 "] Nobody in view, drawing stopped\n", timestamp);
+		}
+		sprintf_s(g_generalMessage, "Idle, step in to start\n");
+		return false;
 	}
-	glVertexPointer(3, GL_FLOAT, 0, coordinates);
-	glDrawArrays(GL_POINTS, 0, 1);
+	return sensor_idle;
+}
 
-	if (joint2.getPositionConfidence() == 1)
+void SampleViewer::SensorStartupThread(void* pSelf)
+{
+	SampleViewer* pViewer = (SampleViewer*)pSelf;
+	pViewer->m_sensorStatus = pViewer->InitSensor(pViewer->m_deviceUri);
+}
+
+openni::Status SampleViewer::Init(int argc, char **argv)
+{
+	g_startupOrigin = GetTimeMicros();
+
+	bool useMock = false;
+	bool useIntents = false;
+	RobotLinkMode linkMode = LINK_PIPELINED;
+	bool rateControl = true;
+	bool closedLoop = false;
+	unsigned int mockUpMs = 0, mockDownMs = 0;
+	std::vector<const char*> serialDevices;
+	int arenaRobots = 1;
+	int idleSeconds = g_defaultIdleSeconds;
+	bool listDepthModes = false;
+	unsigned int maxDecisionAge = g_defaultMaxDecisionAge;
+	StaleAction staleAction = STALE_STOP;
+	const char* gestureFile = NULL;
+	DriverPolicy driverPolicy = DRIVER_CLOSEST;
+	bool calibrate = false;
+	const char* calibrationFile = NULL;
+	bool publish = false;
+	bool publishTakeOver = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-device") == 0 && i+1 < argc)
+		{
+			// Given more than once, every sensor is tracked and their users merged
+			++i;
+			if (m_sensorCount < MERGE_MAX_SENSORS)
+			{
+				m_sensorUris[m_sensorCount++] = argv[i];
+			}
+			m_deviceUri = m_sensorUris[0];
+		}
+		else if (strcmp(argv[i], "-pose") == 0 && i+3 < argc)
+		{
+			// Where the last -device stands: x and z in mm from the first, turned yaw degrees to the right
+			SensorPose pose = MakeSensorPose();
+			pose.x = (float)atof(argv[++i]);
+			pose.z = (float)atof(argv[++i]);
+			pose.yaw = (float)atof(argv[++i]);
+			m_merger.SetPose(m_sensorCount > 0 ? m_sensorCount - 1 : 0, pose);
+		}
+		else if (strcmp(argv[i], "-calibrate") == 0)
+		{
+			// Find where the other sensors stand from one person walking around, saved when done
+			calibrate = true;
+		}
+		else if (strcmp(argv[i], "-calibration") == 0 && i+1 < argc)
+		{
+			// Sensor transforms saved by -calibrate, in place of -pose
+			calibrationFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-publish") == 0)
+		{
+			// Share every frame's skeletons and steering with other processes, see SkeletonReader.h
+			publish = true;
+		}
+		else if (strcmp(argv[i], "-publish-takeover") == 0)
+		{
+			// -publish into the memory a viewer that crashed left behind
+			publish = true;
+			publishTakeOver = true;
+		}
+		else if (strcmp(argv[i], "-steering") == 0 && i+1 < argc)
+		{
+			steering_mode = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-intent") == 0)
+		{
+			useIntents = true;
+		}
+		else if (strcmp(argv[i], "-acknowledged") == 0)
+		{
+			// Wait for a reply to every command, as NXT++ motor calls do
+			linkMode = LINK_ACKNOWLEDGED;
+		}
+		else if (strcmp(argv[i], "-norate") == 0)
+		{
+			// Send motion as fast as it changes, whatever the radio keeps up with
+			rateControl = false;
+		}
+		else if (strcmp(argv[i], "-closedloop") == 0)
+		{
+			// Regulate wheel speeds from the tachometers instead of setting power
+			closedLoop = true;
+		}
+		else if (strcmp(argv[i], "-serial") == 0 && i+1 < argc)
+		{
+			// Bound RFCOMM device or serial port, Linux only. Once per robot in an arena.
+			serialDevices.push_back(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-mock") == 0)
+		{
+			useMock = true;
+		}
+		else if (strcmp(argv[i], "-hands") == 0)
+		{
+			// Steer with a tracked hand, wave or click to start
+			m_useHands = true;
+		}
+		else if (strcmp(argv[i], "-idle") == 0 && i+1 < argc)
+		{
+			// Seconds with nobody in view before the sensor slows down, 0 never
+			idleSeconds = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-depthmode") == 0 && i+1 < argc)
+		{
+			// Depth resolution and rate, e.g. 320x240@60, or list for what the device has
+			++i;
+			if (strcmp(argv[i], "list") == 0)
+			{
+				listDepthModes = true;
+			}
+			else if (sscanf(argv[i], "%dx%d@%d", &m_depthWidth, &m_depthHeight, &m_depthFps) != 3)
+			{
+				m_depthFps = 0;
+			}
+		}
+		else if (strcmp(argv[i], "-maxage") == 0 && i+1 < argc)
+		{
+			// Oldest frame in ms the robot may still be steered from, 0 for any
+			maxDecisionAge = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-stale") == 0 && i+1 < argc)
+		{
+			// What older steering gets instead: hold (last fresh command) or stop
+			staleAction = strcmp(argv[++i], "hold") == 0 ? STALE_HOLD : STALE_STOP;
+		}
+		else if (strcmp(argv[i], "-frames") == 0 && i+1 < argc)
+		{
+			// Exit after this many tracker frames, e.g. of an .oni recording
+			g_frameLimit = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-driver") == 0 && i+1 < argc)
+		{
+			// Who drives: hands, closest, zone or everyone (all tracked, as before)
+			++i;
+			if (strcmp(argv[i], "hands") == 0)
+			{
+				driverPolicy = DRIVER_RAISED_HANDS;
+			}
+			else if (strcmp(argv[i], "zone") == 0)
+			{
+				driverPolicy = DRIVER_IN_ZONE;
+			}
+			else if (strcmp(argv[i], "everyone") == 0)
+			{
+				driverPolicy = DRIVER_EVERYONE;
+			}
+			else
+			{
+				driverPolicy = DRIVER_CLOSEST;
+			}
+		}
+		else if (strcmp(argv[i], "-arena") == 0 && i+1 < argc)
+		{
+			// Robots in the arena, driven by whoever stands in their zone
+			arenaRobots = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-gestures") == 0 && i+1 < argc)
+		{
+			// Recorded gesture templates, next to the default ones
+			gestureFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-mockdrop") == 0 && i+2 < argc)
+		{
+			// Simulated brick losing the link for <down> ms after every <up> ms
+			useMock = true;
+			mockUpMs = atoi(argv[++i]);
+			mockDownMs = atoi(argv[++i]);
+		}
+	}
+
+	g_idleAfter = idleSeconds > 0 ? (uint64_t)idleSeconds * 1000000 : 0;
+	if (m_sensorCount > 1 && m_useHands)
+	{
+		printf("Hand mode reads the first sensor only\n");
+		m_sensorCount = 1;
+	}
+	if (calibrationFile != NULL)
+	{
+		SensorTransform transforms[MERGE_MAX_SENSORS];
+		for (int s = 0; s < MERGE_MAX_SENSORS; ++s)
+		{
+			transforms[s] = m_merger.GetTransform(s);
+		}
+		if (LoadTransforms(calibrationFile, transforms, MERGE_MAX_SENSORS) < 0)
+		{
+			printf("Could not read the sensor transforms from %s\n", calibrationFile);
+		}
+		for (int s = 0; s < MERGE_MAX_SENSORS; ++s)
+		{
+			m_merger.SetTransform(s, transforms[s]);
+		}
+	}
+	for (int s = 1; calibrate && s < m_sensorCount; ++s)
+	{
+		m_pCalibrations[s] = new SensorCalibration();
+	}
+	if (publish && !m_publisher.Open(SHARED_SKELETONS_NAME, publishTakeOver))
+	{
+		printf("Could not share the skeletons as %s, another viewer may have it (-publish-takeover after a crash)\n",
+			SHARED_SKELETONS_NAME);
+	}
+	robot_count = arenaRobots < 1 ? 1 : (arenaRobots > ARENA_MAX_ZONES ? ARENA_MAX_ZONES : arenaRobots);
+	if (robot_count > SCHEDULER_MAX_BRICKS)
+	{
+		robot_count = SCHEDULER_MAX_BRICKS;
+	}
+	// NXT++ only ever talks to the first brick it finds
+	if (robot_count > 1 && !useMock && (int)serialDevices.size() < robot_count)
+	{
+		printf("An arena of %d robots needs -mock or a -serial device for every robot\n", robot_count);
+		return openni::STATUS_ERROR;
+	}
+	for (int i = 0; i < robot_count; ++i)
+	{
+		if (useMock)
+		{
+			MockTransport* pMock = new MockTransport(200);
+			pMock->SetLatency(MakeBluetoothLatency());
+			pMock->SetDropCycle(mockUpMs, mockDownMs);
+			if (robot_count > 1)
+			{
+				pMock->ShareAir(&arena_air);
+			}
+			transports[i] = pMock;
+		}
+#ifndef WIN32
+		else if (!serialDevices.empty())
+		{
+			transports[i] = new SerialTransport(serialDevices[i]);
+		}
+#endif
+		else
+		{
+			transports[i] = new NxtppTransport;
+		}
+	}
+	const char* programName = useIntents ? INTENT_PROGRAM_NAME : "program1";
+	if (robot_count > 1)
+	{
+		bricks = new BrickScheduler();
+		for (int i = 0; i < robot_count; ++i)
+		{
+			RobotLink* pLink = bricks->AddBrick(transports[i], programName, linkMode);
+			pLink->SetRateControl(rateControl);
+			drives[i] = CreateDrivetrain(pLink, useIntents, closedLoop);
+		}
+		robot = bricks->GetLink(0);
+		arena = new ArenaMap(MakeArenaHysteresis());
+		arena->AddStrips(robot_count, g_arenaZoneWidth, g_arenaNearZ, g_arenaFarZ);
+		// The zones pick the drivers, nobody is tracked just for showing up
+		driverPolicy = DRIVER_CLOSEST;
+	}
+	else
+	{
+		robot = new RobotLink(transports[0], programName, linkMode);
+		robot->SetRateControl(rateControl);
+		drives[0] = CreateDrivetrain(robot, useIntents, closedLoop);
+	}
+	drive = drives[0];
+	for (int i = 0; i < robot_count; ++i)
+	{
+		GetLink(i)->SetFreshness(maxDecisionAge, staleAction);
+	}
+	speedControl = closedLoop && !useIntents ? (ClosedLoopDrivetrain*)drive : NULL;
+
+	driverSelector = new DriverSelector(driverPolicy, MakeDriverZone());
+	gestures = new GestureRecognizer();
+	gestures->AddDefaultTemplates();
+	if (gestureFile != NULL && !gestures->LoadTemplates(gestureFile))
+	{
+		printf("Could not read all gestures from %s\n", gestureFile);
+	}
+
+	#pragma region Parallel initialization
+	// Bluetooth pairing and loading the tracker data both take seconds, so
+	// the robot, the camera chain and the menu all run at the same time
+	printf("Initialization, please wait...\n");
+	BeginPhase(PHASE_MINDSTORM_CONNECT);
+	if (bricks != NULL)
+	{
+		bricks->Start();
+	}
+	else
+	{
+		robot->Start();
+	}
+	if (!m_sensorThread.Start(SensorStartupThread, this))
+	{
+		SensorStartupThread(this);
+	}
+	#pragma endregion
+	#pragma region Menu
+	if (!m_useHands && (steering_mode < 0 || steering_mode >= STEERING_METHOD_COUNT))
+	{
+		BeginPhase(PHASE_STEERING_MENU);
+		system("cls");
+		printf("Please select steering mode:\n");
+		printf("0. Simple steering\n");
+		printf("1. Depth steering\n");
+		printf("2. Steering with clutches support\n");
+		printf("Enter number: ");
+		cin >> steering_mode; // Get user value for steering
+		EndPhase(PHASE_STEERING_MENU);
+		if (steering_mode < 0 || steering_mode >= STEERING_METHOD_COUNT)
+		{
+			steering_mode = 0;
+		}
+	}
+	#pragma endregion
+
+	m_sensorThread.Join();
+	PrintStartupReport();
+	if (m_sensorStatus != openni::STATUS_OK)
+	{
+		return m_sensorStatus;
+	}
+	if (listDepthModes)
+	{
+		ListDepthModes();
+	}
+	if (m_depthStream.isValid())
+	{
+		// Gestures take as long at any rate, templates are matched at theirs
+		openni::VideoMode mode = m_depthStream.getVideoMode();
+		printf("Depth %dx%d at %d fps\n", mode.getResolutionX(), mode.getResolutionY(), mode.getFps());
+		FitBuffers(mode);
+		gestures->SetFrameStep((mode.getFps() + GESTURE_FRAME_RATE / 2) / GESTURE_FRAME_RATE);
+	}
+
+	return InitOpenGL(argc, argv);
+}
+
+SampleViewer::~SampleViewer()
+{
+	Finalize();
+
+	delete[] m_pTexMap;
+	delete[] m_pDepthHist;
+	ms_self = NULL;
+
+	delete gestures;
+	delete driverSelector;
+	delete arena;
+	for (int i = 0; i < robot_count; ++i)
+	{
+		delete drives[i];
+		drives[i] = NULL;
+	}
+	// The scheduler owns the links of an arena
+	if (bricks != NULL)
+	{
+		delete bricks;
+	}
+	else
+	{
+		delete robot;
+	}
+	for (int i = 0; i < robot_count; ++i)
+	{
+		delete transports[i];
+		transports[i] = NULL;
+	}
+	gestures = NULL;
+	driverSelector = NULL;
+	arena = NULL;
+	drive = NULL;
+	speedControl = NULL;
+	bricks = NULL;
+	robot = NULL;
+}
+#pragma endregion
+#pragma region Methods
+#pragma region Skeleton drawing
+#ifndef USE_GLES
+void glPrintString(void *font, const char *str)
+{
+	int i,l = (int)strlen(str);
+
+	for(i=0; i<l; i++)
+	{   
+		glutBitmapCharacter(font,*str++);
+	}   
+}
+#endif
+
+void DrawStatusLabel(nite::UserTracker* pUserTracker, const nite::UserData& user)
+{
+	int color = user.getId() % colorCount;
+	glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
+
+	float x,y;
+	pUserTracker->convertJointCoordinatesToDepth(user.getCenterOfMass().x, user.getCenterOfMass().y, user.getCenterOfMass().z, &x, &y);
+	x *= GL_WIN_SIZE_X/(float)g_nXRes;
+	y *= GL_WIN_SIZE_Y/(float)g_nYRes;
+	char *msg = g_userStatusLabels[user.getId()];
+	glRasterPos2i(x-((strlen(msg)/2)*8),y);
+	glPrintString(GLUT_BITMAP_HELVETICA_18, msg);
+}
+
+// Merged id and how many sensors see the user, over the first sensor's image
+void DrawMergedLabel(const nite::UserTracker& userTracker, const UserMerger& merger, const MergedUser& user)
+{
+	if ((user.sensors & 1) == 0)
+	{
+		return;
+	}
+	int sensors = 0;
+	for (int mask = user.sensors; mask != 0; mask >>= 1)
+	{
+		sensors += mask & 1;
+	}
+	int color = user.userId % colorCount;
+	glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
+
+	float camera[3];
+	float x, y;
+	merger.ToSensor(0, user.x, user.y, user.z, camera);
+	userTracker.convertJointCoordinatesToDepth(camera[0], camera[1], camera[2], &x, &y);
+	x *= GL_WIN_SIZE_X/(float)g_nXRes;
+	y *= GL_WIN_SIZE_Y/(float)g_nYRes;
+	char msg[40] = "";
+	sprintf_s(msg, "User %d, %d sensor%s", user.userId, sensors, sensors == 1 ? "" : "s");
+	glRasterPos2i(x-((strlen(msg)/2)*8),y);
+	glPrintString(GLUT_BITMAP_HELVETICA_18, msg);
+}
+
+void DrawFrameId(int frameId)
+{
+	char buffer[80] = "";
+	sprintf_s(buffer, "%d", frameId);
+	glColor3f(1.0f, 0.0f, 0.0f);
+	glRasterPos2i(20, 20);
+	glPrintString(GLUT_BITMAP_HELVETICA_18, buffer);
+}
+
+void DrawLinkMetrics(const RobotLinkMetrics& metrics, const RobotTelemetry& telemetry)
+{
+	char buffer[80] = "";
+	sprintf_s(buffer, "Link %.0f/%.0f cmd/s  RTT %.0f ms  queue %d", metrics.sendRate, metrics.rateLimit, metrics.rttMs, metrics.queueDepth);
+	glColor3f(1.0f, 0.0f, 0.0f);
+	glRasterPos2i(20, 40);
+	glPrintString(GLUT_BITMAP_HELVETICA_18, buffer);
+
+	sprintf_s(buffer, "Battery %.2f V  tacho A %ld  B %ld  C %ld", telemetry.batteryMillivolts / 1000.0,
+		telemetry.motors[0].tachoCount, telemetry.motors[1].tachoCount, telemetry.motors[2].tachoCount);
+	glRasterPos2i(20, 60);
+	glPrintString(GLUT_BITMAP_HELVETICA_18, buffer);
+
+	sprintf_s(buffer, "Frame age %.0f ms  decision %.0f ms  dropped %d frames, %d commands  stale %d",
+		g_frameClock.GetAgeMs(), metrics.decisionAgeMs, g_frameClock.GetDropped(), metrics.droppedChanges, metrics.staleCount);
+	glRasterPos2i(20, 80);
+	glPrintString(GLUT_BITMAP_HELVETICA_18, buffer);
+}
+
+void DrawPose(const RobotPose& pose)
+{
+	char buffer[80] = "";
+	sprintf_s(buffer, "Pose x %.0f y %.0f mm  heading %.0f deg  wheels %.0f/%.0f mm/s", pose.x, pose.y,
+		pose.heading * 180 / 3.14159265, pose.leftSpeed, pose.rightSpeed);
+	glColor3f(1.0f, 0.0f, 0.0f);
+	glRasterPos2i(20, 100);
+	glPrintString(GLUT_BITMAP_HELVETICA_18, buffer);
+}
+
+void DrawCenterOfMass(nite::UserTracker* pUserTracker, const nite::UserData& user)
+{
+	glColor3f(1.0f, 1.0f, 1.0f);
+
+	float coordinates[3] = {0};
+
+	pUserTracker->convertJointCoordinatesToDepth(user.getCenterOfMass().x, user.getCenterOfMass().y, user.getCenterOfMass().z, &coordinates[0], &coordinates[1]);
+
+	coordinates[0] *= GL_WIN_SIZE_X/(float)g_nXRes;
+	coordinates[1] *= GL_WIN_SIZE_Y/(float)g_nYRes;
+	glPointSize(8);
+	glVertexPointer(3, GL_FLOAT, 0, coordinates);
+	glDrawArrays(GL_POINTS, 0, 1);
+
+}
+void DrawBoundingBox(const nite::UserData& user)
+{
+	glColor3f(1.0f, 1.0f, 1.0f);
+
+	float coordinates[] =
+	{
+		user.getBoundingBox().max.x, user.getBoundingBox().max.y, 0,
+		user.getBoundingBox().max.x, user.getBoundingBox().min.y, 0,
+		user.getBoundingBox().min.x, user.getBoundingBox().min.y, 0,
+		user.getBoundingBox().min.x, user.getBoundingBox().max.y, 0,
+	};
+	coordinates[0]  *= GL_WIN_SIZE_X/(float)g_nXRes;
+	coordinates[1]  *= GL_WIN_SIZE_Y/(float)g_nYRes;
+	coordinates[3]  *= GL_WIN_SIZE_X/(float)g_nXRes;
+	coordinates[4]  *= GL_WIN_SIZE_Y/(float)g_nYRes;
+	coordinates[6]  *= GL_WIN_SIZE_X/(float)g_nXRes;
+	coordinates[7]  *= GL_WIN_SIZE_Y/(float)g_nYRes;
+	coordinates[9]  *= GL_WIN_SIZE_X/(float)g_nXRes;
+	coordinates[10] *= GL_WIN_SIZE_Y/(float)g_nYRes;
+
+	glPointSize(2);
+	glVertexPointer(3, GL_FLOAT, 0, coordinates);
+	glDrawArrays(GL_LINE_LOOP, 0, 4);
+
+}
+void DrawLimb(nite::UserTracker* pUserTracker, const nite::SkeletonJoint& joint1, const nite::SkeletonJoint& joint2, int color)
+{
+	float coordinates[6] = {0};
+	pUserTracker->convertJointCoordinatesToDepth(joint1.getPosition().x, joint1.getPosition().y, joint1.getPosition().z, &coordinates[0], &coordinates[1]);
+	pUserTracker->convertJointCoordinatesToDepth(joint2.getPosition().x, joint2.getPosition().y, joint2.getPosition().z, &coordinates[3], &coordinates[4]);
+
+	coordinates[0] *= GL_WIN_SIZE_X/(float)g_nXRes;
+	coordinates[1] *= GL_WIN_SIZE_Y/(float)g_nYRes;
+	coordinates[3] *= GL_WIN_SIZE_X/(float)g_nXRes;
+	coordinates[4] *= GL_WIN_SIZE_Y/(float)g_nYRes;
+
+	if (joint1.getPositionConfidence() == 1 && joint2.getPositionConfidence() == 1)
+	{
+		glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
+	}
+	else if (joint1.getPositionConfidence() < 0.5f || joint2.getPositionConfidence() < 0.5f)
+	{
+		return;
+	}
+	else
+	{
+		glColor3f(.5, .5, .5);
+	}
+	glPointSize(2);
+	glVertexPointer(3, GL_FLOAT, 0, coordinates);
+	glDrawArrays(GL_LINES, 0, 2);
+
+	glPointSize(10);
+	if (joint1.getPositionConfidence() == 1)
+	{
+		glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
+	}
+	else
+	{
+		glColor3f(.5, .5, .5);
+	}
+	glVertexPointer(3, GL_FLOAT, 0, coordinates);
+	glDrawArrays(GL_POINTS, 0, 1);
+
+	if (joint2.getPositionConfidence() == 1)
 	{
 		glColor3f(1.0f - Colors[color][0], 1.0f - Colors[color][1], 1.0f - Colors[color][2]);
 	}
@@ -392,142 +1319,62 @@ void DrawSkeleton(nite::UserTracker* pUserTracker, const nite::UserData& userDat
 }
 #pragma endregion
 #pragma region Main function
-#pragma region Steering methods
-void RunSteeringMethodOne(map<string, map<char, float>> positions)
+// Both hands above the head: what NiTE's psi pose stands for where there is
+// no pose detection to ask
+bool HandsRaised(const SkeletonFrame& skeleton)
 {
-	if(positions["right_hand"]['y'] > positions["right_shoulder"]['y'])
-	{
-		if(positions["right_hand"]['x'] > (positions["right_shoulder"]['x'] + precisionX)) 
-		{
-			NXT::Motor::SetReverse(&comm, OUT_B, speed);
-			NXT::Motor::SetForward(&comm, OUT_C, speed);
-		} 
-		else if(positions["right_hand"]['x'] < (positions["right_shoulder"]['x'] - precisionX)) 
-		{
-			NXT::Motor::SetForward(&comm, OUT_B, speed);
-			NXT::Motor::SetReverse(&comm, OUT_C, speed);
-		}  
-		else 
-		{
-			NXT::Motor::SetForward(&comm, OUT_B, speed);
-			NXT::Motor::SetForward(&comm, OUT_C, speed);
-		}
-	} 
-	else if(positions["left_hand"]['y'] > positions["left_shoulder"]['y'])
-	{
-		NXT::Motor::SetReverse(&comm, OUT_B, speed);
-		NXT::Motor::SetReverse(&comm, OUT_C, speed); 
-	} 
-	else 
-	{
-		NXT::Motor::Stop(&comm, OUT_B, true);
-		NXT::Motor::Stop(&comm, OUT_C, true);
-	}
+	const SkeletonJoint& head = skeleton.joints[SKELETON_HEAD];
+	const SkeletonJoint& left = skeleton.joints[SKELETON_LEFT_HAND];
+	const SkeletonJoint& right = skeleton.joints[SKELETON_RIGHT_HAND];
+	return skeleton.tracked && head.confidence >= g_raisedHandConfidence && left.confidence >= g_raisedHandConfidence &&
+		right.confidence >= g_raisedHandConfidence && left.y > head.y && right.y > head.y;
 }
 
-void RunSteeringMethodTwo(map<string, map<char, float>> positions)
+// Driver's gestures: a swipe moves to the next steering method, a circle
+// opens the gripper, and the arms do not steer while it opens. Returns
+// false while they should not.
+bool RunGestures(const SkeletonFrame& skeleton)
 {
-	if(positions["left_hand"]['z'] > positions["right_hand"]['z'] + precisionX 
-		&& positions["right_hand"]['y'] > positions["torso"]['y'] + precisionY)
-	{
-		NXT::Motor::SetForward(&comm, OUT_B, speed);
-		NXT::Motor::SetForward(&comm, OUT_C, speed);
-	}
-						
-	else if(positions["right_hand"]['z'] > positions["left_hand"]['z'] + precisionX 
-		&& positions["left_hand"]['y'] > positions["torso"]['y'] + precisionY)
-	{
-		NXT::Motor::SetReverse(&comm, OUT_B, speed);
-		NXT::Motor::SetReverse(&comm, OUT_C, speed);
-	}
-	else if(positions["right_hand"]['x'] > positions["right_shoulder"]['x'] + precisionX 
-		&& positions["right_hand"]['y'] < positions["right_shoulder"]['y'] - precisionY 
-		&& positions["right_hand"]['y'] > positions["left_hip"]['y'] + precisionY)
-	{
-		NXT::Motor::SetReverse(&comm, OUT_B, speed);
-		NXT::Motor::SetForward(&comm, OUT_C, speed);
-	}
-	else if(positions["left_hand"]['x'] < positions["left_shoulder"]['x'] - precisionX 
-		&& positions["left_hand"]['y'] < positions["left_shoulder"]['y'] - precisionY 
-		&& positions["left_hand"]['y'] > positions["left_hip"]['y'] + precisionY)
+	GestureMatch match;
+	if (gestures != NULL && gestures->Recognize(g_jointHistories[skeleton.userId], g_gestureSince[skeleton.userId], &match))
 	{
-		NXT::Motor::SetForward(&comm, OUT_B, speed);
-		NXT::Motor::SetReverse(&comm, OUT_C, speed);
-	}
-	else
-	{
-		NXT::Motor::Stop(&comm, OUT_B, true);
-		NXT::Motor::Stop(&comm, OUT_C, true);
+		g_gestureSince[skeleton.userId] = skeleton.timestamp;
+		printf("[%08" PRIu64 "] User #%d:\tGesture %s\n", skeleton.timestamp, skeleton.userId, gestures->GetName(match.gesture));
+		switch (match.action)
+		{
+			case GESTURE_NEXT_MODE:
+				steering_mode = (steering_mode + 1) % STEERING_METHOD_COUNT;
+				sprintf_s(g_generalMessage, "Steering mode %d\n", steering_mode);
+				break;
+			case GESTURE_OPEN_GRIPPER:
+				gripper_open_until = skeleton.timestamp + g_gripperOpenTime;
+				drive->Stop();
+				break;
+			default:
+				break;
+		}
 	}
-}
 
-void RunSteeringMethodThree(map<string, map<char, float>> positions)
-{
-	if(positions["right_hand"]['y'] > positions["right_shoulder"]['y'])
-	{
-		NXT::Motor::SetForward(&comm, OUT_A, 10);
-	} 
-	else if(positions["left_hand"]['y'] > (positions["left_shoulder"]['y'] - precisionY)) 
-	{
-		NXT::Motor::SetReverse(&comm, OUT_A, 10);
-	}  
-	else if(positions["right_hand"]['x'] > positions["right_hip"]['x'] + precisionX
-		&& positions["right_hand"]['y'] < positions["right_shoulder"]['y'])
+	if (gripper_open_until == 0)
 	{
-		NXT::Motor::SetForward(&comm, OUT_B, speed);
-		NXT::Motor::SetForward(&comm, OUT_C, speed);
+		return true;
 	}
-	else if(positions["left_hand"]['x'] + 100 < positions["left_hip"]['x'] - precisionY
-		&& positions["left_hand"]['y'] < positions["left_shoulder"]['y'])
+	if (skeleton.timestamp < gripper_open_until)
 	{
-		NXT::Motor::SetReverse(&comm, OUT_B, speed);
-		NXT::Motor::SetReverse(&comm, OUT_C, speed);
-	}
-	else if(positions["left_hand"]['z'] + precisionX < positions["right_hand"]['z']
-		&& positions["left_hand"]['y'] < positions["torso"]['y']
-		&& positions["right_hand"]['y'] < positions["torso"]['y'])
-	{
-		NXT::Motor::SetReverse(&comm, OUT_C, speed);
-		NXT::Motor::SetForward(&comm, OUT_B, speed);
-	}
-	else if(positions["left_hand"]['z'] - precisionX > positions["right_hand"]['z']
-		&& positions["right_hand"]['y'] < positions["torso"]['y']
-		&& positions["left_hand"]['y'] < positions["torso"]['y'])
-	{
-		NXT::Motor::SetReverse(&comm, OUT_B, speed);
-		NXT::Motor::SetForward(&comm, OUT_C, speed);
-	}
-	else
-	{
-		NXT::Motor::Stop(&comm, OUT_A, true);
-		NXT::Motor::Stop(&comm, OUT_B, true);
-		NXT::Motor::Stop(&comm, OUT_C, true);
+		drive->Gripper(g_gripperOpenPower);
+		return false;
 	}
+	drive->Gripper(0);
+	gripper_open_until = 0;
+	return true;
 }
 
-#pragma endregion
-void SampleViewer::Display()
+// Depth image as the background texture, users in their colors when
+// labels are given
+void SampleViewer::DrawDepth(const openni::VideoFrameRef& depthFrame, const nite::UserMap* pUserLabels)
 {
-	nite::UserTrackerFrameRef userTrackerFrame;
-	openni::VideoFrameRef depthFrame;
-	nite::Status rc = m_pUserTracker->readFrame(&userTrackerFrame);
-	if (rc != nite::STATUS_OK)
-	{
-		printf("GetNextData failed\n");
-		return;
-	}
-
-	depthFrame = userTrackerFrame.getDepthFrame();
-
-	if (m_pTexMap == NULL)
-	{
-		// Texture map init
-		m_nTexMapX = MIN_CHUNKS_SIZE(depthFrame.getVideoMode().getResolutionX(), TEXTURE_SIZE);
-		m_nTexMapY = MIN_CHUNKS_SIZE(depthFrame.getVideoMode().getResolutionY(), TEXTURE_SIZE);
-		m_pTexMap = new openni::RGB888Pixel[m_nTexMapX * m_nTexMapY];
-	}
-
-	const nite::UserMap& userLabels = userTrackerFrame.getUserMap();
+	// Sized for the chosen mode in Init(), a recording may bring another
+	FitBuffers(depthFrame.getVideoMode());
 
 	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -538,7 +1385,7 @@ void SampleViewer::Display()
 
 	if (depthFrame.isValid() && g_drawDepth)
 	{
-		calculateHistogram(m_pDepthHist, MAX_DEPTH, depthFrame);
+		calculateHistogram(m_pDepthHist, m_nDepthHistSize, depthFrame);
 	}
 
 	memset(m_pTexMap, 0, m_nTexMapX*m_nTexMapY*sizeof(openni::RGB888Pixel));
@@ -547,7 +1394,7 @@ void SampleViewer::Display()
 	// check if we need to draw depth frame to texture
 	if (depthFrame.isValid() && g_drawDepth)
 	{
-		const nite::UserId* pLabels = userLabels.getPixels();
+		const nite::UserId* pLabels = pUserLabels != NULL ? pUserLabels->getPixels() : NULL;
 
 		const openni::DepthPixel* pDepthRow = (const openni::DepthPixel*)depthFrame.getData();
 		openni::RGB888Pixel* pTexRow = m_pTexMap + depthFrame.getCropOriginY() * m_nTexMapX;
@@ -558,11 +1405,12 @@ void SampleViewer::Display()
 			const openni::DepthPixel* pDepth = pDepthRow;
 			openni::RGB888Pixel* pTex = pTexRow + depthFrame.getCropOriginX();
 
-			for (int x = 0; x < depthFrame.getWidth(); ++x, ++pDepth, ++pTex, ++pLabels)
+			for (int x = 0; x < depthFrame.getWidth(); ++x, ++pDepth, ++pTex)
 			{
+				nite::UserId label = pLabels != NULL ? *pLabels++ : 0;
 				if (*pDepth != 0)
 				{
-					if (*pLabels == 0)
+					if (label == 0)
 					{
 						if (!g_drawBackground)
 						{
@@ -578,9 +1426,9 @@ void SampleViewer::Display()
 					}
 					else
 					{
-						factor[0] = Colors[*pLabels % colorCount][0];
-						factor[1] = Colors[*pLabels % colorCount][1];
-						factor[2] = Colors[*pLabels % colorCount][2];
+						factor[0] = Colors[label % colorCount][0];
+						factor[1] = Colors[label % colorCount][1];
+						factor[2] = Colors[label % colorCount][2];
 					}
 //					// Add debug lines - every 10cm
 // 					else if ((*pDepth / 10) % 10 == 0)
@@ -629,19 +1477,65 @@ void SampleViewer::Display()
 	glTexCoord2f(0, (float)g_nYRes/(float)m_nTexMapY);
 	glVertex2f(0, GL_WIN_SIZE_Y);
 
-	glEnd();
-	glDisable(GL_TEXTURE_2D);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
+}
+
+void SampleViewer::Display()
+{
+	if (m_useHands)
+	{
+		DisplayHands();
+		return;
+	}
+	if (m_sensorCount > 1)
+	{
+		DisplaySensors();
+		return;
+	}
+
+	nite::UserTrackerFrameRef userTrackerFrame;
+	nite::Status rc = m_pUserTracker->readFrame(&userTrackerFrame);
+	if (rc != nite::STATUS_OK)
+	{
+		printf("GetNextData failed\n");
+		return;
+	}
 
+	StartTrackerFrame(userTrackerFrame.getFrameIndex(), userTrackerFrame.getTimestamp());
 	const nite::Array<nite::UserData>& users = userTrackerFrame.getUsers();
+	if (UpdateIdleMode(users, userTrackerFrame.getTimestamp()))
+	{
+		CheckFrameLimit();
+		return;
+	}
+	DrawDepth(userTrackerFrame.getDepthFrame(), &userTrackerFrame.getUserMap());
+
+	SelectDriver(userTrackerFrame, users);
+	m_publisher.BeginFrame(userTrackerFrame.getFrameIndex(), userTrackerFrame.getTimestamp(), steering_mode);
+	bool driverSeen[ARENA_MAX_ZONES] = {false};
 	for (int i = 0; i < users.getSize(); ++i)
 	{
 		const nite::UserData& user = users[i];
 
 		updateUserState(user, userTrackerFrame.getTimestamp());
+		g_trackerPeople += user.isVisible() ? 1 : 0;
+		g_trackerSkeletons += user.getSkeleton().getState() == nite::SKELETON_TRACKED ? 1 : 0;
 		if (user.isNew())
 		{
-			m_pUserTracker->startSkeletonTracking(user.getId());
-			m_pUserTracker->startPoseDetection(user.getId(), nite::POSE_CROSSED_HANDS);
+			if (driverSelector->TracksEveryone())
+			{
+				m_pUserTracker->startSkeletonTracking(user.getId());
+				m_pUserTracker->startPoseDetection(user.getId(), nite::POSE_CROSSED_HANDS);
+			}
+			else if (driverSelector->WatchesHands())
+			{
+				m_pUserTracker->startPoseDetection(user.getId(), nite::POSE_PSI);
+			}
+			if (user.getId() < MAX_USERS)
+			{
+				g_jointHistories[user.getId()].Clear();
+			}
 		}
 		else if (!user.isLost())
 		{
@@ -663,79 +1557,36 @@ void SampleViewer::Display()
 				DrawSkeleton(m_pUserTracker, user);
 			}
 
-			//Mindstorm main program
-			if (users[i].getSkeleton().getState() == nite::SKELETON_TRACKED && mindstrom_connection_open && user.getId() == 1) //&& user.getId() == 1
-			{	
-				#pragma region Assigning joints
-				// Steering variables
-				map<string, const nite::SkeletonJoint> joints;
-				map<string, map<char, float>> positions;
-				
-				// Reading joint values
-				joints.insert(pair<string, const nite::SkeletonJoint>("right_hand", user.getSkeleton().getJoint(nite::JOINT_RIGHT_HAND)));
-				joints.insert(pair<string, const nite::SkeletonJoint>("right_shoulder", user.getSkeleton().getJoint(nite::JOINT_RIGHT_SHOULDER)));
-				joints.insert(pair<string, const nite::SkeletonJoint>("left_hand", user.getSkeleton().getJoint(nite::JOINT_LEFT_HAND)));
-				joints.insert(pair<string, const nite::SkeletonJoint>("left_shoulder", user.getSkeleton().getJoint(nite::JOINT_LEFT_SHOULDER)));
-				joints.insert(pair<string, const nite::SkeletonJoint>("right_elbow", user.getSkeleton().getJoint(nite::JOINT_RIGHT_ELBOW)));
-				joints.insert(pair<string, const nite::SkeletonJoint>("torso", user.getSkeleton().getJoint(nite::JOINT_TORSO)));
-				joints.insert(pair<string, const nite::SkeletonJoint>("left_hip", user.getSkeleton().getJoint(nite::JOINT_LEFT_HIP)));
-
-				if (joints["right_hand"].getPositionConfidence() > .5){
-				positions["right_hand"]['x'] = joints["right_hand"].getPosition().x;
-				positions["right_hand"]['y'] = joints["right_hand"].getPosition().y;
-				positions["right_hand"]['z'] = joints["right_hand"].getPosition().z;
-				}
-				if (joints["right_shoulder"].getPositionConfidence() > .5){
-				positions["right_shoulder"]['x'] = joints["right_shoulder"].getPosition().x;
-				positions["right_shoulder"]['y'] = joints["right_shoulder"].getPosition().y;
-				positions["right_shoulder"]['z'] = joints["right_shoulder"].getPosition().z;
-				}
-				if (joints["left_hand"].getPositionConfidence() > .5){
-				positions["left_hand"]['x'] = joints["left_hand"].getPosition().x;
-				positions["left_hand"]['y'] = joints["left_hand"].getPosition().y;
-				positions["left_hand"]['z'] = joints["left_hand"].getPosition().z;
-				}
-				if (joints["left_shoulder"].getPositionConfidence() > .5){
-				positions["left_shoulder"]['x'] = joints["left_shoulder"].getPosition().x;
-				positions["left_shoulder"]['y'] = joints["left_shoulder"].getPosition().y;
-				positions["left_shoulder"]['z'] = joints["left_shoulder"].getPosition().z;
-				}
-				if (joints["right_elbow"].getPositionConfidence() > .5)
-				{
-				positions["right_elbow"]['x'] = joints["right_elbow"].getPosition().x;
-				positions["right_elbow"]['y'] = joints["right_elbow"].getPosition().y;
-				positions["right_elbow"]['z'] = joints["right_elbow"].getPosition().z;
-				}
-				if (joints["left_elbow"].getPositionConfidence() > .5)
-				{
-				positions["left_elbow"]['x'] = joints["left_elbow"].getPosition().x;
-				positions["left_elbow"]['y'] = joints["left_elbow"].getPosition().y;
-				positions["left_elbow"]['z'] = joints["left_elbow"].getPosition().z;
-				}
-				if (joints["torso"].getPositionConfidence() > .5)
+			SkeletonFrame skeleton;
+			ReadSkeleton(user, userTrackerFrame.getTimestamp(), &skeleton);
+			const nite::Point3f& center = user.getCenterOfMass();
+			m_publisher.AddUser(skeleton, user.isVisible(), center.x, center.y, center.z, 1);
+			if (skeleton.tracked && user.getId() < MAX_USERS)
+			{
+				g_jointHistories[user.getId()].Push(skeleton);
+			}
+			else if (user.getId() < MAX_USERS)
+			{
+				g_jointHistories[user.getId()].Clear();
+			}
+
+			//Mindstorm main program, commands given while the link is down are sent once it is back
+			int driving = -1;
+			for (int r = 0; r < robot_count; ++r)
+			{
+				if (m_drivers[r] == user.getId())
 				{
-				positions["torso"]['x'] = joints["torso"].getPosition().x;
-				positions["torso"]['y'] = joints["torso"].getPosition().y;
-				positions["torso"]['z'] = joints["torso"].getPosition().z;
+					driving = r;
 				}
-				if (joints["left_hip"].getPositionConfidence() > .5)
-				{
-				positions["left_hip"]['x'] = joints["left_hip"].getPosition().x;
-				positions["left_hip"]['y'] = joints["left_hip"].getPosition().y;
-				positions["left_hip"]['z'] = joints["left_hip"].getPosition().z;
-				}	
-				#pragma endregion				
-				switch (steering_mode)
+			}
+			// Gestures only work the first robot, the others are just steered
+			if (users[i].getSkeleton().getState() == nite::SKELETON_TRACKED && driving >= 0)
+			{	
+				driverSeen[driving] = true;
+				// Only ids with a joint history have gestures
+				if (driving > 0 || user.getId() >= MAX_USERS || RunGestures(skeleton))
 				{
-					case 0:
-						RunSteeringMethodOne(positions);
-						break;
-					case 1:
-						RunSteeringMethodTwo(positions);						
-						break;
-					case 2:
-						RunSteeringMethodThree(positions);						
-						break;
+					RunSteering(steering_mode, skeleton, drives[driving]);
 				}
 			}
 		}
@@ -772,9 +1623,494 @@ void SampleViewer::Display()
 		}
 	}
 
+	for (int r = 0; r < robot_count; ++r)
+	{
+		UpdateDriver(r, driverSeen[r]);
+	}
+	PublishRobots();
+	FinishFrame(userTrackerFrame.getFrameIndex());
+}
+
+// Skeleton tracking and the exit pose are only started for drivers, so
+// NiTE spends nothing on spectators but their outline (and, when drivers
+// raise their hands to take over, psi pose detection)
+void SampleViewer::SelectDriver(const nite::UserTrackerFrameRef& userTrackerFrame, const nite::Array<nite::UserData>& users)
+{
+	nite::UserId drivers[ARENA_MAX_ZONES] = {0};
+	if (arena != NULL)
+	{
+		// Whoever stands in a robot's zone drives it
+		if (userTrackerFrame.getFloorConfidence() >= g_floorConfidence)
+		{
+			const nite::Point3f& normal = userTrackerFrame.getFloor().normal;
+			float floorNormal[3] = {normal.x, normal.y, normal.z};
+			arena->SetFloor(floorNormal);
+		}
+		else
+		{
+			arena->ClearFloor();
+		}
+		arena->BeginFrame(userTrackerFrame.getTimestamp());
+		for (int i = 0; i < users.getSize(); ++i)
+		{
+			const nite::UserData& user = users[i];
+			if (!user.isLost() && user.isVisible())
+			{
+				const nite::Point3f& center = user.getCenterOfMass();
+				arena->Place(user.getId(), center.x, center.y, center.z);
+			}
+		}
+		arena->EndFrame();
+		for (int zone = 0; zone < arena->GetZoneCount(); ++zone)
+		{
+			drivers[arena->GetZone(zone).robot] = (nite::UserId)arena->GetDriver(zone);
+		}
+	}
+	else
+	{
+		std::vector<DriverCandidate> candidates;
+		for (int i = 0; i < users.getSize(); ++i)
+		{
+			const nite::UserData& user = users[i];
+			if (user.isLost())
+			{
+				continue;
+			}
+			const nite::PoseData& psi = user.getPose(nite::POSE_PSI);
+			DriverCandidate candidate = {user.getId(), user.isVisible(), user.getCenterOfMass().x, user.getCenterOfMass().z,
+				driverSelector->WatchesHands() && (psi.isEntered() || psi.isHeld())};
+			candidates.push_back(candidate);
+		}
+		drivers[0] = (nite::UserId)driverSelector->Update(candidates.empty() ? NULL : &candidates[0], (int)candidates.size());
+	}
+	SetDrivers(drivers);
+}
+
+// Starts and stops tracking for the users who became or stopped being a driver
+void SampleViewer::SetDrivers(const nite::UserId* pDrivers)
+{
+	// Every sensor's thread tracks everyone in multi-sensor mode
+	bool tracksDrivers = !driverSelector->TracksEveryone() && m_sensorCount < 2;
+	for (int r = 0; r < robot_count; ++r)
+	{
+		nite::UserId previous = m_drivers[r];
+		nite::UserId driver = pDrivers[r];
+		if (driver == previous)
+		{
+			continue;
+		}
+
+		if (previous != 0 && tracksDrivers)
+		{
+			m_pUserTracker->stopSkeletonTracking(previous);
+			m_pUserTracker->stopPoseDetection(previous, nite::POSE_CROSSED_HANDS);
+			if (driverSelector->WatchesHands())
+			{
+				m_pUserTracker->startPoseDetection(previous, nite::POSE_PSI);
+			}
+		}
+		if (driver != 0 && tracksDrivers)
+		{
+			m_pUserTracker->startSkeletonTracking(driver);
+			m_pUserTracker->startPoseDetection(driver, nite::POSE_CROSSED_HANDS);
+			if (driverSelector->WatchesHands())
+			{
+				m_pUserTracker->stopPoseDetection(driver, nite::POSE_PSI);
+			}
+		}
+		if (driver != 0 && robot_count > 1)
+		{
+			printf("User #%d:\tDriving robot %d\n", driver, r);
+		}
+		else if (driver != 0)
+		{
+			printf("User #%d:\tDriving\n", driver);
+		}
+		m_drivers[r] = driver;
+	}
+}
+
+// Multi-sensor mode: every sensor is tracked on its own thread, and the
+// robots are steered from everyone they see, merged into one table. The
+// first sensor's depth image is shown.
+void SampleViewer::DisplaySensors()
+{
+	// Whichever sensor has a new frame first sets the pace
+	if (!m_sensorFrameReady.Wait(g_mergeFrameWait))
+	{
+		return;
+	}
+	uint64_t newest = 0;
+	int freshSensors = 0;
+	for (int s = 0; s < m_sensorCount; ++s)
+	{
+		int lastIndex = m_sensorFrames[s].frameIndex;
+		if (m_pSensors[s]->GetFrame(&m_sensorFrames[s]) && lastIndex >= 0 && m_sensorFrames[s].frameIndex > lastIndex + 1)
+		{
+			m_sensorUnmerged[s] += m_sensorFrames[s].frameIndex - lastIndex - 1;
+		}
+		freshSensors |= m_sensorFrames[s].frameIndex != lastIndex ? 1 << s : 0;
+		if (m_sensorFrames[s].frameIndex >= 0 && m_sensorFrames[s].captured > newest)
+		{
+			newest = m_sensorFrames[s].captured;
+		}
+	}
+	// Sensor clocks differ, so the merged frames are timed on the host's
+	StartTrackerFrame(++m_mergeFrames, newest);
+
+	nite::UserTrackerFrameRef& trackerFrame = m_pSensors[0]->LockTrackerFrame();
+	bool drawn = trackerFrame.isValid();
+	if (drawn)
+	{
+		DrawDepth(trackerFrame.getDepthFrame(), &trackerFrame.getUserMap());
+	}
+	m_pSensors[0]->UnlockTrackerFrame();
+
+	Calibrate(freshSensors);
+	int count = m_merger.Merge(m_sensorFrames, m_sensorCount, m_mergedUsers);
+	SelectMergedDrivers(count, newest);
+	m_publisher.BeginFrame(m_mergeFrames, newest, steering_mode);
+	bool driverSeen[ARENA_MAX_ZONES] = {false};
+	bool present[MAX_USERS] = {false};
+	for (int i = 0; i < count; ++i)
+	{
+		const MergedUser& user = m_mergedUsers[i];
+		const SkeletonFrame& skeleton = user.skeleton;
+		g_trackerPeople++;
+		g_trackerSkeletons += skeleton.tracked ? 1 : 0;
+		m_sharedUsers += (user.sensors & (user.sensors - 1)) != 0 ? 1 : 0;
+		m_publisher.AddUser(skeleton, true, user.x, user.y, user.z, user.sensors);
+		if (drawn && g_drawStatusLabel)
+		{
+			DrawMergedLabel(m_pSensors[0]->GetUserTracker(), m_merger, user);
+		}
+
+		if (user.userId < MAX_USERS)
+		{
+			present[user.userId] = true;
+			if (!g_visibleUsers[user.userId])
+			{
+				printf("[%08" PRIu64 "] User #%d:\tVisible\n", newest, user.userId);
+				g_visibleUsers[user.userId] = true;
+				g_jointHistories[user.userId].Clear();
+			}
+			JointHistory& history = g_jointHistories[user.userId];
+			if (!skeleton.tracked)
+			{
+				history.Clear();
+			}
+			else if (history.GetCount() == 0 || history.GetTimestamp(0) < skeleton.timestamp)
+			{
+				// A sensor slower than the merge gives the same frame again
+				history.Push(skeleton);
+			}
+		}
+
+		int driving = -1;
+		for (int r = 0; r < robot_count; ++r)
+		{
+			if (m_drivers[r] == user.userId)
+			{
+				driving = r;
+			}
+		}
+		if (skeleton.tracked && driving >= 0)
+		{
+			// Decided from the frame of the sensor the skeleton comes from
+			driverSeen[driving] = true;
+			GetLink(driving)->SetDecisionTime(m_sensorFrames[user.skeletonSensor].captured);
+			if (driving > 0 || user.userId >= MAX_USERS || RunGestures(skeleton))
+			{
+				RunSteering(steering_mode, skeleton, drives[driving]);
+			}
+		}
+	}
+	for (int id = 1; id < MAX_USERS; ++id)
+	{
+		if (g_visibleUsers[id] && !present[id])
+		{
+			printf("[%08" PRIu64 "] User #%d:\tOut of Scene\n", newest, id);
+			g_visibleUsers[id] = false;
+			g_jointHistories[id].Clear();
+		}
+	}
+
+	for (int r = 0; r < robot_count; ++r)
+	{
+		UpdateDriver(r, driverSeen[r]);
+	}
+	PublishRobots();
+	if (drawn)
+	{
+		FinishFrame(m_mergeFrames);
+	}
+	else
+	{
+		CheckFrameLimit();
+	}
+}
+
+// SelectDriver() for the merged table, where nobody's tracking needs starting
+void SampleViewer::SelectMergedDrivers(int count, uint64_t timestamp)
+{
+	nite::UserId drivers[ARENA_MAX_ZONES] = {0};
+	if (arena != NULL)
+	{
+		// World space is level as long as the first sensor is
+		arena->BeginFrame(timestamp);
+		for (int i = 0; i < count; ++i)
+		{
+			const MergedUser& user = m_mergedUsers[i];
+			arena->Place(user.userId, user.x, user.y, user.z);
+		}
+		arena->EndFrame();
+		for (int zone = 0; zone < arena->GetZoneCount(); ++zone)
+		{
+			drivers[arena->GetZone(zone).robot] = (nite::UserId)arena->GetDriver(zone);
+		}
+	}
+	else
+	{
+		DriverCandidate candidates[MERGE_MAX_USERS];
+		for (int i = 0; i < count; ++i)
+		{
+			const MergedUser& user = m_mergedUsers[i];
+			DriverCandidate candidate = {user.userId, true, user.x, user.z,
+				driverSelector->WatchesHands() && HandsRaised(user.skeleton)};
+			candidates[i] = candidate;
+		}
+		drivers[0] = (nite::UserId)driverSelector->Update(candidates, count);
+	}
+	SetDrivers(drivers);
+}
+
+// Ends the frame -publish shares, with what every robot was last told
+void SampleViewer::PublishRobots()
+{
+	if (!m_publisher.IsOpen())
+	{
+		return;
+	}
+	for (int r = 0; r < robot_count; ++r)
+	{
+		m_publisher.SetRobot(r, m_drivers[r], GetLink(r)->IsConnected(), drives[r]->GetSpeed(),
+			drives[r]->GetTurnRatio(), drives[r]->GetGripperPower());
+	}
+	m_publisher.EndFrame();
+}
+
+// The one person a sensor sees, NULL while it sees nobody or several or
+// does not track them yet
+const SkeletonFrame* SoleSkeleton(const SensorFrame& frame)
+{
+	const SkeletonFrame* pSkeleton = NULL;
+	for (int i = 0; i < frame.userCount; ++i)
+	{
+		if (!frame.users[i].visible)
+		{
+			continue;
+		}
+		if (pSkeleton != NULL)
+		{
+			return NULL;
+		}
+		pSkeleton = &frame.users[i].skeleton;
+	}
+	return pSkeleton != NULL && pSkeleton->tracked ? pSkeleton : NULL;
+}
+
+// -calibrate: whenever the first sensor and another see one and the same
+// person at about the same moment, their joints are paired for the other
+// sensor's transform. Nobody else may be in view, as which of several
+// people is which is what the transforms are for.
+void SampleViewer::Calibrate(int freshSensors)
+{
+	const SkeletonFrame* pReference = SoleSkeleton(m_sensorFrames[0]);
+	SkeletonFrame world;
+	if (pReference != NULL)
+	{
+		world = *pReference;
+		for (int j = 0; j < SKELETON_JOINT_COUNT; ++j)
+		{
+			float point[3];
+			m_merger.ToWorld(0, world.joints[j].x, world.joints[j].y, world.joints[j].z, point);
+			world.joints[j].x = point[0];
+			world.joints[j].y = point[1];
+			world.joints[j].z = point[2];
+		}
+	}
+	bool solve = m_mergeFrames % g_calibrationSolveFrames == 0;
+	for (int s = 1; s < m_sensorCount; ++s)
+	{
+		if (m_pCalibrations[s] == NULL)
+		{
+			continue;
+		}
+		const SkeletonFrame* pOther = SoleSkeleton(m_sensorFrames[s]);
+		uint64_t skew = m_sensorFrames[0].captured > m_sensorFrames[s].captured ?
+			m_sensorFrames[0].captured - m_sensorFrames[s].captured : m_sensorFrames[s].captured - m_sensorFrames[0].captured;
+		if (pReference != NULL && pOther != NULL && (freshSensors & (1 << s)) != 0 && skew <= g_calibrationMaxSkew)
+		{
+			m_pCalibrations[s]->AddFrame(world, *pOther);
+		}
+		SensorTransform transform;
+		float error;
+		if (solve && m_pCalibrations[s]->Solve(&transform, &error) && error <= g_calibrationMaxError)
+		{
+			if (m_calibrationErrors[s] < 0)
+			{
+				printf("Sensor %d calibrated, %.0f mm rms over %d points\n", s, error, m_pCalibrations[s]->GetPairCount());
+			}
+			m_merger.SetTransform(s, transform);
+			m_calibrationErrors[s] = error;
+		}
+	}
+}
+
+// Keeps what -calibrate found for -calibration
+void SampleViewer::SaveCalibration()
+{
+	bool calibrated = false;
+	SensorTransform transforms[MERGE_MAX_SENSORS];
+	for (int s = 0; s < m_sensorCount; ++s)
+	{
+		calibrated = calibrated || (m_pCalibrations[s] != NULL && m_calibrationErrors[s] >= 0);
+		transforms[s] = m_merger.GetTransform(s);
+	}
+	if (!calibrated)
+	{
+		return;
+	}
+	if (SaveTransforms(g_calibrationFile, transforms, m_sensorCount))
+	{
+		printf("Sensor transforms saved to %s\n", g_calibrationFile);
+	}
+	else
+	{
+		printf("Could not save the sensor transforms to %s\n", g_calibrationFile);
+	}
+}
+
+// What every sensor's thread read, and what of it the merge never saw
+void SampleViewer::PrintSensorReport()
+{
+	if (g_trackerFrames == 0 || m_sensorCount < 2)
+	{
+		return;
+	}
+	printf("  %.1f people per frame seen by more than one sensor\n", (double)m_sharedUsers / g_trackerFrames);
+	for (int s = 0; s < m_sensorCount; ++s)
+	{
+		if (m_pSensors[s] == NULL)
+		{
+			continue;
+		}
+		FrameClock clock = m_pSensors[s]->GetClock();
+		printf("  sensor %d: %d frames, %d never read, %d never merged, frame age %.1f ms mean (%s)\n", s,
+			clock.GetFrames(), clock.GetDropped(), m_sensorUnmerged[s], clock.GetMeanAgeMs(), m_sensorUris[s]);
+		if (m_pCalibrations[s] != NULL)
+		{
+			if (m_calibrationErrors[s] >= 0)
+			{
+				printf("    calibrated, %.0f mm rms\n", m_calibrationErrors[s]);
+			}
+			else
+			{
+				printf("    not calibrated, %d points paired\n", m_pCalibrations[s]->GetPairCount());
+			}
+		}
+	}
+}
+
+void SampleViewer::DisplayHands()
+{
+	nite::HandTrackerFrameRef handTrackerFrame;
+	nite::Status rc = m_pHandTracker->readFrame(&handTrackerFrame);
+	if (rc != nite::STATUS_OK)
+	{
+		printf("GetNextData failed\n");
+		return;
+	}
+
+	StartTrackerFrame(handTrackerFrame.getFrameIndex(), handTrackerFrame.getTimestamp());
+	DrawDepth(handTrackerFrame.getDepthFrame(), NULL);
+
+	// The first wave or click starts a hand, which steers until it is lost
+	const nite::Array<nite::GestureData>& handGestures = handTrackerFrame.getGestures();
+	for (int i = 0; i < handGestures.getSize() && m_driverHand == 0; ++i)
+	{
+		if (handGestures[i].isComplete())
+		{
+			m_handOrigin = handGestures[i].getCurrentPosition();
+			if (m_pHandTracker->startHandTracking(m_handOrigin, &m_driverHand) != nite::STATUS_OK)
+			{
+				m_driverHand = 0;
+			}
+			else
+			{
+				printf("[%08" PRIu64 "] Hand #%d:\tStarted by %s\n", handTrackerFrame.getTimestamp(), m_driverHand,
+					handGestures[i].getType() == nite::GESTURE_WAVE ? "wave" : "click");
+			}
+		}
+	}
+
+	bool driverSeen = false;
+	const nite::Array<nite::HandData>& hands = handTrackerFrame.getHands();
+	for (int i = 0; i < hands.getSize(); ++i)
+	{
+		const nite::HandData& hand = hands[i];
+		if (hand.getId() != m_driverHand)
+		{
+			continue;
+		}
+		if (hand.isLost())
+		{
+			printf("[%08" PRIu64 "] Hand #%d:\tLost\n", handTrackerFrame.getTimestamp(), m_driverHand);
+			m_driverHand = 0;
+		}
+		else if (hand.isTracking())
+		{
+			driverSeen = true;
+			SkeletonJoint position = {hand.getPosition().x, hand.getPosition().y, hand.getPosition().z, 1};
+			SkeletonJoint origin = {m_handOrigin.x, m_handOrigin.y, m_handOrigin.z, 1};
+			RunHandSteering(position, origin, drive);
+
+			// Line from where the hand started to where it is
+			float coordinates[6] = {0};
+			m_pHandTracker->convertHandCoordinatesToDepth(origin.x, origin.y, origin.z, &coordinates[0], &coordinates[1]);
+			m_pHandTracker->convertHandCoordinatesToDepth(position.x, position.y, position.z, &coordinates[3], &coordinates[4]);
+			coordinates[0] *= GL_WIN_SIZE_X/(float)g_nXRes;
+			coordinates[1] *= GL_WIN_SIZE_Y/(float)g_nYRes;
+			coordinates[3] *= GL_WIN_SIZE_X/(float)g_nXRes;
+			coordinates[4] *= GL_WIN_SIZE_Y/(float)g_nYRes;
+			glColor3f(1.0f, 1.0f, 1.0f);
+			glPointSize(2);
+			glVertexPointer(3, GL_FLOAT, 0, coordinates);
+			glDrawArrays(GL_LINES, 0, 2);
+			glPointSize(10);
+			glVertexPointer(3, GL_FLOAT, 0, coordinates + 3);
+			glDrawArrays(GL_POINTS, 0, 1);
+		}
+	}
+
+	UpdateDriver(0, driverSeen);
+	FinishFrame(handTrackerFrame.getFrameIndex());
+}
+
+// Text drawn over the image, then the next frame is shown
+void SampleViewer::FinishFrame(int frameIndex)
+{
 	if (g_drawFrameId)
 	{
-		DrawFrameId(userTrackerFrame.getFrameIndex());
+		DrawFrameId(frameIndex);
+	}
+	if (g_drawLinkMetrics)
+	{
+		DrawLinkMetrics(robot->GetMetrics(), robot->GetTelemetry());
+		if (speedControl != NULL)
+		{
+			DrawPose(speedControl->GetPose());
+		}
 	}
 
 	if (g_generalMessage[0] != '\0')
@@ -785,6 +2121,17 @@ void SampleViewer::Display()
 	}
 	// Swap the OpenGL display buffers
 	glutSwapBuffers();
+	g_drawnFrames++;
+	CheckFrameLimit();
+}
+
+void SampleViewer::CheckFrameLimit()
+{
+	if (g_frameLimit > 0 && g_trackerFrames >= g_frameLimit)
+	{
+		Finalize();
+		exit(0);
+	}
 }
 #pragma endregion
 #pragma region OpenGL
@@ -832,6 +2179,21 @@ void SampleViewer::OnKey(unsigned char key, int /*x*/, int /*y*/)
 	case 'f':
 		g_drawFrameId = !g_drawFrameId;
 		break;
+	case 'm':
+		g_drawLinkMetrics = !g_drawLinkMetrics;
+		break;
+	case 'g':
+		// First robot's driver's right hand over the last second, its action set by hand later
+		if (m_drivers[0] <= 0 || m_drivers[0] >= MAX_USERS)
+		{
+			printf("Nobody with a joint history drives, no gesture recorded\n");
+		}
+		else if (gestures != NULL && gestures->SaveTemplate(g_recordedGesturesFile, "recorded", GESTURE_NONE,
+			GESTURE_RIGHT_HAND, g_recordedGestureThreshold, g_jointHistories[m_drivers[0]], g_recordedGestureFrames))
+		{
+			printf("Gesture added to %s\n", g_recordedGesturesFile);
+		}
+		break;
 	}
 
 }
@@ -9,6 +9,11 @@
 #define _NITE_USER_VIEWER_H_
 
 #include "NiTE.h"
+#include "Platform.h"
+#include "ArenaMap.h"
+#include "SensorTracker.h"
+#include "SensorCalibration.h"
+#include "SkeletonPublisher.h"
 
 #define MAX_DEPTH 10000
 
@@ -22,8 +27,27 @@ class SampleViewer
 
 	protected:
 		virtual void Display();
+		void DisplayHands();	// Display() with the hand tracker instead of skeletons
+		void DisplaySensors();	// Display() with several sensors merged
+		void DrawDepth(const openni::VideoFrameRef& depthFrame, const nite::UserMap* pUserLabels);
+		void FinishFrame(int frameIndex);
+		void CheckFrameLimit();
+		bool SelectDepthMode(int width, int height, int fps);
+		void ListDepthModes();
+		void FitBuffers(const openni::VideoMode& mode);
+		void FindIdleMode();
+		bool UpdateIdleMode(const nite::Array<nite::UserData>& users, uint64_t timestamp);
+		void SelectDriver(const nite::UserTrackerFrameRef& userTrackerFrame, const nite::Array<nite::UserData>& users);
+		void SetDrivers(const nite::UserId* pDrivers);
+		void SelectMergedDrivers(int count, uint64_t timestamp);
+		void Calibrate(int freshSensors);
+		void SaveCalibration();
+		void PublishRobots();
+		void PrintSensorReport();
 		virtual void DisplayPostDraw(){};	// Overload to draw over the screen image
 		virtual void OnKey(unsigned char key, int x, int y);
+		virtual openni::Status InitSensor(const char* deviceUri);
+		openni::Status InitSensors();
 		virtual openni::Status InitOpenGL(int argc, char **argv);
 		void InitOpenGLHooks();
 		void Finalize();
@@ -35,8 +59,10 @@ class SampleViewer
 		static void glutIdle();
 		static void glutDisplay();
 		static void glutKeyboard(unsigned char key, int x, int y);
+		static void SensorStartupThread(void* pSelf);
 
-		float						m_pDepthHist[MAX_DEPTH];
+		float*						m_pDepthHist;
+		int							m_nDepthHistSize;
 		char						m_strSampleName[ONI_MAX_STR];
 		openni::RGB888Pixel*		m_pTexMap;
 		unsigned int				m_nTexMapX;
@@ -44,6 +70,41 @@ class SampleViewer
 
 		openni::Device				m_device;
 		nite::UserTracker*			m_pUserTracker;
+		nite::UserId				m_drivers[ARENA_MAX_ZONES];	// Of every robot, only they are skeleton tracked, 0 for none
+		// Hand mode: no skeletons, a hand tracked from a wave or click steers
+		bool						m_useHands;
+		nite::HandTracker*			m_pHandTracker;
+		nite::HandId				m_driverHand;		// 0 while nobody steers
+		nite::Point3f				m_handOrigin;		// Where the driver's gesture ended
+		// Idle mode: the depth stream NiTE reads switched to a lower rate
+		openni::VideoStream			m_depthStream;
+		openni::VideoMode			m_fullDepthMode;
+		openni::VideoMode			m_idleDepthMode;
+		bool						m_hasIdleMode;		// False when the sensor has no slower mode
+		int							m_depthWidth;		// Asked for with -depthmode, fps 0 for the default
+		int							m_depthHeight;
+		int							m_depthFps;
+
+		// Camera chain starts next to the main thread
+		Thread						m_sensorThread;
+		const char*					m_deviceUri;
+		openni::Status				m_sensorStatus;
+
+		// Several sensors: each tracked on its own thread, users merged into one table
+		SensorTracker*				m_pSensors[MERGE_MAX_SENSORS];
+		const char*					m_sensorUris[MERGE_MAX_SENSORS];	// From -device, the first is m_deviceUri
+		int							m_sensorCount;		// Multi-sensor mode above 1
+		UserMerger					m_merger;
+		Event						m_sensorFrameReady;
+		SensorFrame					m_sensorFrames[MERGE_MAX_SENSORS];	// Latest of every sensor, as last merged
+		int							m_sensorUnmerged[MERGE_MAX_SENSORS];	// Frames the merge never saw
+		MergedUser					m_mergedUsers[MERGE_MAX_USERS];
+		int							m_mergeFrames;
+		int							m_sharedUsers;		// Summed over frames: people seen by several sensors
+		SensorCalibration*			m_pCalibrations[MERGE_MAX_SENSORS];	// From -calibrate, for every sensor but the first
+		float						m_calibrationErrors[MERGE_MAX_SENSORS];	// Rms in mm of the transform in use, -1 before one is found
+
+		SkeletonPublisher			m_publisher;		// From -publish, for other processes
 
 		nite::UserId				m_poseUser;
 		uint64_t					m_poseTime;
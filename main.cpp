@@ -11,11 +11,25 @@
 
 
 #include "Viewer.h"
+#include "Benchmark.h"
+#include "SkeletonWatch.h"
+#include "SharedSkeletons.h"
+#include <string.h>
+#include <stdlib.h>
 
 int main(int argc, char** argv)
 {
 	openni::Status rc = openni::STATUS_OK;
 
+	if (argc > 2 && strcmp(argv[1], "-bench") == 0)
+	{
+		return RunBenchmark(argv[2]);
+	}
+	if (argc > 1 && strcmp(argv[1], "-watch") == 0)
+	{
+		return RunSkeletonWatch(SHARED_SKELETONS_NAME, argc > 2 ? atoi(argv[2]) : 0);
+	}
+
 	SampleViewer sampleViewer("User Viewer");
 
 	rc = sampleViewer.Init(argc, argv);